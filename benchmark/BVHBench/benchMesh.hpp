@@ -0,0 +1,39 @@
+﻿#pragma once
+#include <sampler/spherical.hpp>
+#include <shape/triangleMesh.hpp>
+
+// 带正弦起伏的球面, 经纬方向各resolution与2 * resolution段, 约4 * resolution²个三角形
+inline pbrt::TriangleMesh GenerateMesh(size_t resolution)
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    size_t columns = resolution * 2;
+    for (size_t i = 0; i <= resolution; i++)
+    {
+        float theta = pbrt::PI * i / resolution;
+        for (size_t j = 0; j <= columns; j++)
+        {
+            float phi = 2.f * pbrt::PI * j / columns;
+            float radius = 1.f + 0.1f * glm::sin(12.f * theta) * glm::sin(9.f * phi) + 0.02f * glm::sin(57.f * theta + 31.f * phi);
+            positions.push_back(radius * glm::vec3{glm::sin(theta) * glm::cos(phi), glm::cos(theta), glm::sin(theta) * glm::sin(phi)});
+        }
+    }
+    for (size_t i = 0; i < resolution; i++)
+    {
+        for (size_t j = 0; j < columns; j++)
+        {
+            uint32_t i0 = static_cast<uint32_t>(i * (columns + 1) + j), i1 = i0 + 1;
+            uint32_t i2 = i0 + static_cast<uint32_t>(columns + 1), i3 = i2 + 1;
+            indices.insert(indices.end(), {i0, i2, i1, i1, i2, i3});
+        }
+    }
+    return pbrt::TriangleMesh(std::move(positions), {}, std::move(indices));
+}
+
+inline pbrt::TriangleMesh CopyMesh(const pbrt::TriangleMesh &mesh)
+{
+    auto positions = mesh.GetPositions();
+    auto normals = mesh.GetNormals();
+    auto indices = mesh.GetIndices();
+    return pbrt::TriangleMesh({positions.begin(), positions.end()}, {normals.begin(), normals.end()}, {indices.begin(), indices.end()});
+}
\ No newline at end of file
@@ -0,0 +1,356 @@
+﻿#include "benchMesh.hpp"
+#include "verify.hpp"
+// core
+#include <accelerate/bvh.hpp>
+#include <accelerate/bvhCalibration.hpp>
+#include <sampler/spherical.hpp>
+#include <shape/model.hpp>
+#include <thread/threadPool.hpp>
+#include <utils/frame.hpp>
+#include <utils/logger.hpp>
+#include <utils/rng.hpp>
+// std
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+
+/*
+    BVH基准测试
+    用法: bvh_bench [--layout=0~4] [--calibrate] [--threads=N] [--numa] [--verify=模式] [模型.obj], 不指定模型时生成程序化网格; --calibrate使用本机测量的SAH代价常数
+    --threads与--numa在环境变量(PBRT_THREADS等)的基础上重新配置线程池, --numa同时开启BVH的NUMA分区副本
+    对每种构建算法输出构建时间, 节点数与内存, SAH代价, 叶子大小与深度直方图,
+    再用固定的主光线, 漫反射弹射光线与阴影光线测试遍历吞吐与每条光线的平均节点/三角形测试数
+    每组光线另外以批量接口求交(主光线为光线包, 其余为光线流), 输出吞吐并与逐条求交的结果比较
+    --verify只运行正确性检查(见verify.hpp), 不计时, 全部通过时返回0; 程序化网格改用VERIFY_MESH_RESOLUTION, 以便暴力求交
+        builders:   各构建算法与布局对比暴力求交
+        cache:      写入并映射二进制BVH缓存, 对比映射前后的数据与结果
+        refit:      顶点变形后Refit, 对比变形后网格的暴力求交
+        instancing: 多层嵌套实例组构成的场景对比世界空间的暴力求交, 并检查超过最大嵌套层数的实例被拒绝
+*/
+
+constexpr size_t IMAGE_SIZE = 512;   // 主光线网格边长
+constexpr size_t REPEAT_COUNT = 3;   // 每组光线重复次数, 取最快一次
+constexpr size_t CHUNK_COUNT = 256;  // 并行分块数
+constexpr size_t STREAM_SIZE = 256;  // 非相干光线批量求交时每批的光线数
+constexpr size_t VERIFY_MESH_RESOLUTION = 48; // 正确性检查使用的程序化网格分辨率, 约9千个三角形
+
+// 直方图只输出非零项, 格式为"下标:数量"
+static std::string FormatHistogram(const std::vector<size_t> &histogram)
+{
+    std::string text;
+    for (size_t i = 0; i < histogram.size(); i++)
+    {
+        if (histogram[i] != 0)
+        {
+            text += std::to_string(i) + ":" + std::to_string(histogram[i]) + " ";
+        }
+    }
+    return text;
+}
+
+// 一组固定光线, 阴影光线的方向未归一化, 终点(t = 1)在光源上
+struct RaySet
+{
+public:
+    std::string __name__;
+    std::vector<pbrt::Ray> __rays__;
+    bool __isShadow__;
+    bool __isCoherent__; // 相邻RAY_PACKET_SIZE条光线构成光线包
+};
+
+struct TraceResult
+{
+public:
+    double __seconds__;
+    size_t __hitCount__;
+    size_t __boundsTestCount__;
+    size_t __triangleTestCount__;
+};
+
+static TraceResult Trace(const pbrt::BVH &bvh, const RaySet &ray_set, float t_min)
+{
+    const auto &rays = ray_set.__rays__;
+    std::vector<size_t> hit_counts(CHUNK_COUNT, 0), bounds_test_counts(CHUNK_COUNT, 0), triangle_test_counts(CHUNK_COUNT, 0);
+    auto start = std::chrono::steady_clock::now();
+    pbrt::MasterThreadPool.ParallelFor(CHUNK_COUNT, [&](size_t chunk)
+                                       {
+                                           size_t begin = rays.size() * chunk / CHUNK_COUNT, end = rays.size() * (chunk + 1) / CHUNK_COUNT;
+                                           for (size_t i = begin; i < end; i++)
+                                           {
+                                               pbrt::Ray ray{rays[i].__origin__, rays[i].__direction__}; // 调试计数从0开始
+                                               bool is_hit = ray_set.__isShadow__ ? bvh.Occluded(ray, t_min, 1.f - t_min) : bvh.Intersect(ray, t_min, std::numeric_limits<float>::infinity()).has_value();
+                                               hit_counts[chunk] += is_hit;
+                                               DEBUG_INFO(bounds_test_counts[chunk] += ray.__boundsTestCount__)
+                                               DEBUG_INFO(triangle_test_counts[chunk] += ray.__triangleTestCount__)
+                                           }
+                                           // end
+                                       });
+    TraceResult result{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), 0, 0, 0};
+    for (size_t chunk = 0; chunk < CHUNK_COUNT; chunk++)
+    {
+        result.__hitCount__ += hit_counts[chunk];
+        result.__boundsTestCount__ += bounds_test_counts[chunk];
+        result.__triangleTestCount__ += triangle_test_counts[chunk];
+    }
+    return result;
+}
+
+// 批量求交, 每批为一个光线包或光线流; 计时之后逐条求交比较命中与距离, 不一致的光线数写入mismatch_count
+static TraceResult TraceBatch(const pbrt::BVH &bvh, const RaySet &ray_set, float t_min, size_t &mismatch_count)
+{
+    const auto &rays = ray_set.__rays__;
+    size_t batch_size = ray_set.__isCoherent__ ? pbrt::RAY_PACKET_SIZE : STREAM_SIZE;
+    size_t batch_count = (rays.size() + batch_size - 1) / batch_size;
+    std::vector<pbrt::HitRecord> records(rays.size());
+    std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+    std::vector<size_t> hit_counts(CHUNK_COUNT, 0);
+    auto start = std::chrono::steady_clock::now();
+    pbrt::MasterThreadPool.ParallelFor(CHUNK_COUNT, [&](size_t chunk)
+                                       {
+                                           for (size_t batch = batch_count * chunk / CHUNK_COUNT; batch < batch_count * (chunk + 1) / CHUNK_COUNT; batch++)
+                                           {
+                                               size_t begin = batch * batch_size, count = glm::min(batch_size, rays.size() - begin);
+                                               std::span<const pbrt::Ray> batch_rays(rays.data() + begin, count);
+                                               if (ray_set.__isShadow__)
+                                               {
+                                                   std::span<bool> batch_occluded(occluded.get() + begin, count);
+                                                   std::fill(batch_occluded.begin(), batch_occluded.end(), false);
+                                                   bvh.OccludedBatch(batch_rays, batch_occluded, t_min, 1.f - t_min);
+                                                   hit_counts[chunk] += std::count(batch_occluded.begin(), batch_occluded.end(), true);
+                                                   continue;
+                                               }
+                                               std::span<pbrt::HitRecord> batch_records(records.data() + begin, count);
+                                               std::fill(batch_records.begin(), batch_records.end(), pbrt::HitRecord{std::numeric_limits<float>::infinity()});
+                                               bvh.IntersectBatch(batch_rays, batch_records, t_min);
+                                               hit_counts[chunk] += std::count_if(batch_records.begin(), batch_records.end(), [](const pbrt::HitRecord &record)
+                                                                                  { return record.__isHit__; });
+                                           }
+                                           // end
+                                       });
+    TraceResult result{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), 0, 0, 0};
+    for (size_t chunk = 0; chunk < CHUNK_COUNT; chunk++)
+    {
+        result.__hitCount__ += hit_counts[chunk];
+    }
+
+    mismatch_count = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        pbrt::Ray ray{rays[i].__origin__, rays[i].__direction__};
+        if (ray_set.__isShadow__)
+        {
+            mismatch_count += occluded[i] != bvh.Occluded(ray, t_min, 1.f - t_min);
+            continue;
+        }
+        auto hit_info = bvh.Intersect(ray, t_min, std::numeric_limits<float>::infinity());
+        bool is_same = hit_info.has_value() == records[i].__isHit__ &&
+                       (!hit_info || glm::abs(hit_info->__t__ - records[i].__tMax__) <= 1e-4f * glm::max(1.f, hit_info->__t__));
+        mismatch_count += !is_same;
+    }
+    return result;
+}
+
+/*
+    主光线: 从包围盒前方的针孔相机射出的IMAGE_SIZE²条光线, 按4x4像素块排列, 相邻RAY_PACKET_SIZE条构成一个光线包
+    漫反射弹射光线: 每个主光线交点沿法线半球余弦采样一条
+    阴影光线: 每个主光线交点连向包围盒上方虚拟面光源上的随机点
+    三组光线只由参考BVH生成一次, 各构建算法使用相同的光线
+*/
+static std::vector<RaySet> GenerateRaySets(const pbrt::BVH &bvh, float t_min)
+{
+    auto bounds = bvh.GetBounds();
+    glm::vec3 diagonal = bounds.GetDiagonal();
+    glm::vec3 center = bounds.__bMin__ + diagonal * 0.5f;
+    float radius = glm::length(diagonal) * 0.5f;
+    glm::vec3 eye = center - glm::vec3{0.f, 0.f, radius * 2.5f};
+    float tan_half_fov = glm::tan(glm::radians(22.5f));
+
+    RaySet primary{"Primary", {}, false, true}, diffuse{"Diffuse", {}, false, false}, shadow{"Shadow", {}, true, false};
+    for (size_t block = 0; block < IMAGE_SIZE * IMAGE_SIZE / 16; block++)
+    {
+        size_t block_x = block % (IMAGE_SIZE / 4) * 4, block_y = block / (IMAGE_SIZE / 4) * 4;
+        for (size_t i = 0; i < 16; i++)
+        {
+            size_t x = block_x + i % 4, y = block_y + i / 4;
+            glm::vec2 ndc = (glm::vec2{x, y} + 0.5f) / static_cast<float>(IMAGE_SIZE) * 2.f - 1.f;
+            primary.__rays__.push_back({eye, glm::normalize(glm::vec3{ndc.x * tan_half_fov, -ndc.y * tan_half_fov, 1.f})});
+        }
+    }
+
+    pbrt::RNG rng(0);
+    for (const auto &ray : primary.__rays__)
+    {
+        auto hit_info = bvh.Intersect(ray, t_min, std::numeric_limits<float>::infinity());
+        if (!hit_info)
+        {
+            continue;
+        }
+        glm::vec3 normal = glm::dot(hit_info->__normal__, ray.__direction__) < 0.f ? hit_info->__normal__ : -hit_info->__normal__;
+        pbrt::Frame frame(normal);
+        diffuse.__rays__.push_back({hit_info->__hitPoint__, frame.WorldFromLocal(pbrt::CosineSampleHemisphere({rng.Uniform(), rng.Uniform()}))});
+        glm::vec3 light_point = center + glm::vec3{(rng.Uniform() - 0.5f) * radius, radius * 2.f, (rng.Uniform() - 0.5f) * radius};
+        shadow.__rays__.push_back({hit_info->__hitPoint__, light_point - hit_info->__hitPoint__});
+    }
+    return {primary, diffuse, shadow};
+}
+
+int main(int argc, char **argv)
+{
+    pbrt::Logger::Init();
+    PBRT_INFO("PBRT Init!");
+
+    pbrt::BVHLayout layout = pbrt::DEFAULT_BVH_LAYOUT;
+    std::string model_path;
+    bool calibrate = false;
+    std::string verify_mode;
+    bool configure_pool = false;
+    auto pool_settings = pbrt::ThreadPoolSettings::FromEnvironment();
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.starts_with("--layout="))
+        {
+            layout = static_cast<pbrt::BVHLayout>(std::stoi(arg.substr(9)));
+        }
+        else if (arg == "--calibrate")
+        {
+            calibrate = true;
+        }
+        else if (arg.starts_with("--verify="))
+        {
+            verify_mode = arg.substr(9);
+        }
+        else if (arg.starts_with("--threads="))
+        {
+            pool_settings.__threadCount__ = std::stoul(arg.substr(10));
+            configure_pool = true;
+        }
+        else if (arg == "--numa")
+        {
+            pool_settings.__numaAware__ = true;
+            configure_pool = true;
+        }
+        else
+        {
+            model_path = arg;
+        }
+    }
+
+    // 线程池此时还没有任务, 可以安全地重启
+    if (configure_pool)
+    {
+        pbrt::MasterThreadPool.Configure(pool_settings);
+    }
+
+    // 模型只借用Model的obj解析, 关闭缓存保证每次都真正构建
+    pbrt::BVHBuildSettings load_settings{};
+    load_settings.__enableCache__ = false;
+    pbrt::TriangleMesh source_mesh;
+    if (model_path.empty())
+    {
+        source_mesh = GenerateMesh(verify_mode.empty() ? 512 : VERIFY_MESH_RESOLUTION);
+        PBRT_INFO("BVH Bench - Procedural Mesh, Triangle Count: {}", source_mesh.GetTriangleCount());
+    }
+    else
+    {
+        pbrt::Model model(model_path, load_settings);
+        source_mesh = CopyMesh(model.GetBVH().GetMesh());
+        PBRT_INFO("BVH Bench - Model: {}, Triangle Count: {}", model_path, source_mesh.GetTriangleCount());
+    }
+    if (!verify_mode.empty())
+    {
+        bool is_passed = false;
+        if (verify_mode == "builders")
+        {
+            is_passed = VerifyBuilders(source_mesh);
+        }
+        else if (verify_mode == "cache")
+        {
+            is_passed = VerifyCache(source_mesh);
+        }
+        else if (verify_mode == "refit")
+        {
+            is_passed = VerifyRefit(source_mesh);
+        }
+        else if (verify_mode == "instancing")
+        {
+            is_passed = VerifyInstancing(source_mesh);
+        }
+        else
+        {
+            PBRT_ERROR("BVH Bench - Unknown verify mode: {}", verify_mode);
+        }
+        PBRT_INFO("BVH Verify - {}: {}", verify_mode, is_passed ? "passed" : "FAILED");
+        return is_passed ? 0 : 1;
+    }
+
+    pbrt::BVHBuildSettings bench_settings = load_settings;
+    bench_settings.__layout__ = layout;
+    bench_settings.__replicatePerNumaNode__ = pool_settings.__numaAware__;
+    if (calibrate)
+    {
+        pbrt::CalibrateBVHCosts(bench_settings);
+    }
+    PBRT_INFO("BVH Bench - Layout: {}, Threads: {}, NUMA Partitions: {}, SAH Costs: traversal {:.2f}, intersection {:.2f}, Max Leaf Size: {}", static_cast<int>(layout), pbrt::MasterThreadPool.GetThreadCount(), pbrt::MasterThreadPool.GetNumaNodeCount(),
+              bench_settings.__traversalCost__, bench_settings.__intersectionCost__, bench_settings.__maxLeafSize__);
+
+    constexpr std::pair<pbrt::BVHBuilderType, const char *> builders[] = {
+        {pbrt::BVHBuilderType::BinnedSAH, "BinnedSAH"},
+        {pbrt::BVHBuilderType::LBVH, "LBVH"},
+        {pbrt::BVHBuilderType::PLOC, "PLOC"},
+        {pbrt::BVHBuilderType::SBVH, "SBVH"}
+        // end
+    };
+    float t_min = 0.f; // 按场景尺度设置, 由首个构建的BVH确定
+    std::vector<RaySet> ray_sets;
+    for (const auto &[builder, name] : builders)
+    {
+        pbrt::BVHBuildSettings settings = bench_settings;
+        settings.__builder__ = builder;
+
+        pbrt::BVH bvh;
+        auto mesh = CopyMesh(source_mesh);
+        auto start = std::chrono::steady_clock::now();
+        bvh.Build(std::move(mesh), settings);
+        double build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        auto report = bvh.GetQualityReport();
+        PBRT_INFO("BVH Bench - [{}] Build: {:.1f} ms, Nodes: {}, Leaves: {}, Memory: {} KB, SAH Cost: {:.2f}, Max Depth: {}", name, build_time * 1e3, report.__nodeCount__, report.__leafCount__,
+                  report.__memorySize__ / 1024, report.__sahCost__, report.__maxDepth__);
+        PBRT_INFO("BVH Bench - [{}] Leaf Size Histogram: {}", name, FormatHistogram(report.__leafSizeHistogram__));
+        PBRT_INFO("BVH Bench - [{}] Depth Histogram: {}", name, FormatHistogram(report.__depthHistogram__));
+
+        if (ray_sets.empty())
+        {
+            t_min = 1e-5f * glm::length(bvh.GetBounds().GetDiagonal());
+            ray_sets = GenerateRaySets(bvh, t_min);
+        }
+        for (const auto &ray_set : ray_sets)
+        {
+            TraceResult best{};
+            for (size_t repeat = 0; repeat < REPEAT_COUNT; repeat++)
+            {
+                auto result = Trace(bvh, ray_set, t_min);
+                if (repeat == 0 || result.__seconds__ < best.__seconds__)
+                {
+                    best = result;
+                }
+            }
+            double ray_count = static_cast<double>(glm::max<size_t>(ray_set.__rays__.size(), 1));
+            PBRT_INFO("BVH Bench - [{}] {} Rays: {}, {:.2f} Mrays/s, Hits: {}, {:.2f} nodes/ray, {:.2f} triangles/ray", name, ray_set.__name__, ray_set.__rays__.size(),
+                      ray_set.__rays__.size() / best.__seconds__ * 1e-6, best.__hitCount__, best.__boundsTestCount__ / ray_count, best.__triangleTestCount__ / ray_count);
+
+            size_t mismatch_count = 0;
+            auto batch = TraceBatch(bvh, ray_set, t_min, mismatch_count);
+            PBRT_INFO("BVH Bench - [{}] {} Batch ({}): {:.2f} Mrays/s, Hits: {}, Mismatches: {}", name, ray_set.__name__, ray_set.__isCoherent__ ? "Packet" : "Stream",
+                      ray_set.__rays__.size() / batch.__seconds__ * 1e-6, batch.__hitCount__, mismatch_count);
+        }
+    }
+
+    PBRT_INFO("PBRT Shutdown!");
+    return 0;
+}
\ No newline at end of file
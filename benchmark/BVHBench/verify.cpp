@@ -0,0 +1,470 @@
+﻿#include "verify.hpp"
+#include "benchMesh.hpp"
+// core
+#include <accelerate/bvh.hpp>
+#include <accelerate/bvhCache.hpp>
+#include <shape/instanceGroup.hpp>
+#include <shape/model.hpp>
+#include <shape/scene.hpp>
+#include <shape/triangle.hpp>
+#include <thread/threadPool.hpp>
+#include <utils/logger.hpp>
+#include <utils/rng.hpp>
+#include <utils/transform.hpp>
+// std
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <utility>
+#include <vector>
+
+constexpr size_t VERIFY_RAY_COUNT = 4096;
+constexpr float VERIFY_T_TOLERANCE = 1e-4f; // 交点距离的相对误差, 不同的三角形求交实现之间的舍入差异
+
+using WorldTriangle = std::array<glm::vec3, 3>;
+
+static std::vector<WorldTriangle> GetWorldTriangles(const pbrt::TriangleMesh &mesh, const glm::mat4 &world_from_object = glm::mat4(1.f))
+{
+    std::vector<WorldTriangle> triangles(mesh.GetTriangleCount());
+    for (size_t i = 0; i < triangles.size(); i++)
+    {
+        for (size_t vertex = 0; vertex < 3; vertex++)
+        {
+            triangles[i][vertex] = glm::vec3(world_from_object * glm::vec4(mesh.GetPosition(i, vertex), 1.f));
+        }
+    }
+    return triangles;
+}
+
+static pbrt::Bounds GetTriangleBounds(const std::vector<WorldTriangle> &triangles)
+{
+    pbrt::Bounds bounds{};
+    for (const auto &triangle : triangles)
+    {
+        for (const auto &position : triangle)
+        {
+            bounds.Expand(position);
+        }
+    }
+    return bounds;
+}
+
+static std::vector<pbrt::Ray> GenerateVerifyRays(const pbrt::Bounds &bounds, uint64_t seed)
+{
+    glm::vec3 diagonal = bounds.GetDiagonal();
+    glm::vec3 center = bounds.__bMin__ + diagonal * 0.5f;
+    float radius = glm::max(glm::length(diagonal) * 0.5f, 1e-3f);
+    pbrt::RNG rng(seed);
+    auto random_direction = [&]()
+    {
+        float z = 1.f - 2.f * rng.Uniform(), phi = 2.f * pbrt::PI * rng.Uniform();
+        float r = glm::sqrt(glm::max(0.f, 1.f - z * z));
+        return glm::vec3{r * glm::cos(phi), r * glm::sin(phi), z};
+        // end
+    };
+    auto random_interior_point = [&]()
+    { return bounds.__bMin__ + diagonal * glm::vec3{rng.Uniform(), rng.Uniform(), rng.Uniform()}; };
+
+    std::vector<pbrt::Ray> rays;
+    rays.reserve(VERIFY_RAY_COUNT);
+    for (size_t i = 0; i < VERIFY_RAY_COUNT; i++)
+    {
+        if (i % 4 == 3)
+        {
+            rays.push_back({random_interior_point(), random_direction()});
+        }
+        else
+        {
+            glm::vec3 origin = center + random_direction() * radius * 1.5f;
+            rays.push_back({origin, glm::normalize(random_interior_point() - origin)});
+        }
+    }
+    return rays;
+}
+
+// 每条光线遍历全部三角形得到的最近交点距离, 未命中为无穷大
+static std::vector<float> BruteForceIntersect(const std::vector<WorldTriangle> &triangles, const std::vector<pbrt::Ray> &rays, float t_min)
+{
+    size_t hit_count = 0;
+    std::vector<float> t_closest(rays.size(), std::numeric_limits<float>::infinity());
+    pbrt::MasterThreadPool.ParallelFor(rays.size(), [&](size_t ray_idx)
+                                       {
+                                           float t_max = std::numeric_limits<float>::infinity();
+                                           for (const auto &triangle : triangles)
+                                           {
+                                               float t, u, v;
+                                               if (pbrt::internal::IntersectTriangle(triangle[0], triangle[1], triangle[2], rays[ray_idx], t_min, t_max, t, u, v))
+                                               {
+                                                   t_max = t;
+                                               }
+                                           }
+                                           t_closest[ray_idx] = t_max;
+                                           // end
+                                       });
+    for (float t : t_closest)
+    {
+        hit_count += t < std::numeric_limits<float>::infinity();
+    }
+    PBRT_INFO("BVH Verify - Brute Force: {} triangles, {} rays, {} hits", triangles.size(), rays.size(), hit_count);
+    return t_closest;
+}
+
+/*
+    与参考结果比较, 返回不一致的光线数
+    最近交点: 命中与否相同且距离在容差内; 遮挡: 到无穷远的遮挡与是否命中相同, 到参考交点一半距离的线段上不能有遮挡
+*/
+static size_t CountMismatches(const pbrt::Shape &shape, const std::vector<pbrt::Ray> &rays, const std::vector<float> &reference_t, float t_min)
+{
+    std::vector<uint8_t> mismatches(rays.size(), 0);
+    pbrt::MasterThreadPool.ParallelFor(rays.size(), [&](size_t ray_idx)
+                                       {
+                                           const auto &ray = rays[ray_idx];
+                                           float reference = reference_t[ray_idx];
+                                           bool reference_hit = reference < std::numeric_limits<float>::infinity();
+                                           auto hit_info = shape.Intersect(ray, t_min, std::numeric_limits<float>::infinity());
+                                           bool is_same = hit_info.has_value() == reference_hit &&
+                                                          (!reference_hit || glm::abs(hit_info->__t__ - reference) <= VERIFY_T_TOLERANCE * glm::max(1.f, reference));
+                                           is_same &= shape.Occluded(ray, t_min, std::numeric_limits<float>::infinity()) == reference_hit;
+                                           is_same &= !reference_hit || !shape.Occluded(ray, t_min, reference * 0.5f);
+                                           mismatches[ray_idx] = !is_same;
+                                           // end
+                                       });
+    size_t mismatch_count = 0;
+    for (uint8_t mismatch : mismatches)
+    {
+        mismatch_count += mismatch;
+    }
+    return mismatch_count;
+}
+
+bool VerifyBuilders(const pbrt::TriangleMesh &mesh)
+{
+    constexpr std::pair<pbrt::BVHBuilderType, const char *> builders[] = {
+        {pbrt::BVHBuilderType::BinnedSAH, "BinnedSAH"},
+        {pbrt::BVHBuilderType::LBVH, "LBVH"},
+        {pbrt::BVHBuilderType::PLOC, "PLOC"},
+        {pbrt::BVHBuilderType::SBVH, "SBVH"}
+        // end
+    };
+    constexpr pbrt::BVHLayout layouts[] = {pbrt::BVHLayout::Binary, pbrt::BVHLayout::Wide4, pbrt::BVHLayout::Wide8, pbrt::BVHLayout::Wide4Quantized, pbrt::BVHLayout::Wide8Quantized};
+
+    auto triangles = GetWorldTriangles(mesh);
+    auto bounds = GetTriangleBounds(triangles);
+    float t_min = 1e-5f * glm::length(bounds.GetDiagonal());
+    auto rays = GenerateVerifyRays(bounds, 1);
+    auto reference_t = BruteForceIntersect(triangles, rays, t_min);
+
+    bool is_passed = true;
+    for (const auto &[builder, name] : builders)
+    {
+        for (auto layout : layouts)
+        {
+            pbrt::BVHBuildSettings settings{};
+            settings.__builder__ = builder;
+            settings.__layout__ = layout;
+            settings.__loadCalibratedCosts__ = false;
+            pbrt::BVH bvh;
+            bvh.Build(CopyMesh(mesh), settings);
+            size_t mismatch_count = CountMismatches(bvh, rays, reference_t, t_min);
+            PBRT_INFO("BVH Verify - [{}] Layout {}: {} rays, {} mismatches against brute force", name, static_cast<int>(layout), rays.size(), mismatch_count);
+            is_passed &= mismatch_count == 0;
+        }
+    }
+    return is_passed;
+}
+
+template <typename T>
+static bool IsSameBytes(std::span<const T> a, std::span<const T> b)
+{
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size_bytes()) == 0);
+}
+
+// 缓存保存的全部数组逐字节相同
+static bool IsSameCacheData(const pbrt::BVHCacheData &a, const pbrt::BVHCacheData &b)
+{
+    return a.__layout__ == b.__layout__ && a.__area__ == b.__area__ &&
+           a.__bounds__.__bMin__ == b.__bounds__.__bMin__ && a.__bounds__.__bMax__ == b.__bounds__.__bMax__ &&
+           IsSameBytes(a.__nodes__, b.__nodes__) &&
+           IsSameBytes(a.__wideNodes4__, b.__wideNodes4__) &&
+           IsSameBytes(a.__wideNodes8__, b.__wideNodes8__) &&
+           IsSameBytes(a.__quantizedNodes4__, b.__quantizedNodes4__) &&
+           IsSameBytes(a.__quantizedNodes8__, b.__quantizedNodes8__) &&
+           IsSameBytes(a.__triangleBlocks4__, b.__triangleBlocks4__) &&
+           IsSameBytes(a.__triangleBlocks8__, b.__triangleBlocks8__) &&
+           IsSameBytes(a.__positions__, b.__positions__) &&
+           IsSameBytes(a.__normals__, b.__normals__) &&
+           IsSameBytes(a.__indices__, b.__indices__) &&
+           IsSameBytes(a.__primitiveIndices__, b.__primitiveIndices__) &&
+           IsSameBytes(a.__aliasProbs__, b.__aliasProbs__) &&
+           IsSameBytes(a.__aliasItems__, b.__aliasItems__);
+}
+
+// 两个BVH的求交, 着色数据, 遮挡与采样结果完全相同, 返回不一致的光线数
+static size_t CountDifferences(const pbrt::BVH &a, const pbrt::BVH &b, const std::vector<pbrt::Ray> &rays, float t_min)
+{
+    size_t difference_count = 0;
+    for (size_t ray_idx = 0; ray_idx < rays.size(); ray_idx++)
+    {
+        const auto &ray = rays[ray_idx];
+        auto hit_a = a.Intersect(ray, t_min, std::numeric_limits<float>::infinity());
+        auto hit_b = b.Intersect(ray, t_min, std::numeric_limits<float>::infinity());
+        bool is_same = hit_a.has_value() == hit_b.has_value() && (!hit_a || (hit_a->__t__ == hit_b->__t__ && hit_a->__normal__ == hit_b->__normal__));
+        is_same &= a.Occluded(ray, t_min, std::numeric_limits<float>::infinity()) == b.Occluded(ray, t_min, std::numeric_limits<float>::infinity());
+        auto sample_a = a.SampleShape(pbrt::RNG(ray_idx));
+        auto sample_b = b.SampleShape(pbrt::RNG(ray_idx));
+        is_same &= sample_a.has_value() == sample_b.has_value() && (!sample_a || (sample_a->__point__ == sample_b->__point__ && sample_a->__pdf__ == sample_b->__pdf__));
+        difference_count += !is_same;
+    }
+    return difference_count;
+}
+
+// 自带的obj解析只接受"f v//vn"格式, 网格没有法线时按相邻面的面积加权法线补齐
+static void WriteObj(const pbrt::TriangleMesh &mesh, const std::filesystem::path &path)
+{
+    auto positions = mesh.GetPositions();
+    auto indices = mesh.GetIndices();
+    std::vector<glm::vec3> normals(mesh.GetNormals().begin(), mesh.GetNormals().end());
+    if (normals.size() != positions.size())
+    {
+        normals.assign(positions.size(), glm::vec3{0.f});
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            auto face_normal = glm::cross(positions[indices[i + 1]] - positions[indices[i]], positions[indices[i + 2]] - positions[indices[i]]);
+            for (size_t k = 0; k < 3; k++)
+            {
+                normals[indices[i + k]] += face_normal;
+            }
+        }
+    }
+
+    std::ofstream file(path);
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        auto normal = glm::length(normals[i]) > 0.f ? glm::normalize(normals[i]) : glm::vec3{0.f, 1.f, 0.f};
+        file << "v " << positions[i].x << " " << positions[i].y << " " << positions[i].z << "\n";
+        file << "vn " << normal.x << " " << normal.y << " " << normal.z << "\n";
+    }
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        file << "f";
+        for (size_t k = 0; k < 3; k++)
+        {
+            file << " " << indices[i + k] + 1 << "//" << indices[i + k] + 1;
+        }
+        file << "\n";
+    }
+}
+
+bool VerifyCache(const pbrt::TriangleMesh &mesh)
+{
+    constexpr pbrt::BVHLayout layouts[] = {pbrt::BVHLayout::Binary, pbrt::BVHLayout::Wide4, pbrt::BVHLayout::Wide8, pbrt::BVHLayout::Wide4Quantized, pbrt::BVHLayout::Wide8Quantized};
+
+    std::error_code ec;
+    auto directory = std::filesystem::temp_directory_path(ec) / "pbrt-verify-cache";
+    std::filesystem::remove_all(directory, ec);
+    std::filesystem::create_directories(directory, ec);
+    auto obj_path = directory / "mesh.obj";
+    WriteObj(mesh, obj_path);
+
+    bool is_passed = true;
+    for (auto layout : layouts)
+    {
+        pbrt::BVHBuildSettings settings{};
+        settings.__layout__ = layout;
+        settings.__loadCalibratedCosts__ = false;
+        settings.__enableCache__ = true;
+        settings.__cacheDirectory__ = directory;
+
+        // 第一次构建并写入缓存, 第二次直接映射; 使用自带的obj解析, 不依赖第三方解析器的行为
+        pbrt::Model built(obj_path, true, settings);
+        pbrt::BVH loaded;
+        bool is_loaded = pbrt::BVHCache(obj_path, "byMyself", settings).Load(loaded);
+        bool is_same_data = is_loaded && IsSameCacheData(built.GetBVH().GetCacheData(), loaded.GetCacheData());
+        auto bounds = built.GetBounds();
+        float t_min = 1e-5f * glm::length(bounds.GetDiagonal());
+        size_t difference_count = is_loaded ? CountDifferences(built.GetBVH(), loaded, GenerateVerifyRays(bounds, 2), t_min) : 0;
+
+        // 调度参数不影响构建结果, 仍命中同一缓存; 叶子大小改变构建结果, 不能命中
+        auto scheduling_settings = settings;
+        scheduling_settings.__subtreeTaskGrain__ /= 2;
+        scheduling_settings.__parallelSplitThreshold__ /= 2;
+        pbrt::BVH scheduling_loaded;
+        bool is_scheduling_hit = pbrt::BVHCache(obj_path, "byMyself", scheduling_settings).Load(scheduling_loaded);
+        auto leaf_settings = settings;
+        leaf_settings.__maxLeafSize__ += 1;
+        pbrt::BVH leaf_loaded;
+        bool is_leaf_hit = pbrt::BVHCache(obj_path, "byMyself", leaf_settings).Load(leaf_loaded);
+
+        PBRT_INFO("BVH Verify - [Cache] Layout {}: loaded {}, identical arrays {}, {} differing rays, scheduling change hits {}, leaf size change hits {}",
+                  static_cast<int>(layout), is_loaded, is_same_data, difference_count, is_scheduling_hit, is_leaf_hit);
+        is_passed &= is_loaded && is_same_data && difference_count == 0 && is_scheduling_hit && !is_leaf_hit;
+    }
+
+    std::filesystem::remove_all(directory, ec);
+    return is_passed;
+}
+
+bool VerifyRefit(const pbrt::TriangleMesh &mesh)
+{
+    constexpr std::pair<pbrt::BVHBuilderType, const char *> builders[] = {
+        {pbrt::BVHBuilderType::BinnedSAH, "BinnedSAH"},
+        {pbrt::BVHBuilderType::LBVH, "LBVH"},
+        {pbrt::BVHBuilderType::PLOC, "PLOC"},
+        {pbrt::BVHBuilderType::SBVH, "SBVH"}
+        // end
+    };
+    constexpr pbrt::BVHLayout layouts[] = {pbrt::BVHLayout::Binary, pbrt::BVHLayout::Wide4, pbrt::BVHLayout::Wide8, pbrt::BVHLayout::Wide4Quantized, pbrt::BVHLayout::Wide8Quantized};
+
+    // 逐帧累积: 小幅起伏只需要重拟合, 上半部分大幅拉伸后部分子树的SAH代价明显退化, 触发局部重建
+    auto source_positions = mesh.GetPositions();
+    auto bounds = mesh.GetTriangleCount() > 0 ? GetTriangleBounds(GetWorldTriangles(mesh)) : pbrt::Bounds{};
+    auto center = 0.5f * (bounds.__bMin__ + bounds.__bMax__);
+    auto extent = bounds.GetDiagonal();
+    std::vector<std::pair<const char *, std::vector<glm::vec3>>> frames = {{"Ripple", {}}, {"Stretch", {}}};
+    for (const auto &position : source_positions)
+    {
+        auto offset = position - center;
+        auto ripple = position + 0.02f * extent * glm::sin(7.f * offset / glm::max(extent, glm::vec3{1e-6f}));
+        frames[0].second.push_back(ripple);
+        float lift = glm::max(0.f, (ripple.y - center.y) / glm::max(extent.y, 1e-6f));
+        frames[1].second.push_back(ripple + glm::vec3{1.5f * extent.x * lift, 0.f, 0.f});
+    }
+
+    bool is_passed = true;
+    for (const auto &[builder, name] : builders)
+    {
+        for (auto layout : layouts)
+        {
+            pbrt::BVHBuildSettings settings{};
+            settings.__builder__ = builder;
+            settings.__layout__ = layout;
+            settings.__loadCalibratedCosts__ = false;
+            pbrt::BVH bvh;
+            bvh.Build(CopyMesh(mesh), settings);
+            for (const auto &[frame_name, positions] : frames)
+            {
+                bvh.Refit(positions);
+                auto triangles = GetWorldTriangles(bvh.GetMesh());
+                auto frame_bounds = GetTriangleBounds(triangles);
+                float t_min = 1e-5f * glm::length(frame_bounds.GetDiagonal());
+                auto rays = GenerateVerifyRays(frame_bounds, 3);
+                size_t mismatch_count = CountMismatches(bvh, rays, BruteForceIntersect(triangles, rays, t_min), t_min);
+                bool is_bounds_same = bvh.GetBounds().__bMin__ == frame_bounds.__bMin__ && bvh.GetBounds().__bMax__ == frame_bounds.__bMax__;
+
+                pbrt::BVH rebuilt;
+                rebuilt.Build(CopyMesh(bvh.GetMesh()), settings);
+                float rebuilt_cost = rebuilt.GetQualityReport().__sahCost__;
+                float cost_ratio = rebuilt_cost > 0.f ? bvh.GetQualityReport().__sahCost__ / rebuilt_cost : 1.f;
+                PBRT_INFO("BVH Verify - [{}] Layout {} {}: {} mismatches against brute force, bounds match {}, SAH cost {:.2f}x of a rebuild",
+                          name, static_cast<int>(layout), frame_name, mismatch_count, is_bounds_same, cost_ratio);
+                is_passed &= mismatch_count == 0 && is_bounds_same;
+            }
+        }
+    }
+    return is_passed;
+}
+
+struct InstancePlacement
+{
+public:
+    glm::vec3 __position__;
+    glm::vec3 __scale__;
+    glm::vec3 __rotate__;
+
+public:
+    glm::mat4 GetWorldFromObject() const { return pbrt::GetWorldFromObject(__position__, __scale__, __rotate__); }
+};
+
+bool VerifyInstancing(const pbrt::TriangleMesh &mesh)
+{
+    constexpr pbrt::BVHLayout layouts[] = {pbrt::BVHLayout::Binary, pbrt::BVHLayout::Wide4, pbrt::BVHLayout::Wide8, pbrt::BVHLayout::Wide4Quantized, pbrt::BVHLayout::Wide8Quantized};
+    constexpr std::pair<pbrt::SceneBuildMode, const char *> modes[] = {{pbrt::SceneBuildMode::TwoLevel, "TwoLevel"}, {pbrt::SceneBuildMode::Flat, "Flat"}};
+    // 第level层实例组放置两次下一层的物体, 网格为第0层; 三层组加上场景正好达到MAX_INSTANCE_DEPTH
+    constexpr size_t GROUP_LEVEL_COUNT = 3;
+    static_assert(GROUP_LEVEL_COUNT + 1 == pbrt::MAX_INSTANCE_DEPTH);
+    const InstancePlacement group_placements[GROUP_LEVEL_COUNT][2] = {
+        {{{-1.2f, 0.f, 0.f}, {1.f, 1.f, 1.f}, {0.f, 0.f, 0.f}}, {{1.2f, 0.3f, 0.f}, {0.8f, 1.2f, 0.8f}, {20.f, 35.f, 0.f}}},
+        {{{0.f, -1.5f, 0.5f}, {0.9f, 0.9f, 0.9f}, {0.f, 45.f, 0.f}}, {{0.f, 1.5f, -0.5f}, {1.1f, 1.f, 1.f}, {25.f, 0.f, 10.f}}},
+        {{{0.f, 0.f, -2.f}, {1.f, 1.f, 1.f}, {0.f, 0.f, 30.f}}, {{0.5f, 0.f, 2.f}, {0.7f, 0.7f, 0.7f}, {60.f, 10.f, 0.f}}}
+        // end
+    };
+    const InstancePlacement group_scene_placement{{0.f, 0.f, 0.f}, {1.f, 1.f, 1.f}, {5.f, 10.f, 15.f}};
+    const InstancePlacement mesh_scene_placement{{0.f, 4.f, 0.f}, {1.5f, 1.5f, 1.5f}, {0.f, 0.f, 0.f}};
+    const InstancePlacement late_scene_placement{{0.f, -4.f, 0.f}, {1.f, 1.f, 1.f}, {0.f, 0.f, 0.f}}; // 加入场景后才加深的组, 构建时应被跳过, 不计入参考结果
+
+    // 参考结果: 所有有效实例展开到世界空间的三角形
+    std::vector<glm::mat4> world_from_objects = {group_scene_placement.GetWorldFromObject()};
+    for (size_t level = GROUP_LEVEL_COUNT; level-- > 0;)
+    {
+        std::vector<glm::mat4> next_world_from_objects;
+        for (const auto &world_from_group : world_from_objects)
+        {
+            for (const auto &placement : group_placements[level])
+            {
+                next_world_from_objects.push_back(world_from_group * placement.GetWorldFromObject());
+            }
+        }
+        world_from_objects = std::move(next_world_from_objects);
+    }
+    world_from_objects.push_back(mesh_scene_placement.GetWorldFromObject());
+    std::vector<WorldTriangle> triangles;
+    for (const auto &world_from_object : world_from_objects)
+    {
+        auto instance_triangles = GetWorldTriangles(mesh, world_from_object);
+        triangles.insert(triangles.end(), instance_triangles.begin(), instance_triangles.end());
+    }
+    auto bounds = GetTriangleBounds(triangles);
+    bounds.Expand(GetTriangleBounds(GetWorldTriangles(mesh, late_scene_placement.GetWorldFromObject())));
+    float t_min = 1e-5f * glm::length(bounds.GetDiagonal());
+    auto rays = GenerateVerifyRays(bounds, 4);
+    auto reference_t = BruteForceIntersect(triangles, rays, t_min);
+
+    bool is_passed = true;
+    for (auto layout : layouts)
+    {
+        pbrt::BVHBuildSettings settings{};
+        settings.__layout__ = layout;
+        settings.__loadCalibratedCosts__ = false;
+        pbrt::BVH bvh;
+        bvh.Build(CopyMesh(mesh), settings);
+        pbrt::InstanceGroup groups[GROUP_LEVEL_COUNT];
+        for (size_t level = 0; level < GROUP_LEVEL_COUNT; level++)
+        {
+            const pbrt::Shape &child = level == 0 ? static_cast<const pbrt::Shape &>(bvh) : groups[level - 1];
+            for (const auto &placement : group_placements[level])
+            {
+                is_passed &= groups[level].AddShape(child, nullptr, placement.__position__, placement.__scale__, placement.__rotate__);
+            }
+            groups[level].Build(layout);
+        }
+
+        // 超过最大层数的组在加入时被拒绝
+        pbrt::InstanceGroup deep_group;
+        bool is_deep_group_rejected = !deep_group.AddShape(groups[GROUP_LEVEL_COUNT - 1]);
+
+        for (const auto &[mode, mode_name] : modes)
+        {
+            pbrt::Scene scene;
+            scene.AddShape(groups[GROUP_LEVEL_COUNT - 1], nullptr, group_scene_placement.__position__, group_scene_placement.__scale__, group_scene_placement.__rotate__);
+            scene.AddShape(bvh, nullptr, mesh_scene_placement.__position__, mesh_scene_placement.__scale__, mesh_scene_placement.__rotate__);
+
+            // 加入场景时层数合法, 之后才加深到超过最大层数的组, 构建时只跳过它自己; 再次加入时直接被拒绝
+            pbrt::InstanceGroup late_outer, late_inner;
+            late_outer.AddShape(late_inner);
+            scene.AddShape(late_outer, nullptr, late_scene_placement.__position__, late_scene_placement.__scale__, late_scene_placement.__rotate__);
+            late_inner.AddShape(groups[GROUP_LEVEL_COUNT - 2]);
+            late_inner.Build(layout);
+            late_outer.Build(layout);
+            bool is_deep_scene_rejected = scene.AddShape(late_outer) == pbrt::INVALID_SHAPE_ID;
+            scene.Build(mode);
+
+            size_t mismatch_count = CountMismatches(scene, rays, reference_t, t_min);
+            PBRT_INFO("BVH Verify - [Instancing] Layout {} {}: {} instances, {} rays, {} mismatches against brute force, over-deep group rejected {}, over-deep scene instance rejected {}",
+                      static_cast<int>(layout), mode_name, world_from_objects.size(), rays.size(), mismatch_count, is_deep_group_rejected, is_deep_scene_rejected);
+            is_passed &= mismatch_count == 0 && is_deep_group_rejected && is_deep_scene_rejected;
+        }
+    }
+    return is_passed;
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+﻿#pragma once
+#include <shape/triangleMesh.hpp>
+
+/*
+    bvh_bench的正确性检查模式(--verify=...), 结果与暴力求交或未经该路径的BVH逐条比较, 全部一致时返回true
+    检查使用固定种子的随机光线: 大部分从包围球外射向包围盒内的随机点, 其余从包围盒内部射向随机方向
+*/
+
+// 每种构建算法与布局的最近交点与遮挡结果与暴力遍历全部三角形的结果比较
+bool VerifyBuilders(const pbrt::TriangleMesh &mesh);
+
+// 网格写成临时obj, 经Model构建并写入缓存后, 再由BVHCache映射加载, 各数组逐字节比较并对比遍历与采样结果; 同时检查缓存键只随影响构建结果的参数变化
+bool VerifyCache(const pbrt::TriangleMesh &mesh);
+
+// 顶点依次做小幅起伏与大幅拉伸后Refit, 每一帧都与变形后网格的暴力求交对比, 并记录与重新构建相比的SAH代价
+bool VerifyRefit(const pbrt::TriangleMesh &mesh);
+
+// 网格经三层嵌套实例组放置到场景中, 各布局与场景构建方式对比世界空间三角形的暴力求交; 同时检查超过MAX_INSTANCE_DEPTH的实例被拒绝或跳过
+bool VerifyInstancing(const pbrt::TriangleMesh &mesh);
\ No newline at end of file
@@ -2,56 +2,387 @@
 #include "thread/threadPool.hpp"
 #include "utils/debugMacro.hpp"
 #include "utils/logger.hpp"
+#include "utils/rng.hpp"
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <tuple>
+#include <type_traits>
 
 namespace pbrt
 {
-    void BVH::Build(std::vector<Triangle> &&triangles)
-    {
-        mOrderedTriangles = std::move(triangles);
+    // 退化包围盒的表面积视为0
+    static float GetSAHArea(const Bounds &bounds) { return bounds.IsValid() ? bounds.GetSurfaceArea() : 0.f; }
 
-        mRoot = mNodeAllocator.Allocate(); // 分配根节点
-        // 初始化根节点首尾索引
-        mRoot->__start__ = 0;
-        mRoot->__end__ = mOrderedTriangles.size();
-        // 初始化根节点包围盒
-        mRoot->__bounds__ = {};
-        for (const auto &triangle : mOrderedTriangles)
-        {
-            mRoot->__bounds__.Expand(triangle.GetBounds());
-        }
-        mRoot->__depth__ = 1;
+    // 子树SAH代价按子树根节点表面积归一化, 整体平移与缩放不改变该值
+    static float GetNormalizedCost(float cost, const Bounds &bounds)
+    {
+        float area = GetSAHArea(bounds);
+        return area > 0.f ? cost / area : 0.f;
+    }
 
-        BVHState state{};
-        size_t triangle_count = mOrderedTriangles.size();
-        RecursiveSplit(mRoot, state); // 递归构建BVH树
-        MasterThreadPool.Wait();
+    // 拼接数组时的索引映射: ends为升序的被替换区间终点, offsets为对应的累计长度变化
+    static size_t RemapIndex(const std::vector<size_t> &ends, const std::vector<ptrdiff_t> &offsets, size_t idx)
+    {
+        size_t k = std::upper_bound(ends.begin(), ends.end(), idx) - ends.begin();
+        return k == 0 ? idx : static_cast<size_t>(static_cast<ptrdiff_t>(idx) + offsets[k - 1]);
+    }
 
-        PBRT_DEBUG("BVH - Total Node Count: {}", (size_t)state.__totalNodeCount__);
-        PBRT_DEBUG("BVH - Leaf Node Count: {}", state.__leafNodeCount__);
+    void BVH::Build(TriangleMesh &&mesh, const BVHBuildSettings &settings)
+    {
+        mSettings = settings;
+        mLayout = settings.__layout__;
+        mMesh = std::move(mesh);
+        size_t triangle_count = mMesh.GetTriangleCount();
+
+        // 并行计算三角形包围盒, 构建器只访问包围盒
+        std::vector<Bounds> triangle_bounds(triangle_count);
+        MasterThreadPool.ParallelFor(triangle_count, [&](size_t i)
+                                     {
+                                         triangle_bounds[i] = mMesh.GetTriangleBounds(i);
+                                         // end
+                                     });
+
+        auto result = BuildHierarchy(triangle_bounds, settings);
+        const auto &stats = result.__stats__;
+        size_t reference_count = result.__primitiveIndices__.size(); // SBVH复制引用后可能多于三角形数
+
+        PBRT_DEBUG("BVH - Total Node Count: {}", stats.__totalNodeCount__);
+        PBRT_DEBUG("BVH - Leaf Node Count: {}", stats.__leafNodeCount__);
         PBRT_DEBUG("BVH - Triangle Count: {}", triangle_count);
-        PBRT_DEBUG("BVH - Mean Leaf Node Triangle Count: {}", static_cast<float>(triangle_count) / static_cast<float>(state.__leafNodeCount__));
-        PBRT_DEBUG("BVH - Max Leaf Node Triangle Count: {}", state.__maxLeafNodeTriangleCount__);
-        PBRT_DEBUG("BVH - Max Tree Depth: {}", state.__maxTreeDepth__);
+        PBRT_DEBUG("BVH - Triangle Reference Count: {}", reference_count);
+        PBRT_DEBUG("BVH - Mean Leaf Node Triangle Count: {}", static_cast<float>(reference_count) / static_cast<float>(stats.__leafNodeCount__));
+        PBRT_DEBUG("BVH - Max Leaf Node Triangle Count: {}", stats.__maxLeafPrimitiveCount__);
+        PBRT_DEBUG("BVH - Max Tree Depth: {}", stats.__maxTreeDepth__);
+        PBRT_DEBUG("BVH - Mesh Vertex Count: {}, Memory: {} KB (per-triangle copies: {} KB)", mMesh.GetVertexCount(), mMesh.GetMemorySize() / 1024, triangle_count * sizeof(TriangleData) / 1024);
 
-        mNodes.reserve(state.__totalNodeCount__); // 预分配内存
-        RecursiveFlatten(mRoot);                  // 递归将BVH树转换为线性结构
+        // 叶子节点只保存网格三角形索引, 不再复制三角形
+        auto primitive_indices = std::move(result.__primitiveIndices__);
 
-        // 以三角形面积为权重构建别名表
+        auto nodes = std::move(result.__nodes__);
+        mBounds = nodes.empty() ? Bounds{} : nodes[0].__bounds__;
+
+        // 将二叉BVH塌缩为N叉BVH, 塌缩完成后二叉节点不再参与遍历
+        auto leaf_range = [](const BVHNode &node)
+        {
+            return std::pair<size_t, size_t>(node.__triangleCount__ == 0 ? 0 : node.__triangleIdx__, node.__triangleCount__);
+        };
+        // 不超过N个三角形的子树合并为一个叶子, 恰好打包为一个三角形块
+        // 宽节点先重排再打包三角形块, 块按节点顺序生成; 量化布局在三角形块打包后再量化节点, 叶子引用已改为块索引
+        if (GetBVHLayoutWidth(mLayout) == 4)
+        {
+            std::vector<WideBVHNode<4>> wide_nodes;
+            std::vector<TriangleBlock<4>> triangle_blocks;
+            CollapseBVH(nodes, wide_nodes, leaf_range, 4);
+            ReorderWideBVH(wide_nodes, settings.__nodeOrder__);
+            BuildTriangleBlocks(wide_nodes, mMesh, std::span<const uint32_t>(primitive_indices), triangle_blocks);
+            PBRT_DEBUG("BVH - Wide4 Node Count: {}, Memory: {} KB", wide_nodes.size(), wide_nodes.size() * sizeof(WideBVHNode<4>) / 1024);
+            PBRT_DEBUG("BVH - Triangle Block Count: {}, Memory: {} KB", triangle_blocks.size(), triangle_blocks.size() * sizeof(TriangleBlock<4>) / 1024);
+            if (IsQuantizedBVHLayout(mLayout))
+            {
+                std::vector<QuantizedWideBVHNode<4>> quantized_nodes;
+                QuantizeWideBVH(wide_nodes, quantized_nodes);
+                if (PBRT_DEBUG_ENABLED()) // 探测光线在单线程上遍历, 只在输出调试日志时对比
+                {
+                    LogQuantizedComparison(std::span<const WideBVHNode<4>>(wide_nodes), std::span<const QuantizedWideBVHNode<4>>(quantized_nodes), std::span<const TriangleBlock<4>>(triangle_blocks));
+                }
+                mQuantizedNodes4.Assign(std::move(quantized_nodes));
+            }
+            else
+            {
+                mWideNodes4.Assign(std::move(wide_nodes));
+            }
+            mTriangleBlocks4.Assign(std::move(triangle_blocks));
+        }
+        else if (GetBVHLayoutWidth(mLayout) == 8)
+        {
+            std::vector<WideBVHNode<8>> wide_nodes;
+            std::vector<TriangleBlock<8>> triangle_blocks;
+            CollapseBVH(nodes, wide_nodes, leaf_range, 8);
+            ReorderWideBVH(wide_nodes, settings.__nodeOrder__);
+            BuildTriangleBlocks(wide_nodes, mMesh, std::span<const uint32_t>(primitive_indices), triangle_blocks);
+            PBRT_DEBUG("BVH - Wide8 Node Count: {}, Memory: {} KB", wide_nodes.size(), wide_nodes.size() * sizeof(WideBVHNode<8>) / 1024);
+            PBRT_DEBUG("BVH - Triangle Block Count: {}, Memory: {} KB", triangle_blocks.size(), triangle_blocks.size() * sizeof(TriangleBlock<8>) / 1024);
+            if (IsQuantizedBVHLayout(mLayout))
+            {
+                std::vector<QuantizedWideBVHNode<8>> quantized_nodes;
+                QuantizeWideBVH(wide_nodes, quantized_nodes);
+                if (PBRT_DEBUG_ENABLED())
+                {
+                    LogQuantizedComparison(std::span<const WideBVHNode<8>>(wide_nodes), std::span<const QuantizedWideBVHNode<8>>(quantized_nodes), std::span<const TriangleBlock<8>>(triangle_blocks));
+                }
+                mQuantizedNodes8.Assign(std::move(quantized_nodes));
+            }
+            else
+            {
+                mWideNodes8.Assign(std::move(wide_nodes));
+            }
+            mTriangleBlocks8.Assign(std::move(triangle_blocks));
+        }
+        else
+        {
+            ReorderBinaryBVH(nodes, settings.__nodeOrder__, leaf_range);
+            mNodes.Assign(std::move(nodes));
+        }
+        mPrimitiveIndices.Assign(std::move(primitive_indices));
+        UpdateSampleTable();
+        mRefitState = {};
+        mCacheFile.reset();
+        UpdateNumaReplicas();
+        if (PBRT_DEBUG_ENABLED()) // 质量报告需要遍历整棵树
+        {
+            PBRT_DEBUG("BVH - SAH Cost: {:.2f}", GetQualityReport().__sahCost__);
+        }
+    }
+
+    void BVH::UpdateSampleTable()
+    {
+        // 并行计算三角形面积, 以面积为权重构建别名表; 别名表按网格三角形索引, SBVH的重复引用不影响采样概率
+        size_t triangle_count = mMesh.GetTriangleCount();
+        std::vector<float> areas(triangle_count);
+        internal::ParallelChunks(0, triangle_count, internal::GetChunkCount(triangle_count), [&](size_t, size_t begin, size_t end)
+                                 {
+                                     for (size_t i = begin; i < end; i++)
+                                     {
+                                         areas[i] = mMesh.GetTriangleArea(i);
+                                     }
+                                     // end
+                                 });
         mArea = 0.f;
-        std::vector<float> areas;
-        areas.reserve(mNodes.size());
-        for (const auto &triangle : mOrderedTriangles)
+        for (float area : areas)
         {
-            areas.push_back(triangle.GetArea());
-            mArea += areas.back();
+            mArea += area;
         }
         mTable.Build(areas);
     }
 
-    std::optional<HitInfo> BVH::Intersect(const Ray &ray, float t_min, float t_max) const
+    void BVH::UpdateNumaReplicas()
+    {
+        mNumaNodes.Clear();
+        mNumaPrimitiveIndices.Clear();
+        mNumaWideNodes4.Clear();
+        mNumaWideNodes8.Clear();
+        mNumaQuantizedNodes4.Clear();
+        mNumaQuantizedNodes8.Clear();
+        mNumaTriangleBlocks4.Clear();
+        mNumaTriangleBlocks8.Clear();
+        if (!mSettings.__replicatePerNumaNode__)
+        {
+            return;
+        }
+
+        // 网格在命中着色与光源采样时读取, Binary布局遍历时也读取顶点, 各布局都复制
+        mMesh.ReplicatePerNumaNode();
+        mNumaPrimitiveIndices.Replicate(mPrimitiveIndices.Span());
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            mNumaWideNodes4.Replicate(mWideNodes4.Span());
+            mNumaTriangleBlocks4.Replicate(mTriangleBlocks4.Span());
+            break;
+        case BVHLayout::Wide8:
+            mNumaWideNodes8.Replicate(mWideNodes8.Span());
+            mNumaTriangleBlocks8.Replicate(mTriangleBlocks8.Span());
+            break;
+        case BVHLayout::Wide4Quantized:
+            mNumaQuantizedNodes4.Replicate(mQuantizedNodes4.Span());
+            mNumaTriangleBlocks4.Replicate(mTriangleBlocks4.Span());
+            break;
+        case BVHLayout::Wide8Quantized:
+            mNumaQuantizedNodes8.Replicate(mQuantizedNodes8.Span());
+            mNumaTriangleBlocks8.Replicate(mTriangleBlocks8.Span());
+            break;
+        default:
+            mNumaNodes.Replicate(mNodes.Span());
+            break;
+        }
+    }
+
+    const Material *BVH::GetMaterial(uint32_t triangle_idx) const
     {
-        std::optional<HitInfo> closest_hit_info;
+        // 最后一个起始索引不大于triangle_idx的区间
+        auto iter = std::upper_bound(mMaterials.begin(), mMaterials.end(), triangle_idx, [](uint32_t idx, const BVHMaterialRange &range)
+                                     { return idx < range.__firstTriangle__; });
+        return iter == mMaterials.begin() ? nullptr : std::prev(iter)->__material__;
+    }
+
+    BVHCacheData BVH::GetCacheData() const
+    {
+        return BVHCacheData{
+            .__layout__ = mLayout,
+            .__bounds__ = mBounds,
+            .__area__ = mArea,
+            .__nodes__ = mNodes.Span(),
+            .__wideNodes4__ = mWideNodes4.Span(),
+            .__wideNodes8__ = mWideNodes8.Span(),
+            .__quantizedNodes4__ = mQuantizedNodes4.Span(),
+            .__quantizedNodes8__ = mQuantizedNodes8.Span(),
+            .__triangleBlocks4__ = mTriangleBlocks4.Span(),
+            .__triangleBlocks8__ = mTriangleBlocks8.Span(),
+            .__positions__ = mMesh.GetPositions(),
+            .__normals__ = mMesh.GetNormals(),
+            .__indices__ = mMesh.GetIndices(),
+            .__primitiveIndices__ = mPrimitiveIndices.Span(),
+            .__aliasProbs__ = mTable.GetProbs(),
+            .__aliasItems__ = mTable.GetItems()
+            // end
+        };
+    }
+
+    void BVH::Attach(const BVHCacheData &data, std::shared_ptr<const MappedFile> file, const BVHBuildSettings &settings)
+    {
+        mSettings = settings;
+        mLayout = data.__layout__;
+        mBounds = data.__bounds__;
+        mArea = data.__area__;
+        mNodes.Attach(data.__nodes__);
+        mWideNodes4.Attach(data.__wideNodes4__);
+        mWideNodes8.Attach(data.__wideNodes8__);
+        mQuantizedNodes4.Attach(data.__quantizedNodes4__);
+        mQuantizedNodes8.Attach(data.__quantizedNodes8__);
+        mTriangleBlocks4.Attach(data.__triangleBlocks4__);
+        mTriangleBlocks8.Attach(data.__triangleBlocks8__);
+        mMesh.Attach(data.__positions__, data.__normals__, data.__indices__);
+        mPrimitiveIndices.Attach(data.__primitiveIndices__);
+        mTable.Attach(data.__aliasProbs__, data.__aliasItems__);
+        mRefitState = {};
+        mCacheFile = std::move(file);
+        UpdateNumaReplicas();
+    }
+
+    BVHBuildResult BVH::BuildHierarchy(const std::vector<Bounds> &triangle_bounds, const BVHBuildSettings &settings) const
+    {
+        if (settings.__builder__ == BVHBuilderType::BinnedSAH)
+        {
+            return BinnedSAHBuilder(settings).Build(triangle_bounds);
+        }
+        if (settings.__builder__ == BVHBuilderType::SBVH)
+        {
+            return SBVHBuilder(settings).Build(mMesh, triangle_bounds);
+        }
+
+        return MortonBuilder(settings).Build(triangle_bounds); // 遍历栈可以溢出到堆, Morton构建器的深树无需回退
+    }
+
+    template <size_t N>
+    void BVH::LogQuantizedComparison(std::span<const WideBVHNode<N>> nodes, std::span<const QuantizedWideBVHNode<N>> quantized_nodes, std::span<const TriangleBlock<N>> blocks) const
+    {
+        PBRT_DEBUG("BVH - Quantized Wide{} Node Count: {}, Memory: {} KB ({:.1f}% of float nodes)", N, quantized_nodes.size(), quantized_nodes.size() * sizeof(QuantizedWideBVHNode<N>) / 1024,
+                   100.f * sizeof(QuantizedWideBVHNode<N>) / sizeof(WideBVHNode<N>));
+
+        // 从包围球外射向包围盒内随机点的探测光线, 分别遍历浮点节点与量化节点
+        constexpr size_t probe_ray_count = 4096;
+        RNG rng(0);
+        glm::vec3 diagonal = mBounds.GetDiagonal();
+        glm::vec3 center = mBounds.__bMin__ + diagonal * 0.5f;
+        float radius = glm::length(diagonal);
+        std::vector<WideRay<N>> rays;
+        rays.reserve(probe_ray_count);
+        for (size_t i = 0; i < probe_ray_count; i++)
+        {
+            glm::vec3 origin = center + radius * glm::normalize(glm::vec3{rng.Uniform() - 0.5f, rng.Uniform() - 0.5f, rng.Uniform() - 0.5f} + 1e-6f);
+            glm::vec3 target = mBounds.__bMin__ + diagonal * glm::vec3{rng.Uniform(), rng.Uniform(), rng.Uniform()};
+            rays.emplace_back(Ray{origin, target - origin});
+        }
+
+        auto trace = [&](auto wide_nodes, size_t &node_visit_count, size_t &hit_count)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (const auto &ray : rays)
+            {
+                TriangleBlockHit closest_hit{};
+                bool is_hit = false;
+                node_visit_count += IntersectWideBVH(wide_nodes, ray, 0.f, std::numeric_limits<float>::infinity(), [&](int block_idx, uint32_t block_count, float &t_closest)
+                                                     {
+                                                         for (uint32_t i = 0; i < block_count; i++)
+                                                         {
+                                                             is_hit |= IntersectTriangleBlock(blocks[block_idx + i], ray, 0.f, t_closest, closest_hit);
+                                                         }
+                                                         // end
+                                                     });
+                hit_count += is_hit;
+            }
+            return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        };
+        size_t float_visit_count = 0, float_hit_count = 0, quantized_visit_count = 0, quantized_hit_count = 0;
+        double float_time = trace(nodes, float_visit_count, float_hit_count);
+        double quantized_time = trace(quantized_nodes, quantized_visit_count, quantized_hit_count);
+
+        PBRT_DEBUG("BVH - Float Wide{} Traversal: {:.2f} Mrays/s, {:.2f} nodes/ray", N, probe_ray_count / float_time * 1e-6, static_cast<double>(float_visit_count) / probe_ray_count);
+        PBRT_DEBUG("BVH - Quantized Wide{} Traversal: {:.2f} Mrays/s, {:.2f} nodes/ray", N, probe_ray_count / quantized_time * 1e-6, static_cast<double>(quantized_visit_count) / probe_ray_count);
+        if (float_hit_count != quantized_hit_count)
+        {
+            PBRT_WARN("BVH - Quantized traversal hit count {} differs from float traversal {}", quantized_hit_count, float_hit_count);
+        }
+    }
+
+    bool BVH::IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
+    {
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            return IntersectWide(mNumaWideNodes4.Get(mWideNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), ray, t_min, t_max, hit);
+        case BVHLayout::Wide8:
+            return IntersectWide(mNumaWideNodes8.Get(mWideNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), ray, t_min, t_max, hit);
+        case BVHLayout::Wide4Quantized:
+            return IntersectWide(mNumaQuantizedNodes4.Get(mQuantizedNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), ray, t_min, t_max, hit);
+        case BVHLayout::Wide8Quantized:
+            return IntersectWide(mNumaQuantizedNodes8.Get(mQuantizedNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), ray, t_min, t_max, hit);
+        default:
+            return IntersectBinary(ray, t_min, t_max, hit);
+        }
+    }
+
+    HitInfo BVH::GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const
+    {
+        // 仅对最近交点读取法线并插值
+        auto triangle = mMesh.GetLocalView().GetTriangle(hit.__primitiveIdx__);
+        glm::vec3 normal = (1.f - hit.__u__ - hit.__v__) * triangle.__n0__ + hit.__u__ * triangle.__n1__ + hit.__v__ * triangle.__n2__;
+        return HitInfo{
+            .__t__ = hit.__t__,
+            .__hitPoint__ = ray.Hit(hit.__t__),
+            .__normal__ = glm::normalize(normal),
+            .__material__ = GetMaterial(hit.__primitiveIdx__)
+            // end
+        };
+    }
+
+    template <typename WideNode>
+    bool BVH::IntersectWide(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        WideRay<N> wide_ray(ray);
+        TriangleBlockHit closest_hit{};
+        bool is_hit = false;
+
+        DEBUG_INFO(size_t triangle_test_count = 0)
+
+        // 叶子节点三角形块求交, 命中后收缩t_max, 使遍历剪掉更远的子节点
+        [[maybe_unused]] auto node_visit_count = IntersectWideBVH(nodes, wide_ray, t_min, t_max, [&](int block_idx, uint32_t block_count, float &t_closest)
+                                                 {
+                                                     DEBUG_INFO(triangle_test_count += block_count * N)
+                                                     for (uint32_t i = 0; i < block_count; i++)
+                                                     {
+                                                         is_hit |= IntersectTriangleBlock(blocks[block_idx + i], wide_ray, t_min, t_closest, closest_hit);
+                                                     }
+                                                     // end
+                                                 });
+
+        DEBUG_INFO(ray.__boundsTestCount__ += node_visit_count)
+        DEBUG_INFO(ray.__triangleTestCount__ += triangle_test_count)
+
+        if (!is_hit)
+        {
+            return false;
+        }
+        t_max = closest_hit.__t__;
+        hit = {closest_hit.__t__, closest_hit.__u__, closest_hit.__v__, mNumaPrimitiveIndices.Get(mPrimitiveIndices.Span())[closest_hit.__triangleIdx__], {}};
+        return true;
+    }
+
+    bool BVH::IntersectBinary(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
+    {
+        bool is_hit = false;
 
         DEBUG_INFO(size_t bounds_test_count = 0, triangle_test_count = 0)
 
@@ -59,21 +390,21 @@ namespace pbrt
             确认光线方向, 用于确定先遍历哪一个节点
             例如光线x分量为负, 则光线从X轴正半轴射向负半轴, 即从右向左穿入包围盒
             右子节点包围盒中心坐标一定大于左边, 而当光线从右向左穿入包围盒, 相交检测仍会先访问左节点, 随后访问右节点时若命中其包围盒的三角形, 那么之前与左节点的相交测试无意义
+            节点重排后紧随父节点的可能是右子节点, 查表结果已按__splitAxis__上的交换标记取反
         */
-        glm::bvec3 dir_is_neg = {
-            ray.__direction__.x < 0,
-            ray.__direction__.y < 0,
-            ray.__direction__.z < 0};
+        auto visit_right_first = GetBinaryVisitOrder(ray.__direction__);
 
         glm::vec3 inv_dir = 1.f / ray.__direction__;
+        auto nodes = mNumaNodes.Get(mNodes.Span());
+        auto primitive_indices = mNumaPrimitiveIndices.Get(mPrimitiveIndices.Span());
+        auto mesh = mMesh.GetLocalView();
 
-        std::array<int, 32> stack; // 栈式非递归遍历, 用于存储待访问的节点索引
-        auto ptr = stack.begin();
-        size_t current_node_idx = 0; // 当前遍历的节点索引
+        TraversalStack<int, BINARY_BVH_STACK_SIZE> stack; // 栈式非递归遍历, 用于存储待访问的节点索引
+        size_t current_node_idx = 0;                      // 当前遍历的节点索引
 
         while (true)
         {
-            auto &node = mNodes[current_node_idx];
+            auto &node = nodes[current_node_idx];
 
             DEBUG_INFO(bounds_test_count++)
 
@@ -81,63 +412,288 @@ namespace pbrt
             if (!node.__bounds__.HasIntersection(ray, inv_dir, t_min, t_max))
             {
                 // 栈为空, 遍历完成
-                if (ptr == stack.begin())
+                if (stack.Empty())
                     break;
 
                 // 从栈中取出下一个要访问的节点
-                current_node_idx = *(--ptr);
+                current_node_idx = stack.Pop();
                 continue;
             }
 
             if (node.__triangleCount__ == 0) // 非叶子节点
             {
                 // 根据光线方向决定先遍历哪一个节点
-                if (dir_is_neg[node.__splitAxis__])
+                if (visit_right_first[node.__splitAxis__])
                 {
-                    *(ptr++) = current_node_idx + 1;   // 左节点入栈
-                    current_node_idx = node.__right__; // 先访问右节点
+                    stack.Push(static_cast<int>(current_node_idx + 1)); // 紧随的子节点入栈
+                    current_node_idx = node.__right__;                  // 先访问__right__子节点
                 }
                 else
                 {
-                    current_node_idx++;        // 先访问左节点
-                    *(ptr++) = node.__right__; // 右节点入栈
+                    current_node_idx++;         // 先访问紧随的子节点
+                    stack.Push(node.__right__); // __right__子节点入栈
                 }
             }
             else // 叶子节点三角形相交检查
             {
-                auto triangle_iter = mOrderedTriangles.begin() + node.__triangleIdx__; // 定位叶节点三角形起始位置
+                auto primitive_iter = primitive_indices.begin() + node.__triangleIdx__; // 定位叶节点三角形索引起始位置
 
                 DEBUG_INFO(triangle_test_count += node.__triangleCount__)
 
-                // 遍历叶子节点内所有三角形进行相交检测
+                // 遍历叶子节点内所有三角形进行相交检测, 只读取顶点位置, 命中时只记录t与重心坐标
                 for (size_t i = 0; i < node.__triangleCount__; i++)
                 {
-                    auto hit_info = triangle_iter->Intersect(ray, t_min, t_max);
-                    ++triangle_iter;
-                    if (hit_info)
+                    float t, u, v;
+                    if (internal::IntersectTriangle(mesh.GetPosition(*primitive_iter, 0), mesh.GetPosition(*primitive_iter, 1), mesh.GetPosition(*primitive_iter, 2), ray, t_min, t_max, t, u, v))
                     {
-                        t_max = hit_info->__t__;
-                        closest_hit_info = hit_info;
+                        t_max = t;
+                        hit = {t, u, v, *primitive_iter, {}};
+                        is_hit = true;
                     }
+                    ++primitive_iter;
                 }
 
                 // 栈为空即遍历完成, 否则从栈中取出下一个要访问的节点
-                if (ptr == stack.begin())
+                if (stack.Empty())
+                    break;
+                current_node_idx = stack.Pop();
+            }
+        }
+
+        DEBUG_INFO(ray.__boundsTestCount__ += bounds_test_count)
+        DEBUG_INFO(ray.__triangleTestCount__ += triangle_test_count)
+
+        return is_hit;
+    }
+
+    bool BVH::Occluded(const Ray &ray, float t_min, float t_max) const
+    {
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            return OccludedWide(mNumaWideNodes4.Get(mWideNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), ray, t_min, t_max);
+        case BVHLayout::Wide8:
+            return OccludedWide(mNumaWideNodes8.Get(mWideNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), ray, t_min, t_max);
+        case BVHLayout::Wide4Quantized:
+            return OccludedWide(mNumaQuantizedNodes4.Get(mQuantizedNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), ray, t_min, t_max);
+        case BVHLayout::Wide8Quantized:
+            return OccludedWide(mNumaQuantizedNodes8.Get(mQuantizedNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), ray, t_min, t_max);
+        default:
+            return OccludedBinary(ray, t_min, t_max);
+        }
+    }
+
+    template <typename WideNode>
+    bool BVH::OccludedWide(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, const Ray &ray, float t_min, float t_max) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        WideRay<N> wide_ray(ray);
+        size_t node_visit_count = 0;
+
+        DEBUG_INFO(size_t triangle_test_count = 0)
+
+        bool is_occluded = OccludedWideBVH(nodes, wide_ray, t_min, t_max, [&](int block_idx, uint32_t block_count)
+                                           {
+                                               for (uint32_t i = 0; i < block_count; i++)
+                                               {
+                                                   DEBUG_INFO(triangle_test_count += N)
+                                                   if (OccludedTriangleBlock(blocks[block_idx + i], wide_ray, t_min, t_max))
+                                                   {
+                                                       return true;
+                                                   }
+                                               }
+                                               return false;
+                                               // end
+                                           },
+                                           node_visit_count);
+
+        DEBUG_INFO(ray.__boundsTestCount__ += node_visit_count)
+        DEBUG_INFO(ray.__triangleTestCount__ += triangle_test_count)
+
+        return is_occluded;
+    }
+
+    /*
+        二叉BVH任意交点遍历
+        遇到第一个交点即返回, 因此不需要按光线方向决定子节点的访问顺序
+    */
+    bool BVH::OccludedBinary(const Ray &ray, float t_min, float t_max) const
+    {
+        DEBUG_INFO(size_t bounds_test_count = 0, triangle_test_count = 0)
+
+        glm::vec3 inv_dir = 1.f / ray.__direction__;
+        auto nodes = mNumaNodes.Get(mNodes.Span());
+        auto primitive_indices = mNumaPrimitiveIndices.Get(mPrimitiveIndices.Span());
+        auto mesh = mMesh.GetLocalView();
+
+        TraversalStack<int, BINARY_BVH_STACK_SIZE> stack;
+        size_t current_node_idx = 0;
+        bool is_occluded = false;
+
+        while (true)
+        {
+            auto &node = nodes[current_node_idx];
+
+            DEBUG_INFO(bounds_test_count++)
+
+            if (!node.__bounds__.HasIntersection(ray, inv_dir, t_min, t_max))
+            {
+                if (stack.Empty())
+                    break;
+                current_node_idx = stack.Pop();
+                continue;
+            }
+
+            if (node.__triangleCount__ == 0)
+            {
+                current_node_idx++;
+                stack.Push(node.__right__);
+            }
+            else
+            {
+                auto primitive_iter = primitive_indices.begin() + node.__triangleIdx__;
+                for (size_t i = 0; i < node.__triangleCount__; i++)
+                {
+                    DEBUG_INFO(triangle_test_count++)
+                    float t, u, v;
+                    if (internal::IntersectTriangle(mesh.GetPosition(*primitive_iter, 0), mesh.GetPosition(*primitive_iter, 1), mesh.GetPosition(*primitive_iter, 2), ray, t_min, t_max, t, u, v))
+                    {
+                        is_occluded = true;
+                        break;
+                    }
+                    ++primitive_iter;
+                }
+
+                if (is_occluded || stack.Empty())
                     break;
-                current_node_idx = *(--ptr);
+                current_node_idx = stack.Pop();
             }
         }
 
         DEBUG_INFO(ray.__boundsTestCount__ += bounds_test_count)
         DEBUG_INFO(ray.__triangleTestCount__ += triangle_test_count)
 
-        return closest_hit_info;
+        return is_occluded;
+    }
+
+    void BVH::IntersectBatch(std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const
+    {
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            IntersectWideBatch(mNumaWideNodes4.Get(mWideNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), rays, records, t_min);
+            break;
+        case BVHLayout::Wide8:
+            IntersectWideBatch(mNumaWideNodes8.Get(mWideNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), rays, records, t_min);
+            break;
+        case BVHLayout::Wide4Quantized:
+            IntersectWideBatch(mNumaQuantizedNodes4.Get(mQuantizedNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), rays, records, t_min);
+            break;
+        case BVHLayout::Wide8Quantized:
+            IntersectWideBatch(mNumaQuantizedNodes8.Get(mQuantizedNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), rays, records, t_min);
+            break;
+        default:
+            Shape::IntersectBatch(rays, records, t_min);
+            break;
+        }
+    }
+
+    template <typename WideNode>
+    void BVH::IntersectWideBatch(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        ScratchBuffer<WideRay<N>> wide_rays(rays.size());
+        std::copy(rays.begin(), rays.end(), wide_rays.begin());
+        ScratchBuffer<TriangleBlockHit> closest_hits(rays.size());
+        ScratchBuffer<uint8_t> is_hit;
+        is_hit.Resize(rays.size(), 0);
+
+        IntersectWideBVHBatch(
+            nodes, rays, wide_rays.Span(), t_min,
+            [&](uint32_t ray_idx)
+            { return records[ray_idx].__tMax__; },
+            [&](int block_idx, uint32_t block_count, std::span<const uint32_t> active)
+            {
+                // 三角形块在外层循环, 一个块读取一次即可与所有活跃光线求交
+                for (uint32_t i = 0; i < block_count; i++)
+                {
+                    const auto &block = blocks[block_idx + i];
+                    for (uint32_t ray_idx : active)
+                    {
+                        is_hit[ray_idx] |= IntersectTriangleBlock(block, wide_rays[ray_idx], t_min, records[ray_idx].__tMax__, closest_hits[ray_idx]);
+                    }
+                }
+                // end
+            });
+
+        auto primitive_indices = mNumaPrimitiveIndices.Get(mPrimitiveIndices.Span());
+        for (size_t ray_idx = 0; ray_idx < rays.size(); ray_idx++)
+        {
+            if (!is_hit[ray_idx])
+            {
+                continue;
+            }
+            const auto &hit = closest_hits[ray_idx];
+            records[ray_idx].__isHit__ = true;
+            records[ray_idx].__hit__ = {hit.__t__, hit.__u__, hit.__v__, primitive_indices[hit.__triangleIdx__], {}};
+        }
+    }
+
+    void BVH::OccludedBatch(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const
+    {
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            OccludedWideBatch(mNumaWideNodes4.Get(mWideNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), rays, occluded, t_min, t_max);
+            break;
+        case BVHLayout::Wide8:
+            OccludedWideBatch(mNumaWideNodes8.Get(mWideNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), rays, occluded, t_min, t_max);
+            break;
+        case BVHLayout::Wide4Quantized:
+            OccludedWideBatch(mNumaQuantizedNodes4.Get(mQuantizedNodes4.Span()), mNumaTriangleBlocks4.Get(mTriangleBlocks4.Span()), rays, occluded, t_min, t_max);
+            break;
+        case BVHLayout::Wide8Quantized:
+            OccludedWideBatch(mNumaQuantizedNodes8.Get(mQuantizedNodes8.Span()), mNumaTriangleBlocks8.Get(mTriangleBlocks8.Span()), rays, occluded, t_min, t_max);
+            break;
+        default:
+            Shape::OccludedBatch(rays, occluded, t_min, t_max);
+            break;
+        }
+    }
+
+    template <typename WideNode>
+    void BVH::OccludedWideBatch(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        ScratchBuffer<WideRay<N>> wide_rays(rays.size());
+        std::copy(rays.begin(), rays.end(), wide_rays.begin());
+
+        // 已被遮挡的光线上界置为-inf, 之后的节点测试全部失败, 自动从活跃列表中移除
+        IntersectWideBVHBatch(
+            nodes, rays, wide_rays.Span(), t_min,
+            [&](uint32_t ray_idx)
+            { return occluded[ray_idx] ? -std::numeric_limits<float>::infinity() : t_max; },
+            [&](int block_idx, uint32_t block_count, std::span<const uint32_t> active)
+            {
+                for (uint32_t i = 0; i < block_count; i++)
+                {
+                    const auto &block = blocks[block_idx + i];
+                    for (uint32_t ray_idx : active)
+                    {
+                        if (!occluded[ray_idx] && OccludedTriangleBlock(block, wide_rays[ray_idx], t_min, t_max))
+                        {
+                            occluded[ray_idx] = true;
+                        }
+                    }
+                }
+                // end
+            });
     }
 
     std::optional<ShapeInfo> BVH::SampleShape(const RNG &rng) const
     {
         auto sample_result = mTable.Sample(rng.Uniform());
-        const auto &triangle = mOrderedTriangles[sample_result.__idx__];
+        Triangle triangle(mMesh.GetLocalView().GetTriangle(sample_result.__idx__));
         auto triangle_sample = triangle.SampleShape(rng);
         if (!triangle_sample.has_value())
         {
@@ -151,6 +707,718 @@ namespace pbrt
         };
     }
 
+    void BVH::Refit(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals)
+    {
+        size_t node_count = GetNodeCount();
+        if (node_count != 0 && !mRefitState.IsValid(node_count))
+        {
+            // 首次Refit时以变形前的树作为质量基准
+            UpdateRefitState();
+            RefitNodes(mRefitState.__baselineCosts__);
+        }
+        if (!mMesh.SetVertices(positions, normals))
+        {
+            return;
+        }
+        if (node_count == 0)
+        {
+            UpdateSampleTable();
+            return;
+        }
+
+        std::vector<float> node_costs;
+        RefitNodes(node_costs);
+        float root_baseline_cost = mRefitState.__baselineCosts__[0];
+        float root_cost = node_costs[0];
+
+        auto roots = FindDegradedSubtrees(node_costs);
+        size_t rebuild_count = 0;
+        if (!roots.empty())
+        {
+            rebuild_count = RebuildSubtrees(roots);
+            UpdateRefitState();
+            RefitNodes(node_costs);
+            // 局部重建后根节点仍然退化, 说明上层划分已不适合当前形状, 整体重建
+            if (roots[0] != 0 && node_costs[0] > root_baseline_cost * mSettings.__refitRebuildThreshold__)
+            {
+                rebuild_count += RebuildSubtrees({0});
+                UpdateRefitState();
+                RefitNodes(node_costs);
+            }
+            mRefitState.__baselineCosts__ = node_costs;
+        }
+        UpdateSampleTable();
+        UpdateNumaReplicas();
+
+        PBRT_DEBUG("BVH - Refit SAH Cost Ratio: {:.3f}, Rebuilt Subtrees: {}, Final Ratio: {:.3f}", root_baseline_cost > 0.f ? root_cost / root_baseline_cost : 1.f, rebuild_count,
+                   root_baseline_cost > 0.f ? node_costs[0] / root_baseline_cost : 1.f);
+    }
+
+    size_t BVH::GetNodeCount() const
+    {
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            return mWideNodes4.size();
+        case BVHLayout::Wide8:
+            return mWideNodes8.size();
+        case BVHLayout::Wide4Quantized:
+            return mQuantizedNodes4.size();
+        case BVHLayout::Wide8Quantized:
+            return mQuantizedNodes8.size();
+        default:
+            return mNodes.size();
+        }
+    }
+
+    BVHQualityReport BVH::GetQualityReport() const
+    {
+        BVHQualityReport report{};
+        report.__nodeCount__ = GetNodeCount();
+        report.__memorySize__ = mNodes.size() * sizeof(BVHNode) + mWideNodes4.size() * sizeof(WideBVHNode<4>) + mWideNodes8.size() * sizeof(WideBVHNode<8>) +
+                                mQuantizedNodes4.size() * sizeof(QuantizedWideBVHNode<4>) + mQuantizedNodes8.size() * sizeof(QuantizedWideBVHNode<8>) +
+                                mTriangleBlocks4.size() * sizeof(TriangleBlock<4>) + mTriangleBlocks8.size() * sizeof(TriangleBlock<8>) + mPrimitiveIndices.size() * sizeof(uint32_t);
+        float root_area = GetSAHArea(mBounds);
+        if (report.__nodeCount__ == 0 || root_area <= 0.f)
+        {
+            return report;
+        }
+
+        float cost = 0.f;
+        auto add_leaf = [&](size_t triangle_count, size_t depth, const Bounds &bounds)
+        {
+            report.__leafCount__++;
+            report.__maxDepth__ = glm::max(report.__maxDepth__, depth);
+            if (report.__leafSizeHistogram__.size() <= triangle_count)
+            {
+                report.__leafSizeHistogram__.resize(triangle_count + 1, 0);
+            }
+            if (report.__depthHistogram__.size() <= depth)
+            {
+                report.__depthHistogram__.resize(depth + 1, 0);
+            }
+            report.__leafSizeHistogram__[triangle_count]++;
+            report.__depthHistogram__[depth]++;
+            cost += mSettings.__intersectionCost__ * triangle_count * GetSAHArea(bounds);
+        };
+
+        // (节点索引, 深度, 节点包围盒), 宽节点不保存自身包围盒, 由父节点的子节点包围盒传入
+        std::vector<std::tuple<uint32_t, size_t, Bounds>> stack{{0, 1, mBounds}};
+        auto visit_wide = [&](const auto &nodes, const auto &blocks)
+        {
+            while (!stack.empty())
+            {
+                auto [node_idx, depth, bounds] = stack.back();
+                stack.pop_back();
+                cost += mSettings.__traversalCost__ * GetSAHArea(bounds);
+                const auto &node = nodes[node_idx];
+                for (size_t i = 0; i < std::remove_cvref_t<decltype(node)>::WIDTH; i++)
+                {
+                    if (node.IsEmpty(i))
+                    {
+                        continue;
+                    }
+                    if (node.IsLeaf(i))
+                    {
+                        // 叶子的__counts__为块数量, 三角形数按块内有效槽位累加
+                        size_t triangle_count = 0;
+                        for (size_t block_idx = node.__children__[i]; block_idx < node.__children__[i] + node.__counts__[i]; block_idx++)
+                        {
+                            triangle_count += blocks[block_idx].__triangleCount__;
+                        }
+                        add_leaf(triangle_count, depth, node.GetChildBounds(i));
+                    }
+                    else
+                    {
+                        stack.push_back({static_cast<uint32_t>(node.__children__[i]), depth + 1, node.GetChildBounds(i)});
+                    }
+                }
+            }
+        };
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            visit_wide(mWideNodes4, mTriangleBlocks4);
+            break;
+        case BVHLayout::Wide8:
+            visit_wide(mWideNodes8, mTriangleBlocks8);
+            break;
+        case BVHLayout::Wide4Quantized:
+            visit_wide(mQuantizedNodes4, mTriangleBlocks4);
+            break;
+        case BVHLayout::Wide8Quantized:
+            visit_wide(mQuantizedNodes8, mTriangleBlocks8);
+            break;
+        default:
+            while (!stack.empty())
+            {
+                auto [node_idx, depth, bounds] = stack.back();
+                stack.pop_back();
+                const auto &node = mNodes[node_idx];
+                if (node.__triangleCount__ != 0)
+                {
+                    add_leaf(node.__triangleCount__, depth, node.__bounds__);
+                    continue;
+                }
+                cost += mSettings.__traversalCost__ * GetSAHArea(node.__bounds__);
+                stack.push_back({node_idx + 1, depth + 1, Bounds{}});
+                stack.push_back({static_cast<uint32_t>(node.__right__), depth + 1, Bounds{}});
+            }
+            break;
+        }
+        report.__sahCost__ = cost / root_area;
+        return report;
+    }
+
+    template <typename Func>
+    void BVH::ForEachInteriorChild(size_t node_idx, Func &&func) const
+    {
+        auto visit_wide = [&](const auto &node)
+        {
+            for (size_t i = 0; i < std::remove_cvref_t<decltype(node)>::WIDTH; i++)
+            {
+                if (!node.IsEmpty(i) && !node.IsLeaf(i))
+                {
+                    func(static_cast<uint32_t>(node.__children__[i]));
+                }
+            }
+        };
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            visit_wide(mWideNodes4[node_idx]);
+            break;
+        case BVHLayout::Wide8:
+            visit_wide(mWideNodes8[node_idx]);
+            break;
+        case BVHLayout::Wide4Quantized:
+            visit_wide(mQuantizedNodes4[node_idx]);
+            break;
+        case BVHLayout::Wide8Quantized:
+            visit_wide(mQuantizedNodes8[node_idx]);
+            break;
+        default:
+            if (mNodes[node_idx].__triangleCount__ == 0)
+            {
+                func(static_cast<uint32_t>(node_idx + 1));
+                func(static_cast<uint32_t>(mNodes[node_idx].__right__));
+            }
+            break;
+        }
+    }
+
+    template <typename Func>
+    void BVH::ForEachLevelBottomUp(Func &&func) const
+    {
+        const auto &order = mRefitState.__order__;
+        const auto &level_offsets = mRefitState.__levelOffsets__;
+        for (size_t level = level_offsets.size() - 1; level > 0; level--)
+        {
+            size_t begin = level_offsets[level - 1], end = level_offsets[level];
+            internal::ParallelChunks(begin, end, internal::GetChunkCount(end - begin), [&](size_t, size_t chunk_begin, size_t chunk_end)
+                                     {
+                                         for (size_t i = chunk_begin; i < chunk_end; i++)
+                                         {
+                                             func(order[i]);
+                                         }
+                                         // end
+                                     });
+        }
+    }
+
+    void BVH::UpdateRefitState()
+    {
+        // 深度优先与treelet排列中父节点总在子节点之前, 顺序遍历即可传递深度
+        size_t node_count = GetNodeCount();
+        auto &depths = mRefitState.__depths__;
+        depths.assign(node_count, 1);
+        uint32_t max_depth = 1;
+        for (size_t i = 0; i < node_count; i++)
+        {
+            max_depth = glm::max(max_depth, depths[i]);
+            ForEachInteriorChild(i, [&](uint32_t child) { depths[child] = depths[i] + 1; });
+        }
+
+        // 按深度计数排序, 同一层的节点互不依赖, 可以并行重拟合
+        auto &level_offsets = mRefitState.__levelOffsets__;
+        level_offsets.assign(max_depth + 1, 0);
+        for (uint32_t depth : depths)
+        {
+            level_offsets[depth]++;
+        }
+        for (size_t level = 1; level <= max_depth; level++)
+        {
+            level_offsets[level] += level_offsets[level - 1];
+        }
+        auto &order = mRefitState.__order__;
+        order.resize(node_count);
+        std::vector<size_t> cursors(level_offsets.begin(), level_offsets.end() - 1);
+        for (size_t i = 0; i < node_count; i++)
+        {
+            order[cursors[depths[i] - 1]++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    void BVH::RefitNodes(std::vector<float> &node_costs)
+    {
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            RefitWide(mWideNodes4, mTriangleBlocks4, node_costs);
+            break;
+        case BVHLayout::Wide8:
+            RefitWide(mWideNodes8, mTriangleBlocks8, node_costs);
+            break;
+        case BVHLayout::Wide4Quantized:
+            RefitWide(mQuantizedNodes4, mTriangleBlocks4, node_costs);
+            break;
+        case BVHLayout::Wide8Quantized:
+            RefitWide(mQuantizedNodes8, mTriangleBlocks8, node_costs);
+            break;
+        default:
+            RefitBinary(node_costs);
+            break;
+        }
+    }
+
+    void BVH::RefitBinary(std::vector<float> &node_costs)
+    {
+        auto &nodes = mNodes.Own();
+        std::vector<float> costs(nodes.size());
+        node_costs.resize(nodes.size());
+        ForEachLevelBottomUp([&](uint32_t node_idx)
+                             {
+                                 auto &node = nodes[node_idx];
+                                 if (node.__triangleCount__ != 0)
+                                 {
+                                     Bounds bounds{};
+                                     for (size_t i = 0; i < node.__triangleCount__; i++)
+                                     {
+                                         bounds.Expand(mMesh.GetTriangleBounds(mPrimitiveIndices[node.__triangleIdx__ + i]));
+                                     }
+                                     node.__bounds__ = bounds;
+                                     costs[node_idx] = mSettings.__intersectionCost__ * node.__triangleCount__ * GetSAHArea(bounds);
+                                 }
+                                 else
+                                 {
+                                     node.__bounds__ = nodes[node_idx + 1].__bounds__;
+                                     node.__bounds__.Expand(nodes[node.__right__].__bounds__);
+                                     costs[node_idx] = mSettings.__traversalCost__ * GetSAHArea(node.__bounds__) + costs[node_idx + 1] + costs[node.__right__];
+                                 }
+                                 node_costs[node_idx] = GetNormalizedCost(costs[node_idx], node.__bounds__);
+                                 // end
+                             });
+        mBounds = nodes[0].__bounds__;
+    }
+
+    template <typename WideNode>
+    void BVH::RefitWide(MappedArray<WideNode> &nodes_array, MappedArray<TriangleBlock<WideNode::WIDTH>> &blocks_array, std::vector<float> &node_costs)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        auto &nodes = nodes_array.Own();
+        auto &blocks = blocks_array.Own();
+
+        // 先并行更新三角形块的顶点与边, 同时得到每个块的包围盒
+        std::vector<Bounds> block_bounds(blocks.size());
+        internal::ParallelChunks(0, blocks.size(), internal::GetChunkCount(blocks.size()), [&](size_t, size_t begin, size_t end)
+                                 {
+                                     for (size_t block_idx = begin; block_idx < end; block_idx++)
+                                     {
+                                         auto &block = blocks[block_idx];
+                                         Bounds bounds{};
+                                         for (size_t lane = 0; lane < block.__triangleCount__; lane++)
+                                         {
+                                             uint32_t triangle_idx = mPrimitiveIndices[block.__triangleIdx__ + lane];
+                                             block.SetTriangle(lane, {mMesh.GetPosition(triangle_idx, 0), mMesh.GetPosition(triangle_idx, 1), mMesh.GetPosition(triangle_idx, 2)});
+                                             bounds.Expand(mMesh.GetTriangleBounds(triangle_idx));
+                                         }
+                                         block_bounds[block_idx] = bounds;
+                                     }
+                                     // end
+                                 });
+
+        // 再逐层更新节点, 子节点的包围盒与代价在上一层已经就绪; 量化节点按新的包围盒重新量化
+        std::vector<Bounds> node_bounds(nodes.size());
+        std::vector<float> costs(nodes.size());
+        node_costs.resize(nodes.size());
+        ForEachLevelBottomUp([&](uint32_t node_idx)
+                             {
+                                 const auto &node = nodes[node_idx];
+                                 WideBVHNode<N> refit_node{};
+                                 Bounds bounds{};
+                                 float cost = 0.f;
+                                 for (size_t i = 0; i < N; i++)
+                                 {
+                                     if (node.IsEmpty(i))
+                                     {
+                                         continue;
+                                     }
+                                     Bounds child_bounds{};
+                                     if (node.IsLeaf(i))
+                                     {
+                                         size_t triangle_count = 0;
+                                         for (size_t block_idx = node.__children__[i]; block_idx < node.__children__[i] + node.__counts__[i]; block_idx++)
+                                         {
+                                             child_bounds.Expand(block_bounds[block_idx]);
+                                             triangle_count += blocks[block_idx].__triangleCount__;
+                                         }
+                                         cost += mSettings.__intersectionCost__ * triangle_count * GetSAHArea(child_bounds);
+                                     }
+                                     else
+                                     {
+                                         child_bounds = node_bounds[node.__children__[i]];
+                                         cost += costs[node.__children__[i]];
+                                     }
+                                     refit_node.SetChild(i, child_bounds, node.__children__[i], node.__counts__[i]);
+                                     bounds.Expand(child_bounds);
+                                 }
+                                 node_bounds[node_idx] = bounds;
+                                 costs[node_idx] = mSettings.__traversalCost__ * GetSAHArea(bounds) + cost;
+                                 node_costs[node_idx] = GetNormalizedCost(costs[node_idx], bounds);
+                                 if constexpr (std::is_same_v<WideNode, WideBVHNode<N>>)
+                                 {
+                                     nodes[node_idx] = refit_node;
+                                 }
+                                 else
+                                 {
+                                     nodes[node_idx] = WideNode(refit_node);
+                                 }
+                                 // end
+                             });
+        mBounds = node_bounds[0];
+    }
+
+    /*
+        从根节点向下查找退化(归一化代价超过基准的__refitRebuildThreshold__倍)的子树
+        退化节点的内部子节点都正常时, 退化来自该节点自身的划分, 重建以它为根的子树; 否则继续向下查找
+    */
+    std::vector<uint32_t> BVH::FindDegradedSubtrees(const std::vector<float> &node_costs) const
+    {
+        const auto &baseline_costs = mRefitState.__baselineCosts__;
+        auto is_degraded = [&](uint32_t node_idx) { return node_costs[node_idx] > baseline_costs[node_idx] * mSettings.__refitRebuildThreshold__; };
+
+        std::vector<uint32_t> roots;
+        std::vector<uint32_t> stack{0};
+        while (!stack.empty())
+        {
+            uint32_t node_idx = stack.back();
+            stack.pop_back();
+            bool has_degraded_child = false;
+            ForEachInteriorChild(node_idx, [&](uint32_t child) { has_degraded_child |= is_degraded(child); });
+            if (is_degraded(node_idx) && !has_degraded_child)
+            {
+                roots.push_back(node_idx);
+                continue;
+            }
+            ForEachInteriorChild(node_idx, [&](uint32_t child) { stack.push_back(child); });
+        }
+        std::sort(roots.begin(), roots.end());
+        return roots;
+    }
+
+    BVHBuildResult BVH::RebuildReferences(std::vector<uint32_t> &primitive_indices, size_t begin, size_t end) const
+    {
+        std::vector<Bounds> reference_bounds(end - begin);
+        for (size_t i = begin; i < end; i++)
+        {
+            reference_bounds[i - begin] = mMesh.GetTriangleBounds(primitive_indices[i]);
+        }
+        auto result = BinnedSAHBuilder(mSettings).Build(reference_bounds);
+
+        // 构建结果的图元索引是区间内的局部位置, 按其重排引用, 叶子改为引用区间内的全局位置
+        std::vector<uint32_t> references(primitive_indices.begin() + begin, primitive_indices.begin() + end);
+        for (size_t i = 0; i < references.size(); i++)
+        {
+            primitive_indices[begin + i] = references[result.__primitiveIndices__[i]];
+        }
+        for (auto &node : result.__nodes__)
+        {
+            if (node.__triangleCount__ != 0)
+            {
+                node.__triangleIdx__ += static_cast<int>(begin);
+            }
+        }
+        return result;
+    }
+
+    size_t BVH::RebuildSubtrees(const std::vector<uint32_t> &roots)
+    {
+        // 局部重建按连续区间替换子树, 先恢复深度优先排列, 重建后再按设置重排
+        if (mSettings.__nodeOrder__ != BVHNodeOrder::DepthFirst)
+        {
+            auto new_indices = ReorderNodes(BVHNodeOrder::DepthFirst);
+            std::vector<uint32_t> depth_first_roots;
+            for (uint32_t root : roots)
+            {
+                depth_first_roots.push_back(new_indices[root]);
+            }
+            std::sort(depth_first_roots.begin(), depth_first_roots.end());
+            UpdateRefitState();
+            size_t rebuild_count = RebuildDepthFirstSubtrees(depth_first_roots);
+            ReorderNodes(mSettings.__nodeOrder__);
+            return rebuild_count;
+        }
+        return RebuildDepthFirstSubtrees(roots);
+    }
+
+    std::vector<uint32_t> BVH::ReorderNodes(BVHNodeOrder order)
+    {
+        auto leaf_range = [](const BVHNode &node)
+        {
+            return std::pair<size_t, size_t>(node.__triangleCount__ == 0 ? 0 : node.__triangleIdx__, node.__triangleCount__);
+        };
+        // 重排会替换整个数组, 取出自有数组重排后重新Assign
+        auto reorder_wide = [&](auto &nodes_array, auto &blocks_array)
+        {
+            auto nodes = std::move(nodes_array.Own());
+            auto blocks = std::move(blocks_array.Own());
+            auto new_indices = ReorderWideBVH(nodes, order);
+            ReorderTriangleBlocks(nodes, blocks);
+            nodes_array.Assign(std::move(nodes));
+            blocks_array.Assign(std::move(blocks));
+            return new_indices;
+        };
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            return reorder_wide(mWideNodes4, mTriangleBlocks4);
+        case BVHLayout::Wide8:
+            return reorder_wide(mWideNodes8, mTriangleBlocks8);
+        case BVHLayout::Wide4Quantized:
+            return reorder_wide(mQuantizedNodes4, mTriangleBlocks4);
+        case BVHLayout::Wide8Quantized:
+            return reorder_wide(mQuantizedNodes8, mTriangleBlocks8);
+        default:
+        {
+            auto nodes = std::move(mNodes.Own());
+            auto new_indices = ReorderBinaryBVH(nodes, order, leaf_range);
+            mNodes.Assign(std::move(nodes));
+            return new_indices;
+        }
+        }
+    }
+
+    size_t BVH::RebuildDepthFirstSubtrees(const std::vector<uint32_t> &roots)
+    {
+        // 子树在深度优先排列中占据连续区间[root, subtree_ends[root]), 逆序遍历得到区间终点
+        size_t node_count = GetNodeCount();
+        std::vector<uint32_t> subtree_ends(node_count);
+        for (size_t i = node_count; i-- > 0;)
+        {
+            subtree_ends[i] = static_cast<uint32_t>(i + 1);
+            ForEachInteriorChild(i, [&](uint32_t child) { subtree_ends[i] = glm::max(subtree_ends[i], subtree_ends[child]); });
+        }
+
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            return RebuildWideSubtrees(mWideNodes4, mTriangleBlocks4, roots, subtree_ends);
+        case BVHLayout::Wide8:
+            return RebuildWideSubtrees(mWideNodes8, mTriangleBlocks8, roots, subtree_ends);
+        case BVHLayout::Wide4Quantized:
+            return RebuildWideSubtrees(mQuantizedNodes4, mTriangleBlocks4, roots, subtree_ends);
+        case BVHLayout::Wide8Quantized:
+            return RebuildWideSubtrees(mQuantizedNodes8, mTriangleBlocks8, roots, subtree_ends);
+        default:
+            return RebuildBinarySubtrees(roots, subtree_ends);
+        }
+    }
+
+    size_t BVH::RebuildBinarySubtrees(const std::vector<uint32_t> &roots, const std::vector<uint32_t> &subtree_ends)
+    {
+        auto &primitive_indices = mPrimitiveIndices.Own();
+        std::vector<uint32_t> rebuilt_roots;
+        std::vector<std::vector<BVHNode>> rebuilt_nodes;
+        for (uint32_t root : roots)
+        {
+            // 子树叶子引用的图元在有序数组中连续
+            size_t begin = primitive_indices.size(), end = 0;
+            for (size_t i = root; i < subtree_ends[root]; i++)
+            {
+                if (mNodes[i].__triangleCount__ != 0)
+                {
+                    begin = glm::min<size_t>(begin, mNodes[i].__triangleIdx__);
+                    end = glm::max<size_t>(end, mNodes[i].__triangleIdx__ + mNodes[i].__triangleCount__);
+                }
+            }
+            rebuilt_roots.push_back(root);
+            rebuilt_nodes.push_back(RebuildReferences(primitive_indices, begin, end).__nodes__);
+        }
+        if (rebuilt_roots.empty())
+        {
+            return 0;
+        }
+
+        // 用重建的子树替换原区间, 区间之后的节点索引整体平移
+        std::vector<size_t> ends;
+        std::vector<ptrdiff_t> offsets;
+        ptrdiff_t offset = 0;
+        for (size_t k = 0; k < rebuilt_roots.size(); k++)
+        {
+            offset += static_cast<ptrdiff_t>(rebuilt_nodes[k].size()) - static_cast<ptrdiff_t>(subtree_ends[rebuilt_roots[k]] - rebuilt_roots[k]);
+            ends.push_back(subtree_ends[rebuilt_roots[k]]);
+            offsets.push_back(offset);
+        }
+        std::vector<BVHNode> nodes;
+        nodes.reserve(mNodes.size() + offset);
+        for (size_t i = 0, k = 0; i < mNodes.size();)
+        {
+            if (k < rebuilt_roots.size() && i == rebuilt_roots[k])
+            {
+                int base = static_cast<int>(nodes.size());
+                for (auto node : rebuilt_nodes[k])
+                {
+                    if (node.__triangleCount__ == 0)
+                    {
+                        node.__right__ += base;
+                    }
+                    nodes.push_back(node);
+                }
+                i = subtree_ends[i];
+                k++;
+                continue;
+            }
+            auto node = mNodes[i];
+            if (node.__triangleCount__ == 0)
+            {
+                node.__right__ = static_cast<int>(RemapIndex(ends, offsets, node.__right__));
+            }
+            nodes.push_back(node);
+            i++;
+        }
+        mNodes.Assign(std::move(nodes));
+        return rebuilt_roots.size();
+    }
+
+    template <typename WideNode>
+    size_t BVH::RebuildWideSubtrees(MappedArray<WideNode> &nodes_array, MappedArray<TriangleBlock<WideNode::WIDTH>> &blocks_array, const std::vector<uint32_t> &roots, const std::vector<uint32_t> &subtree_ends)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        struct RebuiltSubtree
+        {
+        public:
+            uint32_t __root__;
+            size_t __blockBegin__, __blockEnd__; // 子树叶子的三角形块在块数组中连续
+            std::vector<WideBVHNode<N>> __nodes__;
+            std::vector<TriangleBlock<N>> __blocks__;
+        };
+
+        auto nodes = nodes_array.Span();
+        auto blocks = blocks_array.Span();
+        auto &primitive_indices = mPrimitiveIndices.Own();
+        auto leaf_range = [](const BVHNode &node)
+        {
+            return std::pair<size_t, size_t>(node.__triangleCount__ == 0 ? 0 : node.__triangleIdx__, node.__triangleCount__);
+        };
+
+        std::vector<RebuiltSubtree> subtrees;
+        for (uint32_t root : roots)
+        {
+            // 子树的块区间连续, 引用区间也连续, 但槽位顺序与引用顺序不一定一致, 需分别求最小最大值
+            size_t block_begin = blocks.size(), block_end = 0;
+            size_t begin = primitive_indices.size(), end = 0;
+            for (size_t i = root; i < subtree_ends[root]; i++)
+            {
+                for (size_t slot = 0; slot < N; slot++)
+                {
+                    if (nodes[i].IsEmpty(slot) || !nodes[i].IsLeaf(slot))
+                    {
+                        continue;
+                    }
+                    size_t first_block = nodes[i].__children__[slot];
+                    size_t last_block = first_block + nodes[i].__counts__[slot] - 1;
+                    block_begin = glm::min(block_begin, first_block);
+                    block_end = glm::max(block_end, last_block + 1);
+                    begin = glm::min<size_t>(begin, blocks[first_block].__triangleIdx__);
+                    end = glm::max<size_t>(end, blocks[last_block].__triangleIdx__ + blocks[last_block].__triangleCount__);
+                }
+            }
+            auto result = RebuildReferences(primitive_indices, begin, end);
+            auto &subtree = subtrees.emplace_back(RebuiltSubtree{root, block_begin, block_end});
+            CollapseBVH(result.__nodes__, subtree.__nodes__, leaf_range, N);
+            BuildTriangleBlocks(subtree.__nodes__, mMesh, std::span<const uint32_t>(primitive_indices), subtree.__blocks__);
+        }
+        if (subtrees.empty())
+        {
+            return 0;
+        }
+
+        // 用重建的子树替换原区间, 区间之后的节点与块索引整体平移
+        std::vector<size_t> node_ends, block_ends;
+        std::vector<ptrdiff_t> node_offsets, block_offsets;
+        ptrdiff_t node_offset = 0, block_offset = 0;
+        for (const auto &subtree : subtrees)
+        {
+            node_offset += static_cast<ptrdiff_t>(subtree.__nodes__.size()) - static_cast<ptrdiff_t>(subtree_ends[subtree.__root__] - subtree.__root__);
+            block_offset += static_cast<ptrdiff_t>(subtree.__blocks__.size()) - static_cast<ptrdiff_t>(subtree.__blockEnd__ - subtree.__blockBegin__);
+            node_ends.push_back(subtree_ends[subtree.__root__]);
+            block_ends.push_back(subtree.__blockEnd__);
+            node_offsets.push_back(node_offset);
+            block_offsets.push_back(block_offset);
+        }
+
+        std::vector<WideNode> new_nodes;
+        new_nodes.reserve(nodes.size() + node_offset);
+        for (size_t i = 0, k = 0; i < nodes.size();)
+        {
+            if (k < subtrees.size() && i == subtrees[k].__root__)
+            {
+                int node_base = static_cast<int>(new_nodes.size());
+                int block_base = static_cast<int>(RemapIndex(block_ends, block_offsets, subtrees[k].__blockBegin__));
+                for (auto node : subtrees[k].__nodes__)
+                {
+                    for (size_t slot = 0; slot < N; slot++)
+                    {
+                        if (!node.IsEmpty(slot))
+                        {
+                            node.__children__[slot] += node.IsLeaf(slot) ? block_base : node_base;
+                        }
+                    }
+                    if constexpr (std::is_same_v<WideNode, WideBVHNode<N>>)
+                    {
+                        new_nodes.push_back(node);
+                    }
+                    else
+                    {
+                        new_nodes.emplace_back(node);
+                    }
+                }
+                i = subtree_ends[i];
+                k++;
+                continue;
+            }
+            auto node = nodes[i];
+            for (size_t slot = 0; slot < N; slot++)
+            {
+                if (!node.IsEmpty(slot))
+                {
+                    node.__children__[slot] = static_cast<int>(node.IsLeaf(slot) ? RemapIndex(block_ends, block_offsets, node.__children__[slot]) : RemapIndex(node_ends, node_offsets, node.__children__[slot]));
+                }
+            }
+            new_nodes.push_back(node);
+            i++;
+        }
+
+        std::vector<TriangleBlock<N>> new_blocks;
+        new_blocks.reserve(blocks.size() + block_offset);
+        for (size_t i = 0, k = 0; i < blocks.size();)
+        {
+            if (k < subtrees.size() && i == subtrees[k].__blockBegin__)
+            {
+                new_blocks.insert(new_blocks.end(), subtrees[k].__blocks__.begin(), subtrees[k].__blocks__.end());
+                i = subtrees[k].__blockEnd__;
+                k++;
+                continue;
+            }
+            new_blocks.push_back(blocks[i]);
+            i++;
+        }
+
+        nodes_array.Assign(std::move(new_nodes));
+        blocks_array.Assign(std::move(new_blocks));
+        return subtrees.size();
+    }
+
     /* BVH Build optimization versions:
     void BVH::RecursiveSplitByAxis(BVHTreeNode *node, BVHState &state) // 以最长轴分割节点, 划分不平均, 叶节点三角形数量会很多
     {
@@ -412,195 +1680,4 @@ namespace pbrt
         RecursiveSplitBySAHB(right, state);
     }
     */
-
-    void BVH::RecursiveSplit(BVHTreeNode *node, BVHState &state)
-    {
-        state.__totalNodeCount__++;
-        if ((node->__end__ - node->__start__ == 1) || (node->__depth__ > 32))
-        {
-            // 叶字节点或深度超过32层, 直接添加为叶子节点
-            state.AddLeafNode(node);
-            return;
-        }
-
-        auto diagonal = node->__bounds__.GetDiagonal();
-        float min_cost = std::numeric_limits<float>::infinity();
-        size_t min_split_idx = 0;
-        Bounds min_left_bounds{}, min_right_bounds{};
-        constexpr size_t bucket_count = 12;     // 桶的数量
-        for (size_t axis = 0; axis < 3; axis++) // 遍历3个轴(X, Y, Z)
-        {
-            Bounds bucket_bounds[bucket_count] = {};         // 桶的包围盒
-            size_t bucket_triangle_count[bucket_count] = {}; // 桶内三角形数量
-            // 遍历节点内三角形, 并根据三角形中心点位置将其分配到不同的桶中
-            for (size_t triangle_idx = node->__start__; triangle_idx < node->__end__; triangle_idx++)
-            {
-                Triangle triangle = mOrderedTriangles[triangle_idx];
-                float triangle_center = (triangle.__p0__[axis] + triangle.__p1__[axis] + triangle.__p2__[axis]) / 3.f; // 三角形中心点位置
-                // 根据三角形中心点位置确定其所属的桶索引, 并将三角形分配到该桶中
-                size_t bucket_idx = glm::clamp<size_t>(glm::floor((triangle_center - node->__bounds__.__bMin__[axis]) * bucket_count / diagonal[axis]), 0, bucket_count - 1);
-                bucket_bounds[bucket_idx].Expand(triangle.__p0__);
-                bucket_bounds[bucket_idx].Expand(triangle.__p1__);
-                bucket_bounds[bucket_idx].Expand(triangle.__p2__);
-                bucket_triangle_count[bucket_idx]++;
-            }
-
-            // 初始以第一个桶为左子节点, 其他桶为右子节点
-            Bounds left_bounds = bucket_bounds[0];
-            size_t left_triangle_count = bucket_triangle_count[0];
-            for (size_t i = 1; i <= bucket_count - 1; i++)
-            {
-                Bounds right_bounds{};
-                size_t right_triangle_count = 0;
-                for (size_t j = bucket_count - 1; j >= i; j--) // 从后往前遍历桶, 更新右子节点的包围盒
-                {
-                    right_bounds.Expand(bucket_bounds[j]);
-                    right_triangle_count += bucket_triangle_count[j];
-                }
-
-                // 右子节点为空, 则当前划分轴不合适
-                if (right_triangle_count == 0)
-                {
-                    break;
-                }
-
-                if (left_triangle_count != 0)
-                {
-                    // 计算当前划分的成本
-                    // cost = traversal_cost + Prob_left * Σ(T_left_triangles) + Prob_right * Σ(T_right_triangles)
-                    // Prob_left与Prob_right与包围盒表面积成正比, 这里近似认为traversal_cost是常数项
-                    // T_left_triangles与T_right_triangles为遍历包围盒内几何体相交测试的时间开销
-                    float cost = left_bounds.GetSurfaceArea() * left_triangle_count + right_bounds.GetSurfaceArea() * right_triangle_count;
-                    if (cost < min_cost)
-                    {
-                        min_cost = cost;
-                        node->__splitAxis__ = axis; // 记录最优划分轴
-                        min_split_idx = i;          // 记录最优划分索引
-                        // 记录最优划分位置的左右子节点包围盒
-                        min_left_bounds = left_bounds;
-                        min_right_bounds = right_bounds;
-                    }
-                }
-
-                // 拓展左子节点以计算下一个划分位置成本
-                left_bounds.Expand(bucket_bounds[i]);
-                left_triangle_count += bucket_triangle_count[i];
-            }
-        }
-
-        // 没有找到好的分割轴
-        if (min_split_idx == 0)
-        {
-            state.AddLeafNode(node);
-            return;
-        }
-
-        // 申请左右子节点内存
-        auto *left = mNodeAllocator.Allocate();
-        auto *right = mNodeAllocator.Allocate();
-        node->__children__[0] = left;
-        node->__children__[1] = right;
-
-        // 对当前节点内三角形进行排序并分配到左右子节点(只记录三角形索引, 避免频繁申请内存)
-        size_t head_ptr = node->__start__;
-        size_t tail_ptr = node->__end__ - 1;
-        while (head_ptr <= tail_ptr)
-        {
-            // 确认头指针指向的三角形是否属于左子节点
-            Triangle triangle_head = mOrderedTriangles[head_ptr];
-            auto triangle_head_center = (triangle_head.__p0__[node->__splitAxis__] + triangle_head.__p1__[node->__splitAxis__] + triangle_head.__p2__[node->__splitAxis__]) / 3.f;
-            size_t head_bucket_idx = glm::clamp<size_t>(glm::floor((triangle_head_center - node->__bounds__.__bMin__[node->__splitAxis__]) * bucket_count / diagonal[node->__splitAxis__]), 0, bucket_count - 1);
-            bool head_is_left = head_bucket_idx < min_split_idx;
-
-            // 确认尾指针指向的三角形是否属于左子节点
-            Triangle triangle_tail = mOrderedTriangles[tail_ptr];
-            auto triangle_tail_center = (triangle_tail.__p0__[node->__splitAxis__] + triangle_tail.__p1__[node->__splitAxis__] + triangle_tail.__p2__[node->__splitAxis__]) / 3.f;
-            size_t tail_bucket_idx = glm::clamp<size_t>(glm::floor((triangle_tail_center - node->__bounds__.__bMin__[node->__splitAxis__]) * bucket_count / diagonal[node->__splitAxis__]), 0, bucket_count - 1);
-            bool tail_is_left = tail_bucket_idx < min_split_idx;
-
-            if (head_is_left && tail_is_left) // 都在左边
-            {
-                head_ptr++;
-            }
-            else if ((!head_is_left) && (!tail_is_left)) // 都在右边
-            {
-                tail_ptr--;
-            }
-            else if ((!head_is_left) && tail_is_left) // 头在右边, 尾在左边
-            {
-                std::swap(mOrderedTriangles[head_ptr], mOrderedTriangles[tail_ptr]);
-                tail_ptr--;
-                head_ptr++;
-            }
-            else // 头在左边, 尾在右边
-            {
-                tail_ptr--;
-                head_ptr++;
-            }
-        }
-        // 完成后head_ptr为右子节点的起始索引
-        left->__start__ = node->__start__;
-        left->__end__ = head_ptr;
-        right->__start__ = left->__end__;
-        right->__end__ = node->__end__;
-        node->__end__ = node->__start__; // 表明当前节点不再包含三角形, 为非叶子节点
-
-        // 更新左右子节点的深度与包围盒
-        left->__depth__ = node->__depth__ + 1;
-        right->__depth__ = node->__depth__ + 1;
-        left->__bounds__ = min_left_bounds;
-        right->__bounds__ = min_right_bounds;
-
-        // 大规模三角形划分时并行递归构建子节点
-        if ((right->__end__ - left->__start__) > (128 * 1024))
-        {
-            MasterThreadPool.ParallelFor(2, 1, [&, left, right](size_t i, size_t)
-                                         {
-                                             if (i == 0)
-                                             {
-                                                 RecursiveSplit(left, state);
-                                             }
-                                             else
-                                             {
-                                                 RecursiveSplit(right, state);
-                                             }
-                                             // end
-                                         });
-        }
-        else
-        {
-            RecursiveSplit(left, state);
-            RecursiveSplit(right, state);
-        }
-    }
-
-    /*
-        深度优先-递归地将BVH二叉树节点flatten到一个线性数组中
-        对于一个非叶子节点的下一个节点一定是它的左子节点, 然后存储右子节点索引即可
-        可以提升相交检测时遍历BVH结构的缓存命中率
-    */
-    size_t BVH::RecursiveFlatten(BVHTreeNode *node)
-    {
-        BVHNode bvh_node{
-            node->__bounds__,
-            0,
-            static_cast<uint16_t>(node->__end__ - node->__start__),
-            static_cast<uint8_t>(node->__splitAxis__)
-            // end
-        };
-
-        auto idx = mNodes.size();
-        mNodes.push_back(bvh_node);
-        if (bvh_node.__triangleCount__ == 0) // 非叶子节点
-        {
-            RecursiveFlatten(node->__children__[0]);                         // 左子节点紧随其后
-            mNodes[idx].__right__ = RecursiveFlatten(node->__children__[1]); // 记录右子节点索引
-        }
-        else // 叶子节点
-        {
-            // 存储第一个三角形索引
-            mNodes[idx].__triangleIdx__ = node->__start__;
-        }
-        return idx;
-    }
 }
\ No newline at end of file
@@ -1,108 +1,166 @@
 ﻿#pragma once
 #include "bounds.hpp"
-#include "shape/triangle.hpp"
+#include "bvhBuilder.hpp"
+#include "mortonBuilder.hpp"
+#include "sbvhBuilder.hpp"
+#include "triangleBlock.hpp"
+#include "shape/triangleMesh.hpp"
 #include "sampler/aliasTable.hpp"
-#include "thread/spinLock.hpp"
+#include "thread/numaReplicated.hpp"
+#include "utils/mappedFile.hpp"
 
 namespace pbrt
 {
-    // BVH二叉树节点
-    struct BVHTreeNode
+    // BVH运行时数据的只读视图, 用于写入缓存或从缓存映射内存恢复
+    struct BVHCacheData
     {
     public:
-        Bounds __bounds__{};
-        size_t __start__, __end__; // [__start__, __end__)
-        BVHTreeNode *__children__[2];
-
-        size_t __depth__;
-        uint8_t __splitAxis__;
+        BVHLayout __layout__;
+        Bounds __bounds__;
+        float __area__;
+        std::span<const BVHNode> __nodes__;
+        std::span<const WideBVHNode<4>> __wideNodes4__;
+        std::span<const WideBVHNode<8>> __wideNodes8__;
+        std::span<const QuantizedWideBVHNode<4>> __quantizedNodes4__;
+        std::span<const QuantizedWideBVHNode<8>> __quantizedNodes8__;
+        std::span<const TriangleBlock<4>> __triangleBlocks4__;
+        std::span<const TriangleBlock<8>> __triangleBlocks8__;
+        std::span<const glm::vec3> __positions__;
+        std::span<const glm::vec3> __normals__;
+        std::span<const uint32_t> __indices__;
+        std::span<const uint32_t> __primitiveIndices__;
+        std::span<const float> __aliasProbs__;
+        std::span<const AliasTable::Item> __aliasItems__;
     };
 
-    // BVH线性节点
-    struct alignas(32) BVHNode
+    // Refit所需的拓扑信息, 首次Refit时生成, 拓扑变化(重建)后失效
+    struct BVHRefitState
     {
     public:
-        Bounds __bounds__{};
-        union
-        {
-            int __right__;       // 右子节点索引(仅非叶子节点有效)
-            int __triangleIdx__; // 三角形起始位置索引(仅叶子节点有效)
-        };
-        uint16_t __triangleCount__; // 节点三角形数量
-        uint8_t __splitAxis__;
-    };
+        std::vector<uint32_t> __depths__;      // 每个节点的深度, 根节点为1
+        std::vector<uint32_t> __order__;       // 按深度分层排列的节点索引
+        std::vector<size_t> __levelOffsets__;  // 深度为d的节点位于__order__[__levelOffsets__[d - 1], __levelOffsets__[d])
+        std::vector<float> __baselineCosts__;  // 上次构建后各子树的归一化SAH代价, 用于判断Refit后的质量退化
 
-    struct BVHState
-    {
     public:
-        std::atomic<size_t> __totalNodeCount__{}; // 总节点数
-        size_t __leafNodeCount__{};               // 叶子节点数
-        size_t __maxLeafNodeTriangleCount__{};    // 最大叶子节点三角形数量
-        size_t __maxTreeDepth__{};
-        SpinLock __lock__{};
+        bool IsValid(size_t node_count) const { return __depths__.size() == node_count && node_count != 0; }
+    };
 
+    /*
+        BVH质量报告, 用于横向比较构建算法与布局
+        SAH代价按根包围盒表面积归一化: 内部节点计访问代价, 叶子计三角形求交代价, 各项乘以表面积, 代价常数取自构建参数
+        叶子深度为从根节点到达该叶子需要访问的节点数, 宽BVH的叶子不占节点, 深度与父节点相同
+    */
+    struct BVHQualityReport
+    {
     public:
-        void AddLeafNode(BVHTreeNode *node)
-        {
-            Guard guard(__lock__);
-            __leafNodeCount__++;
-            __maxLeafNodeTriangleCount__ = glm::max(__maxLeafNodeTriangleCount__, node->__end__ - node->__start__);
-            __maxTreeDepth__ = glm::max(__maxTreeDepth__, node->__depth__);
-        }
+        size_t __nodeCount__{};                    // 当前布局的节点数
+        size_t __leafCount__{};                    // 叶子数, 宽BVH为叶子槽位数
+        size_t __memorySize__{};                   // 节点, 三角形块与叶子引用的字节数, 不含网格
+        size_t __maxDepth__{};                     // 最大叶子深度
+        float __sahCost__{};                       // 归一化SAH代价
+        std::vector<size_t> __leafSizeHistogram__; // 下标为叶子三角形数
+        std::vector<size_t> __depthHistogram__;    // 下标为叶子深度
     };
 
-    class BVHTreeNodeAllocator // BVH二叉树节点分配器, 避免频繁申请内存的开销
+    // 网格中从__firstTriangle__开始的三角形使用的材质, 用于多个物体合并为一个BVH的场景
+    struct BVHMaterialRange
     {
-    private:
-        size_t mPtr;
-        std::vector<BVHTreeNode *> mNodesList;
-        SpinLock mLock{};
-
     public:
-        BVHTreeNodeAllocator() : mPtr(4096) {}
-
-        BVHTreeNode *Allocate()
-        {
-            Guard guard(mLock);
-            // 初始化时会一次性申请大量缓存, 此后只当指针指向最后一个缓存块时, 再申请新的缓存块
-            if (mPtr == 4096)
-            {
-                mNodesList.push_back(new BVHTreeNode[4096]);
-                mPtr = 0;
-            }
-            // 返回当前最后一块缓存(当前可用的节点地址)的指针, 并将指针后移一位
-            return &(mNodesList.back()[mPtr++]);
-        }
-
-        ~BVHTreeNodeAllocator()
-        {
-            for (auto *nodes : mNodesList)
-            {
-                delete[] nodes;
-            }
-            mNodesList.clear();
-        }
+        uint32_t __firstTriangle__;
+        const Material *__material__;
     };
 
     class BVH : public Shape
     {
     public:
-        void Build(std::vector<Triangle> &&triangles);
-        std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const override;
-        Bounds GetBounds() const override { return mNodes[0].__bounds__; }
+        void Build(TriangleMesh &&mesh, const BVHBuildSettings &settings = {});
+        BVHCacheData GetCacheData() const;
+        void Attach(const BVHCacheData &data, std::shared_ptr<const MappedFile> file, const BVHBuildSettings &settings); // 直接使用映射内存中的数据, 持有file保证映射有效
+        /*
+            顶点变形后更新BVH, 三角形拓扑不变
+            先自底向上并行重拟合节点包围盒, 再检查各子树的SAH代价, 退化超过__refitRebuildThreshold__的子树用分桶SAH局部重建
+        */
+        void Refit(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals = {});
+        BVHQualityReport GetQualityReport() const; // 按当前布局遍历全部节点统计, 开销与节点数成正比
+        const TriangleMesh &GetMesh() const { return mMesh; }
+        const BVHBuildSettings &GetSettings() const { return mSettings; }
+        void SetMaterials(std::vector<BVHMaterialRange> &&materials) { mMaterials = std::move(materials); } // 按__firstTriangle__升序, 命中时写入HitInfo::__material__
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override; // hit.__primitiveIdx__为网格三角形索引
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override;
+        bool Occluded(const Ray &ray, float t_min, float t_max) const override;
+        void IntersectBatch(std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const override;
+        void OccludedBatch(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const override;
+        Bounds GetBounds() const override { return mBounds; }
         float GetArea() const override { return mArea; }
         std::optional<ShapeInfo> SampleShape(const RNG &rng) const override;
 
     private:
-        void RecursiveSplit(BVHTreeNode *node, BVHState &state); // 递归划分BVH节点(二叉树结构)
-        size_t RecursiveFlatten(BVHTreeNode *node);              // 递归将BVH二叉树转换为线性结构
+        const Material *GetMaterial(uint32_t triangle_idx) const; // 未设置材质区间时为nullptr
+        BVHBuildResult BuildHierarchy(const std::vector<Bounds> &triangle_bounds, const BVHBuildSettings &settings) const; // 按构建算法生成线性节点
+
+        bool IntersectBinary(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const;
+        // WideNode为WideBVHNode<N>或QuantizedWideBVHNode<N>
+        template <typename WideNode>
+        bool IntersectWide(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const;
+        bool OccludedBinary(const Ray &ray, float t_min, float t_max) const;
+        template <typename WideNode>
+        bool OccludedWide(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, const Ray &ray, float t_min, float t_max) const;
+        template <typename WideNode>
+        void IntersectWideBatch(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const;
+        template <typename WideNode>
+        void OccludedWideBatch(std::span<const WideNode> nodes, std::span<const TriangleBlock<WideNode::WIDTH>> blocks, std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const;
+
+        // Refit: node_costs为各节点子树按其表面积归一化的SAH代价, 节点包围盒随之更新
+        size_t GetNodeCount() const; // 当前布局的节点数
+        template <typename Func>
+        void ForEachInteriorChild(size_t node_idx, Func &&func) const;
+        template <typename Func>
+        void ForEachLevelBottomUp(Func &&func) const; // 从最深层开始逐层并行处理节点, 同层节点互不依赖
+        void UpdateRefitState();
+        void RefitNodes(std::vector<float> &node_costs);
+        void RefitBinary(std::vector<float> &node_costs);
+        template <typename WideNode>
+        void RefitWide(MappedArray<WideNode> &nodes, MappedArray<TriangleBlock<WideNode::WIDTH>> &blocks, std::vector<float> &node_costs);
+        std::vector<uint32_t> FindDegradedSubtrees(const std::vector<float> &node_costs) const; // 返回需要重建的子树根节点, 互不嵌套, 按索引升序
+        BVHBuildResult RebuildReferences(std::vector<uint32_t> &primitive_indices, size_t begin, size_t end) const; // 分桶SAH重建一段引用并重排
+        size_t RebuildSubtrees(const std::vector<uint32_t> &roots); // 返回实际重建的子树数量
+        size_t RebuildDepthFirstSubtrees(const std::vector<uint32_t> &roots); // 节点为深度优先排列时按连续区间重建
+        std::vector<uint32_t> ReorderNodes(BVHNodeOrder order); // 重排当前布局的节点(及三角形块), 返回原索引到新索引的映射
+        size_t RebuildBinarySubtrees(const std::vector<uint32_t> &roots, const std::vector<uint32_t> &subtree_ends);
+        template <typename WideNode>
+        size_t RebuildWideSubtrees(MappedArray<WideNode> &nodes, MappedArray<TriangleBlock<WideNode::WIDTH>> &blocks, const std::vector<uint32_t> &roots, const std::vector<uint32_t> &subtree_ends);
+        void UpdateSampleTable(); // 按当前顶点重新计算面积与采样表
+        void UpdateNumaReplicas(); // 构建, 加载或Refit后按__replicatePerNumaNode__重新复制当前布局的热数据与网格
+
+        template <size_t N>
+        void LogQuantizedComparison(std::span<const WideBVHNode<N>> nodes, std::span<const QuantizedWideBVHNode<N>> quantized_nodes, std::span<const TriangleBlock<N>> blocks) const; // 对比量化前后的内存与遍历吞吐, 只在启用调试日志时调用
 
     private:
-        std::vector<BVHNode> mNodes;
-        std::vector<Triangle> mOrderedTriangles;
-        BVHTreeNodeAllocator mNodeAllocator{};
-        BVHTreeNode *mRoot;
+        BVHBuildSettings mSettings{};
+        BVHLayout mLayout = DEFAULT_BVH_LAYOUT;
+        Bounds mBounds{};
+        MappedArray<BVHNode> mNodes;                // 二叉线性节点(仅Binary布局保留)
+        MappedArray<WideBVHNode<4>> mWideNodes4;    // 4叉节点(Wide4布局)
+        MappedArray<WideBVHNode<8>> mWideNodes8;    // 8叉节点(Wide8布局)
+        MappedArray<QuantizedWideBVHNode<4>> mQuantizedNodes4; // 4叉量化节点(Wide4Quantized布局)
+        MappedArray<QuantizedWideBVHNode<8>> mQuantizedNodes8; // 8叉量化节点(Wide8Quantized布局)
+        MappedArray<TriangleBlock<4>> mTriangleBlocks4; // 宽BVH叶子的三角形求交块(热数据)
+        MappedArray<TriangleBlock<8>> mTriangleBlocks8;
+        NumaReplicated<BVHNode> mNumaNodes;            // 以上热数据在各NUMA分区的副本, 只复制当前布局
+        NumaReplicated<WideBVHNode<4>> mNumaWideNodes4;
+        NumaReplicated<WideBVHNode<8>> mNumaWideNodes8;
+        NumaReplicated<QuantizedWideBVHNode<4>> mNumaQuantizedNodes4;
+        NumaReplicated<QuantizedWideBVHNode<8>> mNumaQuantizedNodes8;
+        NumaReplicated<TriangleBlock<4>> mNumaTriangleBlocks4;
+        NumaReplicated<TriangleBlock<8>> mNumaTriangleBlocks8;
+        TriangleMesh mMesh;                          // 共享顶点的索引网格, 宽BVH布局下仅在最终命中与采样时读取(冷数据)
+        MappedArray<uint32_t> mPrimitiveIndices;     // 叶子引用到网格三角形的索引, 叶子内连续
+        NumaReplicated<uint32_t> mNumaPrimitiveIndices; // 网格本身的副本由TriangleMesh持有
         float mArea;
-        AliasTable mTable; // 三角形采样表
+        AliasTable mTable;                              // 三角形采样表, 按网格三角形索引
+        std::shared_ptr<const MappedFile> mCacheFile{}; // 从缓存加载时持有映射, 以上数组均指向其中
+        BVHRefitState mRefitState{};
+        std::vector<BVHMaterialRange> mMaterials{};
     };
 }
\ No newline at end of file
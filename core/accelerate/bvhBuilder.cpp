@@ -0,0 +1,520 @@
+﻿#include "bvhBuilder.hpp"
+#include "thread/threadPool.hpp"
+#include <algorithm>
+
+namespace pbrt
+{
+    // 顶层阶段的节点, 由调用线程按层划分, 到达子树粒度后交给子树任务
+    struct BVHTopNode
+    {
+    public:
+        BVHPrimitiveRange __range__;
+        int __children__[2] = {-1, -1};
+        int __subtreeIdx__ = -1; // 作为子树任务时的任务索引
+        uint8_t __splitAxis__ = 0;
+        size_t __slot__ = 0; // 在最终线性节点数组中的位置
+    };
+
+    // 中等规模节点并行划分的结果
+    struct BVHTopSplit
+    {
+    public:
+        bool __isSplit__ = false;
+        uint8_t __axis__ = 0;
+        BVHPrimitiveRange __left__, __right__;
+    };
+
+    // 根据图元中心在区间中心包围盒中的位置确定桶索引, 分桶与划分共用, 保证两者结果一致
+    static size_t GetBucketIdx(const BVHPrimitiveRange &range, const glm::vec3 &centroid, size_t axis)
+    {
+        float extent = range.__centroidBounds__.__bMax__[axis] - range.__centroidBounds__.__bMin__[axis];
+        float offset = (centroid[axis] - range.__centroidBounds__.__bMin__[axis]) * BVH_BUCKET_COUNT / extent;
+        if (offset >= static_cast<float>(BVH_BUCKET_COUNT - 1))
+        {
+            return BVH_BUCKET_COUNT - 1;
+        }
+        return offset > 0.f ? static_cast<size_t>(offset) : 0;
+    }
+
+    /*
+        深度优先为顶层节点分配最终数组中的位置, 返回子树之后的下一个位置
+        子树任务的节点整体占据一段连续槽位, 保持左子节点紧随父节点的布局
+    */
+    static size_t AssignSlots(std::vector<BVHTopNode> &top_nodes, const std::vector<std::vector<BVHNode>> &subtree_nodes, size_t idx, size_t slot)
+    {
+        auto &node = top_nodes[idx];
+        node.__slot__ = slot;
+        if (node.__subtreeIdx__ >= 0)
+        {
+            return slot + subtree_nodes[node.__subtreeIdx__].size();
+        }
+        size_t next_slot = AssignSlots(top_nodes, subtree_nodes, node.__children__[0], slot + 1);
+        return AssignSlots(top_nodes, subtree_nodes, node.__children__[1], next_slot);
+    }
+
+    namespace internal
+    {
+        size_t GetChunkCount(size_t count)
+        {
+            // 每个线程分到多个块以平衡负载, 同时保证每块足够大以摊薄任务开销
+            constexpr size_t min_chunk_size = 4 * 1024;
+            size_t chunk_count = MasterThreadPool.GetThreadCount() * 4;
+            return glm::clamp<size_t>(count / min_chunk_size, 1, glm::max<size_t>(chunk_count, 1));
+        }
+
+        void ParallelChunks(size_t begin, size_t end, size_t chunk_count, const std::function<void(size_t, size_t, size_t)> &lambda)
+        {
+            // 只有一块时直接在调用线程执行, 省去任务调度与等待
+            if (chunk_count == 1)
+            {
+                lambda(0, begin, end);
+                return;
+            }
+            size_t count = end - begin;
+            MasterThreadPool.ParallelFor(chunk_count, [&](size_t chunk_idx)
+                                         {
+                                             lambda(chunk_idx, begin + count * chunk_idx / chunk_count, begin + count * (chunk_idx + 1) / chunk_count);
+                                             // end
+                                         });
+        }
+    }
+
+    BVHBuildResult BinnedSAHBuilder::Build(const std::vector<Bounds> &primitive_bounds)
+    {
+        BVHBuildResult result{};
+        size_t primitive_count = primitive_bounds.size();
+        if (primitive_count == 0)
+        {
+            return result;
+        }
+
+        mPrimitiveBounds = &primitive_bounds;
+        mCentroids.resize(primitive_count);
+        mPrimitiveIndices.resize(primitive_count);
+        mSwapBuffer.resize(primitive_count);
+
+        // 并行计算图元中心与根节点包围盒
+        size_t chunk_count = internal::GetChunkCount(primitive_count);
+        std::vector<BVHBucket> chunk_bounds(chunk_count);
+        internal::ParallelChunks(0, primitive_count, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                 {
+                                     auto &chunk = chunk_bounds[chunk_idx];
+                                     for (size_t i = begin; i < end; i++)
+                                     {
+                                         const auto &bounds = primitive_bounds[i];
+                                         mPrimitiveIndices[i] = static_cast<uint32_t>(i);
+                                         mCentroids[i] = (bounds.__bMin__ + bounds.__bMax__) * 0.5f;
+                                         chunk.__bounds__.Expand(bounds);
+                                         chunk.__centroidBounds__.Expand(mCentroids[i]);
+                                     }
+                                     // end
+                                 });
+        BVHBucket root_bounds{};
+        for (const auto &chunk : chunk_bounds)
+        {
+            root_bounds.Expand(chunk);
+        }
+
+        BVHPrimitiveRange root_range{
+            .__start__ = 0,
+            .__end__ = primitive_count,
+            .__bounds__ = root_bounds.__bounds__,
+            .__centroidBounds__ = root_bounds.__centroidBounds__,
+            .__depth__ = 1
+            // end
+        };
+
+        // 不超过子树粒度的小规模构建(如Refit的局部重建)直接在调用线程串行完成, 省去任务调度
+        if (primitive_count <= mSettings.__subtreeTaskGrain__)
+        {
+            result.__nodes__.reserve(primitive_count * 2 - 1);
+            BuildSubtree(root_range, result.__nodes__, result.__stats__);
+            ReleaseBuffers(result);
+            return result;
+        }
+
+        // 顶层阶段: 按层划分, 直到所有待划分节点都不超过子树粒度
+        std::vector<BVHTopNode> top_nodes;
+        top_nodes.push_back({.__range__ = root_range});
+        std::vector<size_t> open_nodes{0};
+        std::vector<size_t> subtree_roots; // 作为子树任务构建的顶层节点
+        size_t top_inner_node_count = 0;
+
+        auto add_children = [&](size_t idx, const BVHPrimitiveRange &left, const BVHPrimitiveRange &right, uint8_t axis, std::vector<size_t> &next_open_nodes)
+        {
+            top_nodes[idx].__children__[0] = static_cast<int>(top_nodes.size());
+            top_nodes[idx].__children__[1] = static_cast<int>(top_nodes.size() + 1);
+            top_nodes[idx].__splitAxis__ = axis;
+            next_open_nodes.push_back(top_nodes.size());
+            top_nodes.push_back({.__range__ = left});
+            next_open_nodes.push_back(top_nodes.size());
+            top_nodes.push_back({.__range__ = right});
+            top_inner_node_count++;
+        };
+        auto add_subtree = [&](size_t idx)
+        {
+            top_nodes[idx].__subtreeIdx__ = static_cast<int>(subtree_roots.size());
+            subtree_roots.push_back(idx);
+        };
+
+        while (!open_nodes.empty())
+        {
+            std::vector<size_t> next_open_nodes, medium_nodes;
+            for (size_t idx : open_nodes)
+            {
+                BVHPrimitiveRange range = top_nodes[idx].__range__;
+                if (range.GetCount() <= mSettings.__subtreeTaskGrain__ || IsLeafRange(range))
+                {
+                    add_subtree(idx);
+                }
+                else if (range.GetCount() > mSettings.__parallelSplitThreshold__)
+                {
+                    // 大节点: 节点内部并行分桶与划分
+                    BVHPrimitiveRange left, right;
+                    uint8_t axis;
+                    if (Split(range, true, left, right, axis))
+                    {
+                        add_children(idx, left, right, axis, next_open_nodes);
+                    }
+                    else
+                    {
+                        add_subtree(idx); // 无法划分, 由子树任务生成叶子
+                    }
+                }
+                else
+                {
+                    medium_nodes.push_back(idx);
+                }
+            }
+
+            // 中等节点: 节点之间并行, 节点内部串行划分
+            std::vector<BVHTopSplit> splits(medium_nodes.size());
+            MasterThreadPool.ParallelFor(medium_nodes.size(), [&](size_t i)
+                                         {
+                                             auto &split = splits[i];
+                                             split.__isSplit__ = Split(top_nodes[medium_nodes[i]].__range__, false, split.__left__, split.__right__, split.__axis__);
+                                             // end
+                                         });
+            for (size_t i = 0; i < medium_nodes.size(); i++)
+            {
+                if (splits[i].__isSplit__)
+                {
+                    add_children(medium_nodes[i], splits[i].__left__, splits[i].__right__, splits[i].__axis__, next_open_nodes);
+                }
+                else
+                {
+                    add_subtree(medium_nodes[i]);
+                }
+            }
+            open_nodes = std::move(next_open_nodes);
+        }
+
+        // 子树阶段: 每个任务在独立的节点数组中构建, 统计信息各自记录, 无需加锁
+        std::vector<std::vector<BVHNode>> subtree_nodes(subtree_roots.size());
+        std::vector<BVHBuildStats> subtree_stats(subtree_roots.size());
+        MasterThreadPool.ParallelFor(subtree_roots.size(), [&](size_t i)
+                                     {
+                                         const auto &range = top_nodes[subtree_roots[i]].__range__;
+                                         subtree_nodes[i].reserve(range.GetCount() * 2 - 1);
+                                         BuildSubtree(range, subtree_nodes[i], subtree_stats[i]);
+                                         // end
+                                     });
+
+        result.__stats__.__totalNodeCount__ = top_inner_node_count;
+        for (const auto &stats : subtree_stats)
+        {
+            result.__stats__.Merge(stats);
+        }
+
+        // 展平阶段: 确定每个子树的槽位后并行拷贝, 子树内的右子节点索引加上槽位偏移
+        size_t total_node_count = AssignSlots(top_nodes, subtree_nodes, 0, 0);
+        result.__nodes__.resize(total_node_count);
+        for (const auto &top_node : top_nodes)
+        {
+            if (top_node.__subtreeIdx__ < 0)
+            {
+                result.__nodes__[top_node.__slot__] = {
+                    top_node.__range__.__bounds__,
+                    static_cast<int>(top_nodes[top_node.__children__[1]].__slot__),
+                    0,
+                    top_node.__splitAxis__
+                    // end
+                };
+            }
+        }
+        MasterThreadPool.ParallelFor(subtree_roots.size(), [&](size_t i)
+                                     {
+                                         int slot = static_cast<int>(top_nodes[subtree_roots[i]].__slot__);
+                                         auto *dst = result.__nodes__.data() + slot;
+                                         for (const auto &node : subtree_nodes[i])
+                                         {
+                                             *dst = node;
+                                             if (node.__triangleCount__ == 0)
+                                             {
+                                                 dst->__right__ += slot;
+                                             }
+                                             dst++;
+                                         }
+                                         subtree_nodes[i].clear();
+                                         subtree_nodes[i].shrink_to_fit();
+                                         // end
+                                     });
+
+        ReleaseBuffers(result);
+        return result;
+    }
+
+    void BinnedSAHBuilder::ReleaseBuffers(BVHBuildResult &result)
+    {
+        result.__primitiveIndices__ = std::move(mPrimitiveIndices);
+        mCentroids.clear();
+        mCentroids.shrink_to_fit();
+        mSwapBuffer.clear();
+        mSwapBuffer.shrink_to_fit();
+        mPrimitiveBounds = nullptr;
+    }
+
+    void BinnedSAHBuilder::BinPrimitives(const BVHPrimitiveRange &range, size_t begin, size_t end, BVHBuckets &buckets) const
+    {
+        auto extent = range.__centroidBounds__.GetDiagonal();
+        for (size_t i = begin; i < end; i++)
+        {
+            uint32_t primitive_idx = mPrimitiveIndices[i];
+            const auto &centroid = mCentroids[primitive_idx];
+            const auto &bounds = (*mPrimitiveBounds)[primitive_idx];
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                // 图元中心在该轴上重合, 无法沿该轴划分
+                if (!(extent[axis] > 0.f))
+                {
+                    continue;
+                }
+                auto &bucket = buckets[axis][GetBucketIdx(range, centroid, axis)];
+                bucket.__bounds__.Expand(bounds);
+                bucket.__centroidBounds__.Expand(centroid);
+                bucket.__count__++;
+            }
+        }
+    }
+
+    std::optional<BVHSplit> BinnedSAHBuilder::FindSplit(const BVHPrimitiveRange &range, bool parallel) const
+    {
+        BVHBuckets buckets{};
+        if (parallel)
+        {
+            // 每块独立分桶后合并
+            size_t chunk_count = internal::GetChunkCount(range.GetCount());
+            std::vector<BVHBuckets> chunk_buckets(chunk_count);
+            internal::ParallelChunks(range.__start__, range.__end__, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                     {
+                                         BinPrimitives(range, begin, end, chunk_buckets[chunk_idx]);
+                                         // end
+                                     });
+            for (const auto &chunk : chunk_buckets)
+            {
+                for (size_t axis = 0; axis < 3; axis++)
+                {
+                    for (size_t i = 0; i < BVH_BUCKET_COUNT; i++)
+                    {
+                        buckets[axis][i].Expand(chunk[axis][i]);
+                    }
+                }
+            }
+        }
+        else
+        {
+            BinPrimitives(range, range.__start__, range.__end__, buckets);
+        }
+
+        std::optional<BVHSplit> best_split;
+        float min_cost = std::numeric_limits<float>::infinity();
+        auto extent = range.__centroidBounds__.GetDiagonal();
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            if (!(extent[axis] > 0.f))
+            {
+                continue;
+            }
+
+            // 从后往前累积右子节点的桶, 避免对每个划分位置重复遍历
+            std::array<BVHBucket, BVH_BUCKET_COUNT> right_buckets{};
+            BVHBucket right{};
+            for (size_t i = BVH_BUCKET_COUNT - 1; i > 0; i--)
+            {
+                right.Expand(buckets[axis][i]);
+                right_buckets[i] = right;
+            }
+
+            BVHBucket left{};
+            for (size_t i = 1; i < BVH_BUCKET_COUNT; i++)
+            {
+                left.Expand(buckets[axis][i - 1]);
+                const auto &right_bucket = right_buckets[i];
+                if (left.__count__ == 0 || right_bucket.__count__ == 0)
+                {
+                    continue;
+                }
+                // cost = traversal_cost + Prob_left * Σ(T_left_triangles) + Prob_right * Σ(T_right_triangles)
+                // Prob_left与Prob_right与包围盒表面积成正比, 比较划分时常数项与公共系数可以省去, 叶子判定见ShouldCreateLeaf
+                float cost = left.__bounds__.GetSurfaceArea() * left.__count__ + right_bucket.__bounds__.GetSurfaceArea() * right_bucket.__count__;
+                if (cost < min_cost)
+                {
+                    min_cost = cost;
+                    best_split = BVHSplit{
+                        .__axis__ = static_cast<uint8_t>(axis),
+                        .__bucketIdx__ = i,
+                        .__left__ = left,
+                        .__right__ = right_bucket,
+                        .__cost__ = cost
+                        // end
+                    };
+                }
+            }
+        }
+        return best_split;
+    }
+
+    size_t BinnedSAHBuilder::Partition(const BVHPrimitiveRange &range, const BVHSplit &split, bool parallel)
+    {
+        auto is_left = [&](uint32_t primitive_idx)
+        {
+            return GetBucketIdx(range, mCentroids[primitive_idx], split.__axis__) < split.__bucketIdx__;
+        };
+
+        if (!parallel)
+        {
+            auto begin = mPrimitiveIndices.begin();
+            return std::partition(begin + range.__start__, begin + range.__end__, is_left) - begin;
+        }
+
+        /*
+            并行划分分三趟, 分块方式相同:
+            1. 每块统计左子节点图元数
+            2. 根据前缀和将每块的图元分散到临时缓冲中的对应位置
+            3. 将临时缓冲拷贝回索引数组
+        */
+        size_t chunk_count = internal::GetChunkCount(range.GetCount());
+        std::vector<size_t> left_offsets(chunk_count), right_offsets(chunk_count);
+        internal::ParallelChunks(range.__start__, range.__end__, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                 {
+                                     left_offsets[chunk_idx] = std::count_if(mPrimitiveIndices.begin() + begin, mPrimitiveIndices.begin() + end, is_left);
+                                     right_offsets[chunk_idx] = (end - begin) - left_offsets[chunk_idx];
+                                     // end
+                                 });
+
+        size_t left_count = 0, right_count = 0;
+        for (size_t i = 0; i < chunk_count; i++)
+        {
+            size_t chunk_left_count = left_offsets[i], chunk_right_count = right_offsets[i];
+            left_offsets[i] = range.__start__ + left_count;
+            right_offsets[i] = right_count;
+            left_count += chunk_left_count;
+            right_count += chunk_right_count;
+        }
+        size_t mid = range.__start__ + left_count;
+
+        internal::ParallelChunks(range.__start__, range.__end__, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                 {
+                                     size_t left_ptr = left_offsets[chunk_idx];
+                                     size_t right_ptr = mid + right_offsets[chunk_idx];
+                                     for (size_t i = begin; i < end; i++)
+                                     {
+                                         uint32_t primitive_idx = mPrimitiveIndices[i];
+                                         mSwapBuffer[is_left(primitive_idx) ? left_ptr++ : right_ptr++] = primitive_idx;
+                                     }
+                                     // end
+                                 });
+        internal::ParallelChunks(range.__start__, range.__end__, chunk_count, [&](size_t, size_t begin, size_t end)
+                                 {
+                                     std::copy(mSwapBuffer.begin() + begin, mSwapBuffer.begin() + end, mPrimitiveIndices.begin() + begin);
+                                     // end
+                                 });
+        return mid;
+    }
+
+    bool BinnedSAHBuilder::Split(const BVHPrimitiveRange &range, bool parallel, BVHPrimitiveRange &left, BVHPrimitiveRange &right, uint8_t &axis)
+    {
+        auto split = FindSplit(range, parallel);
+        if (internal::ShouldCreateLeaf(mSettings, range.GetCount(), range.__bounds__.GetSurfaceArea(), split ? split->__cost__ : std::numeric_limits<float>::infinity()))
+        {
+            return false;
+        }
+
+        // 图元中心全部重合, 没有可用的SAH划分, 但图元数超过叶子上限
+        if (!split)
+        {
+            SplitMiddle(range, left, right);
+            axis = 0;
+            return true;
+        }
+
+        size_t mid = Partition(range, *split, parallel);
+        axis = split->__axis__;
+        left = {
+            .__start__ = range.__start__,
+            .__end__ = mid,
+            .__bounds__ = split->__left__.__bounds__,
+            .__centroidBounds__ = split->__left__.__centroidBounds__,
+            .__depth__ = range.__depth__ + 1
+            // end
+        };
+        right = {
+            .__start__ = mid,
+            .__end__ = range.__end__,
+            .__bounds__ = split->__right__.__bounds__,
+            .__centroidBounds__ = split->__right__.__centroidBounds__,
+            .__depth__ = range.__depth__ + 1
+            // end
+        };
+        return true;
+    }
+
+    void BinnedSAHBuilder::SplitMiddle(const BVHPrimitiveRange &range, BVHPrimitiveRange &left, BVHPrimitiveRange &right) const
+    {
+        size_t mid = range.__start__ + range.GetCount() / 2;
+        left = {.__start__ = range.__start__, .__end__ = mid, .__depth__ = range.__depth__ + 1};
+        right = {.__start__ = mid, .__end__ = range.__end__, .__depth__ = range.__depth__ + 1};
+        for (auto *child : {&left, &right})
+        {
+            for (size_t i = child->__start__; i < child->__end__; i++)
+            {
+                uint32_t primitive_idx = mPrimitiveIndices[i];
+                child->__bounds__.Expand((*mPrimitiveBounds)[primitive_idx]);
+                child->__centroidBounds__.Expand(mCentroids[primitive_idx]);
+            }
+        }
+    }
+
+    /*
+        深度优先-递归地串行构建子树, 直接写入线性数组
+        非叶子节点的下一个节点一定是它的左子节点, 然后存储右子节点索引即可
+    */
+    size_t BinnedSAHBuilder::BuildSubtree(const BVHPrimitiveRange &range, std::vector<BVHNode> &nodes, BVHBuildStats &stats)
+    {
+        stats.__totalNodeCount__++;
+        size_t idx = nodes.size();
+        nodes.push_back({
+            range.__bounds__,
+            static_cast<int>(range.__start__),
+            static_cast<uint16_t>(range.GetCount()),
+            0
+            // end
+        });
+
+        BVHPrimitiveRange left, right;
+        uint8_t axis;
+        if (IsLeafRange(range) || !Split(range, false, left, right, axis))
+        {
+            // 单个图元, 或SAH判定叶子不比划分更贵, 作为叶子节点
+            stats.AddLeafNode(range.GetCount(), range.__depth__);
+            return idx;
+        }
+
+        nodes[idx].__triangleCount__ = 0;
+        nodes[idx].__splitAxis__ = axis;
+        BuildSubtree(left, nodes, stats); // 左子节点紧随其后
+        size_t right_idx = BuildSubtree(right, nodes, stats);
+        nodes[idx].__right__ = static_cast<int>(right_idx); // 记录右子节点索引
+        return idx;
+    }
+}
\ No newline at end of file
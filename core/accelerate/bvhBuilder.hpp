@@ -0,0 +1,204 @@
+﻿#pragma once
+#include "bounds.hpp"
+#include "nodeOrder.hpp"
+#include "wideBVH.hpp"
+#include <array>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace pbrt
+{
+    // BVH线性节点
+    struct alignas(32) BVHNode
+    {
+    public:
+        Bounds __bounds__{};
+        union
+        {
+            int __right__;       // 右子节点索引(仅非叶子节点有效)
+            int __triangleIdx__; // 三角形起始位置索引(仅叶子节点有效)
+        };
+        uint16_t __triangleCount__; // 节点三角形数量
+        uint8_t __splitAxis__;      // 划分轴, 重排后子节点交换过的节点加上BVH_SWAPPED_SPLIT_AXIS
+    };
+
+    // BVH构建算法
+    enum class BVHBuilderType
+    {
+        BinnedSAH, // 分桶SAH, 遍历质量最高
+        LBVH,      // Morton码排序后直接生成层次结构, 构建最快
+        PLOC,      // Morton码排序后并行局部聚类, 构建速度与遍历质量折中
+        SBVH       // 对象划分与空间划分结合, 细长或大三角形较多时遍历质量最高, 构建最慢
+    };
+
+    constexpr size_t BVH_MAX_LEAF_SIZE = std::numeric_limits<uint16_t>::max(); // 叶子三角形数的存储上限(BVHNode::__triangleCount__)
+
+    // BVH构建参数
+    struct BVHBuildSettings
+    {
+    public:
+        BVHLayout __layout__ = DEFAULT_BVH_LAYOUT;
+        BVHBuilderType __builder__ = BVHBuilderType::BinnedSAH;
+        BVHNodeOrder __nodeOrder__ = BVHNodeOrder::DepthFirst; // 构建后节点在数组中的排列顺序, Treelet需显式启用
+        float __traversalCost__ = 1.f;                         // SAH代价中访问一个二叉节点的相对代价
+        float __intersectionCost__ = 1.f;                      // SAH代价中求交一个三角形的相对代价, 可由CalibrateBVHCosts按本机测量
+        bool __loadCalibratedCosts__ = true;                   // Model构建前读取CalibrateBVHCosts保存的本机代价替换上面两项, 没有保存的结果时保持原值
+        size_t __maxLeafSize__ = 8;                            // 叶子最多三角形数, 超过时即使划分代价更高也继续划分, 不超过BVH_MAX_LEAF_SIZE
+        size_t __parallelSplitThreshold__ = 64 * 1024;         // 图元数超过该值的节点, 节点内部并行分桶与划分
+        size_t __subtreeTaskGrain__ = 4 * 1024;                // 图元数不超过该值的子树作为一个任务串行构建(展平)
+        size_t __plocRadius__ = 16;                            // PLOC在Morton序上搜索最近邻的半径
+        float __sbvhReferenceBudget__ = 0.3f;                  // SBVH空间划分允许额外复制的引用数, 相对图元数的比例
+        float __sbvhOverlapThreshold__ = 1e-5f;                // 对象划分左右子节点重叠面积与根节点表面积之比超过该值时才尝试空间划分
+        float __refitRebuildThreshold__ = 1.5f;                // Refit后子树归一化SAH代价相对上次构建增长超过该倍数时重建该子树
+        bool __replicatePerNumaNode__ = false;                 // 节点, 三角形块, 引用索引与网格在线程池的每个NUMA分区保留一份副本, 需要线程池开启NUMA分区
+        bool __enableCache__ = false;                          // 从文件加载模型时读写二进制BVH缓存, 需显式开启; 缓存参数与调度参数不参与缓存键
+        std::filesystem::path __cacheDirectory__{};            // 缓存与代价测量结果的目录, 为空时使用系统临时目录下的pbrt-cache
+    };
+
+    // BVH构建统计, 每个子树任务独立统计, 构建结束后合并, 避免加锁
+    struct BVHBuildStats
+    {
+    public:
+        size_t __totalNodeCount__{};         // 总节点数
+        size_t __leafNodeCount__{};          // 叶子节点数
+        size_t __maxLeafPrimitiveCount__{};  // 最大叶子节点图元数量
+        size_t __maxTreeDepth__{};
+
+    public:
+        void AddLeafNode(size_t primitive_count, size_t depth)
+        {
+            __leafNodeCount__++;
+            __maxLeafPrimitiveCount__ = glm::max(__maxLeafPrimitiveCount__, primitive_count);
+            __maxTreeDepth__ = glm::max(__maxTreeDepth__, depth);
+        }
+
+        void Merge(const BVHBuildStats &stats)
+        {
+            __totalNodeCount__ += stats.__totalNodeCount__;
+            __leafNodeCount__ += stats.__leafNodeCount__;
+            __maxLeafPrimitiveCount__ = glm::max(__maxLeafPrimitiveCount__, stats.__maxLeafPrimitiveCount__);
+            __maxTreeDepth__ = glm::max(__maxTreeDepth__, stats.__maxTreeDepth__);
+        }
+    };
+
+    /*
+        BVH构建结果
+        __nodes__为深度优先排列的线性节点, 左子节点紧随父节点
+        叶子节点的__triangleIdx__为__primitiveIndices__中的起始位置, __primitiveIndices__记录重排后的图元原始索引
+        SBVH空间划分会复制引用, 此时同一图元可能在__primitiveIndices__中出现多次
+    */
+    struct BVHBuildResult
+    {
+    public:
+        std::vector<BVHNode> __nodes__;
+        std::vector<uint32_t> __primitiveIndices__;
+        BVHBuildStats __stats__;
+    };
+
+    namespace internal
+    {
+        size_t GetChunkCount(size_t count); // 按线程数确定并行分块数, 每块不少于4096个元素
+
+        /*
+            SAH终止判定, 代价以光线命中当前节点为条件:
+            叶子: C_i · N
+            划分: C_t + C_i · (A_L · N_L + A_R · N_R) / A
+            split_cost为A_L · N_L + A_R · N_R, 没有可用划分时为无穷大
+            图元数不超过叶子上限且叶子不比划分更贵时返回true; 超过上限时必须划分
+        */
+        inline bool ShouldCreateLeaf(const BVHBuildSettings &settings, size_t count, float area, float split_cost)
+        {
+            if (count > glm::clamp<size_t>(settings.__maxLeafSize__, 1, BVH_MAX_LEAF_SIZE))
+            {
+                return false;
+            }
+            if (count <= 1 || !(area > 0.f))
+            {
+                return true;
+            }
+            return settings.__intersectionCost__ * count <= settings.__traversalCost__ + settings.__intersectionCost__ * split_cost / area;
+        }
+
+        // 将[begin, end)等分为chunk_count块并行处理, 相同参数下分块结果确定, 便于多趟处理之间对应
+        void ParallelChunks(size_t begin, size_t end, size_t chunk_count, const std::function<void(size_t, size_t, size_t)> &lambda);
+    }
+
+    // 构建过程中的图元区间[__start__, __end__)
+    struct BVHPrimitiveRange
+    {
+    public:
+        size_t __start__, __end__;
+        Bounds __bounds__{};         // 区间内图元的包围盒
+        Bounds __centroidBounds__{}; // 区间内图元中心的包围盒, 用于分桶
+        size_t __depth__;
+
+    public:
+        size_t GetCount() const { return __end__ - __start__; }
+    };
+
+    constexpr size_t BVH_BUCKET_COUNT = 12; // SAH分桶数量
+
+    struct BVHBucket
+    {
+    public:
+        Bounds __bounds__{};
+        Bounds __centroidBounds__{};
+        size_t __count__{};
+
+    public:
+        void Expand(const BVHBucket &bucket)
+        {
+            __bounds__.Expand(bucket.__bounds__);
+            __centroidBounds__.Expand(bucket.__centroidBounds__);
+            __count__ += bucket.__count__;
+        }
+    };
+
+    using BVHBuckets = std::array<std::array<BVHBucket, BVH_BUCKET_COUNT>, 3>; // 3个轴各自的桶
+
+    // 最优SAH划分: 桶索引小于__bucketIdx__的图元属于左子节点
+    struct BVHSplit
+    {
+    public:
+        uint8_t __axis__;
+        size_t __bucketIdx__;
+        BVHBucket __left__, __right__;
+        float __cost__; // A_L · N_L + A_R · N_R
+    };
+
+    /*
+        并行分桶SAH构建器
+        1. 顶层阶段由调用线程按层推进: 大节点(超过__parallelSplitThreshold__)在节点内部并行分桶与划分, 中等节点之间并行划分
+        2. 不超过__subtreeTaskGrain__的节点作为子树任务, 每个任务在独立的节点数组中串行构建, 统计信息各自记录
+        3. 根据各子树节点数确定其在最终数组中的位置, 并行拷贝到预分配的槽位
+        构建只重排图元索引, 不移动图元本身
+    */
+    class BinnedSAHBuilder
+    {
+    private:
+        BVHBuildSettings mSettings;
+        std::vector<glm::vec3> mCentroids;       // 图元中心
+        std::vector<uint32_t> mPrimitiveIndices; // 重排后的图元索引
+        std::vector<uint32_t> mSwapBuffer;       // 并行划分时的临时缓冲
+        const std::vector<Bounds> *mPrimitiveBounds = nullptr;
+
+    public:
+        BinnedSAHBuilder(const BVHBuildSettings &settings = {}) : mSettings(settings) {}
+
+        BVHBuildResult Build(const std::vector<Bounds> &primitive_bounds);
+
+    private:
+        void BinPrimitives(const BVHPrimitiveRange &range, size_t begin, size_t end, BVHBuckets &buckets) const;
+        std::optional<BVHSplit> FindSplit(const BVHPrimitiveRange &range, bool parallel) const;
+        size_t Partition(const BVHPrimitiveRange &range, const BVHSplit &split, bool parallel);
+        bool Split(const BVHPrimitiveRange &range, bool parallel, BVHPrimitiveRange &left, BVHPrimitiveRange &right, uint8_t &axis); // SAH判定为叶子时返回false
+        void SplitMiddle(const BVHPrimitiveRange &range, BVHPrimitiveRange &left, BVHPrimitiveRange &right) const; // 按索引对半划分
+        size_t BuildSubtree(const BVHPrimitiveRange &range, std::vector<BVHNode> &nodes, BVHBuildStats &stats); // 递归串行构建子树
+        void ReleaseBuffers(BVHBuildResult &result); // 交出重排后的图元索引并释放临时缓冲
+
+        static bool IsLeafRange(const BVHPrimitiveRange &range) { return range.GetCount() == 1; }
+    };
+}
\ No newline at end of file
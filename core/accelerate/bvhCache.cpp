@@ -0,0 +1,223 @@
+﻿#include "bvhCache.hpp"
+#include "utils/hash.hpp"
+#include "utils/logger.hpp"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace pbrt
+{
+    namespace
+    {
+        struct BVHCacheWriteSection
+        {
+        public:
+            const void *__data__;
+            size_t __count__;
+            size_t __elementSize__;
+        };
+
+        template <typename T>
+        BVHCacheWriteSection MakeSection(std::span<const T> values)
+        {
+            return {values.data(), values.size(), sizeof(T)};
+        }
+
+        // 校验段信息并返回映射内存中的数组视图, 校验失败返回false
+        template <typename T>
+        bool GetSection(const MappedFile &file, const BVHCacheHeader &header, BVHCacheSection section, std::span<const T> &values)
+        {
+            const auto &info = header.__sections__[static_cast<size_t>(section)];
+            if (info.__elementSize__ != sizeof(T) || info.__offset__ % alignof(T) != 0)
+            {
+                return false;
+            }
+            if (info.__offset__ > file.GetSize() || info.__count__ > (file.GetSize() - info.__offset__) / sizeof(T))
+            {
+                return false;
+            }
+            values = std::span<const T>(reinterpret_cast<const T *>(file.GetData() + info.__offset__), info.__count__);
+            return true;
+        }
+    }
+
+    std::filesystem::path GetBVHCacheDirectory(const BVHBuildSettings &settings)
+    {
+        if (!settings.__cacheDirectory__.empty())
+        {
+            return settings.__cacheDirectory__;
+        }
+        std::error_code ec;
+        auto directory = std::filesystem::temp_directory_path(ec) / "pbrt-cache";
+        return ec ? std::filesystem::path{} : directory;
+    }
+
+    BVHCache::BVHCache(const std::filesystem::path &source, std::string_view parser, const BVHBuildSettings &settings)
+        : mSettings(settings)
+    {
+        if (!settings.__enableCache__)
+        {
+            return;
+        }
+        auto source_file = MappedFile::Open(source);
+        if (source_file == nullptr)
+        {
+            return;
+        }
+        mKey = ComputeKey(Hash64::Compute(source_file->GetData(), source_file->GetSize()), parser, settings);
+
+        auto directory = GetBVHCacheDirectory(settings);
+        if (directory.empty())
+        {
+            return;
+        }
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << mKey << ".bvh";
+        mPath = directory / name.str();
+    }
+
+    uint64_t BVHCache::ComputeKey(uint64_t source_hash, std::string_view parser, const BVHBuildSettings &settings)
+    {
+        uint64_t key = Hash64::Compute(parser.data(), parser.size(), source_hash);
+        key = Hash64::Combine(key, BVH_CACHE_VERSION);
+        key = Hash64::Combine(key, static_cast<uint32_t>(settings.__layout__));
+        key = Hash64::Combine(key, static_cast<uint32_t>(settings.__builder__));
+        key = Hash64::Combine(key, static_cast<uint32_t>(settings.__nodeOrder__));
+        key = Hash64::Combine(key, settings.__traversalCost__);
+        key = Hash64::Combine(key, settings.__intersectionCost__);
+        key = Hash64::Combine(key, static_cast<uint64_t>(settings.__maxLeafSize__));
+        key = Hash64::Combine(key, static_cast<uint64_t>(settings.__plocRadius__));
+        key = Hash64::Combine(key, settings.__sbvhReferenceBudget__);
+        key = Hash64::Combine(key, settings.__sbvhOverlapThreshold__);
+        return key;
+    }
+
+    bool BVHCache::Load(BVH &bvh) const
+    {
+        if (mPath.empty())
+        {
+            return false;
+        }
+        auto file = MappedFile::Open(mPath);
+        if (file == nullptr || file->GetSize() < sizeof(BVHCacheHeader))
+        {
+            return false;
+        }
+
+        const auto &header = *reinterpret_cast<const BVHCacheHeader *>(file->GetData());
+        if (header.__magic__ != BVH_CACHE_MAGIC || header.__version__ != BVH_CACHE_VERSION || header.__key__ != mKey)
+        {
+            PBRT_WARN("BVH cache {} is stale or corrupted, rebuild", mPath.string());
+            return false;
+        }
+
+        BVHCacheData data{
+            .__layout__ = static_cast<BVHLayout>(header.__layout__),
+            .__bounds__ = Bounds({header.__bMin__[0], header.__bMin__[1], header.__bMin__[2]}, {header.__bMax__[0], header.__bMax__[1], header.__bMax__[2]}),
+            .__area__ = header.__area__
+            // end
+        };
+        bool is_valid = GetSection(*file, header, BVHCacheSection::Nodes, data.__nodes__) &&
+                        GetSection(*file, header, BVHCacheSection::WideNodes4, data.__wideNodes4__) &&
+                        GetSection(*file, header, BVHCacheSection::WideNodes8, data.__wideNodes8__) &&
+                        GetSection(*file, header, BVHCacheSection::QuantizedNodes4, data.__quantizedNodes4__) &&
+                        GetSection(*file, header, BVHCacheSection::QuantizedNodes8, data.__quantizedNodes8__) &&
+                        GetSection(*file, header, BVHCacheSection::TriangleBlocks4, data.__triangleBlocks4__) &&
+                        GetSection(*file, header, BVHCacheSection::TriangleBlocks8, data.__triangleBlocks8__) &&
+                        GetSection(*file, header, BVHCacheSection::Positions, data.__positions__) &&
+                        GetSection(*file, header, BVHCacheSection::Normals, data.__normals__) &&
+                        GetSection(*file, header, BVHCacheSection::Indices, data.__indices__) &&
+                        GetSection(*file, header, BVHCacheSection::PrimitiveIndices, data.__primitiveIndices__) &&
+                        GetSection(*file, header, BVHCacheSection::AliasProbs, data.__aliasProbs__) &&
+                        GetSection(*file, header, BVHCacheSection::AliasItems, data.__aliasItems__);
+        size_t triangle_count = data.__indices__.size() / 3;
+        if (!is_valid || data.__indices__.size() % 3 != 0 || (!data.__normals__.empty() && data.__normals__.size() != data.__positions__.size()) ||
+            data.__aliasProbs__.size() != triangle_count || data.__aliasItems__.size() != triangle_count)
+        {
+            PBRT_WARN("BVH cache {} is stale or corrupted, rebuild", mPath.string());
+            return false;
+        }
+
+        bvh.Attach(data, std::move(file), mSettings);
+        PBRT_INFO("BVH cache {} mapped with {} triangles", mPath.string(), triangle_count);
+        return true;
+    }
+
+    void BVHCache::Save(const BVH &bvh) const
+    {
+        if (mPath.empty())
+        {
+            return;
+        }
+        auto data = bvh.GetCacheData();
+        BVHCacheWriteSection sections[static_cast<size_t>(BVHCacheSection::Count)] = {
+            MakeSection(data.__nodes__),
+            MakeSection(data.__wideNodes4__),
+            MakeSection(data.__wideNodes8__),
+            MakeSection(data.__quantizedNodes4__),
+            MakeSection(data.__quantizedNodes8__),
+            MakeSection(data.__triangleBlocks4__),
+            MakeSection(data.__triangleBlocks8__),
+            MakeSection(data.__positions__),
+            MakeSection(data.__normals__),
+            MakeSection(data.__indices__),
+            MakeSection(data.__primitiveIndices__),
+            MakeSection(data.__aliasProbs__),
+            MakeSection(data.__aliasItems__)
+            // end
+        };
+
+        BVHCacheHeader header{};
+        header.__magic__ = BVH_CACHE_MAGIC;
+        header.__version__ = BVH_CACHE_VERSION;
+        header.__layout__ = static_cast<uint32_t>(data.__layout__);
+        header.__key__ = mKey;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            header.__bMin__[axis] = data.__bounds__.__bMin__[axis];
+            header.__bMax__[axis] = data.__bounds__.__bMax__[axis];
+        }
+        header.__area__ = data.__area__;
+        uint64_t offset = sizeof(BVHCacheHeader);
+        for (size_t i = 0; i < std::size(sections); i++)
+        {
+            offset = (offset + BVH_CACHE_ALIGNMENT - 1) / BVH_CACHE_ALIGNMENT * BVH_CACHE_ALIGNMENT;
+            header.__sections__[i] = {offset, sections[i].__count__, static_cast<uint32_t>(sections[i].__elementSize__), 0};
+            offset += sections[i].__count__ * sections[i].__elementSize__;
+        }
+
+        // 先写临时文件再重命名, 其他进程不会映射到写了一半的缓存
+        std::error_code ec;
+        std::filesystem::create_directories(mPath.parent_path(), ec);
+        auto temp_path = mPath;
+        temp_path += ".tmp" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        {
+            std::ofstream file(temp_path, std::ios::binary);
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            uint64_t written = sizeof(header);
+            const char zeros[BVH_CACHE_ALIGNMENT] = {};
+            for (size_t i = 0; i < std::size(sections); i++)
+            {
+                file.write(zeros, header.__sections__[i].__offset__ - written);
+                file.write(static_cast<const char *>(sections[i].__data__), sections[i].__count__ * sections[i].__elementSize__);
+                written = header.__sections__[i].__offset__ + sections[i].__count__ * sections[i].__elementSize__;
+            }
+            if (!file.good())
+            {
+                file.close();
+                std::filesystem::remove(temp_path, ec);
+                PBRT_WARN("Failed to write BVH cache {}", mPath.string());
+                return;
+            }
+        }
+        std::filesystem::rename(temp_path, mPath, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temp_path, ec);
+            PBRT_WARN("Failed to write BVH cache {}", mPath.string());
+            return;
+        }
+        PBRT_INFO("BVH cache {} written, {} KB", mPath.string(), offset / 1024);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+﻿#pragma once
+#include "bvh.hpp"
+#include <filesystem>
+#include <string_view>
+
+namespace pbrt
+{
+    /*
+        BVH二进制缓存文件格式(本机字节序)
+        [BVHCacheHeader][section 0][section 1]...
+        各段起始位置按BVH_CACHE_ALIGNMENT对齐, 段内为数组原样的字节, 所有引用均为数组下标, 文件中不含任何指针
+        因此文件与映射地址无关, 多个进程可以在任意地址映射同一文件并共享物理页
+    */
+    constexpr uint64_t BVH_CACHE_MAGIC = 0x48434842'54524250ull; // "PBRTBHCH"
+    constexpr uint32_t BVH_CACHE_VERSION = 6;                     // 任何段的布局变化都需要递增
+    constexpr size_t BVH_CACHE_ALIGNMENT = 64;
+
+    enum class BVHCacheSection : uint32_t
+    {
+        Nodes,
+        WideNodes4,
+        WideNodes8,
+        QuantizedNodes4,
+        QuantizedNodes8,
+        TriangleBlocks4,
+        TriangleBlocks8,
+        Positions,
+        Normals,
+        Indices,
+        PrimitiveIndices,
+        AliasProbs,
+        AliasItems,
+        Count
+    };
+
+    struct BVHCacheSectionInfo
+    {
+    public:
+        uint64_t __offset__;      // 相对文件起始的字节偏移
+        uint64_t __count__;       // 元素数量
+        uint32_t __elementSize__; // 元素字节数, 加载时与当前编译的结构体大小比对
+        uint32_t __padding__;
+    };
+
+    struct BVHCacheHeader
+    {
+    public:
+        uint64_t __magic__;
+        uint32_t __version__;
+        uint32_t __layout__;
+        uint64_t __key__; // 源文件内容与构建参数的哈希
+        float __bMin__[3];
+        float __bMax__[3];
+        float __area__;
+        uint32_t __padding__;
+        BVHCacheSectionInfo __sections__[static_cast<size_t>(BVHCacheSection::Count)];
+    };
+
+    std::filesystem::path GetBVHCacheDirectory(const BVHBuildSettings &settings); // __cacheDirectory__为空时返回系统临时目录下的pbrt-cache, 失败返回空路径
+
+    /*
+        模型BVH缓存
+        缓存键由源文件内容哈希, 解析方式与影响构建结果的参数组成, 任一变化都会使用新的缓存文件
+        命中时BVH直接引用映射内存, 不解析不构建也不拷贝
+    */
+    class BVHCache
+    {
+    private:
+        std::filesystem::path mPath{}; // 为空表示不使用缓存
+        uint64_t mKey = 0;
+        BVHBuildSettings mSettings;
+
+    public:
+        BVHCache(const std::filesystem::path &source, std::string_view parser, const BVHBuildSettings &settings);
+
+        bool Load(BVH &bvh) const;       // 命中返回true
+        void Save(const BVH &bvh) const; // 写入失败仅警告, 不影响渲染
+
+    private:
+        static uint64_t ComputeKey(uint64_t source_hash, std::string_view parser, const BVHBuildSettings &settings);
+    };
+}
\ No newline at end of file
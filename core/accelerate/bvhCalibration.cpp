@@ -0,0 +1,247 @@
+﻿#include "bvhCalibration.hpp"
+#include "bvhCache.hpp"
+#include "triangleBlock.hpp"
+#include "shape/triangle.hpp"
+#include "utils/logger.hpp"
+#include "utils/rng.hpp"
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+
+namespace pbrt
+{
+    constexpr size_t CALIBRATION_RAY_COUNT = 1024;
+    constexpr size_t CALIBRATION_PRIMITIVE_COUNT = 256;
+    constexpr size_t CALIBRATION_REPEAT_COUNT = 5;
+
+    static volatile size_t CalibrationSink = 0; // 保存测试结果, 防止测试循环被优化掉
+
+    // 重复测量取最短耗时, 减少调度与频率波动的干扰, 返回单次测试的秒数
+    template <typename Func>
+    static double MeasureTestSeconds(size_t test_count, Func &&func)
+    {
+        double best_seconds = std::numeric_limits<double>::infinity();
+        for (size_t repeat = 0; repeat < CALIBRATION_REPEAT_COUNT; repeat++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            CalibrationSink = CalibrationSink + func();
+            best_seconds = glm::min(best_seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best_seconds / test_count;
+    }
+
+    // 单位立方体内的随机光线、包围盒与三角形, 约一半的测试命中
+    struct CalibrationScene
+    {
+    public:
+        std::vector<Ray> __rays__;
+        std::vector<Bounds> __bounds__;
+        std::vector<TriangleData> __triangles__;
+
+    public:
+        CalibrationScene()
+        {
+            RNG rng(0);
+            auto random_point = [&](float scale) { return glm::vec3{rng.Uniform() - 0.5f, rng.Uniform() - 0.5f, rng.Uniform() - 0.5f} * scale; };
+            for (size_t i = 0; i < CALIBRATION_RAY_COUNT; i++)
+            {
+                __rays__.push_back({random_point(2.f), glm::normalize(random_point(2.f) + 1e-6f)});
+            }
+            for (size_t i = 0; i < CALIBRATION_PRIMITIVE_COUNT; i++)
+            {
+                glm::vec3 center = random_point(1.f), extent = glm::abs(random_point(1.f)) + 0.05f;
+                __bounds__.push_back({center - extent, center + extent});
+                glm::vec3 p0 = random_point(1.f), p1 = p0 + random_point(1.f), p2 = p0 + random_point(1.f);
+                glm::vec3 normal = glm::normalize(glm::cross(p1 - p0, p2 - p0));
+                __triangles__.push_back({p0, p1, p2, normal, normal, normal});
+            }
+        }
+    };
+
+    static BVHCostCalibration MeasureBinaryCosts(const CalibrationScene &scene)
+    {
+        size_t test_count = scene.__rays__.size() * CALIBRATION_PRIMITIVE_COUNT;
+        double node_seconds = MeasureTestSeconds(test_count, [&]()
+                                                 {
+                                                     size_t hit_count = 0;
+                                                     for (const auto &ray : scene.__rays__)
+                                                     {
+                                                         glm::vec3 inv_dir = 1.f / ray.__direction__;
+                                                         for (const auto &bounds : scene.__bounds__)
+                                                         {
+                                                             hit_count += bounds.HasIntersection(ray, inv_dir, 0.f, std::numeric_limits<float>::infinity());
+                                                         }
+                                                     }
+                                                     return hit_count;
+                                                     // end
+                                                 });
+        double triangle_seconds = MeasureTestSeconds(test_count, [&]()
+                                                     {
+                                                         size_t hit_count = 0;
+                                                         for (const auto &ray : scene.__rays__)
+                                                         {
+                                                             for (const auto &triangle : scene.__triangles__)
+                                                             {
+                                                                 float t, u, v;
+                                                                 hit_count += internal::IntersectTriangle(triangle.__p0__, triangle.__p1__, triangle.__p2__, ray, 0.f, std::numeric_limits<float>::infinity(), t, u, v);
+                                                             }
+                                                         }
+                                                         return hit_count;
+                                                         // end
+                                                     });
+        return {1.f, static_cast<float>(triangle_seconds / node_seconds)};
+    }
+
+    template <typename WideNode>
+    static BVHCostCalibration MeasureWideCosts(const CalibrationScene &scene)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        std::vector<WideNode> nodes;
+        std::vector<TriangleBlock<N>> blocks;
+        for (size_t i = 0; i + N <= CALIBRATION_PRIMITIVE_COUNT; i += N)
+        {
+            WideBVHNode<N> node{};
+            auto &block = blocks.emplace_back();
+            for (size_t lane = 0; lane < N; lane++)
+            {
+                node.SetChild(lane, scene.__bounds__[i + lane], 0, 0);
+                block.SetTriangle(lane, scene.__triangles__[i + lane]);
+            }
+            if constexpr (std::is_same_v<WideNode, WideBVHNode<N>>)
+            {
+                nodes.push_back(node);
+            }
+            else
+            {
+                nodes.emplace_back(node);
+            }
+        }
+
+        size_t test_count = scene.__rays__.size() * nodes.size();
+        double node_seconds = MeasureTestSeconds(test_count, [&]()
+                                                 {
+                                                     size_t hit_count = 0;
+                                                     for (const auto &ray : scene.__rays__)
+                                                     {
+                                                         WideRay<N> wide_ray(ray);
+                                                         alignas(32) float t_near[N];
+                                                         for (const auto &node : nodes)
+                                                         {
+                                                             hit_count += IntersectWideNode(node, wide_ray, 0.f, std::numeric_limits<float>::infinity(), t_near);
+                                                         }
+                                                     }
+                                                     return hit_count;
+                                                     // end
+                                                 });
+        double block_seconds = MeasureTestSeconds(test_count, [&]()
+                                                  {
+                                                      size_t hit_count = 0;
+                                                      for (const auto &ray : scene.__rays__)
+                                                      {
+                                                          WideRay<N> wide_ray(ray);
+                                                          for (const auto &block : blocks)
+                                                          {
+                                                              float t_max = std::numeric_limits<float>::infinity();
+                                                              TriangleBlockHit hit{};
+                                                              hit_count += IntersectTriangleBlock(block, wide_ray, 0.f, t_max, hit);
+                                                          }
+                                                      }
+                                                      return hit_count;
+                                                      // end
+                                                  });
+        double traversal_seconds = node_seconds / glm::log2(static_cast<double>(N));
+        double intersection_seconds = block_seconds / N;
+        return {1.f, static_cast<float>(intersection_seconds / traversal_seconds)};
+    }
+
+    BVHCostCalibration MeasureBVHCosts(BVHLayout layout)
+    {
+        CalibrationScene scene;
+        switch (layout)
+        {
+        case BVHLayout::Wide4:
+            return MeasureWideCosts<WideBVHNode<4>>(scene);
+        case BVHLayout::Wide8:
+            return MeasureWideCosts<WideBVHNode<8>>(scene);
+        case BVHLayout::Wide4Quantized:
+            return MeasureWideCosts<QuantizedWideBVHNode<4>>(scene);
+        case BVHLayout::Wide8Quantized:
+            return MeasureWideCosts<QuantizedWideBVHNode<8>>(scene);
+        default:
+            return MeasureBinaryCosts(scene);
+        }
+    }
+
+    // 测量结果按布局保存在缓存目录, 格式为一行"traversal_cost intersection_cost"
+    static std::filesystem::path GetCalibrationPath(const BVHBuildSettings &settings)
+    {
+        auto directory = GetBVHCacheDirectory(settings);
+        return directory.empty() ? std::filesystem::path{} : directory / ("bvh-costs-" + std::to_string(static_cast<int>(settings.__layout__)) + ".txt");
+    }
+
+    static std::optional<BVHCostCalibration> ReadCalibration(const std::filesystem::path &path)
+    {
+        BVHCostCalibration loaded{};
+        std::ifstream file(path);
+        if (file >> loaded.__traversalCost__ >> loaded.__intersectionCost__ && loaded.__traversalCost__ > 0.f && loaded.__intersectionCost__ > 0.f)
+        {
+            return loaded;
+        }
+        return std::nullopt;
+    }
+
+    // 同一进程内每种布局的结果, 读取或测量后不再访问文件
+    static std::mutex CalibrationMutex;
+    static std::array<std::optional<BVHCostCalibration>, 5> Calibrations;
+
+    void CalibrateBVHCosts(BVHBuildSettings &settings)
+    {
+        std::lock_guard<std::mutex> lock(CalibrationMutex);
+        auto &calibration = Calibrations[static_cast<size_t>(settings.__layout__)];
+        if (!calibration.has_value())
+        {
+            auto path = GetCalibrationPath(settings);
+            calibration = ReadCalibration(path);
+            if (!calibration.has_value())
+            {
+                calibration = MeasureBVHCosts(settings.__layout__);
+                PBRT_INFO("BVH - Calibrated SAH Costs: traversal {:.2f}, intersection {:.2f}", calibration->__traversalCost__, calibration->__intersectionCost__);
+                if (!path.empty())
+                {
+                    std::error_code ec;
+                    std::filesystem::create_directories(path.parent_path(), ec);
+                    std::ofstream(path) << calibration->__traversalCost__ << " " << calibration->__intersectionCost__ << "\n";
+                }
+            }
+        }
+        settings.__traversalCost__ = calibration->__traversalCost__;
+        settings.__intersectionCost__ = calibration->__intersectionCost__;
+    }
+
+    bool LoadCalibratedBVHCosts(BVHBuildSettings &settings)
+    {
+        if (!settings.__loadCalibratedCosts__)
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(CalibrationMutex);
+        auto &calibration = Calibrations[static_cast<size_t>(settings.__layout__)];
+        if (!calibration.has_value())
+        {
+            // 没有保存的结果时不记录, 之后的CalibrateBVHCosts仍会测量
+            calibration = ReadCalibration(GetCalibrationPath(settings));
+            if (!calibration.has_value())
+            {
+                return false;
+            }
+            PBRT_DEBUG("BVH - Loaded Calibrated SAH Costs: traversal {:.2f}, intersection {:.2f}", calibration->__traversalCost__, calibration->__intersectionCost__);
+        }
+        settings.__traversalCost__ = calibration->__traversalCost__;
+        settings.__intersectionCost__ = calibration->__intersectionCost__;
+        return true;
+    }
+}
\ No newline at end of file
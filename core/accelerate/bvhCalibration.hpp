@@ -0,0 +1,33 @@
+﻿#pragma once
+#include "bvhBuilder.hpp"
+
+namespace pbrt
+{
+    // 本机测得的SAH代价常数, 以一次二叉节点访问为1
+    struct BVHCostCalibration
+    {
+    public:
+        float __traversalCost__;
+        float __intersectionCost__;
+    };
+
+    /*
+        用随机光线与随机包围盒/三角形的微基准测量layout下的节点测试与三角形测试耗时
+        二叉布局: 一次光线-包围盒slab测试, 一次标量Möller-Trumbore求交
+        宽布局: 构建器的SAH在二叉树上评估, 一次宽节点SIMD测试折算为log2(N)层二叉节点, 一次三角形块求交折算为N个三角形
+        耗时约数十毫秒, 结果只与CPU和编译选项有关
+    */
+    BVHCostCalibration MeasureBVHCosts(BVHLayout layout);
+
+    /*
+        为settings的布局填入本机SAH代价常数
+        优先读取缓存目录下保存的测量结果, 不存在时测量并写入; 同一进程内每种布局只读取或测量一次
+    */
+    void CalibrateBVHCosts(BVHBuildSettings &settings);
+
+    /*
+        只读取CalibrateBVHCosts保存的测量结果, 不进行测量, 返回是否读取到
+        __loadCalibratedCosts__关闭或结果不存在时settings保持不变(默认代价均为1)
+    */
+    bool LoadCalibratedBVHCosts(BVHBuildSettings &settings);
+}
\ No newline at end of file
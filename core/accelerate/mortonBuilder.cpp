@@ -0,0 +1,453 @@
+﻿#include "mortonBuilder.hpp"
+#include "thread/threadPool.hpp"
+#include <bit>
+#include <memory>
+
+namespace pbrt
+{
+    // 将10位整数的各位间隔两位展开, 用于交错xyz三个分量
+    static uint32_t ExpandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    static glm::vec3 GetCenter(const Bounds &bounds) { return (bounds.__bMin__ + bounds.__bMax__) * 0.5f; }
+
+    static size_t GetLeafCount(const MortonNode &node) { return (node.__nodeCount__ + 1) / 2; } // 满二叉树叶子数
+
+    BVHBuildResult MortonBuilder::Build(const std::vector<Bounds> &primitive_bounds)
+    {
+        BVHBuildResult result{};
+        size_t primitive_count = primitive_bounds.size();
+        if (primitive_count == 0)
+        {
+            return result;
+        }
+
+        ComputeMortonCodes(primitive_bounds);
+        RadixSort();
+
+        // 叶子按Morton序排列
+        mNodes.resize(primitive_count * 2 - 1);
+        MasterThreadPool.ParallelFor(primitive_count, [&](size_t i)
+                                     {
+                                         mNodes[i] = {.__bounds__ = primitive_bounds[mSortedPrimitives[i]]};
+                                         // end
+                                     });
+
+        if (primitive_count == 1)
+        {
+            mRoot = 0;
+        }
+        else if (mSettings.__builder__ == BVHBuilderType::PLOC)
+        {
+            ClusterPLOC();
+        }
+        else
+        {
+            EmitLBVH();
+        }
+        mMortonCodes.clear();
+        mMortonCodes.shrink_to_fit();
+
+        /*
+            展平: 顶层子树由调用线程写入, 叶子数不超过子树粒度的子树作为任务并行写入
+            左子节点紧随父节点, 右子节点位于左子树之后; 叶子按深度优先顺序写入图元索引
+        */
+        result.__nodes__.resize(mNodes[mRoot].__nodeCount__);
+        result.__primitiveIndices__.resize(primitive_count);
+        std::vector<MortonFlattenEntry> tasks;
+        FlattenSubtree({mRoot, 0, 0, 1}, result, result.__stats__, &tasks);
+
+        std::vector<BVHBuildStats> task_stats(tasks.size());
+        MasterThreadPool.ParallelFor(tasks.size(), [&](size_t i)
+                                     {
+                                         FlattenSubtree(tasks[i], result, task_stats[i], nullptr);
+                                         // end
+                                     });
+        for (const auto &stats : task_stats)
+        {
+            result.__stats__.Merge(stats);
+        }
+
+        mNodes.clear();
+        mNodes.shrink_to_fit();
+        mSortedPrimitives.clear();
+        mSortedPrimitives.shrink_to_fit();
+        return result;
+    }
+
+    void MortonBuilder::ComputeMortonCodes(const std::vector<Bounds> &primitive_bounds)
+    {
+        size_t primitive_count = primitive_bounds.size();
+
+        // 并行计算图元中心的包围盒
+        size_t chunk_count = internal::GetChunkCount(primitive_count);
+        std::vector<Bounds> chunk_bounds(chunk_count);
+        internal::ParallelChunks(0, primitive_count, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                 {
+                                     for (size_t i = begin; i < end; i++)
+                                     {
+                                         chunk_bounds[chunk_idx].Expand(GetCenter(primitive_bounds[i]));
+                                     }
+                                     // end
+                                 });
+        Bounds centroid_bounds{};
+        for (const auto &bounds : chunk_bounds)
+        {
+            centroid_bounds.Expand(bounds);
+        }
+
+        // 中心归一化到[0, 1023]³的网格后交错各位得到30位Morton码
+        glm::vec3 extent = centroid_bounds.GetDiagonal();
+        glm::vec3 scale{
+            extent.x > 0.f ? 1023.f / extent.x : 0.f,
+            extent.y > 0.f ? 1023.f / extent.y : 0.f,
+            extent.z > 0.f ? 1023.f / extent.z : 0.f};
+        mMortonCodes.resize(primitive_count);
+        mSortedPrimitives.resize(primitive_count);
+        MasterThreadPool.ParallelFor(primitive_count, [&](size_t i)
+                                     {
+                                         glm::vec3 grid = glm::clamp((GetCenter(primitive_bounds[i]) - centroid_bounds.__bMin__) * scale, 0.f, 1023.f);
+                                         mMortonCodes[i] = ExpandBits(static_cast<uint32_t>(grid.x)) * 4 + ExpandBits(static_cast<uint32_t>(grid.y)) * 2 + ExpandBits(static_cast<uint32_t>(grid.z));
+                                         mSortedPrimitives[i] = static_cast<uint32_t>(i);
+                                         // end
+                                     });
+    }
+
+    /*
+        并行LSD基数排序, 每趟8位, 30位Morton码共4趟
+        每趟: 各块统计直方图 → 按(桶, 块)顺序求前缀和得到每块每个桶的写入位置 → 各块分散写入, 保证排序稳定
+    */
+    void MortonBuilder::RadixSort()
+    {
+        constexpr size_t radix_bits = 8;
+        constexpr size_t radix_size = 1 << radix_bits;
+        size_t count = mMortonCodes.size();
+        size_t chunk_count = internal::GetChunkCount(count);
+        std::vector<uint32_t> codes_buffer(count), primitives_buffer(count);
+        std::vector<std::array<size_t, radix_size>> offsets(chunk_count);
+
+        for (size_t shift = 0; shift < 30; shift += radix_bits)
+        {
+            internal::ParallelChunks(0, count, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                     {
+                                         auto &histogram = offsets[chunk_idx];
+                                         histogram.fill(0);
+                                         for (size_t i = begin; i < end; i++)
+                                         {
+                                             histogram[(mMortonCodes[i] >> shift) & (radix_size - 1)]++;
+                                         }
+                                         // end
+                                     });
+
+            size_t offset = 0;
+            bool is_sorted = false; // 所有键在该位上相同, 本趟无需移动
+            for (size_t digit = 0; digit < radix_size; digit++)
+            {
+                size_t digit_count = 0;
+                for (size_t chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++)
+                {
+                    size_t chunk_digit_count = offsets[chunk_idx][digit];
+                    offsets[chunk_idx][digit] = offset;
+                    offset += chunk_digit_count;
+                    digit_count += chunk_digit_count;
+                }
+                is_sorted |= digit_count == count;
+            }
+            if (is_sorted)
+            {
+                continue;
+            }
+
+            internal::ParallelChunks(0, count, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                     {
+                                         auto &chunk_offsets = offsets[chunk_idx];
+                                         for (size_t i = begin; i < end; i++)
+                                         {
+                                             size_t dst = chunk_offsets[(mMortonCodes[i] >> shift) & (radix_size - 1)]++;
+                                             codes_buffer[dst] = mMortonCodes[i];
+                                             primitives_buffer[dst] = mSortedPrimitives[i];
+                                         }
+                                         // end
+                                     });
+            mMortonCodes.swap(codes_buffer);
+            mSortedPrimitives.swap(primitives_buffer);
+        }
+    }
+
+    /*
+        Karras, Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees
+        内部节点i ∈ [0, n - 1)覆盖的区间一端为i, 由相邻Morton码公共前缀长度δ的大小确定方向与另一端, 再二分查找区间内δ变化处作为划分位置
+        Morton码相同时以索引参与比较, 保证δ严格区分
+    */
+    void MortonBuilder::EmitLBVH()
+    {
+        int64_t primitive_count = static_cast<int64_t>(mMortonCodes.size());
+        int64_t inner_offset = primitive_count; // 内部节点i在mNodes中的索引为n + i
+        std::vector<int> parents(primitive_count * 2 - 1, -1);
+
+        auto delta = [&](int64_t i, int64_t j) -> int
+        {
+            if (j < 0 || j >= primitive_count)
+            {
+                return -1;
+            }
+            uint32_t code_i = mMortonCodes[i], code_j = mMortonCodes[j];
+            if (code_i == code_j)
+            {
+                return 32 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+            }
+            return std::countl_zero(code_i ^ code_j);
+        };
+
+        MasterThreadPool.ParallelFor(primitive_count - 1, [&](size_t idx)
+                                     {
+                                         int64_t i = static_cast<int64_t>(idx);
+                                         // 区间方向: 与公共前缀更长的一侧相邻
+                                         int64_t d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+                                         int delta_min = delta(i, i - d);
+
+                                         // 倍增确定区间长度上界, 再二分得到另一端j
+                                         int64_t l_max = 2;
+                                         while (delta(i, i + l_max * d) > delta_min)
+                                         {
+                                             l_max *= 2;
+                                         }
+                                         int64_t l = 0;
+                                         for (int64_t t = l_max / 2; t >= 1; t /= 2)
+                                         {
+                                             if (delta(i, i + (l + t) * d) > delta_min)
+                                             {
+                                                 l += t;
+                                             }
+                                         }
+                                         int64_t j = i + l * d;
+
+                                         // 二分查找区间内公共前缀变短的位置作为划分
+                                         int delta_node = delta(i, j);
+                                         int64_t s = 0, t = l;
+                                         do
+                                         {
+                                             t = (t + 1) / 2;
+                                             if (delta(i, i + (s + t) * d) > delta_node)
+                                             {
+                                                 s += t;
+                                             }
+                                         } while (t > 1);
+                                         int64_t gamma = i + s * d + glm::min<int64_t>(d, 0);
+
+                                         // 子区间只含一个图元时子节点为叶子
+                                         auto &node = mNodes[inner_offset + i];
+                                         node.__children__[0] = static_cast<int>(glm::min(i, j) == gamma ? gamma : inner_offset + gamma);
+                                         node.__children__[1] = static_cast<int>(glm::max(i, j) == gamma + 1 ? gamma + 1 : inner_offset + gamma + 1);
+                                         parents[node.__children__[0]] = static_cast<int>(inner_offset + i);
+                                         parents[node.__children__[1]] = static_cast<int>(inner_offset + i);
+                                         // end
+                                     });
+
+        // 自底向上合并包围盒: 每个叶子向上爬升, 后到达父节点的线程负责计算父节点, 先到达的线程退出
+        auto visit_counts = std::make_unique<std::atomic<uint32_t>[]>(primitive_count - 1);
+        MasterThreadPool.ParallelFor(primitive_count, [&](size_t leaf)
+                                     {
+                                         int node_idx = parents[leaf];
+                                         while (node_idx >= 0)
+                                         {
+                                             if (visit_counts[node_idx - inner_offset].fetch_add(1, std::memory_order_acq_rel) == 0)
+                                             {
+                                                 break;
+                                             }
+                                             auto &node = mNodes[node_idx];
+                                             const auto &left = mNodes[node.__children__[0]];
+                                             const auto &right = mNodes[node.__children__[1]];
+                                             node.__bounds__ = left.__bounds__;
+                                             node.__bounds__.Expand(right.__bounds__);
+                                             node.__nodeCount__ = left.__nodeCount__ + right.__nodeCount__ + 1;
+                                             node_idx = parents[node_idx];
+                                         }
+                                         // end
+                                     });
+        mRoot = static_cast<int>(inner_offset);
+    }
+
+    /*
+        Meister & Bittner, Parallel Locally-Ordered Clustering for Bounding Volume Hierarchy Construction
+        每轮: 并行为每个簇在Morton序半径r内寻找合并后表面积最小的邻居 → 互为最近邻的簇合并为新节点, 新簇留在较小索引处保持空间顺序
+        代价相同时依次比较索引距离、较小索引的奇偶与较小索引, 比较键只取决于簇对本身, 所有簇对之间存在全序
+        全局代价最小的一对必然互为最近邻, 每轮至少合并一对; 大量重合图元时相邻簇两两配对, 避免每轮只合并一对
+    */
+    void MortonBuilder::ClusterPLOC()
+    {
+        size_t primitive_count = mSortedPrimitives.size();
+        int64_t radius = static_cast<int64_t>(glm::max<size_t>(mSettings.__plocRadius__, 1));
+        std::vector<int> clusters(primitive_count), next_clusters(primitive_count);
+        std::vector<Bounds> cluster_bounds(primitive_count), next_cluster_bounds(primitive_count); // 与簇一一对应, 搜索时连续访问
+        std::vector<uint32_t> neighbors(primitive_count);
+        for (size_t i = 0; i < primitive_count; i++)
+        {
+            clusters[i] = static_cast<int>(i);
+            cluster_bounds[i] = mNodes[i].__bounds__;
+        }
+
+        // 簇对(i, j)的比较键: 合并代价, 索引距离, 较小索引的奇偶, 较小索引
+        auto is_closer = [](float cost, int64_t i, int64_t j, float best_cost, int64_t best_j)
+        {
+            if (cost != best_cost)
+            {
+                return cost < best_cost;
+            }
+            int64_t distance = glm::abs(i - j), best_distance = glm::abs(i - best_j);
+            if (distance != best_distance)
+            {
+                return distance < best_distance;
+            }
+            int64_t first = glm::min(i, j), best_first = glm::min(i, best_j);
+            if ((first & 1) != (best_first & 1))
+            {
+                return (first & 1) < (best_first & 1);
+            }
+            return first < best_first;
+        };
+
+        size_t next_node_idx = primitive_count;
+        while (clusters.size() > 1)
+        {
+            int64_t cluster_count = static_cast<int64_t>(clusters.size());
+
+            // 最近邻搜索
+            MasterThreadPool.ParallelFor(cluster_count, [&](size_t idx)
+                                         {
+                                             int64_t i = static_cast<int64_t>(idx);
+                                             Bounds bounds = cluster_bounds[i];
+                                             float min_cost = std::numeric_limits<float>::infinity();
+                                             int64_t neighbor = -1;
+                                             for (int64_t j = glm::max<int64_t>(i - radius, 0); j <= glm::min<int64_t>(i + radius, cluster_count - 1); j++)
+                                             {
+                                                 if (j == i)
+                                                 {
+                                                     continue;
+                                                 }
+                                                 // 合并包围盒表面积的一半, 只用于比较
+                                                 glm::vec3 diagonal = glm::max(bounds.__bMax__, cluster_bounds[j].__bMax__) - glm::min(bounds.__bMin__, cluster_bounds[j].__bMin__);
+                                                 float cost = diagonal.x * (diagonal.y + diagonal.z) + diagonal.y * diagonal.z;
+                                                 if (cost < min_cost || (cost == min_cost && is_closer(cost, i, j, min_cost, neighbor)))
+                                                 {
+                                                     min_cost = cost;
+                                                     neighbor = j;
+                                                 }
+                                             }
+                                             neighbors[i] = static_cast<uint32_t>(neighbor);
+                                             // end
+                                         });
+
+            // 合并与压缩分两趟: 各块统计新节点数与保留的簇数, 前缀和后各块并行写入
+            auto is_merge = [&](size_t i)
+            { return neighbors[neighbors[i]] == i && i < neighbors[i]; };
+            auto is_removed = [&](size_t i)
+            { return neighbors[neighbors[i]] == i && i > neighbors[i]; };
+
+            size_t chunk_count = internal::GetChunkCount(cluster_count);
+            std::vector<size_t> merge_offsets(chunk_count), cluster_offsets(chunk_count);
+            internal::ParallelChunks(0, cluster_count, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                     {
+                                         for (size_t i = begin; i < end; i++)
+                                         {
+                                             merge_offsets[chunk_idx] += is_merge(i);
+                                             cluster_offsets[chunk_idx] += !is_removed(i);
+                                         }
+                                         // end
+                                     });
+            size_t merge_count = 0, next_cluster_count = 0;
+            for (size_t chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++)
+            {
+                size_t chunk_merge_count = merge_offsets[chunk_idx], chunk_cluster_count = cluster_offsets[chunk_idx];
+                merge_offsets[chunk_idx] = next_node_idx + merge_count;
+                cluster_offsets[chunk_idx] = next_cluster_count;
+                merge_count += chunk_merge_count;
+                next_cluster_count += chunk_cluster_count;
+            }
+
+            next_clusters.resize(next_cluster_count);
+            next_cluster_bounds.resize(next_cluster_count);
+            internal::ParallelChunks(0, cluster_count, chunk_count, [&](size_t chunk_idx, size_t begin, size_t end)
+                                     {
+                                         size_t node_ptr = merge_offsets[chunk_idx];
+                                         size_t cluster_ptr = cluster_offsets[chunk_idx];
+                                         for (size_t i = begin; i < end; i++)
+                                         {
+                                             if (is_removed(i))
+                                             {
+                                                 continue;
+                                             }
+                                             if (!is_merge(i))
+                                             {
+                                                 next_cluster_bounds[cluster_ptr] = cluster_bounds[i];
+                                                 next_clusters[cluster_ptr++] = clusters[i];
+                                                 continue;
+                                             }
+                                             const auto &left = mNodes[clusters[i]];
+                                             const auto &right = mNodes[clusters[neighbors[i]]];
+                                             auto &node = mNodes[node_ptr];
+                                             node.__bounds__ = left.__bounds__;
+                                             node.__bounds__.Expand(right.__bounds__);
+                                             node.__children__[0] = clusters[i];
+                                             node.__children__[1] = clusters[neighbors[i]];
+                                             node.__nodeCount__ = left.__nodeCount__ + right.__nodeCount__ + 1;
+                                             next_cluster_bounds[cluster_ptr] = node.__bounds__;
+                                             next_clusters[cluster_ptr++] = static_cast<int>(node_ptr++);
+                                         }
+                                         // end
+                                     });
+            next_node_idx += merge_count;
+            clusters.swap(next_clusters);
+            cluster_bounds.swap(next_cluster_bounds);
+        }
+        mRoot = clusters[0];
+    }
+
+    void MortonBuilder::FlattenSubtree(const MortonFlattenEntry &entry, BVHBuildResult &result, BVHBuildStats &stats, std::vector<MortonFlattenEntry> *tasks) const
+    {
+        std::vector<MortonFlattenEntry> stack{entry};
+        while (!stack.empty())
+        {
+            auto current = stack.back();
+            stack.pop_back();
+            const auto &node = mNodes[current.__node__];
+            if (tasks != nullptr && current.__node__ != entry.__node__ && GetLeafCount(node) <= mSettings.__subtreeTaskGrain__)
+            {
+                tasks->push_back(current);
+                continue;
+            }
+
+            stats.__totalNodeCount__++;
+            auto &bvh_node = result.__nodes__[current.__slot__];
+            if (node.__children__[0] < 0) // 叶子节点, 索引即为Morton序位置
+            {
+                bvh_node = {node.__bounds__, static_cast<int>(current.__leafStart__), 1, 0};
+                result.__primitiveIndices__[current.__leafStart__] = mSortedPrimitives[current.__node__];
+                stats.AddLeafNode(1, current.__depth__);
+                continue;
+            }
+
+            // 以子节点中心相距最远的轴作为划分轴, 并保证左子节点在该轴上靠前, 与遍历时按光线方向选择先访问的子节点一致
+            int left_idx = node.__children__[0], right_idx = node.__children__[1];
+            glm::vec3 offset = GetCenter(mNodes[right_idx].__bounds__) - GetCenter(mNodes[left_idx].__bounds__);
+            glm::vec3 distance = glm::abs(offset);
+            uint8_t axis = distance.x >= distance.y ? (distance.x >= distance.z ? 0 : 2) : (distance.y >= distance.z ? 1 : 2);
+            if (offset[axis] < 0.f)
+            {
+                std::swap(left_idx, right_idx);
+            }
+
+            const auto &left = mNodes[left_idx];
+            size_t right_slot = current.__slot__ + 1 + left.__nodeCount__;
+            bvh_node = {node.__bounds__, static_cast<int>(right_slot), 0, axis};
+            stack.push_back({right_idx, right_slot, current.__leafStart__ + GetLeafCount(left), current.__depth__ + 1});
+            stack.push_back({left_idx, current.__slot__ + 1, current.__leafStart__, current.__depth__ + 1});
+        }
+    }
+}
\ No newline at end of file
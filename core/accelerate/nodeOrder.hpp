@@ -0,0 +1,259 @@
+﻿#pragma once
+#include "bounds.hpp"
+#include <algorithm>
+#include <array>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace pbrt
+{
+    // BVH节点在线性数组中的排列顺序
+    enum class BVHNodeOrder
+    {
+        DepthFirst, // 构建器输出的深度优先顺序, 子树连续, 但同一层的兄弟节点可能相距整个子树
+        Treelet     // 按SAH命中概率把节点聚成页大小的小树(treelet), 命中概率高的上层节点集中在数组前部少量页内
+    };
+
+    constexpr size_t BVH_TREELET_BYTES = 4096; // treelet的目标大小(一页)
+
+    // 二叉节点的__splitAxis__不小于该值时, 两个子节点已交换(右子节点紧随父节点, 左子节点由__right__引用), 划分轴为__splitAxis__ - BVH_SWAPPED_SPLIT_AXIS
+    constexpr uint8_t BVH_SWAPPED_SPLIT_AXIS = 3;
+
+    /*
+        二叉遍历以__splitAxis__查表决定是否先访问__right__引用的子节点
+        前3项为光线方向各分量是否为负(从右向左穿入, 先访问右子节点), 子节点交换过的节点查后3项, 结果取反
+    */
+    inline std::array<bool, 6> GetBinaryVisitOrder(const glm::vec3 &direction)
+    {
+        return {direction.x < 0, direction.y < 0, direction.z < 0, direction.x >= 0, direction.y >= 0, direction.z >= 0};
+    }
+
+    namespace internal
+    {
+        // 退化包围盒的表面积视为0
+        inline float GetOrderArea(const Bounds &bounds) { return bounds.IsValid() ? bounds.GetSurfaceArea() : 0.f; }
+
+        /*
+            计算节点的新排列, 返回new_order[k]为放在位置k的原节点索引; 输入与输出中父节点都排在子节点之前
+            children(node_idx, out)按槽位顺序追加数组中的子节点(原索引, 表面积)
+            chain_first_child为true时(二叉节点)每个内部节点之后必须紧随它的一个子节点
+            DepthFirst: 按槽位顺序前序遍历
+            Treelet: 从treelet根出发, 反复放置候选中表面积最大(命中概率最高)的节点, 放满treelet_size个节点后, 剩余候选成为新的treelet根
+                     新treelet按表面积从大到小紧接着父treelet放置, 不超过treelet_size的子树直接按深度优先连续放置
+                     二叉节点沿表面积较大的子节点连续放置, 命中概率高的路径上父子节点相邻
+        */
+        template <typename ChildrenFunc>
+        inline std::vector<uint32_t> ComputeNodeOrder(size_t node_count, BVHNodeOrder order, size_t treelet_size, bool chain_first_child, ChildrenFunc &&children)
+        {
+            std::vector<uint32_t> new_order;
+            if (node_count == 0)
+            {
+                return new_order;
+            }
+            new_order.reserve(node_count);
+            std::vector<std::pair<uint32_t, float>> node_children;
+
+            // 前序遍历子树, by_area为true时先放置表面积较大的子节点
+            std::vector<uint32_t> stack;
+            auto place_depth_first = [&](uint32_t root, bool by_area)
+            {
+                stack.push_back(root);
+                while (!stack.empty())
+                {
+                    uint32_t node_idx = stack.back();
+                    stack.pop_back();
+                    new_order.push_back(node_idx);
+                    node_children.clear();
+                    children(node_idx, node_children);
+                    if (by_area)
+                    {
+                        std::stable_sort(node_children.begin(), node_children.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+                    }
+                    for (size_t i = node_children.size(); i-- > 0;)
+                    {
+                        stack.push_back(node_children[i].first);
+                    }
+                }
+            };
+
+            if (order == BVHNodeOrder::DepthFirst)
+            {
+                place_depth_first(0, false);
+                return new_order;
+            }
+
+            std::vector<uint32_t> subtree_sizes(node_count, 1);
+            for (size_t i = node_count; i-- > 0;)
+            {
+                node_children.clear();
+                children(static_cast<uint32_t>(i), node_children);
+                for (const auto &[child, area] : node_children)
+                {
+                    subtree_sizes[i] += subtree_sizes[child];
+                }
+            }
+
+            std::vector<uint32_t> treelet_roots{0};
+            std::priority_queue<std::pair<float, uint32_t>> candidates; // (表面积, 原节点索引)
+            std::vector<uint32_t> child_roots;
+            while (!treelet_roots.empty())
+            {
+                uint32_t root = treelet_roots.back();
+                treelet_roots.pop_back();
+                if (subtree_sizes[root] <= treelet_size)
+                {
+                    place_depth_first(root, chain_first_child);
+                    continue;
+                }
+
+                candidates.push({0.f, root});
+                size_t placed_count = 0;
+                while (!candidates.empty() && placed_count < treelet_size)
+                {
+                    uint32_t node_idx = candidates.top().second;
+                    candidates.pop();
+                    while (true)
+                    {
+                        new_order.push_back(node_idx);
+                        placed_count++;
+                        node_children.clear();
+                        children(node_idx, node_children);
+                        if (node_children.empty())
+                        {
+                            break;
+                        }
+                        size_t next = node_children.size();
+                        if (chain_first_child)
+                        {
+                            next = 0;
+                            for (size_t i = 1; i < node_children.size(); i++)
+                            {
+                                if (node_children[i].second > node_children[next].second)
+                                {
+                                    next = i;
+                                }
+                            }
+                        }
+                        for (size_t i = 0; i < node_children.size(); i++)
+                        {
+                            if (i != next)
+                            {
+                                candidates.push({node_children[i].second, node_children[i].first});
+                            }
+                        }
+                        if (next == node_children.size())
+                        {
+                            break;
+                        }
+                        node_idx = node_children[next].first;
+                    }
+                }
+
+                // 候选按表面积降序出队, 逆序压栈使表面积最大的子treelet最先放置
+                child_roots.clear();
+                while (!candidates.empty())
+                {
+                    child_roots.push_back(candidates.top().second);
+                    candidates.pop();
+                }
+                treelet_roots.insert(treelet_roots.end(), child_roots.rbegin(), child_roots.rend());
+            }
+            return new_order;
+        }
+
+        inline std::vector<uint32_t> InvertNodeOrder(const std::vector<uint32_t> &new_order)
+        {
+            std::vector<uint32_t> new_indices(new_order.size());
+            for (size_t k = 0; k < new_order.size(); k++)
+            {
+                new_indices[new_order[k]] = static_cast<uint32_t>(k);
+            }
+            return new_indices;
+        }
+    }
+
+    /*
+        按order重排二叉线性节点, 返回原索引到新索引的映射
+        重排保持"一个子节点紧随父节点, 另一个由__right__引用"的约定, 紧随的是原右子节点时在__splitAxis__上记录交换
+        leaf_range(node) -> std::pair<size_t, size_t>与CollapseBVH相同, count为0表示内部节点
+    */
+    template <typename BinaryNode, typename LeafRangeFunc>
+    inline std::vector<uint32_t> ReorderBinaryBVH(std::vector<BinaryNode> &nodes, BVHNodeOrder order, LeafRangeFunc &&leaf_range)
+    {
+        if (nodes.size() < 2)
+        {
+            // 只有根节点时没有可重排的子节点(空场景的根节点图元数也为0, 不能当作内部节点)
+            return std::vector<uint32_t>(nodes.size(), 0);
+        }
+        auto new_order = internal::ComputeNodeOrder(nodes.size(), order, BVH_TREELET_BYTES / sizeof(BinaryNode), true, [&](uint32_t node_idx, std::vector<std::pair<uint32_t, float>> &children)
+                                                    {
+                                                        const auto &node = nodes[node_idx];
+                                                        if (leaf_range(node).second == 0)
+                                                        {
+                                                            children.push_back({node_idx + 1, internal::GetOrderArea(nodes[node_idx + 1].__bounds__)});
+                                                            children.push_back({static_cast<uint32_t>(node.__right__), internal::GetOrderArea(nodes[node.__right__].__bounds__)});
+                                                        }
+                                                        // end
+                                                    });
+        auto new_indices = internal::InvertNodeOrder(new_order);
+
+        std::vector<BinaryNode> reordered(nodes.size());
+        for (size_t k = 0; k < new_order.size(); k++)
+        {
+            auto node = nodes[new_order[k]];
+            if (leaf_range(node).second == 0)
+            {
+                uint32_t first = new_indices[new_order[k] + 1], second = new_indices[node.__right__];
+                if (first == k + 1)
+                {
+                    node.__right__ = static_cast<int>(second);
+                }
+                else
+                {
+                    node.__right__ = static_cast<int>(first);
+                    node.__splitAxis__ = node.__splitAxis__ >= BVH_SWAPPED_SPLIT_AXIS ? node.__splitAxis__ - BVH_SWAPPED_SPLIT_AXIS : node.__splitAxis__ + BVH_SWAPPED_SPLIT_AXIS;
+                }
+            }
+            reordered[k] = node;
+        }
+        nodes = std::move(reordered);
+        return new_indices;
+    }
+
+    // 按order重排宽节点(WideBVHNode或QuantizedWideBVHNode), 只改写内部子节点引用, 叶子引用不变; 返回原索引到新索引的映射
+    template <typename WideNode>
+    inline std::vector<uint32_t> ReorderWideBVH(std::vector<WideNode> &nodes, BVHNodeOrder order)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        auto new_order = internal::ComputeNodeOrder(nodes.size(), order, glm::max<size_t>(BVH_TREELET_BYTES / sizeof(WideNode), 1), false, [&](uint32_t node_idx, std::vector<std::pair<uint32_t, float>> &children)
+                                                    {
+                                                        const auto &node = nodes[node_idx];
+                                                        for (size_t i = 0; i < N; i++)
+                                                        {
+                                                            if (!node.IsEmpty(i) && !node.IsLeaf(i))
+                                                            {
+                                                                children.push_back({static_cast<uint32_t>(node.__children__[i]), internal::GetOrderArea(node.GetChildBounds(i))});
+                                                            }
+                                                        }
+                                                        // end
+                                                    });
+        auto new_indices = internal::InvertNodeOrder(new_order);
+
+        std::vector<WideNode> reordered;
+        reordered.reserve(nodes.size());
+        for (uint32_t node_idx : new_order)
+        {
+            auto &node = reordered.emplace_back(nodes[node_idx]);
+            for (size_t i = 0; i < N; i++)
+            {
+                if (!node.IsEmpty(i) && !node.IsLeaf(i))
+                {
+                    node.__children__[i] = static_cast<int>(new_indices[node.__children__[i]]);
+                }
+            }
+        }
+        nodes = std::move(reordered);
+        return new_indices;
+    }
+}
\ No newline at end of file
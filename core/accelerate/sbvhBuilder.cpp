@@ -0,0 +1,431 @@
+﻿#include "sbvhBuilder.hpp"
+#include <array>
+
+namespace pbrt
+{
+    // 退化包围盒的表面积视为0, 使空节点不影响代价
+    static float GetArea(const Bounds &bounds) { return bounds.IsValid() ? bounds.GetSurfaceArea() : 0.f; }
+
+    static Bounds GetIntersection(const Bounds &a, const Bounds &b) { return {glm::max(a.__bMin__, b.__bMin__), glm::min(a.__bMax__, b.__bMax__)}; }
+
+    static Bounds GetUnion(const Bounds &a, const Bounds &b)
+    {
+        Bounds bounds = a;
+        bounds.Expand(b);
+        return bounds;
+    }
+
+    static glm::vec3 GetCenter(const Bounds &bounds) { return (bounds.__bMin__ + bounds.__bMax__) * 0.5f; }
+
+    static size_t GetObjectBucketIdx(const Bounds &centroid_bounds, const glm::vec3 &centroid, size_t axis)
+    {
+        float extent = centroid_bounds.__bMax__[axis] - centroid_bounds.__bMin__[axis];
+        float offset = (centroid[axis] - centroid_bounds.__bMin__[axis]) * BVH_BUCKET_COUNT / extent;
+        if (offset >= static_cast<float>(BVH_BUCKET_COUNT - 1))
+        {
+            return BVH_BUCKET_COUNT - 1;
+        }
+        return offset > 0.f ? static_cast<size_t>(offset) : 0;
+    }
+
+    static size_t GetSpatialBinIdx(float origin, float bin_width, float value)
+    {
+        float offset = (value - origin) / bin_width;
+        if (offset >= static_cast<float>(SBVH_SPATIAL_BIN_COUNT - 1))
+        {
+            return SBVH_SPATIAL_BIN_COUNT - 1;
+        }
+        return offset > 0.f ? static_cast<size_t>(offset) : 0;
+    }
+
+    BVHBuildResult SBVHBuilder::Build(const TriangleMesh &mesh, const std::vector<Bounds> &triangle_bounds)
+    {
+        BVHBuildResult result{};
+        size_t triangle_count = mesh.GetTriangleCount();
+        if (triangle_count == 0)
+        {
+            return result;
+        }
+
+        mMesh = &mesh;
+        mResult = &result;
+
+        std::vector<SBVHReference> references(triangle_count);
+        Bounds root_bounds{};
+        for (size_t i = 0; i < triangle_count; i++)
+        {
+            references[i] = {triangle_bounds[i], static_cast<uint32_t>(i)};
+            root_bounds.Expand(triangle_bounds[i]);
+        }
+        mMinOverlapArea = mSettings.__sbvhOverlapThreshold__ * GetArea(root_bounds);
+        mReferenceCount = triangle_count;
+        mMaxReferenceCount = triangle_count + static_cast<size_t>(mSettings.__sbvhReferenceBudget__ * triangle_count);
+
+        result.__nodes__.reserve(triangle_count * 2);
+        result.__primitiveIndices__.reserve(mMaxReferenceCount);
+        BuildNode(std::move(references), root_bounds, 1);
+
+        mMesh = nullptr;
+        mResult = nullptr;
+        return result;
+    }
+
+    size_t SBVHBuilder::BuildNode(std::vector<SBVHReference> &&references, const Bounds &bounds, size_t depth)
+    {
+        auto &nodes = mResult->__nodes__;
+        auto &stats = mResult->__stats__;
+        stats.__totalNodeCount__++;
+        size_t idx = nodes.size();
+        nodes.push_back({bounds, 0, 0, 0});
+
+        auto make_leaf = [&]()
+        {
+            auto &primitive_indices = mResult->__primitiveIndices__;
+            nodes[idx].__triangleIdx__ = static_cast<int>(primitive_indices.size());
+            nodes[idx].__triangleCount__ = static_cast<uint16_t>(references.size());
+            for (const auto &reference : references)
+            {
+                primitive_indices.push_back(reference.__primitiveIdx__);
+            }
+            stats.AddLeafNode(references.size(), depth);
+            return idx;
+        };
+
+        // 单个引用直接作为叶子节点
+        if (references.size() == 1)
+        {
+            return make_leaf();
+        }
+
+        Bounds centroid_bounds{};
+        for (const auto &reference : references)
+        {
+            centroid_bounds.Expand(GetCenter(reference.__bounds__));
+        }
+
+        // 对象划分的子节点重叠较大时尝试空间划分
+        auto best_split = FindObjectSplit(references, centroid_bounds);
+        bool try_spatial = mReferenceCount < mMaxReferenceCount;
+        if (best_split.has_value())
+        {
+            try_spatial &= GetArea(GetIntersection(best_split->__left__, best_split->__right__)) > mMinOverlapArea;
+        }
+        if (try_spatial)
+        {
+            auto spatial_split = FindSpatialSplit(references, bounds);
+            if (spatial_split.has_value() && (!best_split.has_value() || spatial_split->__cost__ < best_split->__cost__))
+            {
+                best_split = spatial_split;
+            }
+        }
+
+        if (internal::ShouldCreateLeaf(mSettings, references.size(), GetArea(bounds), best_split.has_value() ? best_split->__cost__ : std::numeric_limits<float>::infinity()))
+        {
+            return make_leaf();
+        }
+
+        // 引用中心全部重合, 没有可用划分, 但引用数超过叶子上限时按顺序对半划分
+        auto split_middle = [&](std::vector<SBVHReference> &left, std::vector<SBVHReference> &right)
+        {
+            auto mid = references.begin() + references.size() / 2;
+            left.assign(references.begin(), mid);
+            right.assign(mid, references.end());
+        };
+
+        std::vector<SBVHReference> left, right;
+        uint8_t axis = 0;
+        if (!best_split.has_value())
+        {
+            split_middle(left, right);
+        }
+        else if (best_split->__isSpatial__)
+        {
+            PartitionSpatial(references, *best_split, left, right);
+            if (left.empty() || right.empty())
+            {
+                // 取消分割后一侧为空, 退回对象划分
+                left.clear();
+                right.clear();
+                best_split = FindObjectSplit(references, centroid_bounds);
+                if (!best_split.has_value())
+                {
+                    if (internal::ShouldCreateLeaf(mSettings, references.size(), GetArea(bounds), std::numeric_limits<float>::infinity()))
+                    {
+                        return make_leaf();
+                    }
+                    split_middle(left, right);
+                }
+                else
+                {
+                    PartitionObject(references, *best_split, centroid_bounds, left, right);
+                }
+            }
+        }
+        else
+        {
+            PartitionObject(references, *best_split, centroid_bounds, left, right);
+        }
+        if (best_split.has_value())
+        {
+            axis = best_split->__axis__;
+        }
+        mReferenceCount += left.size() + right.size() - references.size();
+        references.clear();
+        references.shrink_to_fit();
+
+        // 子节点包围盒由划分后的引用重新计算, 包含取消分割带来的变化
+        Bounds left_bounds{}, right_bounds{};
+        for (const auto &reference : left)
+        {
+            left_bounds.Expand(reference.__bounds__);
+        }
+        for (const auto &reference : right)
+        {
+            right_bounds.Expand(reference.__bounds__);
+        }
+
+        nodes[idx].__splitAxis__ = axis;
+        BuildNode(std::move(left), left_bounds, depth + 1); // 左子节点紧随其后
+        size_t right_idx = BuildNode(std::move(right), right_bounds, depth + 1);
+        nodes[idx].__right__ = static_cast<int>(right_idx); // 记录右子节点索引
+        return idx;
+    }
+
+    std::optional<SBVHSplit> SBVHBuilder::FindObjectSplit(const std::vector<SBVHReference> &references, const Bounds &centroid_bounds) const
+    {
+        std::optional<SBVHSplit> best_split;
+        auto extent = centroid_bounds.GetDiagonal();
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            if (!(extent[axis] > 0.f))
+            {
+                continue;
+            }
+
+            std::array<BVHBucket, BVH_BUCKET_COUNT> buckets{};
+            for (const auto &reference : references)
+            {
+                auto &bucket = buckets[GetObjectBucketIdx(centroid_bounds, GetCenter(reference.__bounds__), axis)];
+                bucket.__bounds__.Expand(reference.__bounds__);
+                bucket.__count__++;
+            }
+
+            std::array<BVHBucket, BVH_BUCKET_COUNT> right_buckets{};
+            BVHBucket right{};
+            for (size_t i = BVH_BUCKET_COUNT - 1; i > 0; i--)
+            {
+                right.Expand(buckets[i]);
+                right_buckets[i] = right;
+            }
+
+            BVHBucket left{};
+            for (size_t i = 1; i < BVH_BUCKET_COUNT; i++)
+            {
+                left.Expand(buckets[i - 1]);
+                const auto &right_bucket = right_buckets[i];
+                if (left.__count__ == 0 || right_bucket.__count__ == 0)
+                {
+                    continue;
+                }
+                float cost = GetArea(left.__bounds__) * left.__count__ + GetArea(right_bucket.__bounds__) * right_bucket.__count__;
+                if (!best_split.has_value() || cost < best_split->__cost__)
+                {
+                    best_split = SBVHSplit{
+                        .__isSpatial__ = false,
+                        .__axis__ = static_cast<uint8_t>(axis),
+                        .__cost__ = cost,
+                        .__bucketIdx__ = i,
+                        .__position__ = 0.f,
+                        .__left__ = left.__bounds__,
+                        .__right__ = right_bucket.__bounds__
+                        // end
+                    };
+                }
+            }
+        }
+        return best_split;
+    }
+
+    std::optional<SBVHSplit> SBVHBuilder::FindSpatialSplit(const std::vector<SBVHReference> &references, const Bounds &bounds) const
+    {
+        std::optional<SBVHSplit> best_split;
+        auto extent = bounds.GetDiagonal();
+        for (size_t axis = 0; axis < 3; axis++)
+        {
+            if (!(extent[axis] > 0.f))
+            {
+                continue;
+            }
+
+            // 每个引用在起止箱内计数, 跨越的每个箱内放入裁剪到该箱的部分
+            float origin = bounds.__bMin__[axis];
+            float bin_width = extent[axis] / SBVH_SPATIAL_BIN_COUNT;
+            std::array<SBVHSpatialBin, SBVH_SPATIAL_BIN_COUNT> bins{};
+            for (const auto &reference : references)
+            {
+                size_t first_bin = GetSpatialBinIdx(origin, bin_width, reference.__bounds__.__bMin__[axis]);
+                size_t last_bin = GetSpatialBinIdx(origin, bin_width, reference.__bounds__.__bMax__[axis]);
+                bins[first_bin].__entryCount__++;
+                bins[last_bin].__exitCount__++;
+                if (first_bin == last_bin)
+                {
+                    bins[first_bin].__bounds__.Expand(reference.__bounds__);
+                    continue;
+                }
+                for (size_t bin = first_bin; bin <= last_bin; bin++)
+                {
+                    float lower = origin + bin_width * bin;
+                    float upper = bin == SBVH_SPATIAL_BIN_COUNT - 1 ? bounds.__bMax__[axis] : origin + bin_width * (bin + 1);
+                    Bounds clipped = ClipReference(reference, axis, lower, upper);
+                    if (clipped.IsValid())
+                    {
+                        bins[bin].__bounds__.Expand(clipped);
+                    }
+                }
+            }
+
+            // 左侧按开始计数, 右侧按结束计数, 跨越平面的引用同时计入两侧
+            std::array<Bounds, SBVH_SPATIAL_BIN_COUNT> right_bounds{};
+            std::array<size_t, SBVH_SPATIAL_BIN_COUNT> right_counts{};
+            Bounds right{};
+            size_t right_count = 0;
+            for (size_t i = SBVH_SPATIAL_BIN_COUNT - 1; i > 0; i--)
+            {
+                right.Expand(bins[i].__bounds__);
+                right_count += bins[i].__exitCount__;
+                right_bounds[i] = right;
+                right_counts[i] = right_count;
+            }
+
+            Bounds left{};
+            size_t left_count = 0;
+            for (size_t i = 1; i < SBVH_SPATIAL_BIN_COUNT; i++)
+            {
+                left.Expand(bins[i - 1].__bounds__);
+                left_count += bins[i - 1].__entryCount__;
+                if (left_count == 0 || right_counts[i] == 0)
+                {
+                    continue;
+                }
+                float cost = GetArea(left) * left_count + GetArea(right_bounds[i]) * right_counts[i];
+                if (!best_split.has_value() || cost < best_split->__cost__)
+                {
+                    best_split = SBVHSplit{
+                        .__isSpatial__ = true,
+                        .__axis__ = static_cast<uint8_t>(axis),
+                        .__cost__ = cost,
+                        .__bucketIdx__ = 0,
+                        .__position__ = origin + bin_width * i,
+                        .__left__ = left,
+                        .__right__ = right_bounds[i]
+                        // end
+                    };
+                }
+            }
+        }
+        return best_split;
+    }
+
+    void SBVHBuilder::PartitionObject(std::vector<SBVHReference> &references, const SBVHSplit &split, const Bounds &centroid_bounds, std::vector<SBVHReference> &left, std::vector<SBVHReference> &right) const
+    {
+        for (const auto &reference : references)
+        {
+            bool is_left = GetObjectBucketIdx(centroid_bounds, GetCenter(reference.__bounds__), split.__axis__) < split.__bucketIdx__;
+            (is_left ? left : right).push_back(reference);
+        }
+    }
+
+    void SBVHBuilder::PartitionSpatial(std::vector<SBVHReference> &references, const SBVHSplit &split, std::vector<SBVHReference> &left, std::vector<SBVHReference> &right) const
+    {
+        size_t axis = split.__axis__;
+        float position = split.__position__;
+
+        // 完全位于平面一侧的引用直接归入该侧
+        std::vector<SBVHReference> straddling;
+        Bounds left_bounds{}, right_bounds{};
+        for (const auto &reference : references)
+        {
+            if (reference.__bounds__.__bMax__[axis] <= position)
+            {
+                left.push_back(reference);
+                left_bounds.Expand(reference.__bounds__);
+            }
+            else if (reference.__bounds__.__bMin__[axis] >= position)
+            {
+                right.push_back(reference);
+                right_bounds.Expand(reference.__bounds__);
+            }
+            else
+            {
+                straddling.push_back(reference);
+            }
+        }
+
+        /*
+            跨越平面的引用比较三种方案的代价, 取最小者:
+            分割: 裁剪后两侧各放一份; 取消分割: 整体放入左侧或右侧, 不增加引用数
+        */
+        constexpr float infinity = std::numeric_limits<float>::infinity();
+        for (const auto &reference : straddling)
+        {
+            SBVHReference left_part{ClipReference(reference, axis, -infinity, position), reference.__primitiveIdx__};
+            SBVHReference right_part{ClipReference(reference, axis, position, infinity), reference.__primitiveIdx__};
+            float left_count = static_cast<float>(left.size()), right_count = static_cast<float>(right.size());
+            float split_cost = infinity;
+            if (left_part.__bounds__.IsValid() && right_part.__bounds__.IsValid())
+            {
+                split_cost = GetArea(GetUnion(left_bounds, left_part.__bounds__)) * (left_count + 1) + GetArea(GetUnion(right_bounds, right_part.__bounds__)) * (right_count + 1);
+            }
+            float left_cost = GetArea(GetUnion(left_bounds, reference.__bounds__)) * (left_count + 1) + GetArea(right_bounds) * right_count;
+            float right_cost = GetArea(left_bounds) * left_count + GetArea(GetUnion(right_bounds, reference.__bounds__)) * (right_count + 1);
+
+            if (split_cost < left_cost && split_cost < right_cost)
+            {
+                left.push_back(left_part);
+                left_bounds.Expand(left_part.__bounds__);
+                right.push_back(right_part);
+                right_bounds.Expand(right_part.__bounds__);
+            }
+            else if (left_cost <= right_cost)
+            {
+                left.push_back(reference);
+                left_bounds.Expand(reference.__bounds__);
+            }
+            else
+            {
+                right.push_back(reference);
+                right_bounds.Expand(reference.__bounds__);
+            }
+        }
+    }
+
+    /*
+        依次检查三角形的三条边: 位于平板内的顶点以及与两个边界平面的交点构成裁剪后多边形的顶点
+        结果再与引用当前的包围盒求交, 保证多次裁剪后的引用不会超出之前的范围
+    */
+    Bounds SBVHBuilder::ClipReference(const SBVHReference &reference, size_t axis, float lower, float upper) const
+    {
+        const glm::vec3 vertices[3] = {mMesh->GetPosition(reference.__primitiveIdx__, 0), mMesh->GetPosition(reference.__primitiveIdx__, 1), mMesh->GetPosition(reference.__primitiveIdx__, 2)};
+        Bounds clipped{};
+        for (size_t i = 0; i < 3; i++)
+        {
+            const auto &a = vertices[i];
+            const auto &b = vertices[(i + 1) % 3];
+            if (a[axis] >= lower && a[axis] <= upper)
+            {
+                clipped.Expand(a);
+            }
+            for (float plane : {lower, upper})
+            {
+                if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
+                {
+                    float t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    glm::vec3 point = glm::mix(a, b, t);
+                    point[axis] = plane;
+                    clipped.Expand(point);
+                }
+            }
+        }
+        return GetIntersection(clipped, reference.__bounds__);
+    }
+}
\ No newline at end of file
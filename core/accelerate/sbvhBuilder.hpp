@@ -0,0 +1,66 @@
+﻿#pragma once
+#include "bvhBuilder.hpp"
+#include "shape/triangleMesh.hpp"
+
+namespace pbrt
+{
+    // 三角形引用, 空间划分后同一三角形的多个引用各自持有裁剪后的包围盒
+    struct SBVHReference
+    {
+    public:
+        Bounds __bounds__;
+        uint32_t __primitiveIdx__;
+    };
+
+    constexpr size_t SBVH_SPATIAL_BIN_COUNT = 32; // 空间划分的分箱数量
+
+    struct SBVHSpatialBin
+    {
+    public:
+        Bounds __bounds__{};
+        size_t __entryCount__{}; // 在该箱内开始的引用数
+        size_t __exitCount__{};  // 在该箱内结束的引用数
+    };
+
+    // 节点划分方案: 对象划分按中心分桶, 空间划分按平面切分
+    struct SBVHSplit
+    {
+    public:
+        bool __isSpatial__;
+        uint8_t __axis__;
+        float __cost__;
+        size_t __bucketIdx__; // 对象划分: 桶索引小于该值的引用属于左子节点
+        float __position__;   // 空间划分: 划分平面位置
+        Bounds __left__, __right__;
+    };
+
+    /*
+        空间划分BVH(Stich et al. 2009, Spatial Splits in Bounding Volume Hierarchies)
+        每个节点先求分桶SAH对象划分, 当左右子节点重叠面积超过阈值时, 再沿三轴分箱求空间划分:
+        跨越多个箱的三角形被裁剪到每个箱内, 划分时跨越平面的引用复制到两侧, 并比较整体移到一侧(取消分割)的代价
+        复制的引用总数不超过__sbvhReferenceBudget__, 超出后只做对象划分
+    */
+    class SBVHBuilder
+    {
+    private:
+        BVHBuildSettings mSettings;
+        const TriangleMesh *mMesh = nullptr;
+        BVHBuildResult *mResult = nullptr;
+        float mMinOverlapArea = 0.f;   // 触发空间划分的重叠面积
+        size_t mMaxReferenceCount = 0; // 引用数上限
+        size_t mReferenceCount = 0;
+
+    public:
+        SBVHBuilder(const BVHBuildSettings &settings = {}) : mSettings(settings) {}
+
+        BVHBuildResult Build(const TriangleMesh &mesh, const std::vector<Bounds> &triangle_bounds);
+
+    private:
+        size_t BuildNode(std::vector<SBVHReference> &&references, const Bounds &bounds, size_t depth); // 递归构建, 返回节点索引
+        std::optional<SBVHSplit> FindObjectSplit(const std::vector<SBVHReference> &references, const Bounds &centroid_bounds) const;
+        std::optional<SBVHSplit> FindSpatialSplit(const std::vector<SBVHReference> &references, const Bounds &bounds) const;
+        void PartitionObject(std::vector<SBVHReference> &references, const SBVHSplit &split, const Bounds &centroid_bounds, std::vector<SBVHReference> &left, std::vector<SBVHReference> &right) const;
+        void PartitionSpatial(std::vector<SBVHReference> &references, const SBVHSplit &split, std::vector<SBVHReference> &left, std::vector<SBVHReference> &right) const;
+        Bounds ClipReference(const SBVHReference &reference, size_t axis, float lower, float upper) const; // 三角形在[lower, upper]平板内部分的包围盒
+    };
+}
\ No newline at end of file
@@ -1,15 +1,94 @@
 ﻿#include "sceneBVH.hpp"
+#include "thread/taskGroup.hpp"
 #include "utils/debugMacro.hpp"
 #include "utils/logger.hpp"
 #include <array>
+#include <type_traits>
 
 namespace pbrt
 {
-    void SceneBVH::Build(std::vector<ShapeBVHInfo> &&shapeBVHInfos)
+    // 光线命中实例的世界包围盒后才变换到对象空间求交, 叶子中的多个实例各自剔除
+    static bool IntersectInstance(const SceneInstance &instance, uint32_t instance_idx, const Ray &ray, const glm::vec3 &inv_dir, float t_min, float &t_max, PrimitiveHit &hit)
     {
+        DEBUG_INFO(ray.__boundsTestCount__++)
+        if (!instance.__bounds__.HasIntersection(ray, inv_dir, t_min, t_max))
+        {
+            return false;
+        }
+        auto ray_object = ray.ObjectFromWorld(instance.__objectFromWorld__);
+        bool is_hit = instance.__shape__->IntersectPrimitive(ray_object, t_min, t_max, hit);
+        DEBUG_INFO(ray.__boundsTestCount__ += ray_object.__boundsTestCount__);
+        DEBUG_INFO(ray.__triangleTestCount__ += ray_object.__triangleTestCount__);
+        if (is_hit)
+        {
+            hit.PushInstance(instance_idx);
+        }
+        return is_hit;
+    }
+
+    static bool OccludedInstance(const SceneInstance &instance, const Ray &ray, const glm::vec3 &inv_dir, float t_min, float t_max)
+    {
+        DEBUG_INFO(ray.__boundsTestCount__++)
+        if (!instance.__bounds__.HasIntersection(ray, inv_dir, t_min, t_max))
+        {
+            return false;
+        }
+        auto ray_object = ray.ObjectFromWorld(instance.__objectFromWorld__);
+        bool is_occluded = instance.__shape__->Occluded(ray_object, t_min, t_max);
+        DEBUG_INFO(ray.__boundsTestCount__ += ray_object.__boundsTestCount__);
+        DEBUG_INFO(ray.__triangleTestCount__ += ray_object.__triangleTestCount__);
+        return is_occluded;
+    }
+
+    /*
+        对象空间的交点与法线变换回世界空间, 法线用逆变换的转置变换
+        物体自身给出材质时(合并后的场景BVH, 嵌套实例组中指定了材质的实例)保留, 否则继承实例的材质
+    */
+    static void WorldFromObject(HitInfo &hit_info, const ShapeBVHInfo &shapeBVHInfo)
+    {
+        hit_info.__hitPoint__ = shapeBVHInfo.__worldFromObject__.TransformPoint(hit_info.__hitPoint__);
+        hit_info.__normal__ = glm::normalize(shapeBVHInfo.__objectFromWorld__.TransformTransposed(hit_info.__normal__));
+        if (!hit_info.__material__)
+        {
+            hit_info.__material__ = shapeBVHInfo.__material__;
+        }
+    }
+
+    // 叶子的实例区间, 数量为0表示内部节点
+    static std::pair<size_t, size_t> GetLeafRange(const SceneBVHNode &node)
+    {
+        return {node.__shapeBVHInfoCount__ == 0 ? 0 : node.__shapeBVHInfoIdx__, node.__shapeBVHInfoCount__};
+    }
+
+    static SceneInstance MakeSceneInstance(const ShapeBVHInfo &shapeBVHInfo)
+    {
+        return {shapeBVHInfo.__bounds__, shapeBVHInfo.__objectFromWorld__, shapeBVHInfo.__shape__};
+    }
+
+    void SceneBVH::Build(std::vector<ShapeBVHInfo> &&shapeBVHInfos, BVHLayout layout, BVHNodeOrder order)
+    {
+        mLayout = layout;
+        mOrder = order;
+        mNodes.clear();
+        mOrderedShapeBVHInfos.clear();
+        mInfinityShapeBVHInfos.clear();
+        mNodeAllocator.Clear();
         auto shapeBVHInfos_temp = std::move(shapeBVHInfos);
+
+        /*
+            命中记录逐层压入实例索引, 超过MAX_INSTANCE_DEPTH层时最内层的索引被丢弃, 命中会解析到错误的实例
+            AddShape已拒绝过深的物体, 这里只跳过加入后才加深的实例(如加入后又重新Build的实例组), 其余实例照常构建
+        */
+        mInstanceDepth = 1;
         for (auto &shapeBVHInfo : shapeBVHInfos_temp)
         {
+            size_t instance_depth = shapeBVHInfo.__shape__->GetInstanceDepth() + 1;
+            if (instance_depth > MAX_INSTANCE_DEPTH)
+            {
+                PBRT_ERROR("Scene - Instance depth {} exceeds the maximum {}, skipping the instance", instance_depth, MAX_INSTANCE_DEPTH);
+                continue;
+            }
+            mInstanceDepth = glm::max(mInstanceDepth, instance_depth);
             if (shapeBVHInfo.__shape__->GetBounds().IsValid())
             {
                 shapeBVHInfo.UpdateBounds();
@@ -21,49 +100,332 @@ namespace pbrt
             }
         }
 
-        mRoot = mNodeAllocator.Allocate();
-        mRoot->__start__ = 0;
-        mRoot->__end__ = mOrderedShapeBVHInfos.size();
-        mRoot->__bounds__ = {};
+        // 没有有限大小的实例时(如删除了全部物体)不生成节点, 遍历与Refit都跳过空树, 只处理无限大物体
+        mRoot = nullptr;
+        mBounds = {};
+        if (!mOrderedShapeBVHInfos.empty())
+        {
+            mRoot = mNodeAllocator.Allocate();
+            mRoot->__start__ = 0;
+            mRoot->__end__ = mOrderedShapeBVHInfos.size();
+            mRoot->__bounds__ = {};
+            for (const auto &shapeBVHInfo : mOrderedShapeBVHInfos)
+            {
+                mRoot->__bounds__.Expand(shapeBVHInfo.__bounds__);
+            }
+            mRoot->__depth__ = 1;
+
+            SceneBVHState state{};
+            size_t shapeBVHInfo_count = mOrderedShapeBVHInfos.size();
+            RecursiveSplit(mRoot, state);
+
+            PBRT_INFO("--Scene BVH State--");
+            PBRT_DEBUG("Scene - Total Node Count: {}", (size_t)state.__totalNodeCount__);
+            PBRT_DEBUG("Scene - Leaf Node Count: {}", state.__leafNodeCount__);
+            PBRT_DEBUG("Scene - ShapeBVHInfo Count: {}", shapeBVHInfo_count);
+            PBRT_DEBUG("Scene - Mean Leaf Node ShapeBVHInfo Count: {}", static_cast<float>(shapeBVHInfo_count) / static_cast<float>(state.__leafNodeCount__));
+            PBRT_DEBUG("Scene - Max Leaf Node ShapeBVHInfo Count: {}", state.__maxLeafNodeShapeBVHInfoCount__);
+            PBRT_DEBUG("Scene - Max Tree Depth: {}", state.__maxTreeDepth__);
+
+            // 预分配内存
+            mNodes.reserve(state.__totalNodeCount__);
+            RecursiveFlatten(mRoot);
+            mBounds = mNodes[0].__bounds__;
+        }
+
+        // 划分完成后实例顺序确定, 按同样的顺序提取热数据
+        size_t transform_type_counts[3] = {};
+        mInstances.clear();
+        mInstances.reserve(mOrderedShapeBVHInfos.size());
         for (const auto &shapeBVHInfo : mOrderedShapeBVHInfos)
         {
-            mRoot->__bounds__.Expand(shapeBVHInfo.__bounds__);
+            mInstances.push_back(MakeSceneInstance(shapeBVHInfo));
+            transform_type_counts[static_cast<size_t>(shapeBVHInfo.__objectFromWorld__.__type__)]++;
+        }
+        mInfinityInstances.clear();
+        for (const auto &shapeBVHInfo : mInfinityShapeBVHInfos)
+        {
+            mInfinityInstances.push_back(MakeSceneInstance(shapeBVHInfo));
+        }
+        PBRT_DEBUG("Scene - Identity / Translation / General Instance Count: {} / {} / {}", transform_type_counts[0], transform_type_counts[1], transform_type_counts[2]);
+
+        // 实例id到下标的映射, 无限大物体排在有限物体之后
+        mInstanceSlots.clear();
+        auto add_instance_slot = [&](const ShapeBVHInfo &shapeBVHInfo, size_t slot)
+        {
+            if (shapeBVHInfo.__id__ == INVALID_SCENE_SHAPE_ID)
+            {
+                return;
+            }
+            if (shapeBVHInfo.__id__ >= mInstanceSlots.size())
+            {
+                mInstanceSlots.resize(shapeBVHInfo.__id__ + 1, INVALID_SCENE_SHAPE_ID);
+            }
+            mInstanceSlots[shapeBVHInfo.__id__] = static_cast<uint32_t>(slot);
+        };
+        for (size_t i = 0; i < mOrderedShapeBVHInfos.size(); i++)
+        {
+            add_instance_slot(mOrderedShapeBVHInfos[i], i);
+        }
+        for (size_t i = 0; i < mInfinityShapeBVHInfos.size(); i++)
+        {
+            add_instance_slot(mInfinityShapeBVHInfos[i], mOrderedShapeBVHInfos.size() + i);
+        }
+
+        if (mLayout == BVHLayout::Binary)
+        {
+            ReorderBinaryBVH(mNodes, mOrder, GetLeafRange);
+        }
+        BuildWideNodes();
+        mBuildSAHCost = GetSAHCost();
+        PBRT_DEBUG("Scene - Binary / Wide4 / Wide8 Node Count: {} / {} / {}", mNodes.size(), glm::max(mWideNodes4.size(), mQuantizedNodes4.size()), glm::max(mWideNodes8.size(), mQuantizedNodes8.size()));
+        PBRT_DEBUG("Scene - SAH Cost: {:.2f}", mBuildSAHCost);
+    }
+
+    bool SceneBVH::Refit(std::span<const ShapeBVHInfo> shapeBVHInfos)
+    {
+        for (const auto &shapeBVHInfo : shapeBVHInfos)
+        {
+            uint32_t slot = shapeBVHInfo.__id__ < mInstanceSlots.size() ? mInstanceSlots[shapeBVHInfo.__id__] : INVALID_SCENE_SHAPE_ID;
+            if (slot == INVALID_SCENE_SHAPE_ID)
+            {
+                PBRT_WARN("Scene - Refit: instance {} is not in the scene BVH", shapeBVHInfo.__id__);
+                continue;
+            }
+            if (slot < mInstances.size())
+            {
+                auto &ordered_shapeBVHInfo = mOrderedShapeBVHInfos[slot];
+                ordered_shapeBVHInfo = shapeBVHInfo;
+                ordered_shapeBVHInfo.UpdateBounds();
+                mInstances[slot] = MakeSceneInstance(ordered_shapeBVHInfo);
+            }
+            else
+            {
+                mInfinityShapeBVHInfos[slot - mInstances.size()] = shapeBVHInfo;
+                mInfinityInstances[slot - mInstances.size()] = MakeSceneInstance(shapeBVHInfo);
+            }
+        }
+
+        // 父节点总排在子节点之前(见ComputeNodeOrder), 逆序遍历即自底向上
+        if (!mInstances.empty())
+        {
+            for (size_t i = mNodes.size(); i-- > 0;)
+            {
+                auto &node = mNodes[i];
+                node.__bounds__ = {};
+                if (node.__shapeBVHInfoCount__ == 0)
+                {
+                    node.__bounds__.Expand(mNodes[i + 1].__bounds__);
+                    node.__bounds__.Expand(mNodes[node.__right__].__bounds__);
+                }
+                else
+                {
+                    for (size_t j = node.__shapeBVHInfoIdx__; j < node.__shapeBVHInfoIdx__ + node.__shapeBVHInfoCount__; j++)
+                    {
+                        node.__bounds__.Expand(mInstances[j].__bounds__);
+                    }
+                }
+            }
         }
-        mRoot->__depth__ = 1;
+        mBounds = mNodes.empty() ? Bounds{} : mNodes[0].__bounds__;
+        RefitWideNodes();
+
+        return GetSAHCost() <= mBuildSAHCost * SCENE_BVH_MAX_REFIT_COST_RATIO;
+    }
 
-        SceneBVHState state{};
-        size_t shapeBVHInfo_count = mOrderedShapeBVHInfos.size();
-        RecursiveSplit(mRoot, state);
-        MasterThreadPool.Wait();
+    void SceneBVH::BuildWideNodes()
+    {
+        if (GetBVHLayoutWidth(mLayout) == 4)
+        {
+            CollapseBVH(mNodes, mWideNodes4, GetLeafRange);
+            ReorderWideBVH(mWideNodes4, mOrder);
+            if (IsQuantizedBVHLayout(mLayout))
+            {
+                QuantizeWideBVH(mWideNodes4, mQuantizedNodes4);
+                mWideNodes4.clear();
+            }
+        }
+        else if (GetBVHLayoutWidth(mLayout) == 8)
+        {
+            CollapseBVH(mNodes, mWideNodes8, GetLeafRange);
+            ReorderWideBVH(mWideNodes8, mOrder);
+            if (IsQuantizedBVHLayout(mLayout))
+            {
+                QuantizeWideBVH(mWideNodes8, mQuantizedNodes8);
+                mWideNodes8.clear();
+            }
+        }
+    }
+
+    // 重排后父节点仍排在子节点之前, 逆序遍历时内部子节点的包围盒已经就绪
+    template <typename WideNode>
+    static void RefitWideBVH(std::vector<WideNode> &nodes, std::span<const SceneInstance> instances)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        std::vector<Bounds> node_bounds(nodes.size());
+        for (size_t node_idx = nodes.size(); node_idx-- > 0;)
+        {
+            const auto &node = nodes[node_idx];
+            WideBVHNode<N> refit_node{};
+            Bounds bounds{};
+            for (size_t i = 0; i < N; i++)
+            {
+                if (node.IsEmpty(i))
+                {
+                    continue;
+                }
+                Bounds child_bounds{};
+                if (node.IsLeaf(i))
+                {
+                    for (size_t j = node.__children__[i]; j < node.__children__[i] + node.__counts__[i]; j++)
+                    {
+                        child_bounds.Expand(instances[j].__bounds__);
+                    }
+                }
+                else
+                {
+                    child_bounds = node_bounds[node.__children__[i]];
+                }
+                refit_node.SetChild(i, child_bounds, node.__children__[i], node.__counts__[i]);
+                bounds.Expand(child_bounds);
+            }
+            node_bounds[node_idx] = bounds;
+            if constexpr (std::is_same_v<WideNode, WideBVHNode<N>>)
+            {
+                nodes[node_idx] = refit_node;
+            }
+            else
+            {
+                nodes[node_idx] = WideNode(refit_node);
+            }
+        }
+    }
 
-        PBRT_INFO("--Scene BVH State--");
-        PBRT_DEBUG("Scene - Total Node Count: {}", (size_t)state.__totalNodeCount__);
-        PBRT_DEBUG("Scene - Leaf Node Count: {}", state.__leafNodeCount__);
-        PBRT_DEBUG("Scene - ShapeBVHInfo Count: {}", shapeBVHInfo_count);
-        PBRT_DEBUG("Scene - Mean Leaf Node ShapeBVHInfo Count: {}", static_cast<float>(shapeBVHInfo_count) / static_cast<float>(state.__leafNodeCount__));
-        PBRT_DEBUG("Scene - Max Leaf Node ShapeBVHInfo Count: {}", state.__maxLeafNodeShapeBVHInfoCount__);
-        PBRT_DEBUG("Scene - Max Tree Depth: {}", state.__maxTreeDepth__);
+    void SceneBVH::RefitWideNodes()
+    {
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            RefitWideBVH(mWideNodes4, mInstances);
+            break;
+        case BVHLayout::Wide8:
+            RefitWideBVH(mWideNodes8, mInstances);
+            break;
+        case BVHLayout::Wide4Quantized:
+            RefitWideBVH(mQuantizedNodes4, mInstances);
+            break;
+        case BVHLayout::Wide8Quantized:
+            RefitWideBVH(mQuantizedNodes8, mInstances);
+            break;
+        default:
+            break;
+        }
+    }
 
-        // 预分配内存
-        mNodes.reserve(state.__totalNodeCount__);
-        RecursiveFlatten(mRoot);
+    // 以根节点表面积归一化的SAH代价, 内部节点按1次包围盒测试, 叶子按实例数计
+    float SceneBVH::GetSAHCost() const
+    {
+        if (mInstances.empty() || !mBounds.IsValid() || mBounds.GetSurfaceArea() == 0.f)
+        {
+            return 0.f;
+        }
+        float cost = 0.f;
+        for (const auto &node : mNodes)
+        {
+            float area = node.__bounds__.IsValid() ? node.__bounds__.GetSurfaceArea() : 0.f;
+            cost += area * (node.__shapeBVHInfoCount__ == 0 ? 1.f : static_cast<float>(node.__shapeBVHInfoCount__));
+        }
+        return cost / mBounds.GetSurfaceArea();
     }
 
-    std::optional<HitInfo> SceneBVH::Intersect(const Ray &ray, float t_min, float t_max) const
+    bool SceneBVH::IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
     {
-        std::optional<HitInfo> closest_hit_info;
-        const ShapeBVHInfo *closest_shapeBVHInfo = nullptr;
+        bool is_hit = false;
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            is_hit = IntersectWide(mWideNodes4, ray, t_min, t_max, hit);
+            break;
+        case BVHLayout::Wide8:
+            is_hit = IntersectWide(mWideNodes8, ray, t_min, t_max, hit);
+            break;
+        case BVHLayout::Wide4Quantized:
+            is_hit = IntersectWide(mQuantizedNodes4, ray, t_min, t_max, hit);
+            break;
+        case BVHLayout::Wide8Quantized:
+            is_hit = IntersectWide(mQuantizedNodes8, ray, t_min, t_max, hit);
+            break;
+        default:
+            is_hit = IntersectBinary(ray, t_min, t_max, hit);
+            break;
+        }
+
+        for (size_t i = 0; i < mInfinityInstances.size(); i++)
+        {
+            const auto &infinity_instance = mInfinityInstances[i];
+            auto ray_object = ray.ObjectFromWorld(infinity_instance.__objectFromWorld__);
+            bool is_infinity_hit = infinity_instance.__shape__->IntersectPrimitive(ray_object, t_min, t_max, hit);
+            DEBUG_INFO(ray.__boundsTestCount__ += ray_object.__boundsTestCount__);
+            DEBUG_INFO(ray.__triangleTestCount__ += ray_object.__triangleTestCount__);
+            if (is_infinity_hit)
+            {
+                hit.PushInstance(static_cast<uint32_t>(mInstances.size() + i));
+                is_hit = true;
+            }
+        }
+        return is_hit;
+    }
+
+    HitInfo SceneBVH::GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const
+    {
+        // 实例下标之后依次为无限大物体
+        uint32_t instance_idx = hit.__instanceIdx__[0];
+        bool is_infinity = instance_idx >= mInstances.size();
+        const auto &instance = is_infinity ? mInfinityInstances[instance_idx - mInstances.size()] : mInstances[instance_idx];
+        const auto &shapeBVHInfo = is_infinity ? mInfinityShapeBVHInfos[instance_idx - mInstances.size()] : mOrderedShapeBVHInfos[instance_idx];
+        auto hit_info = instance.__shape__->GetHitInfo(ray.ObjectFromWorld(instance.__objectFromWorld__), hit.PopInstance());
+        WorldFromObject(hit_info, shapeBVHInfo);
+        return hit_info;
+    }
+
+    template <typename WideNode>
+    bool SceneBVH::IntersectWide(const std::vector<WideNode> &nodes, const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        bool is_hit = false;
+        glm::vec3 inv_dir = 1.f / ray.__direction__;
+
+        [[maybe_unused]] auto node_visit_count = IntersectWideBVH(std::span(nodes), WideRay<N>(ray), t_min, t_max, [&](int shapeBVHInfo_idx, uint32_t shapeBVHInfo_count, float &t_closest)
+                                                 {
+                                                     for (uint32_t i = shapeBVHInfo_idx; i < shapeBVHInfo_idx + shapeBVHInfo_count; i++)
+                                                     {
+                                                         is_hit |= IntersectInstance(mInstances[i], i, ray, inv_dir, t_min, t_closest, hit);
+                                                     }
+                                                     // end
+                                                 });
+
+        DEBUG_INFO(ray.__boundsTestCount__ += node_visit_count)
+        if (is_hit)
+        {
+            t_max = hit.__t__;
+        }
+        return is_hit;
+    }
+
+    bool SceneBVH::IntersectBinary(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
+    {
+        bool is_hit = false;
+        if (mNodes.empty())
+        {
+            return is_hit;
+        }
         DEBUG_INFO(size_t bounds_test_count = 0)
 
-        glm::bvec3 dir_is_neg = {
-            ray.__direction__.x < 0,
-            ray.__direction__.y < 0,
-            ray.__direction__.z < 0};
+        auto visit_right_first = GetBinaryVisitOrder(ray.__direction__);
 
         glm::vec3 inv_dir = 1.f / ray.__direction__;
 
-        std::array<int, 32> stack;
-        auto ptr = stack.begin();
+        TraversalStack<int, BINARY_BVH_STACK_SIZE> stack;
         size_t current_node_idx = 0;
 
         while (true)
@@ -74,82 +436,337 @@ namespace pbrt
 
             if (!node.__bounds__.HasIntersection(ray, inv_dir, t_min, t_max))
             {
-                if (ptr == stack.begin())
+                if (stack.Empty())
                     break;
 
-                current_node_idx = *(--ptr);
+                current_node_idx = stack.Pop();
                 continue;
             }
 
             if (node.__shapeBVHInfoCount__ == 0) // 非叶子节点递归进入子节点
             {
                 // 根据光线方向决定先遍历哪一个节点
-                if (dir_is_neg[node.__splitAxis__])
+                if (visit_right_first[node.__splitAxis__])
                 {
-                    *(ptr++) = current_node_idx + 1;
+                    stack.Push(static_cast<int>(current_node_idx + 1));
                     current_node_idx = node.__right__;
                 }
                 else
                 {
-                    current_node_idx++;        // 左节点
-                    *(ptr++) = node.__right__; // 右节点
+                    current_node_idx++;         // 左节点
+                    stack.Push(node.__right__); // 右节点
                 }
             }
             else // 叶子节点三角形相交检查
             {
-                auto shapeBVHInfo_iter = mOrderedShapeBVHInfos.begin() + node.__shapeBVHInfoIdx__;
-                for (size_t i = 0; i < node.__shapeBVHInfoCount__; i++)
+                for (uint32_t i = node.__shapeBVHInfoIdx__; i < node.__shapeBVHInfoIdx__ + node.__shapeBVHInfoCount__; i++)
                 {
                     // 用对象空间光线进行相交检测
-                    auto ray_object = ray.ObjectFromWorld(shapeBVHInfo_iter->__objectFromWorld__);
-                    auto hit_info = shapeBVHInfo_iter->__shape__->Intersect(ray_object, t_min, t_max);
-                    DEBUG_INFO(ray.__boundsTestCount__ += ray_object.__boundsTestCount__);
-                    DEBUG_INFO(ray.__triangleTestCount__ += ray_object.__triangleTestCount__);
-                    if (hit_info)
+                    is_hit |= IntersectInstance(mInstances[i], i, ray, inv_dir, t_min, t_max, hit);
+                }
+
+                if (stack.Empty())
+                    break;
+                current_node_idx = stack.Pop();
+            }
+        }
+
+        DEBUG_INFO(ray.__boundsTestCount__ += bounds_test_count)
+        return is_hit;
+    }
+
+    bool SceneBVH::Occluded(const Ray &ray, float t_min, float t_max) const
+    {
+        bool is_occluded = false;
+        switch (mLayout)
+        {
+        case BVHLayout::Wide4:
+            is_occluded = OccludedWide(mWideNodes4, ray, t_min, t_max);
+            break;
+        case BVHLayout::Wide8:
+            is_occluded = OccludedWide(mWideNodes8, ray, t_min, t_max);
+            break;
+        case BVHLayout::Wide4Quantized:
+            is_occluded = OccludedWide(mQuantizedNodes4, ray, t_min, t_max);
+            break;
+        case BVHLayout::Wide8Quantized:
+            is_occluded = OccludedWide(mQuantizedNodes8, ray, t_min, t_max);
+            break;
+        default:
+            is_occluded = OccludedBinary(ray, t_min, t_max);
+            break;
+        }
+        if (is_occluded)
+        {
+            return true;
+        }
+
+        for (const auto &infinity_instance : mInfinityInstances)
+        {
+            auto ray_object = ray.ObjectFromWorld(infinity_instance.__objectFromWorld__);
+            if (infinity_instance.__shape__->Occluded(ray_object, t_min, t_max))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename WideNode>
+    bool SceneBVH::OccludedWide(const std::vector<WideNode> &nodes, const Ray &ray, float t_min, float t_max) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        size_t node_visit_count = 0;
+        glm::vec3 inv_dir = 1.f / ray.__direction__;
+        bool is_occluded = OccludedWideBVH(std::span(nodes), WideRay<N>(ray), t_min, t_max, [&](int shapeBVHInfo_idx, uint32_t shapeBVHInfo_count)
+                                           {
+                                               for (uint32_t i = shapeBVHInfo_idx; i < shapeBVHInfo_idx + shapeBVHInfo_count; i++)
+                                               {
+                                                   if (OccludedInstance(mInstances[i], ray, inv_dir, t_min, t_max))
+                                                   {
+                                                       return true;
+                                                   }
+                                               }
+                                               return false;
+                                               // end
+                                           },
+                                           node_visit_count);
+
+        DEBUG_INFO(ray.__boundsTestCount__ += node_visit_count)
+        return is_occluded;
+    }
+
+    bool SceneBVH::OccludedBinary(const Ray &ray, float t_min, float t_max) const
+    {
+        if (mNodes.empty())
+        {
+            return false;
+        }
+        DEBUG_INFO(size_t bounds_test_count = 0)
+
+        glm::vec3 inv_dir = 1.f / ray.__direction__;
+
+        TraversalStack<int, BINARY_BVH_STACK_SIZE> stack;
+        size_t current_node_idx = 0;
+        bool is_occluded = false;
+
+        while (true)
+        {
+            auto &node = mNodes[current_node_idx];
+
+            DEBUG_INFO(bounds_test_count++)
+
+            if (!node.__bounds__.HasIntersection(ray, inv_dir, t_min, t_max))
+            {
+                if (stack.Empty())
+                    break;
+                current_node_idx = stack.Pop();
+                continue;
+            }
+
+            if (node.__shapeBVHInfoCount__ == 0)
+            {
+                current_node_idx++;
+                stack.Push(node.__right__);
+            }
+            else
+            {
+                for (size_t i = node.__shapeBVHInfoIdx__; i < node.__shapeBVHInfoIdx__ + node.__shapeBVHInfoCount__; i++)
+                {
+                    is_occluded = OccludedInstance(mInstances[i], ray, inv_dir, t_min, t_max);
+                    if (is_occluded)
                     {
-                        t_max = hit_info->__t__;
-                        closest_hit_info = hit_info;
-                        closest_shapeBVHInfo = &(*shapeBVHInfo_iter);
+                        break;
                     }
-                    ++shapeBVHInfo_iter;
                 }
 
-                if (ptr == stack.begin())
+                if (is_occluded || stack.Empty())
                     break;
-                current_node_idx = *(--ptr);
+                current_node_idx = stack.Pop();
             }
         }
 
-        for (const auto &infinity_shapeBVHInfo : mInfinityShapeBVHInfos)
+        DEBUG_INFO(ray.__boundsTestCount__ += bounds_test_count)
+        return is_occluded;
+    }
+
+    void SceneBVH::IntersectBatch(std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const
+    {
+        switch (mLayout)
         {
-            auto ray_object = ray.ObjectFromWorld(infinity_shapeBVHInfo.__objectFromWorld__);
-            auto hit_info = infinity_shapeBVHInfo.__shape__->Intersect(ray_object, t_min, t_max);
-            DEBUG_INFO(ray.__boundsTestCount__ += ray_object.__boundsTestCount__);
-            DEBUG_INFO(ray.__triangleTestCount__ += ray_object.__triangleTestCount__);
-            if (hit_info)
+        case BVHLayout::Wide4:
+            IntersectWideBatch(mWideNodes4, rays, records, t_min);
+            break;
+        case BVHLayout::Wide8:
+            IntersectWideBatch(mWideNodes8, rays, records, t_min);
+            break;
+        case BVHLayout::Wide4Quantized:
+            IntersectWideBatch(mQuantizedNodes4, rays, records, t_min);
+            break;
+        case BVHLayout::Wide8Quantized:
+            IntersectWideBatch(mQuantizedNodes8, rays, records, t_min);
+            break;
+        default:
+            Shape::IntersectBatch(rays, records, t_min);
+            break;
+        }
+    }
+
+    template <typename WideNode>
+    void SceneBVH::IntersectWideBatch(const std::vector<WideNode> &nodes, std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        ScratchBuffer<WideRay<N>> wide_rays(rays.size());
+        std::copy(rays.begin(), rays.end(), wide_rays.begin());
+        ScratchBuffer<Ray> rays_object;
+        ScratchBuffer<HitRecord> records_object;
+        ScratchBuffer<uint32_t> rays_object_idx;
+        rays_object.Reserve(rays.size());
+        records_object.Reserve(rays.size());
+        rays_object_idx.Reserve(rays.size());
+
+        // 到达该物体且命中其世界包围盒的光线统一变换到对象空间, 作为一批交给物体求交; 无限大物体不测试包围盒
+        auto intersect_shape = [&](const SceneInstance &instance, uint32_t instance_idx, std::span<const uint32_t> active, bool test_bounds)
+        {
+            rays_object.Clear();
+            records_object.Clear();
+            rays_object_idx.Clear();
+            for (uint32_t ray_idx : active)
+            {
+                if (test_bounds && !instance.__bounds__.HasIntersection(rays[ray_idx], t_min, records[ray_idx].__tMax__))
+                {
+                    continue;
+                }
+                rays_object.PushBack(rays[ray_idx].ObjectFromWorld(instance.__objectFromWorld__));
+                records_object.PushBack({records[ray_idx].__tMax__});
+                rays_object_idx.PushBack(ray_idx);
+            }
+            if (rays_object.Empty())
             {
-                t_max = hit_info->__t__;
-                closest_hit_info = hit_info;
-                closest_shapeBVHInfo = &infinity_shapeBVHInfo;
+                return;
+            }
+            instance.__shape__->IntersectBatch(rays_object.Span(), records_object.Span(), t_min);
+            for (size_t k = 0; k < rays_object.Size(); k++)
+            {
+                if (records_object[k].__isHit__)
+                {
+                    records[rays_object_idx[k]] = records_object[k];
+                    records[rays_object_idx[k]].__hit__.PushInstance(instance_idx);
+                }
+            }
+        };
+
+        IntersectWideBVHBatch(
+            std::span(nodes), rays, wide_rays.Span(), t_min,
+            [&](uint32_t ray_idx)
+            { return records[ray_idx].__tMax__; },
+            [&](int shapeBVHInfo_idx, uint32_t shapeBVHInfo_count, std::span<const uint32_t> active)
+            {
+                for (uint32_t i = shapeBVHInfo_idx; i < shapeBVHInfo_idx + shapeBVHInfo_count; i++)
+                {
+                    intersect_shape(mInstances[i], i, active, true);
+                }
+                // end
+            });
+
+        if (!mInfinityInstances.empty())
+        {
+            ScratchBuffer<uint32_t> all_rays(rays.size());
+            std::iota(all_rays.begin(), all_rays.end(), 0);
+            for (size_t i = 0; i < mInfinityInstances.size(); i++)
+            {
+                intersect_shape(mInfinityInstances[i], static_cast<uint32_t>(mInstances.size() + i), all_rays.Span(), false);
             }
         }
+    }
 
-        if (closest_shapeBVHInfo)
+    void SceneBVH::OccludedBatch(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const
+    {
+        switch (mLayout)
         {
-            closest_hit_info->__hitPoint__ = closest_shapeBVHInfo->__worldFromObject__ * glm::vec4(closest_hit_info->__hitPoint__, 1.f);
-            // TBN方法计算法线变换
-            closest_hit_info->__normal__ = glm::normalize(glm::vec3(glm::transpose(closest_shapeBVHInfo->__objectFromWorld__) * glm::vec4(closest_hit_info->__normal__, 0.f)));
-            closest_hit_info->__material__ = closest_shapeBVHInfo->__material__;
+        case BVHLayout::Wide4:
+            OccludedWideBatch(mWideNodes4, rays, occluded, t_min, t_max);
+            break;
+        case BVHLayout::Wide8:
+            OccludedWideBatch(mWideNodes8, rays, occluded, t_min, t_max);
+            break;
+        case BVHLayout::Wide4Quantized:
+            OccludedWideBatch(mQuantizedNodes4, rays, occluded, t_min, t_max);
+            break;
+        case BVHLayout::Wide8Quantized:
+            OccludedWideBatch(mQuantizedNodes8, rays, occluded, t_min, t_max);
+            break;
+        default:
+            Shape::OccludedBatch(rays, occluded, t_min, t_max);
+            break;
         }
+    }
 
-        DEBUG_INFO(ray.__boundsTestCount__ += bounds_test_count)
-        return closest_hit_info;
+    template <typename WideNode>
+    void SceneBVH::OccludedWideBatch(const std::vector<WideNode> &nodes, std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        ScratchBuffer<WideRay<N>> wide_rays(rays.size());
+        std::copy(rays.begin(), rays.end(), wide_rays.begin());
+        ScratchBuffer<Ray> rays_object;
+        ScratchBuffer<uint32_t> rays_object_idx;
+        ScratchBuffer<bool> occluded_object;
+        rays_object.Reserve(rays.size());
+        rays_object_idx.Reserve(rays.size());
+
+        auto occluded_shape = [&](const SceneInstance &instance, std::span<const uint32_t> active, bool test_bounds)
+        {
+            rays_object.Clear();
+            rays_object_idx.Clear();
+            for (uint32_t ray_idx : active)
+            {
+                if (!occluded[ray_idx] && (!test_bounds || instance.__bounds__.HasIntersection(rays[ray_idx], t_min, t_max)))
+                {
+                    rays_object.PushBack(rays[ray_idx].ObjectFromWorld(instance.__objectFromWorld__));
+                    rays_object_idx.PushBack(ray_idx);
+                }
+            }
+            if (rays_object.Empty())
+            {
+                return;
+            }
+            occluded_object.Clear();
+            occluded_object.Resize(rays_object.Size(), false);
+            instance.__shape__->OccludedBatch(rays_object.Span(), occluded_object.Span(), t_min, t_max);
+            for (size_t k = 0; k < rays_object.Size(); k++)
+            {
+                occluded[rays_object_idx[k]] = occluded_object[k];
+            }
+        };
+
+        IntersectWideBVHBatch(
+            std::span(nodes), rays, wide_rays.Span(), t_min,
+            [&](uint32_t ray_idx)
+            { return occluded[ray_idx] ? -std::numeric_limits<float>::infinity() : t_max; },
+            [&](int shapeBVHInfo_idx, uint32_t shapeBVHInfo_count, std::span<const uint32_t> active)
+            {
+                for (uint32_t i = shapeBVHInfo_idx; i < shapeBVHInfo_idx + shapeBVHInfo_count; i++)
+                {
+                    occluded_shape(mInstances[i], active, true);
+                }
+                // end
+            });
+
+        if (!mInfinityInstances.empty())
+        {
+            ScratchBuffer<uint32_t> all_rays(rays.size());
+            std::iota(all_rays.begin(), all_rays.end(), 0);
+            for (const auto &infinity_instance : mInfinityInstances)
+            {
+                occluded_shape(infinity_instance, all_rays.Span(), false);
+            }
+        }
     }
 
     void SceneBVH::RecursiveSplit(SceneBVHTreeNode *node, SceneBVHState &state)
     {
         state.__totalNodeCount__++;
-        if ((node->__end__ - node->__start__ == 1) || (node->__depth__ > 32))
+        if (node->__end__ - node->__start__ == 1)
         {
             state.AddLeafNode(node);
             return;
@@ -261,18 +878,15 @@ namespace pbrt
 
         if ((right->__end__ - left->__start__) > (128 * 1024))
         {
-            MasterThreadPool.ParallelFor(2, 1, [&, left, right](size_t i, size_t)
-                                         {
-                                             if (i == 0)
-                                             {
-                                                 RecursiveSplit(left, state);
-                                             }
-                                             else
-                                             {
-                                                 RecursiveSplit(right, state);
-                                             }
-                                             // end
-                                         });
+            // 左子树交给其他线程, 右子树在当前线程划分, 只等待本节点的左子树
+            TaskGroup group;
+            group.Spawn([&, left]()
+                        {
+                            RecursiveSplit(left, state);
+                            // end
+                        });
+            RecursiveSplit(right, state);
+            group.Wait();
         }
         else
         {
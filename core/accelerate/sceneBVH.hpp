@@ -1,19 +1,26 @@
 ﻿#pragma once
 #include "bounds.hpp"
+#include "nodeOrder.hpp"
+#include "wideBVH.hpp"
 #include "shape/shape.hpp"
 #include "thread/threadPool.hpp"
 
 namespace pbrt
 {
+    constexpr uint32_t INVALID_SCENE_SHAPE_ID = std::numeric_limits<uint32_t>::max();
+    constexpr float SCENE_BVH_MAX_REFIT_COST_RATIO = 1.5f; // 重新拟合后的SAH代价超过构建时的该倍数时重建顶层BVH
+
+    // 构建输入与实例的冷数据, 遍历时只读取SceneInstance, 确定最近交点后才读取材质与变换
     struct ShapeBVHInfo
     {
     public:
         const Shape *__shape__;
         const Material *__material__;
-        glm::mat4 __worldFromObject__;
-        glm::mat4 __objectFromWorld__;
+        AffineTransform __worldFromObject__;
+        AffineTransform __objectFromWorld__;
         Bounds __bounds__{};
         glm::vec3 __center__;
+        uint32_t __id__{INVALID_SCENE_SHAPE_ID}; // Scene分配的实例id, 增量更新时据此定位实例
 
     public:
         void UpdateBounds()
@@ -24,13 +31,21 @@ namespace pbrt
             {
                 // 依次获取8个顶点的世界坐标并包括到包围盒中
                 auto corner_object = bounds_object.GetCorner(idx);
-                glm::vec3 corner_world = __worldFromObject__ * glm::vec4(corner_object, 1.f);
-                __bounds__.Expand(corner_world);
+                __bounds__.Expand(__worldFromObject__.TransformPoint(corner_object));
             }
             __center__ = (__bounds__.__bMax__ + __bounds__.__bMin__) * 0.5f;
         }
     };
 
+    // 实例的热数据, 与mOrderedShapeBVHInfos一一对应; 光线先测试世界包围盒, 命中后才变换到对象空间(惰性变换)
+    struct SceneInstance
+    {
+    public:
+        Bounds __bounds__{};                 // 世界空间包围盒, 无限大物体无效且不测试
+        AffineTransform __objectFromWorld__; // 单位变换与纯平移走快速路径
+        const Shape *__shape__;
+    };
+
     struct SceneBVHTreeNode
     {
     public:
@@ -52,7 +67,7 @@ namespace pbrt
             int __shapeBVHInfoIdx__;
         };
         uint16_t __shapeBVHInfoCount__;
-        uint8_t __splitAxis__;
+        uint8_t __splitAxis__; // 划分轴, 重排后子节点交换过的节点加上BVH_SWAPPED_SPLIT_AXIS
     };
 
     struct SceneBVHState
@@ -95,32 +110,76 @@ namespace pbrt
             return &(mNodesList.back()[mPtr++]);
         }
 
-        ~SceneBVHTreeNodeAllocator()
+        // 树节点只在构建期间使用, 重新构建前释放
+        void Clear()
         {
             for (auto *nodes : mNodesList)
             {
                 delete[] nodes;
             }
             mNodesList.clear();
+            mPtr = 4096;
+        }
+
+        ~SceneBVHTreeNodeAllocator()
+        {
+            Clear();
         }
     };
 
     class SceneBVH : public Shape
     {
     public:
-        void Build(std::vector<ShapeBVHInfo> &&shapeBVHInfos);
-        std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const override;
-        Bounds GetBounds() const override { return mNodes[0].__bounds__; }
+        void Build(std::vector<ShapeBVHInfo> &&shapeBVHInfos, BVHLayout layout = DEFAULT_BVH_LAYOUT, BVHNodeOrder order = BVHNodeOrder::DepthFirst);
+        /*
+            增量更新: 按__id__替换已有实例的变换与材质, 树的拓扑不变, 自底向上重新拟合(refit)二叉节点与宽节点的包围盒, 量化节点就地重新量化
+            物体本身的BVH不受影响; 返回false表示拟合后的SAH代价相对构建时退化过多, 调用者应重新Build
+        */
+        bool Refit(std::span<const ShapeBVHInfo> shapeBVHInfos);
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override; // 向hit.__instanceIdx__压入实例下标, 无限大物体排在有限物体之后
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override;
+        bool Occluded(const Ray &ray, float t_min, float t_max) const override;
+        void IntersectBatch(std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const override;
+        void OccludedBatch(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const override;
+        Bounds GetBounds() const override { return mBounds; }
+        size_t GetInstanceDepth() const override { return mInstanceDepth; }
 
     private:
         void RecursiveSplit(SceneBVHTreeNode *node, SceneBVHState &state);
         size_t RecursiveFlatten(SceneBVHTreeNode *node);
+        void BuildWideNodes(); // 由二叉节点生成遍历用的宽节点
+        void RefitWideNodes(); // 拓扑不变, 按实例的新包围盒更新宽节点
+        float GetSAHCost() const;
+
+        // 有限包围盒物体的最近交点, 只记录轻量命中
+        bool IntersectBinary(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const;
+        template <typename WideNode>
+        bool IntersectWide(const std::vector<WideNode> &nodes, const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const;
+        bool OccludedBinary(const Ray &ray, float t_min, float t_max) const;
+        template <typename WideNode>
+        bool OccludedWide(const std::vector<WideNode> &nodes, const Ray &ray, float t_min, float t_max) const;
+        template <typename WideNode>
+        void IntersectWideBatch(const std::vector<WideNode> &nodes, std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const;
+        template <typename WideNode>
+        void OccludedWideBatch(const std::vector<WideNode> &nodes, std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const;
 
     private:
-        std::vector<SceneBVHNode> mNodes;
+        BVHLayout mLayout;
+        BVHNodeOrder mOrder;
+        Bounds mBounds{};
+        float mBuildSAHCost{};
+        size_t mInstanceDepth{1};
+        std::vector<SceneBVHNode> mNodes; // 宽布局也保留, 增量更新时在二叉节点上重新拟合
+        std::vector<WideBVHNode<4>> mWideNodes4;
+        std::vector<WideBVHNode<8>> mWideNodes8;
+        std::vector<QuantizedWideBVHNode<4>> mQuantizedNodes4;
+        std::vector<QuantizedWideBVHNode<8>> mQuantizedNodes8;
+        std::vector<SceneInstance> mInstances;          // 遍历用热数据, 与mOrderedShapeBVHInfos下标相同
+        std::vector<SceneInstance> mInfinityInstances; // 与mInfinityShapeBVHInfos下标相同
         std::vector<ShapeBVHInfo> mOrderedShapeBVHInfos;
         std::vector<ShapeBVHInfo> mInfinityShapeBVHInfos;
+        std::vector<uint32_t> mInstanceSlots; // 实例id到实例下标, 编码与PrimitiveHit::__instanceIdx__相同
         SceneBVHTreeNodeAllocator mNodeAllocator{};
-        SceneBVHTreeNode *mRoot;
+        SceneBVHTreeNode *mRoot = nullptr;
     };
 }
\ No newline at end of file
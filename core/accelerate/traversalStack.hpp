@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace pbrt
+{
+    constexpr size_t BINARY_BVH_STACK_SIZE = 64; // 二叉遍历栈在栈上预留的项数, 与树深相当
+
+    /*
+        BVH遍历栈, 前N项使用栈上的定长数组, 超出时整体搬到堆上继续增长
+        常见深度的树遍历不分配内存, 退化几何或SBVH生成的深树也不会受固定容量限制而越界
+        T需要可平凡拷贝; 栈持有指向自身数组的指针, 不可拷贝或移动
+    */
+    template <typename T, size_t N>
+    class TraversalStack
+    {
+    private:
+        T mInline[N];
+        std::vector<T> mHeap;
+        T *mData = mInline;
+        size_t mCapacity = N;
+        size_t mSize = 0;
+
+    public:
+        TraversalStack() = default;
+        TraversalStack(const TraversalStack &) = delete;
+        TraversalStack &operator=(const TraversalStack &) = delete;
+
+        bool Empty() const { return mSize == 0; }
+
+        void Push(const T &value)
+        {
+            if (mSize == mCapacity)
+            {
+                Grow();
+            }
+            mData[mSize++] = value;
+        }
+
+        T Pop() { return mData[--mSize]; }
+
+    private:
+        void Grow()
+        {
+            mHeap.resize(mCapacity * 2);
+            if (mData == mInline)
+            {
+                std::copy(mInline, mInline + mSize, mHeap.begin());
+            }
+            mData = mHeap.data();
+            mCapacity = mHeap.size();
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,195 @@
+﻿#pragma once
+#include "wideBVH.hpp"
+#include "shape/triangleMesh.hpp"
+
+namespace pbrt
+{
+    /*
+        N个三角形打包的SoA求交块, 构建时预计算边向量, 一次SIMD求交N个三角形
+        只保存求交所需的顶点与边, 法线等着色数据留在冷数组中, 仅在确定最近交点后读取
+        不足N个的槽位以零边填充, 求交时行列式为0, 重心坐标为NaN, 比较全部失败, 不会产生命中
+    */
+    template <size_t N>
+    struct alignas(sizeof(float) * N) TriangleBlock
+    {
+    public:
+        float __p0X__[N], __p0Y__[N], __p0Z__[N];
+        float __e1X__[N], __e1Y__[N], __e1Z__[N]; // e₁ = P₁ - P₀
+        float __e2X__[N], __e2Y__[N], __e2Z__[N]; // e₂ = P₂ - P₀
+        int __triangleIdx__;                      // 第0个槽位对应的三角形引用索引, 块内引用连续
+        uint32_t __triangleCount__;               // 有效槽位数, 用于Refit
+
+    public:
+        TriangleBlock()
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                __p0X__[i] = __p0Y__[i] = __p0Z__[i] = 0.f;
+                __e1X__[i] = __e1Y__[i] = __e1Z__[i] = 0.f;
+                __e2X__[i] = __e2Y__[i] = __e2Z__[i] = 0.f;
+            }
+            __triangleIdx__ = -1;
+            __triangleCount__ = 0;
+        }
+
+        void SetTriangle(size_t i, const TriangleData &triangle)
+        {
+            glm::vec3 e1 = triangle.__p1__ - triangle.__p0__;
+            glm::vec3 e2 = triangle.__p2__ - triangle.__p0__;
+            __p0X__[i] = triangle.__p0__.x;
+            __p0Y__[i] = triangle.__p0__.y;
+            __p0Z__[i] = triangle.__p0__.z;
+            __e1X__[i] = e1.x;
+            __e1Y__[i] = e1.y;
+            __e1Z__[i] = e1.z;
+            __e2X__[i] = e2.x;
+            __e2Y__[i] = e2.y;
+            __e2Z__[i] = e2.z;
+        }
+    };
+
+    // 三角形块求交结果, 仅记录重心坐标, 着色信息在最终命中后再计算
+    struct TriangleBlockHit
+    {
+    public:
+        float __t__;
+        float __u__, __v__;
+        int __triangleIdx__;
+    };
+
+    namespace internal
+    {
+        /*
+            Möller-Trumbore算法的SIMD版本, 与Triangle::Intersect逐项对应
+            [t u v]ᵀ = 1/(S₁ · e₁)[S₂ · e₂, S₁ · S, S₂ · D]ᵀ, S = O - P₀, S₁ = D × e₂, S₂ = S × e₁
+            返回各槽位的命中掩码
+        */
+        template <size_t N>
+        inline uint32_t TestTriangleBlock(const TriangleBlock<N> &block, const WideRay<N> &ray, float t_min, float t_max, VFloat<N> &t, VFloat<N> &u, VFloat<N> &v)
+        {
+            using V = VFloat<N>;
+            const V &dx = ray.__direction__[0], &dy = ray.__direction__[1], &dz = ray.__direction__[2];
+            V e1x = V::Load(block.__e1X__), e1y = V::Load(block.__e1Y__), e1z = V::Load(block.__e1Z__);
+            V e2x = V::Load(block.__e2X__), e2y = V::Load(block.__e2Y__), e2z = V::Load(block.__e2Z__);
+
+            // S₁ = D × e₂
+            V s1x = dy * e2z - dz * e2y;
+            V s1y = dz * e2x - dx * e2z;
+            V s1z = dx * e2y - dy * e2x;
+            V inv_det = V::Broadcast(1.f) / (e1x * s1x + e1y * s1y + e1z * s1z);
+
+            // S = O - P₀
+            V sx = ray.__origin__[0] - V::Load(block.__p0X__);
+            V sy = ray.__origin__[1] - V::Load(block.__p0Y__);
+            V sz = ray.__origin__[2] - V::Load(block.__p0Z__);
+            u = (sx * s1x + sy * s1y + sz * s1z) * inv_det;
+
+            // S₂ = S × e₁
+            V s2x = sy * e1z - sz * e1y;
+            V s2y = sz * e1x - sx * e1z;
+            V s2z = sx * e1y - sy * e1x;
+            v = (dx * s2x + dy * s2y + dz * s2z) * inv_det;
+            t = (e2x * s2x + e2y * s2y + e2z * s2z) * inv_det;
+
+            V zero = V::Broadcast(0.f), one = V::Broadcast(1.f);
+            auto mask = (u >= zero) & (u <= one) & (v >= zero) & ((u + v) <= one) & (t > V::Broadcast(t_min)) & (t < V::Broadcast(t_max));
+            return mask.Bits();
+        }
+    }
+
+    // 最近交点求交, 命中且比t_max更近时更新t_max与hit, 返回是否命中
+    template <size_t N>
+    inline bool IntersectTriangleBlock(const TriangleBlock<N> &block, const WideRay<N> &ray, float t_min, float &t_max, TriangleBlockHit &hit)
+    {
+        VFloat<N> t, u, v;
+        uint32_t hit_bits = internal::TestTriangleBlock(block, ray, t_min, t_max, t, u, v);
+        if (hit_bits == 0)
+        {
+            return false;
+        }
+
+        alignas(sizeof(float) * N) float t_lanes[N], u_lanes[N], v_lanes[N];
+        t.Store(t_lanes);
+        u.Store(u_lanes);
+        v.Store(v_lanes);
+        bool is_hit = false;
+        while (hit_bits != 0)
+        {
+            uint32_t i = PopLowestBit(hit_bits);
+            if (t_lanes[i] < t_max)
+            {
+                t_max = t_lanes[i];
+                hit = {t_lanes[i], u_lanes[i], v_lanes[i], block.__triangleIdx__ + static_cast<int>(i)};
+                is_hit = true;
+            }
+        }
+        return is_hit;
+    }
+
+    // 任意交点测试, 用于阴影光线
+    template <size_t N>
+    inline bool OccludedTriangleBlock(const TriangleBlock<N> &block, const WideRay<N> &ray, float t_min, float t_max)
+    {
+        VFloat<N> t, u, v;
+        return internal::TestTriangleBlock(block, ray, t_min, t_max, t, u, v) != 0;
+    }
+
+    /*
+        将宽BVH叶子中的三角形打包为三角形块
+        叶子的__children__改为首个块索引, __counts__改为块数量; 叶子内三角形超过N个时拆分为多个连续的块
+        primitive_indices为叶子引用到网格三角形的映射
+    */
+    template <size_t N>
+    inline void BuildTriangleBlocks(std::vector<WideBVHNode<N>> &nodes, const TriangleMesh &mesh, std::span<const uint32_t> primitive_indices, std::vector<TriangleBlock<N>> &blocks)
+    {
+        blocks.clear();
+        blocks.reserve(primitive_indices.size() / N + nodes.size());
+        for (auto &node : nodes)
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                if (node.IsEmpty(i) || !node.IsLeaf(i))
+                {
+                    continue;
+                }
+                size_t triangle_start = node.__children__[i];
+                size_t triangle_count = node.__counts__[i];
+                size_t block_start = blocks.size();
+                for (size_t offset = 0; offset < triangle_count; offset += N)
+                {
+                    auto &block = blocks.emplace_back();
+                    block.__triangleIdx__ = static_cast<int>(triangle_start + offset);
+                    block.__triangleCount__ = static_cast<uint32_t>(glm::min<size_t>(N, triangle_count - offset));
+                    for (size_t lane = 0; lane < N && offset + lane < triangle_count; lane++)
+                    {
+                        block.SetTriangle(lane, mesh.GetTriangle(primitive_indices[triangle_start + offset + lane]));
+                    }
+                }
+                node.__children__[i] = static_cast<int>(block_start);
+                node.__counts__[i] = static_cast<uint32_t>(blocks.size() - block_start);
+            }
+        }
+    }
+
+    // 按节点顺序重排三角形块, 使块与引用它们的宽节点排列一致, 叶子的块索引随之改写; WideNode为WideBVHNode<N>或QuantizedWideBVHNode<N>
+    template <typename WideNode>
+    inline void ReorderTriangleBlocks(std::vector<WideNode> &nodes, std::vector<TriangleBlock<WideNode::WIDTH>> &blocks)
+    {
+        std::vector<TriangleBlock<WideNode::WIDTH>> reordered;
+        reordered.reserve(blocks.size());
+        for (auto &node : nodes)
+        {
+            for (size_t i = 0; i < WideNode::WIDTH; i++)
+            {
+                if (node.IsEmpty(i) || !node.IsLeaf(i))
+                {
+                    continue;
+                }
+                size_t block_start = node.__children__[i];
+                node.__children__[i] = static_cast<int>(reordered.size());
+                reordered.insert(reordered.end(), blocks.begin() + block_start, blocks.begin() + block_start + node.__counts__[i]);
+            }
+        }
+        blocks = std::move(reordered);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,952 @@
+﻿#pragma once
+#include "bounds.hpp"
+#include "traversalStack.hpp"
+#include "utils/scratchBuffer.hpp"
+#include "utils/simd.hpp"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+#include <span>
+#include <numeric>
+#include <utility>
+
+namespace pbrt
+{
+    // BVH运行时节点布局
+    enum class BVHLayout
+    {
+        Binary,         // 二叉线性节点, 每次迭代测试一个包围盒
+        Wide4,          // 4叉节点, SSE一次测试4个子包围盒
+        Wide8,          // 8叉节点, AVX一次测试8个子包围盒
+        Wide4Quantized, // 4叉量化节点, 子包围盒相对父包围盒量化为8位, 节点大小减半
+        Wide8Quantized  // 8叉量化节点
+    };
+
+    constexpr BVHLayout DEFAULT_BVH_LAYOUT = (SIMD_WIDTH == 8) ? BVHLayout::Wide8 : BVHLayout::Wide4;
+
+    // 布局的分支数, 二叉布局返回2
+    constexpr size_t GetBVHLayoutWidth(BVHLayout layout)
+    {
+        switch (layout)
+        {
+        case BVHLayout::Wide4:
+        case BVHLayout::Wide4Quantized:
+            return 4;
+        case BVHLayout::Wide8:
+        case BVHLayout::Wide8Quantized:
+            return 8;
+        default:
+            return 2;
+        }
+    }
+
+    constexpr bool IsQuantizedBVHLayout(BVHLayout layout)
+    {
+        return layout == BVHLayout::Wide4Quantized || layout == BVHLayout::Wide8Quantized;
+    }
+
+    /*
+        N叉BVH节点, 子节点包围盒以SoA方式存储, 便于一次SIMD测试全部子节点
+        Wide4: 6 * 16 + 16 + 16 = 128字节(两条缓存行)
+        Wide8: 6 * 32 + 32 + 32 = 256字节(四条缓存行)
+    */
+    template <size_t N>
+    struct alignas(64) WideBVHNode
+    {
+    public:
+        static constexpr size_t WIDTH = N;
+
+    public:
+        float __bMinX__[N], __bMinY__[N], __bMinZ__[N];
+        float __bMaxX__[N], __bMaxY__[N], __bMaxZ__[N];
+        int __children__[N];    // 内部子节点: 宽节点索引; 叶子: 图元起始索引; 空槽: -1
+        uint32_t __counts__[N]; // 叶子图元数量, 0表示内部子节点
+
+    public:
+        WideBVHNode()
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                SetChild(i, {}, -1, 0);
+            }
+        }
+
+        void SetChild(size_t i, const Bounds &bounds, int child, uint32_t count)
+        {
+            __bMinX__[i] = bounds.__bMin__.x;
+            __bMinY__[i] = bounds.__bMin__.y;
+            __bMinZ__[i] = bounds.__bMin__.z;
+            __bMaxX__[i] = bounds.__bMax__.x;
+            __bMaxY__[i] = bounds.__bMax__.y;
+            __bMaxZ__[i] = bounds.__bMax__.z;
+            __children__[i] = child;
+            __counts__[i] = count;
+        }
+
+        Bounds GetChildBounds(size_t i) const
+        {
+            return {{__bMinX__[i], __bMinY__[i], __bMinZ__[i]}, {__bMaxX__[i], __bMaxY__[i], __bMaxZ__[i]}};
+        }
+
+        bool IsEmpty(size_t i) const { return __children__[i] < 0; }
+        bool IsLeaf(size_t i) const { return __counts__[i] != 0; }
+    };
+
+    /*
+        N叉量化BVH节点, 子包围盒以父包围盒最小点为原点, 各轴以2的幂为步长量化为8位整数
+        Wide4: 16 + 6 * 4 + 16 + 8 = 64字节(一条缓存行)
+        Wide8: 16 + 6 * 8 + 32 + 16 = 112字节, 对齐后128字节(两条缓存行)
+        步长为2的幂, q * 2^e是精确的, 解量化平面origin + q * 2^e只有一次舍入; 量化时逐个验证该平面, 下界向下/上界向上取整
+        因此解量化包围盒总是包含原包围盒, 遍历不会漏掉任何交点
+    */
+    template <size_t N>
+    struct alignas(64) QuantizedWideBVHNode
+    {
+    public:
+        static constexpr size_t WIDTH = N;
+        static constexpr int MIN_EXPONENT = -126; // 保证步长为规格化浮点数
+
+    public:
+        float __origin__[3];    // 量化原点(父包围盒最小点)
+        int8_t __exponent__[3]; // 各轴量化步长2^e
+        uint8_t __padding__;
+        uint8_t __qMinX__[N], __qMinY__[N], __qMinZ__[N];
+        uint8_t __qMaxX__[N], __qMaxY__[N], __qMaxZ__[N];
+        int __children__[N];    // 与WideBVHNode相同
+        uint16_t __counts__[N]; // 叶子图元(或三角形块)数量, 不超过二叉节点的16位图元数
+
+    public:
+        QuantizedWideBVHNode() = default;
+
+        // 由浮点宽节点量化, 子节点引用原样保留
+        explicit QuantizedWideBVHNode(const WideBVHNode<N> &node)
+        {
+            Bounds parent{};
+            for (size_t i = 0; i < N; i++)
+            {
+                if (!node.IsEmpty(i))
+                {
+                    parent.Expand(node.GetChildBounds(i));
+                }
+            }
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float origin = parent.IsValid() ? parent.__bMin__[axis] : 0.f;
+                float extent = parent.IsValid() ? parent.__bMax__[axis] - origin : 0.f;
+                int exponent = extent > 0.f ? static_cast<int>(std::ceil(std::log2(extent / 255.f))) : MIN_EXPONENT;
+                exponent = glm::max(exponent, MIN_EXPONENT);
+                // log2的舍入误差与origin + 255 * 2^e的舍入都可能使上界略小于父包围盒, 逐步放大步长直到覆盖
+                while (parent.IsValid() && origin + 255.f * std::ldexp(1.f, exponent) < parent.__bMax__[axis])
+                {
+                    exponent++;
+                }
+                __origin__[axis] = origin;
+                __exponent__[axis] = static_cast<int8_t>(exponent);
+            }
+            __padding__ = 0;
+
+            for (size_t i = 0; i < N; i++)
+            {
+                __children__[i] = node.__children__[i];
+                __counts__[i] = static_cast<uint16_t>(node.__counts__[i]);
+                if (node.IsEmpty(i))
+                {
+                    // 空槽位为反转的包围盒, 遍历时由IsEmpty过滤
+                    SetQuantized(i, {1, 1, 1}, {0, 0, 0});
+                    continue;
+                }
+                auto bounds = node.GetChildBounds(i);
+                std::array<uint8_t, 3> q_min, q_max;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    float scale = GetScale(axis);
+                    float lo = glm::clamp(std::floor((bounds.__bMin__[axis] - __origin__[axis]) / scale), 0.f, 255.f);
+                    float hi = glm::clamp(std::ceil((bounds.__bMax__[axis] - __origin__[axis]) / scale), 0.f, 255.f);
+                    // 除法存在舍入, 以实际解量化的平面校正, 保证下界不大于原下界, 上界不小于原上界
+                    while (lo > 0.f && __origin__[axis] + lo * scale > bounds.__bMin__[axis])
+                    {
+                        lo -= 1.f;
+                    }
+                    while (hi < 255.f && __origin__[axis] + hi * scale < bounds.__bMax__[axis])
+                    {
+                        hi += 1.f;
+                    }
+                    q_min[axis] = static_cast<uint8_t>(lo);
+                    q_max[axis] = static_cast<uint8_t>(hi);
+                }
+                SetQuantized(i, q_min, q_max);
+            }
+        }
+
+        // 直接拼出2^e的浮点位模式, 遍历时无需调用ldexp
+        float GetScale(int axis) const { return std::bit_cast<float>(static_cast<uint32_t>(__exponent__[axis] + 127) << 23); }
+
+        Bounds GetChildBounds(size_t i) const
+        {
+            glm::vec3 scale{GetScale(0), GetScale(1), GetScale(2)};
+            glm::vec3 origin{__origin__[0], __origin__[1], __origin__[2]};
+            return {origin + glm::vec3{__qMinX__[i], __qMinY__[i], __qMinZ__[i]} * scale,
+                    origin + glm::vec3{__qMaxX__[i], __qMaxY__[i], __qMaxZ__[i]} * scale};
+        }
+
+        bool IsEmpty(size_t i) const { return __children__[i] < 0; }
+        bool IsLeaf(size_t i) const { return __counts__[i] != 0; }
+
+    private:
+        void SetQuantized(size_t i, const std::array<uint8_t, 3> &q_min, const std::array<uint8_t, 3> &q_max)
+        {
+            __qMinX__[i] = q_min[0];
+            __qMinY__[i] = q_min[1];
+            __qMinZ__[i] = q_min[2];
+            __qMaxX__[i] = q_max[0];
+            __qMaxY__[i] = q_max[1];
+            __qMaxZ__[i] = q_max[2];
+        }
+    };
+
+    static_assert(sizeof(QuantizedWideBVHNode<4>) == 64 && sizeof(QuantizedWideBVHNode<8>) == 128);
+
+    // 宽节点求交所需的预计算光线数据, 每条光线只计算一次
+    template <size_t N>
+    struct WideRay
+    {
+    public:
+        VFloat<N> __origin__[3];
+        VFloat<N> __direction__[3];
+        VFloat<N> __invDir__[3];
+        bool __dirIsNeg__[3];
+
+    public:
+        WideRay() = default;
+        WideRay(const Ray &ray)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                __origin__[axis] = VFloat<N>::Broadcast(ray.__origin__[axis]);
+                __direction__[axis] = VFloat<N>::Broadcast(ray.__direction__[axis]);
+                __invDir__[axis] = VFloat<N>::Broadcast(1.f / ray.__direction__[axis]);
+                __dirIsNeg__[axis] = ray.__direction__[axis] < 0.f;
+            }
+        }
+    };
+
+    /*
+        一次测试节点的全部N个子包围盒, 返回命中掩码, 并写出每个子节点的进入距离
+        根据光线方向符号直接选取近/远平面, 省去逐轴的min/max
+    */
+    template <size_t N>
+    inline uint32_t IntersectWideNode(const WideBVHNode<N> &node, const WideRay<N> &ray, float t_min, float t_max, float *t_near)
+    {
+        using V = VFloat<N>;
+        V near_x = V::Load(ray.__dirIsNeg__[0] ? node.__bMaxX__ : node.__bMinX__);
+        V near_y = V::Load(ray.__dirIsNeg__[1] ? node.__bMaxY__ : node.__bMinY__);
+        V near_z = V::Load(ray.__dirIsNeg__[2] ? node.__bMaxZ__ : node.__bMinZ__);
+        V far_x = V::Load(ray.__dirIsNeg__[0] ? node.__bMinX__ : node.__bMaxX__);
+        V far_y = V::Load(ray.__dirIsNeg__[1] ? node.__bMinY__ : node.__bMaxY__);
+        V far_z = V::Load(ray.__dirIsNeg__[2] ? node.__bMinZ__ : node.__bMaxZ__);
+
+        V t_near_x = (near_x - ray.__origin__[0]) * ray.__invDir__[0];
+        V t_near_y = (near_y - ray.__origin__[1]) * ray.__invDir__[1];
+        V t_near_z = (near_z - ray.__origin__[2]) * ray.__invDir__[2];
+        V t_far_x = (far_x - ray.__origin__[0]) * ray.__invDir__[0];
+        V t_far_y = (far_y - ray.__origin__[1]) * ray.__invDir__[1];
+        V t_far_z = (far_z - ray.__origin__[2]) * ray.__invDir__[2];
+
+        V near = Max(Max(t_near_x, t_near_y), Max(t_near_z, V::Broadcast(t_min))); // 最晚的进入时间
+        V far = Min(Min(t_far_x, t_far_y), Min(t_far_z, V::Broadcast(t_max)));     // 最早的离开时间
+        near.Store(t_near);
+        return (near <= far).Bits();
+    }
+
+    /*
+        量化节点求交: 先解量化出与构建时校验过的完全相同的平面, 其余与浮点节点一致
+        origin + q * 2^e中乘法精确, 加法一次舍入, 与是否使用FMA无关
+    */
+    template <size_t N>
+    inline uint32_t IntersectWideNode(const QuantizedWideBVHNode<N> &node, const WideRay<N> &ray, float t_min, float t_max, float *t_near)
+    {
+        using V = VFloat<N>;
+        V origin_x = V::Broadcast(node.__origin__[0]), scale_x = V::Broadcast(node.GetScale(0));
+        V origin_y = V::Broadcast(node.__origin__[1]), scale_y = V::Broadcast(node.GetScale(1));
+        V origin_z = V::Broadcast(node.__origin__[2]), scale_z = V::Broadcast(node.GetScale(2));
+        V near_x = origin_x + V::LoadU8(ray.__dirIsNeg__[0] ? node.__qMaxX__ : node.__qMinX__) * scale_x;
+        V near_y = origin_y + V::LoadU8(ray.__dirIsNeg__[1] ? node.__qMaxY__ : node.__qMinY__) * scale_y;
+        V near_z = origin_z + V::LoadU8(ray.__dirIsNeg__[2] ? node.__qMaxZ__ : node.__qMinZ__) * scale_z;
+        V far_x = origin_x + V::LoadU8(ray.__dirIsNeg__[0] ? node.__qMinX__ : node.__qMaxX__) * scale_x;
+        V far_y = origin_y + V::LoadU8(ray.__dirIsNeg__[1] ? node.__qMinY__ : node.__qMaxY__) * scale_y;
+        V far_z = origin_z + V::LoadU8(ray.__dirIsNeg__[2] ? node.__qMinZ__ : node.__qMaxZ__) * scale_z;
+
+        V t_near_x = (near_x - ray.__origin__[0]) * ray.__invDir__[0];
+        V t_near_y = (near_y - ray.__origin__[1]) * ray.__invDir__[1];
+        V t_near_z = (near_z - ray.__origin__[2]) * ray.__invDir__[2];
+        V t_far_x = (far_x - ray.__origin__[0]) * ray.__invDir__[0];
+        V t_far_y = (far_y - ray.__origin__[1]) * ray.__invDir__[1];
+        V t_far_z = (far_z - ray.__origin__[2]) * ray.__invDir__[2];
+
+        V near = Max(Max(t_near_x, t_near_y), Max(t_near_z, V::Broadcast(t_min)));
+        V far = Min(Min(t_far_x, t_far_y), Min(t_far_z, V::Broadcast(t_max)));
+        near.Store(t_near);
+        return (near <= far).Bits();
+    }
+
+    struct WideBVHStackEntry
+    {
+    public:
+        int __ref__;        // 宽节点索引或叶子图元起始索引
+        uint32_t __count__; // 叶子图元数量, 0表示内部节点
+        float __tNear__;    // 进入距离, 出栈时若已超过t_max直接剪枝
+    };
+
+    constexpr size_t WIDE_BVH_STACK_DEPTH = 32; // 宽BVH遍历栈在栈上预留的树深, 每层最多压入N - 1个兄弟节点, 更深的树溢出到堆
+
+    /*
+        N叉BVH最近交点遍历
+        命中的子节点按进入距离从远到近入栈, 最近的子节点最先出栈, 命中后缩小的t_max可以剪掉更多远处子树
+        leaf(start, count, t_max): 叶子图元求交回调, 命中时更新t_max
+        root: 遍历起始的宽节点, 默认为根节点
+        返回访问的宽节点数, 用于调试统计
+    */
+    template <typename WideNode, typename LeafFunc>
+    inline size_t IntersectWideBVH(std::span<const WideNode> nodes, const WideRay<WideNode::WIDTH> &wide_ray, float t_min, float t_max, LeafFunc &&leaf, int root = 0)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        if (nodes.empty())
+        {
+            return 0;
+        }
+
+        TraversalStack<WideBVHStackEntry, WIDE_BVH_STACK_DEPTH * (N - 1) + 1> stack;
+        size_t node_visit_count = 0;
+        stack.Push({root, 0, t_min});
+
+        while (!stack.Empty())
+        {
+            auto entry = stack.Pop();
+            if (entry.__tNear__ > t_max)
+            {
+                continue;
+            }
+
+            if (entry.__count__ != 0) // 叶子
+            {
+                leaf(entry.__ref__, entry.__count__, t_max);
+                continue;
+            }
+
+            const auto &node = nodes[entry.__ref__];
+            node_visit_count++;
+
+            alignas(32) float t_near[N];
+            uint32_t hit_bits = IntersectWideNode(node, wide_ray, t_min, t_max, t_near);
+
+            // 插入排序, 按进入距离降序排列命中的子节点
+            WideBVHStackEntry hits[N];
+            size_t hit_count = 0;
+            while (hit_bits != 0)
+            {
+                uint32_t i = PopLowestBit(hit_bits);
+                if (node.IsEmpty(i))
+                {
+                    continue;
+                }
+                WideBVHStackEntry hit{node.__children__[i], node.__counts__[i], t_near[i]};
+                size_t j = hit_count++;
+                while (j > 0 && hits[j - 1].__tNear__ < hit.__tNear__)
+                {
+                    hits[j] = hits[j - 1];
+                    j--;
+                }
+                hits[j] = hit;
+            }
+
+            for (size_t i = 0; i < hit_count; i++)
+            {
+                stack.Push(hits[i]);
+            }
+        }
+
+        return node_visit_count;
+    }
+
+    /*
+        N叉BVH任意交点遍历(阴影光线)
+        只需判断是否存在遮挡, 子节点不按距离排序, leaf(start, count)返回true即提前结束
+    */
+    template <typename WideNode, typename LeafFunc>
+    inline bool OccludedWideBVH(std::span<const WideNode> nodes, const WideRay<WideNode::WIDTH> &wide_ray, float t_min, float t_max, LeafFunc &&leaf, size_t &node_visit_count)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        TraversalStack<WideBVHStackEntry, WIDE_BVH_STACK_DEPTH * (N - 1) + 1> stack;
+        stack.Push({0, 0, t_min});
+
+        while (!stack.Empty())
+        {
+            auto entry = stack.Pop();
+            if (entry.__count__ != 0)
+            {
+                if (leaf(entry.__ref__, entry.__count__))
+                {
+                    return true;
+                }
+                continue;
+            }
+
+            const auto &node = nodes[entry.__ref__];
+            node_visit_count++;
+
+            alignas(32) float t_near[N];
+            uint32_t hit_bits = IntersectWideNode(node, wide_ray, t_min, t_max, t_near);
+            while (hit_bits != 0)
+            {
+                uint32_t i = PopLowestBit(hit_bits);
+                if (!node.IsEmpty(i))
+                {
+                    stack.Push({node.__children__[i], node.__counts__[i], t_near[i]});
+                }
+            }
+        }
+
+        return false;
+    }
+
+    constexpr size_t RAY_STREAM_MIN_ACTIVE_COUNT = 4; // 光线流遍历的最少活跃光线数
+
+    struct WideBVHStreamEntry
+    {
+    public:
+        int __ref__;        // 宽节点索引或叶子图元起始索引
+        uint32_t __count__; // 叶子图元数量, 0表示内部节点
+        size_t __begin__;   // 到达该节点的活跃光线在索引缓冲中的区间[__begin__, __end__)
+        size_t __end__;
+    };
+
+    /*
+        N叉BVH光线流遍历, 一组光线共享节点的读取
+        每个节点对全部活跃光线求交, 按子节点过滤出新的活跃光线列表, 只有列表非空的子节点才会入栈
+        相干光线(光线包)的活跃列表几乎不变, 非相干光线流则随遍历逐步分散
+        t_max_of(ray_idx): 返回光线当前的求交上界, 返回-inf可使光线提前退出(如已被遮挡)
+        leaf(start, count, active): 叶子图元与到达该叶子的光线索引求交
+        返回光线与宽节点的求交次数, 用于调试统计
+    */
+    template <typename WideNode, typename TMaxFunc, typename LeafFunc>
+    inline size_t IntersectWideBVHStream(std::span<const WideNode> nodes, std::span<const WideRay<WideNode::WIDTH>> rays, float t_min, TMaxFunc &&t_max_of, LeafFunc &&leaf)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        if (nodes.empty() || rays.empty())
+        {
+            return 0;
+        }
+
+        // 索引缓冲按栈的方式使用: 后入栈的子节点区间总在缓冲末尾, 出栈时截断其上已处理完的区间
+        // t_nears与indices一一对应, 记录光线进入该节点的距离
+        ScratchBuffer<uint32_t> indices(rays.size());
+        ScratchBuffer<float> t_nears;
+        t_nears.Resize(rays.size(), t_min);
+        std::iota(indices.begin(), indices.end(), 0);
+        indices.Reserve(rays.size() * 4);
+        t_nears.Reserve(rays.size() * 4);
+        ScratchBuffer<uint32_t> masks(rays.size());
+        ScratchBuffer<float> child_t_nears(rays.size() * N);
+
+        TraversalStack<WideBVHStreamEntry, WIDE_BVH_STACK_DEPTH * (N - 1) + 1> stack;
+        size_t node_test_count = 0;
+        stack.Push({0, 0, 0, rays.size()});
+
+        while (!stack.Empty())
+        {
+            auto entry = stack.Pop();
+
+            // 剔除入栈后已找到更近交点的光线
+            size_t end = entry.__begin__;
+            for (size_t k = entry.__begin__; k < entry.__end__; k++)
+            {
+                if (t_nears[k] <= t_max_of(indices[k]))
+                {
+                    indices[end] = indices[k];
+                    t_nears[end] = t_nears[k];
+                    end++;
+                }
+            }
+            indices.Resize(end);
+            t_nears.Resize(end);
+            if (end == entry.__begin__)
+            {
+                continue;
+            }
+
+            size_t active_count = end - entry.__begin__;
+            if (entry.__count__ != 0) // 叶子
+            {
+                leaf(entry.__ref__, entry.__count__, std::span<const uint32_t>(indices.Data() + entry.__begin__, active_count));
+                continue;
+            }
+
+            // 活跃光线过少时共享节点读取的收益抵不过区间维护的开销, 退化为逐条光线遍历子树
+            if (active_count <= RAY_STREAM_MIN_ACTIVE_COUNT)
+            {
+                for (size_t k = entry.__begin__; k < end; k++)
+                {
+                    uint32_t ray_idx = indices[k];
+                    node_test_count += IntersectWideBVH(
+                        nodes, rays[ray_idx], t_min, t_max_of(ray_idx),
+                        [&](int start, uint32_t count, float &t_closest)
+                        {
+                            leaf(start, count, std::span<const uint32_t>(&ray_idx, 1));
+                            t_closest = t_max_of(ray_idx);
+                        },
+                        entry.__ref__);
+                }
+                continue;
+            }
+
+            const auto &node = nodes[entry.__ref__];
+            uint32_t valid_bits = 0;
+            for (uint32_t i = 0; i < N; i++)
+            {
+                valid_bits |= node.IsEmpty(i) ? 0u : (1u << i);
+            }
+            float child_t_near_sum[N] = {};
+            size_t child_ray_count[N] = {};
+            for (size_t k = 0; k < active_count; k++)
+            {
+                uint32_t ray_idx = indices[entry.__begin__ + k];
+                float *t_near = child_t_nears.Data() + k * N;
+                uint32_t hit_bits = IntersectWideNode(node, rays[ray_idx], t_min, t_max_of(ray_idx), t_near) & valid_bits;
+                masks[k] = hit_bits;
+                while (hit_bits != 0)
+                {
+                    uint32_t i = PopLowestBit(hit_bits);
+                    child_t_near_sum[i] += t_near[i];
+                    child_ray_count[i]++;
+                }
+            }
+            node_test_count += active_count;
+
+            // 按平均进入距离从远到近入栈, 最近的子节点最先处理
+            std::array<uint32_t, N> order;
+            size_t order_count = 0;
+            for (uint32_t i = 0; i < N; i++)
+            {
+                if (child_ray_count[i] == 0)
+                {
+                    continue;
+                }
+                child_t_near_sum[i] /= static_cast<float>(child_ray_count[i]);
+                size_t j = order_count++;
+                while (j > 0 && child_t_near_sum[order[j - 1]] < child_t_near_sum[i])
+                {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = i;
+            }
+
+            // 按入栈顺序为每个子节点分配连续区间, 再一次遍历把光线分发到各自的区间
+            size_t child_offset[N];
+            size_t offset = indices.Size();
+            for (size_t o = 0; o < order_count; o++)
+            {
+                uint32_t i = order[o];
+                child_offset[i] = offset;
+                stack.Push({node.__children__[i], node.__counts__[i], offset, offset + child_ray_count[i]});
+                offset += child_ray_count[i];
+            }
+            indices.Resize(offset);
+            t_nears.Resize(offset);
+            for (size_t k = 0; k < active_count; k++)
+            {
+                uint32_t ray_idx = indices[entry.__begin__ + k];
+                uint32_t hit_bits = masks[k];
+                while (hit_bits != 0)
+                {
+                    uint32_t i = PopLowestBit(hit_bits);
+                    indices[child_offset[i]] = ray_idx;
+                    t_nears[child_offset[i]++] = child_t_nears[k * N + i];
+                }
+            }
+        }
+
+        return node_test_count;
+    }
+
+    constexpr size_t RAY_PACKET_SIZE = 16; // 光线包的最大光线数, 不超过掩码的32位
+
+    // 光线方向所在卦限
+    inline uint32_t GetDirectionOctant(const Ray &ray)
+    {
+        return static_cast<uint32_t>(ray.__direction__.x < 0.f) |
+               (static_cast<uint32_t>(ray.__direction__.y < 0.f) << 1) |
+               (static_cast<uint32_t>(ray.__direction__.z < 0.f) << 2);
+    }
+
+    /*
+        光线包: 方向卦限相同的一组光线, 起点与方向倒数以SoA方式存储, 每SIMD_WIDTH条光线为一组
+        遍历时一个子包围盒一次与一组光线求交, 卦限相同保证所有光线选取同一组近/远平面
+    */
+    struct RayPacket
+    {
+    public:
+        static constexpr size_t CHUNK_COUNT = (RAY_PACKET_SIZE + SIMD_WIDTH - 1) / SIMD_WIDTH;
+        static constexpr size_t LANE_COUNT = CHUNK_COUNT * SIMD_WIDTH; // 末组不足SIMD_WIDTH条时补齐的槽位不参与遍历
+
+    public:
+        alignas(32) float __origin__[3][LANE_COUNT];
+        alignas(32) float __invDir__[3][LANE_COUNT];
+        bool __dirIsNeg__[3];
+        uint32_t __count__;
+
+    public:
+        explicit RayPacket(std::span<const Ray> rays) : __count__(static_cast<uint32_t>(rays.size()))
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                __dirIsNeg__[axis] = rays[0].__direction__[axis] < 0.f;
+                for (size_t lane = 0; lane < LANE_COUNT; lane++)
+                {
+                    __origin__[axis][lane] = lane < rays.size() ? rays[lane].__origin__[axis] : 0.f;
+                    __invDir__[axis][lane] = lane < rays.size() ? 1.f / rays[lane].__direction__[axis] : 0.f;
+                }
+            }
+        }
+
+        // 光线数不超过RAY_PACKET_SIZE且方向卦限全部相同时可以作为光线包遍历
+        static bool IsCoherent(std::span<const Ray> rays)
+        {
+            if (rays.empty() || rays.size() > RAY_PACKET_SIZE)
+            {
+                return false;
+            }
+            uint32_t octant = GetDirectionOctant(rays[0]);
+            return std::all_of(rays.begin() + 1, rays.end(), [&](const Ray &ray)
+                               { return GetDirectionOctant(ray) == octant; });
+        }
+    };
+
+    struct WideBVHPacketEntry
+    {
+    public:
+        int __ref__;         // 宽节点索引或叶子图元起始索引
+        uint32_t __count__;  // 叶子图元数量, 0表示内部节点
+        uint32_t __active__; // 到达该节点的光线掩码
+        float __tNear__;     // 活跃光线中最小的进入距离
+    };
+
+    /*
+        N叉BVH光线包遍历, 包内光线共享一个节点栈, 每个节点只读取一次
+        逐个子节点用SIMD对全部活跃光线求交, 命中的子节点携带命中光线的掩码, 按最小进入距离从远到近入栈
+        出栈时剔除当前最近交点已比该节点最小进入距离更近的光线, 全部剔除则跳过该节点
+        回调与IntersectWideBVHStream相同: t_max_of(lane)返回光线的求交上界, 返回-inf使光线退出; leaf(start, count, active)
+        返回访问的宽节点数, 用于调试统计
+    */
+    template <typename WideNode, typename TMaxFunc, typename LeafFunc>
+    inline size_t IntersectWideBVHPacket(std::span<const WideNode> nodes, const RayPacket &packet, float t_min, TMaxFunc &&t_max_of, LeafFunc &&leaf)
+    {
+        constexpr size_t N = WideNode::WIDTH;
+        using V = VFloat<SIMD_WIDTH>;
+        if (nodes.empty() || packet.__count__ == 0)
+        {
+            return 0;
+        }
+
+        // 光线的当前上界, 只在叶子回调后刷新; 补齐的槽位为-inf, 永远不会命中
+        alignas(32) float t_max[RayPacket::LANE_COUNT];
+        uint32_t live = 0; // 尚未退出的光线
+        for (uint32_t lane = 0; lane < RayPacket::LANE_COUNT; lane++)
+        {
+            t_max[lane] = lane < packet.__count__ ? t_max_of(lane) : -std::numeric_limits<float>::infinity();
+            live |= t_max[lane] >= t_min ? (1u << lane) : 0u;
+        }
+
+        V origin[3][RayPacket::CHUNK_COUNT], inv_dir[3][RayPacket::CHUNK_COUNT];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (size_t c = 0; c < RayPacket::CHUNK_COUNT; c++)
+            {
+                origin[axis][c] = V::Load(packet.__origin__[axis] + c * SIMD_WIDTH);
+                inv_dir[axis][c] = V::Load(packet.__invDir__[axis] + c * SIMD_WIDTH);
+            }
+        }
+        constexpr uint32_t CHUNK_MASK = (1u << SIMD_WIDTH) - 1;
+        V v_t_min = V::Broadcast(t_min);
+
+        TraversalStack<WideBVHPacketEntry, WIDE_BVH_STACK_DEPTH * (N - 1) + 1> stack;
+        size_t node_visit_count = 0;
+        stack.Push({0, 0, live, t_min});
+
+        while (!stack.Empty() && live != 0)
+        {
+            auto entry = stack.Pop();
+            uint32_t active = 0;
+            V t_near_entry = V::Broadcast(entry.__tNear__);
+            for (size_t c = 0; c < RayPacket::CHUNK_COUNT; c++)
+            {
+                active |= (V::Load(t_max + c * SIMD_WIDTH) >= t_near_entry).Bits() << (c * SIMD_WIDTH);
+            }
+            active &= entry.__active__ & live;
+            if (active == 0)
+            {
+                continue;
+            }
+
+            if (entry.__count__ != 0) // 叶子
+            {
+                uint32_t lanes[RAY_PACKET_SIZE];
+                uint32_t lane_count = 0;
+                for (uint32_t bits = active; bits != 0;)
+                {
+                    lanes[lane_count++] = PopLowestBit(bits);
+                }
+                leaf(entry.__ref__, entry.__count__, std::span<const uint32_t>(lanes, lane_count));
+                for (uint32_t k = 0; k < lane_count; k++)
+                {
+                    t_max[lanes[k]] = t_max_of(lanes[k]);
+                    live &= t_max[lanes[k]] >= t_min ? ~0u : ~(1u << lanes[k]);
+                }
+                continue;
+            }
+
+            const auto &node = nodes[entry.__ref__];
+            node_visit_count++;
+
+            WideBVHPacketEntry hits[N];
+            size_t hit_count = 0;
+            for (uint32_t i = 0; i < N; i++)
+            {
+                if (node.IsEmpty(i))
+                {
+                    continue;
+                }
+                auto bounds = node.GetChildBounds(i);
+                V near_plane[3], far_plane[3];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    near_plane[axis] = V::Broadcast(packet.__dirIsNeg__[axis] ? bounds.__bMax__[axis] : bounds.__bMin__[axis]);
+                    far_plane[axis] = V::Broadcast(packet.__dirIsNeg__[axis] ? bounds.__bMin__[axis] : bounds.__bMax__[axis]);
+                }
+
+                // 与IntersectWideNode逐条光线的计算完全相同, 结果不受遍历方式影响
+                uint32_t child_active = 0;
+                float child_t_near = std::numeric_limits<float>::infinity();
+                for (size_t c = 0; c < RayPacket::CHUNK_COUNT; c++)
+                {
+                    uint32_t chunk_active = (active >> (c * SIMD_WIDTH)) & CHUNK_MASK;
+                    if (chunk_active == 0)
+                    {
+                        continue;
+                    }
+                    V t_near_x = (near_plane[0] - origin[0][c]) * inv_dir[0][c];
+                    V t_near_y = (near_plane[1] - origin[1][c]) * inv_dir[1][c];
+                    V t_near_z = (near_plane[2] - origin[2][c]) * inv_dir[2][c];
+                    V t_far_x = (far_plane[0] - origin[0][c]) * inv_dir[0][c];
+                    V t_far_y = (far_plane[1] - origin[1][c]) * inv_dir[1][c];
+                    V t_far_z = (far_plane[2] - origin[2][c]) * inv_dir[2][c];
+                    V near = Max(Max(t_near_x, t_near_y), Max(t_near_z, v_t_min));
+                    V far = Min(Min(t_far_x, t_far_y), Min(t_far_z, V::Load(t_max + c * SIMD_WIDTH)));
+                    uint32_t hit_bits = (near <= far).Bits() & chunk_active;
+                    if (hit_bits == 0)
+                    {
+                        continue;
+                    }
+                    alignas(32) float t_near[SIMD_WIDTH];
+                    near.Store(t_near);
+                    child_active |= hit_bits << (c * SIMD_WIDTH);
+                    while (hit_bits != 0)
+                    {
+                        child_t_near = std::min(child_t_near, t_near[PopLowestBit(hit_bits)]);
+                    }
+                }
+                if (child_active == 0)
+                {
+                    continue;
+                }
+
+                // 插入排序, 按最小进入距离降序排列
+                WideBVHPacketEntry hit{node.__children__[i], node.__counts__[i], child_active, child_t_near};
+                size_t j = hit_count++;
+                while (j > 0 && hits[j - 1].__tNear__ < hit.__tNear__)
+                {
+                    hits[j] = hits[j - 1];
+                    j--;
+                }
+                hits[j] = hit;
+            }
+
+            for (size_t i = 0; i < hit_count; i++)
+            {
+                stack.Push(hits[i]);
+            }
+        }
+
+        return node_visit_count;
+    }
+
+    /*
+        批量遍历入口: 相干的光线(RayPacket::IsCoherent)作为光线包遍历, 其余以光线流遍历
+        wide_rays[i]为rays[i]的预计算数据, 光线流遍历与叶子求交使用; 回调中的光线索引即rays的下标
+    */
+    template <typename WideNode, typename TMaxFunc, typename LeafFunc>
+    inline size_t IntersectWideBVHBatch(std::span<const WideNode> nodes, std::span<const Ray> rays, std::span<const WideRay<WideNode::WIDTH>> wide_rays, float t_min, TMaxFunc &&t_max_of, LeafFunc &&leaf)
+    {
+        if (RayPacket::IsCoherent(rays))
+        {
+            return IntersectWideBVHPacket(nodes, RayPacket(rays), t_min, t_max_of, leaf);
+        }
+        return IntersectWideBVHStream(nodes, wide_rays, t_min, t_max_of, leaf);
+    }
+
+    namespace internal
+    {
+        /*
+            将二叉BVH塌缩为N叉BVH
+            每个宽节点从二叉节点的两个子节点出发, 反复展开表面积最大的内部子节点, 直到填满N个槽位
+            图元数不超过max_leaf_size的子树直接合并为一个叶子(子树图元在有序数组中连续)
+        */
+        template <size_t N, typename BinaryNode, typename LeafRangeFunc>
+        class BVHCollapser
+        {
+        private:
+            const std::vector<BinaryNode> &mBinary;
+            std::vector<WideBVHNode<N>> &mWide;
+            LeafRangeFunc &mLeafRange;
+            size_t mMaxLeafSize;
+            std::vector<std::pair<size_t, size_t>> mRanges; // 每个二叉节点子树的图元区间(start, count)
+
+        public:
+            BVHCollapser(const std::vector<BinaryNode> &binary, std::vector<WideBVHNode<N>> &wide, LeafRangeFunc &leaf_range, size_t max_leaf_size)
+                : mBinary(binary), mWide(wide), mLeafRange(leaf_range), mMaxLeafSize(max_leaf_size) {}
+
+            void Collapse()
+            {
+                mWide.clear();
+                if (mBinary.empty())
+                {
+                    return;
+                }
+
+                // 子节点索引总大于父节点, 逆序遍历即可自底向上得到子树区间
+                mRanges.resize(mBinary.size());
+                for (size_t i = mBinary.size(); i-- > 0;)
+                {
+                    auto [start, count] = mLeafRange(mBinary[i]);
+                    if (count != 0)
+                    {
+                        mRanges[i] = {start, count};
+                    }
+                    else
+                    {
+                        const auto &left = mRanges[i + 1];
+                        const auto &right = mRanges[mBinary[i].__right__];
+                        mRanges[i] = {glm::min(left.first, right.first), left.second + right.second};
+                    }
+                }
+
+                if (mRanges[0].second == 0)
+                {
+                    return;
+                }
+
+                mWide.reserve(mBinary.size() / (N - 1) + 1);
+                if (IsCollapsedLeaf(0))
+                {
+                    // 根节点本身即为叶子
+                    mWide.emplace_back();
+                    mWide[0].SetChild(0, mBinary[0].__bounds__, static_cast<int>(mRanges[0].first), static_cast<uint32_t>(mRanges[0].second));
+                }
+                else
+                {
+                    Build(0);
+                }
+            }
+
+        private:
+            bool IsCollapsedLeaf(size_t binary_idx) const
+            {
+                return mLeafRange(mBinary[binary_idx]).second != 0 || mRanges[binary_idx].second <= mMaxLeafSize;
+            }
+
+            size_t Build(size_t binary_idx)
+            {
+                size_t wide_idx = mWide.size();
+                mWide.emplace_back();
+
+                std::array<size_t, N> slots;
+                size_t slot_count = 2;
+                slots[0] = binary_idx + 1;
+                slots[1] = mBinary[binary_idx].__right__;
+
+                // 展开表面积最大的内部子节点, 它被光线命中的概率最高
+                while (slot_count < N)
+                {
+                    size_t best_slot = N;
+                    float best_area = -1.f;
+                    for (size_t i = 0; i < slot_count; i++)
+                    {
+                        if (IsCollapsedLeaf(slots[i]))
+                        {
+                            continue;
+                        }
+                        float area = mBinary[slots[i]].__bounds__.GetSurfaceArea();
+                        if (area > best_area)
+                        {
+                            best_area = area;
+                            best_slot = i;
+                        }
+                    }
+                    if (best_slot == N)
+                    {
+                        break;
+                    }
+                    size_t opened = slots[best_slot];
+                    slots[best_slot] = opened + 1;
+                    slots[slot_count++] = mBinary[opened].__right__;
+                }
+
+                for (size_t i = 0; i < slot_count; i++)
+                {
+                    size_t child = slots[i];
+                    const auto &bounds = mBinary[child].__bounds__;
+                    if (IsCollapsedLeaf(child))
+                    {
+                        mWide[wide_idx].SetChild(i, bounds, static_cast<int>(mRanges[child].first), static_cast<uint32_t>(mRanges[child].second));
+                    }
+                    else
+                    {
+                        // 递归会使mWide扩容, 必须在返回后再通过索引访问
+                        size_t child_wide_idx = Build(child);
+                        mWide[wide_idx].SetChild(i, bounds, static_cast<int>(child_wide_idx), 0);
+                    }
+                }
+                return wide_idx;
+            }
+        };
+    }
+
+    /*
+        leaf_range(node) -> std::pair<size_t, size_t>: 返回二叉节点的叶子图元区间(start, count), count为0表示内部节点
+        二叉节点需按深度优先展开(左子节点紧随父节点), 并提供__bounds__与__right__
+    */
+    template <size_t N, typename BinaryNode, typename LeafRangeFunc>
+    inline void CollapseBVH(const std::vector<BinaryNode> &binary, std::vector<WideBVHNode<N>> &wide, LeafRangeFunc &&leaf_range, size_t max_leaf_size = 0)
+    {
+        internal::BVHCollapser<N, BinaryNode, std::remove_reference_t<LeafRangeFunc>> collapser(binary, wide, leaf_range, max_leaf_size);
+        collapser.Collapse();
+    }
+
+    // 将浮点宽节点逐个量化, 节点顺序与子节点引用不变
+    template <size_t N>
+    inline void QuantizeWideBVH(const std::vector<WideBVHNode<N>> &wide, std::vector<QuantizedWideBVHNode<N>> &quantized)
+    {
+        quantized.clear();
+        quantized.reserve(wide.size());
+        for (const auto &node : wide)
+        {
+            quantized.emplace_back(node);
+        }
+    }
+}
\ No newline at end of file
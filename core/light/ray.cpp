@@ -3,10 +3,9 @@
 namespace pbrt
 {
     // 将射线从世界空间变换到物体空间
-    Ray Ray::ObjectFromWorld(const glm::mat4 &object_from_world) const
+    Ray Ray::ObjectFromWorld(const AffineTransform &object_from_world) const
     {
-        glm::vec3 o = object_from_world * glm::vec4(__origin__, 1.f);
-        glm::vec3 d = object_from_world * glm::vec4(__direction__, 0.f);
-        return Ray{o, d};
+        // 返回新的光线而不是自身的引用, 调试计数从0开始, 由调用者累加回世界空间光线
+        return Ray{object_from_world.TransformPoint(__origin__), object_from_world.TransformVector(__direction__)};
     }
 }
\ No newline at end of file
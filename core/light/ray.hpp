@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include "material/material.hpp"
 #include "utils/debugMacro.hpp"
+#include "utils/transform.hpp"
 #include <glm/glm.hpp>
 
 namespace pbrt
@@ -17,7 +18,7 @@ namespace pbrt
             return __origin__ + t * __direction__;
         }
 
-        Ray ObjectFromWorld(const glm::mat4 &object_from_world) const;
+        Ray ObjectFromWorld(const AffineTransform &object_from_world) const;
 
         DEBUG_INFO(mutable size_t __boundsTestCount__ = 0)
         DEBUG_INFO(mutable size_t __triangleTestCount__ = 0)
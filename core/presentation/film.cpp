@@ -40,19 +40,17 @@ namespace pbrt
     void Film::Save(const std::filesystem::path &filename) const
     {
         std::vector<glm::vec3> buffer(mWidth * mHeight);
-        MasterThreadPool.ParallelFor(mWidth, mHeight, [&](size_t x, size_t y)
-                                     {
-                                         auto pixel = GetPixel(x, y);
-                                         // 防止NaN check导致该像素内无采样点
-                                         if (pixel.__sampleCount__ == 0)
-                                         {
-                                             return;
-                                         }
-                                         buffer[y * mWidth + x] = pixel.__color__ / static_cast<double>(pixel.__sampleCount__);
-                                         // end
-                                     },
-                                     false);
-        MasterThreadPool.Wait();
+        MasterThreadPool.ParallelFor2D(mWidth, mHeight, [&](size_t x, size_t y)
+                                       {
+                                           auto pixel = GetPixel(x, y);
+                                           // 防止NaN check导致该像素内无采样点
+                                           if (pixel.__sampleCount__ == 0)
+                                           {
+                                               return;
+                                           }
+                                           buffer[y * mWidth + x] = pixel.__color__ / static_cast<double>(pixel.__sampleCount__);
+                                           // end
+                                       });
 
         Image image(std::move(buffer), mWidth, mHeight);
         image.Save(filename);
@@ -67,18 +67,15 @@ namespace pbrt
              << mWidth << " " << mHeight << "\n255\n";
 
         std::vector<uint8_t> buffer(mWidth * mHeight * 3);
-        MasterThreadPool.ParallelFor(mWidth, mHeight, [&](size_t x, size_t y)
-                                     {
-                                         auto idx = (y * mWidth + x) * 3;
-                                         RGB rgb(GetPixel(x, y));
-                                         buffer[idx + 0] = rgb.mRed;
-                                         buffer[idx + 1] = rgb.mGreen;
-                                         buffer[idx + 2] = rgb.mBlue;
-                                         // end
-                                     },
-                                     false);
-
-        MasterThreadPool.Wait();
+        MasterThreadPool.ParallelFor2D(mWidth, mHeight, [&](size_t x, size_t y)
+                                       {
+                                           auto idx = (y * mWidth + x) * 3;
+                                           RGB rgb(GetPixel(x, y));
+                                           buffer[idx + 0] = rgb.mRed;
+                                           buffer[idx + 1] = rgb.mGreen;
+                                           buffer[idx + 2] = rgb.mBlue;
+                                           // end
+                                       });
         file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
     }
 
@@ -1,4 +1,5 @@
 ﻿#pragma once
+#include "thread/numaReplicated.hpp"
 #include <glm/glm.hpp>
 #include <filesystem>
 
@@ -8,6 +9,7 @@ namespace pbrt
     {
     private:
         std::vector<glm::vec3> mPixels;
+        NumaReplicated<glm::vec3> mNumaPixels; // 像素在各NUMA分区的副本, 用于渲染时频繁读取的图像(如环境光贴图)
         size_t mWidth, mHeight;
 
     private:
@@ -24,11 +26,14 @@ namespace pbrt
         Image(std::vector<glm::vec3> &&pixels, size_t width, size_t height) : mPixels(pixels), mWidth(width), mHeight(height) {}
 
         // 像素访问
-        glm::vec3 GetPixel(size_t x, size_t y) const { return mPixels[glm::clamp<size_t>(y, 0, mHeight - 1) * mWidth + glm::clamp<size_t>(x, 0, mWidth - 1)]; }
+        glm::vec3 GetPixel(size_t x, size_t y) const { return mNumaPixels.Get(mPixels)[glm::clamp<size_t>(y, 0, mHeight - 1) * mWidth + glm::clamp<size_t>(x, 0, mWidth - 1)]; }
         glm::vec3 GetPixel(const glm::vec2 &point) const { return GetPixel(static_cast<size_t>(point.x), static_cast<size_t>(point.y)); }
         // 设置像素值时进行边界检查，防止越界访问
         void SetPixel(size_t x, size_t y, const glm::vec3 &val) { mPixels[glm::clamp<size_t>(y, 0, mHeight - 1) * mWidth + glm::clamp<size_t>(x, 0, mWidth - 1)] = val; }
 
+        // 在线程池的每个NUMA分区复制一份像素, 之后SetPixel的修改需要重新复制才能被读取到
+        void ReplicatePerNumaNode() { mNumaPixels.Replicate(mPixels); }
+
         // 获取图像分辨率或尺寸
         size_t GetWidth() const { return mWidth; }
         size_t GetHeight() const { return mHeight; }
@@ -142,6 +142,15 @@ namespace pbrt
                 }
             }
 
+            if (mEditableScene)
+            {
+                mSceneEditor(*mEditableScene, dt);
+                if (mEditableScene->Update())
+                {
+                    mCurrentSPP = 0; // 场景改变, 重新累积采样
+                }
+            }
+
             auto start = std::chrono::high_resolution_clock::now();            // 记录开始时间
             RendererFrame();                                                   // 渲染一帧
             auto duration = std::chrono::high_resolution_clock::now() - start; // 计算耗时
@@ -169,15 +178,9 @@ namespace pbrt
         {
             film.Clear(); // 清空
         }
-        MasterThreadPool.ParallelFor(film.GetWidth(), film.GetHeight(), [&](size_t x, size_t y)
-                                     {
-                                         for (size_t i = mCurrentSPP; i < mCurrentSPP + render_spp; i++)
-                                         {
-                                             film.AddSample(x, y, renderer->RenderPixel({x, y, i}));
-                                         }
-                                         // end
-                                     });
-        MasterThreadPool.Wait();
+        mTileScheduler.Resize(film.GetWidth(), film.GetHeight()); // 分辨率随帧率调整, 不变时沿用上一帧的划分
+        mTileScheduler.ParallelForTiles([&](const RenderTile &tile)
+                                        { renderer->RenderTileSamples(mTileScheduler, tile, mCurrentSPP, render_spp); });
         mCurrentSPP += render_spp;
     }
 
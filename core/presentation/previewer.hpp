@@ -1,6 +1,8 @@
 ﻿#pragma once
 #include "renderer/renderer.hpp"
+#include "renderer/tileScheduler.hpp"
 #include <SFML/Graphics.hpp>
+#include <functional>
 #include <vector>
 #include <memory>
 
@@ -19,6 +21,10 @@ namespace pbrt
         glm::ivec2 mFilmResolution;
 
         size_t mCurrentSPP = 0;
+        TileScheduler mTileScheduler{TileOrder::Spiral}; // 从画面中心向外渲染
+
+        Scene *mEditableScene = nullptr;
+        std::function<void(Scene &, float)> mSceneEditor;
 
         std::shared_ptr<sf::RenderWindow> mWindow;
         std::shared_ptr<sf::Texture> mTexture;
@@ -34,6 +40,16 @@ namespace pbrt
         ~Previewer() = default;
         bool Preview();
 
+        /*
+            交互式场景编辑: 每帧渲染前调用editor(scene, dt)修改场景(如SetShapeTransform)
+            之后由预览器调用Scene::Update增量更新, 场景发生变化时重新累积采样
+        */
+        void SetSceneEditor(Scene &scene, std::function<void(Scene &, float)> editor)
+        {
+            mEditableScene = &scene;
+            mSceneEditor = std::move(editor);
+        }
+
         sf::RenderWindow &GetWindow() const
         {
             return *mWindow;
@@ -315,7 +315,7 @@ namespace pbrt
                 glm::vec3 shadow_origin = lv.position + dir * bdpt::SHADOW_EPS;
                 float shadow_tmin = bdpt::SHADOW_EPS;
                 float shadow_tmax = dist - bdpt::SHADOW_EPS;
-                if (mScene.Intersect(Ray{shadow_origin, dir}, shadow_tmin, shadow_tmax))
+                if (mScene.Occluded(Ray{shadow_origin, dir}, shadow_tmin, shadow_tmax))
                 {
                     continue;
                 }
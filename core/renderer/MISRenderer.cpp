@@ -9,11 +9,16 @@ namespace pbrt
         return (pdf_j * pdf_j) / (pdf_j * pdf_j + pdf_k * pdf_k);
     }
 
-    glm::vec3 MISRenderer::RenderPixel(const glm::ivec3 &pixel_coord)
+    std::optional<Ray> MISRenderer::GenerateCameraRay(const glm::ivec3 &pixel_coord)
     {
         thread_local RNG rng{};
-        rng.SetSeed(static_cast<size_t>(pixel_coord.x + pixel_coord.y * 10000 + pixel_coord.z * 10000 * 10000));
-        auto ray = mCamera.GenerateRay(pixel_coord, {rng.Uniform(), rng.Uniform()});
+        return SampleCameraRay(pixel_coord, rng);
+    }
+
+    glm::vec3 MISRenderer::TracePixel(const glm::ivec3 &pixel_coord, const HitRecord *camera_hit)
+    {
+        thread_local RNG rng{};
+        auto ray = SampleCameraRay(pixel_coord, rng);
 
         glm::vec3 beta = {1.f, 1.f, 1.f};     // i = 1, β = 1; i > 1, β = Π( f_i * |cosθ_i| / pdf_i )
         glm::vec3 radiance = {0.f, 0.f, 0.f}; // L_o = L_e + ∫(f_i * L_i * |cosθ_i|) = Σ (β * L_e) -> RR -> Σ (β / q_r * L_e)
@@ -33,7 +38,8 @@ namespace pbrt
 
         while (true)
         {
-            auto hit_info = mScene.Intersect(ray);
+            auto hit_info = camera_hit ? mScene.GetHitInfo(ray, *camera_hit) : mScene.Intersect(ray); // 相机光线使用块内批量求交的结果
+            camera_hit = nullptr;
             if (hit_info.has_value()) // 与场景相交
             {
                 // 与光源相交, 直接对结果产生贡献(如果在RR后会导致光源上有黑色噪点)
@@ -88,7 +94,7 @@ namespace pbrt
                                 最小距离防止光线与发出该光线的表面自身相交
                                 最大距离防止光线与目标光源本身相交
                             */
-                            if (light_info.has_value() && (!mScene.Intersect(Ray{hit_info->__hitPoint__, light_info->__lightPoint__ - hit_info->__hitPoint__}, 1e-5, 1.f - 1e-5)))
+                            if (light_info.has_value() && (!mScene.Occluded(Ray{hit_info->__hitPoint__, light_info->__lightPoint__ - hit_info->__hitPoint__}, 1e-5, 1.f - 1e-5)))
                             {
                                 glm::vec3 light_dir_local = frame.LocalFromWorld(light_info->__direction__);
 
@@ -3,5 +3,5 @@
 
 namespace pbrt
 {
-    DEFINE_RENDERER(MIS)
+    DEFINE_BATCH_RENDERER(MIS)
 }
\ No newline at end of file
@@ -4,11 +4,16 @@
 
 namespace pbrt
 {
-    glm::vec3 PTRenderer::RenderPixel(const glm::ivec3 &pixel_coord)
+    std::optional<Ray> PTRenderer::GenerateCameraRay(const glm::ivec3 &pixel_coord)
     {
         thread_local RNG rng{};
-        rng.SetSeed(static_cast<size_t>(pixel_coord.x + pixel_coord.y * 10000 + pixel_coord.z * 10000 * 10000));
-        auto ray = mCamera.GenerateRay(pixel_coord, {rng.Uniform(), rng.Uniform()});
+        return SampleCameraRay(pixel_coord, rng);
+    }
+
+    glm::vec3 PTRenderer::TracePixel(const glm::ivec3 &pixel_coord, const HitRecord *camera_hit)
+    {
+        thread_local RNG rng{};
+        auto ray = SampleCameraRay(pixel_coord, rng);
         glm::vec3 beta = {1.f, 1.f, 1.f};
         glm::vec3 radiance = {0.f, 0.f, 0.f};
         float q = 0.9f;
@@ -16,7 +21,8 @@ namespace pbrt
 
         while (true)
         {
-            auto hit_info = mScene.Intersect(ray);
+            auto hit_info = camera_hit ? mScene.GetHitInfo(ray, *camera_hit) : mScene.Intersect(ray); // 相机光线使用块内批量求交的结果
+            camera_hit = nullptr;
             if (hit_info.has_value())
             {
                 if (last_is_delta && hit_info->__material__ && hit_info->__material__->mAreaLight)
@@ -49,7 +55,7 @@ namespace pbrt
                         if (light_sample_info.has_value())
                         {
                             auto light_info = light_sample_info->__light__->SampleLight(hit_info->__hitPoint__, mScene.GetRadius(), rng, false);
-                            if (light_info.has_value() && (!mScene.Intersect({hit_info->__hitPoint__, light_info->__lightPoint__ - hit_info->__hitPoint__}, 1e-5, 1.f - 1e-5)))
+                            if (light_info.has_value() && (!mScene.Occluded({hit_info->__hitPoint__, light_info->__lightPoint__ - hit_info->__hitPoint__}, 1e-5, 1.f - 1e-5)))
                             {
                                 glm::vec3 light_dir_local = frame.LocalFromWorld(light_info->__direction__);
                                 radiance += beta * hit_info->__material__->BSDF(hit_info->__hitPoint__, light_dir_local, view_dir) * glm::abs(light_dir_local.y) * light_info->__Le__ / (light_info->__pdf__ * light_sample_info->__prob__);
@@ -3,5 +3,5 @@
 
 namespace pbrt
 {
-    DEFINE_RENDERER(PT)
+    DEFINE_BATCH_RENDERER(PT)
 }
\ No newline at end of file
@@ -3,10 +3,15 @@
 
 namespace pbrt
 {
-    glm::vec3 NormalRenderer::RenderPixel(const glm::ivec3 &pixel_coord)
+    std::optional<Ray> NormalRenderer::GenerateCameraRay(const glm::ivec3 &pixel_coord)
+    {
+        return mCamera.GenerateRay(pixel_coord);
+    }
+
+    glm::vec3 NormalRenderer::TracePixel(const glm::ivec3 &pixel_coord, const HitRecord *camera_hit)
     {
         auto ray = mCamera.GenerateRay(pixel_coord);
-        auto hit_info = mScene.Intersect(ray);
+        auto hit_info = camera_hit ? mScene.GetHitInfo(ray, *camera_hit) : mScene.Intersect(ray);
         if (hit_info.has_value())
         {
             glm::ivec3 color = (hit_info->__normal__ * 0.5f + 0.5f) * 255.f;
@@ -3,5 +3,5 @@
 
 namespace pbrt
 {
-    DEFINE_RENDERER(Normal)
+    DEFINE_BATCH_RENDERER(Normal)
 }
\ No newline at end of file
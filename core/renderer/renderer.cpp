@@ -1,6 +1,7 @@
 ﻿#include "renderer.hpp"
-#include "thread/threadPool.hpp"
+#include "tileScheduler.hpp"
 #include "utils/progress.hpp"
+#include "utils/scratchBuffer.hpp"
 
 namespace pbrt
 {
@@ -11,21 +12,60 @@ namespace pbrt
         auto &film = mCamera.GetFilm();
         film.Clear();
         Progress progress(film.GetWidth() * film.GetHeight() * spp);
+        TileScheduler scheduler(film.GetWidth(), film.GetHeight());
         while (current_spp < spp)
         {
-            MasterThreadPool.ParallelFor(film.GetWidth(), film.GetHeight(), [&](size_t x, size_t y)
-                                         {
-                                             for (int i = 0; i < increase; i++)
-                                             {
-                                                 film.AddSample(x, y, RenderPixel({x, y, current_spp + i}));
-                                             }
-                                             progress.Update(increase);
-                                             // end
-                                         });
-            MasterThreadPool.Wait();
+            scheduler.ParallelForTiles([&](const RenderTile &tile)
+                                       {
+                                           RenderTileSamples(scheduler, tile, current_spp, increase);
+                                           progress.Update(tile.__size__.x * tile.__size__.y * increase);
+                                           // end
+                                       });
             current_spp += increase;
             increase = std::min<size_t>(current_spp, 32);
             film.Save(filename);
         }
     }
+
+    void Renderer::RenderTileSamples(const TileScheduler &scheduler, const RenderTile &tile, size_t first_sample, size_t sample_count)
+    {
+        auto &film = mCamera.GetFilm();
+        ScratchBuffer<glm::uvec2> pixels;
+        scheduler.ForEachPixel(tile, [&](size_t x, size_t y)
+                               { pixels.PushBack(glm::uvec2(x, y)); });
+
+        ScratchBuffer<Ray> rays;
+        ScratchBuffer<HitRecord> records;
+        for (size_t sample = first_sample; sample < first_sample + sample_count; sample++)
+        {
+            rays.Clear();
+            for (const auto &pixel : pixels)
+            {
+                auto ray = GenerateCameraRay({pixel.x, pixel.y, sample});
+                if (!ray.has_value())
+                {
+                    break;
+                }
+                rays.PushBack(*ray);
+            }
+
+            bool is_batched = rays.Size() == pixels.Size();
+            if (is_batched)
+            {
+                records.Resize(rays.Size());
+                mScene.Intersect(rays.Span(), records.Span());
+            }
+            for (size_t k = 0; k < pixels.Size(); k++)
+            {
+                glm::ivec3 pixel_coord{pixels[k].x, pixels[k].y, sample};
+                film.AddSample(pixels[k].x, pixels[k].y, is_batched ? TracePixel(pixel_coord, &records[k]) : RenderPixel(pixel_coord));
+            }
+        }
+    }
+
+    Ray Renderer::SampleCameraRay(const glm::ivec3 &pixel_coord, RNG &rng) const
+    {
+        rng.SetSeed(static_cast<size_t>(pixel_coord.x + pixel_coord.y * 10000 + pixel_coord.z * 10000 * 10000));
+        return mCamera.GenerateRay(pixel_coord, {rng.Uniform(), rng.Uniform()});
+    }
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 ﻿#pragma once
 #include "presentation/camera.hpp"
 #include "shape/scene.hpp"
+#include "tileScheduler.hpp"
+#include "utils/rng.hpp"
 
 namespace pbrt
 {
@@ -14,6 +16,19 @@ namespace pbrt
         Name##Renderer(Camera &camera, const Scene &scene) : Renderer(camera, scene) {} \
     };
 
+// 批量求交相机光线的渲染器, 实现GenerateCameraRay与TracePixel
+#define DEFINE_BATCH_RENDERER(Name)                                                                                \
+    class Name##Renderer : public Renderer                                                                         \
+    {                                                                                                              \
+    private:                                                                                                       \
+        glm::vec3 RenderPixel(const glm::ivec3 &pixel_coord) override { return TracePixel(pixel_coord, nullptr); } \
+        std::optional<Ray> GenerateCameraRay(const glm::ivec3 &pixel_coord) override;                              \
+        glm::vec3 TracePixel(const glm::ivec3 &pixel_coord, const HitRecord *camera_hit) override;                 \
+                                                                                                                   \
+    public:                                                                                                        \
+        Name##Renderer(Camera &camera, const Scene &scene) : Renderer(camera, scene) {}                            \
+    };
+
     class Renderer
     {
         friend class Previewer;
@@ -22,11 +37,27 @@ namespace pbrt
         Camera &mCamera;
         const Scene &mScene;
 
+    protected:
+        // 以像素坐标与采样序号为随机数种子, 生成像素内随机偏移的相机光线, rng之后继续用于该采样的路径
+        Ray SampleCameraRay(const glm::ivec3 &pixel_coord, RNG &rng) const;
+
     public:
         Renderer(Camera &camera, const Scene &scene) : mCamera(camera), mScene(scene) {}
 
         void Render(const std::filesystem::path &filename, size_t spp);
 
+        /*
+            渲染块内每个像素的采样[first_sample, first_sample + sample_count)
+            每个采样先生成块内全部相机光线, 按Morton顺序每4x4个像素构成一个光线包, 由Scene的批量求交一起遍历, 再逐像素着色
+            不批量求交相机光线的渲染器逐像素调用RenderPixel
+        */
+        void RenderTileSamples(const TileScheduler &scheduler, const RenderTile &tile, size_t first_sample, size_t sample_count);
+
         virtual glm::vec3 RenderPixel(const glm::ivec3 &pixel_coord) = 0;
+
+        // 相机光线, 必须与TracePixel第一次求交的光线完全相同; 返回nullopt表示不批量求交相机光线
+        virtual std::optional<Ray> GenerateCameraRay(const glm::ivec3 &pixel_coord) { return std::nullopt; }
+        // camera_hit为相机光线的批量求交结果, 为nullptr时自行求交
+        virtual glm::vec3 TracePixel(const glm::ivec3 &pixel_coord, const HitRecord *camera_hit) { return RenderPixel(pixel_coord); }
     };
 }
\ No newline at end of file
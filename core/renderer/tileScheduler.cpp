@@ -0,0 +1,153 @@
+﻿#include "tileScheduler.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace pbrt
+{
+    // 在相邻位之间插入0, 用于二维Morton编码
+    static uint32_t SpreadBits2D(uint32_t v)
+    {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    // (x, y)在边长为n(2的幂)的Hilbert曲线上的序号
+    static uint64_t HilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+    {
+        uint64_t d = 0;
+        for (uint32_t s = n / 2; s > 0; s /= 2)
+        {
+            uint32_t rx = (x & s) > 0;
+            uint32_t ry = (y & s) > 0;
+            d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+            // 旋转象限, 使子曲线的起点与终点和上一级相接
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    // 块坐标按Hilbert顺序排列, 块数不是2的幂时在覆盖它的2的幂网格上排序并跳过多余的位置
+    static std::vector<glm::uvec2> GetHilbertOrder(uint32_t count_x, uint32_t count_y)
+    {
+        uint32_t n = 1;
+        while (n < std::max(count_x, count_y))
+        {
+            n *= 2;
+        }
+        std::vector<std::pair<uint64_t, glm::uvec2>> keyed;
+        keyed.reserve(static_cast<size_t>(count_x) * count_y);
+        for (uint32_t y = 0; y < count_y; y++)
+        {
+            for (uint32_t x = 0; x < count_x; x++)
+            {
+                keyed.push_back({HilbertIndex(n, x, y), {x, y}});
+            }
+        }
+        std::sort(keyed.begin(), keyed.end(), [](const auto &a, const auto &b)
+                  { return a.first < b.first; });
+
+        std::vector<glm::uvec2> order;
+        order.reserve(keyed.size());
+        for (const auto &[key, tile] : keyed)
+        {
+            order.push_back(tile);
+        }
+        return order;
+    }
+
+    // 从中心的块开始按右、下、左、上螺旋向外, 跳过画面外的位置
+    static std::vector<glm::uvec2> GetSpiralOrder(uint32_t count_x, uint32_t count_y)
+    {
+        std::vector<glm::uvec2> order;
+        size_t total = static_cast<size_t>(count_x) * count_y;
+        order.reserve(total);
+        int64_t x = (count_x - 1) / 2, y = (count_y - 1) / 2;
+        constexpr int64_t DX[4] = {1, 0, -1, 0}, DY[4] = {0, 1, 0, -1};
+        auto visit = [&]()
+        {
+            if (x >= 0 && y >= 0 && x < count_x && y < count_y)
+            {
+                order.push_back({static_cast<uint32_t>(x), static_cast<uint32_t>(y)});
+            }
+            // end
+        };
+        visit();
+        for (int64_t length = 1, dir = 0; order.size() < total; length++)
+        {
+            // 每个长度走两段, 之后长度加1
+            for (int segment = 0; segment < 2; segment++, dir = (dir + 1) % 4)
+            {
+                for (int64_t step = 0; step < length; step++)
+                {
+                    x += DX[dir];
+                    y += DY[dir];
+                    visit();
+                }
+            }
+        }
+        return order;
+    }
+
+    TileScheduler::TileScheduler(size_t width, size_t height, TileOrder order, size_t tile_size)
+        : mTileSize(std::clamp<size_t>(tile_size, 1, 256)), mOrder(order)
+    {
+        std::vector<std::pair<uint32_t, glm::uvec2>> keyed;
+        for (uint32_t y = 0; y < mTileSize; y++)
+        {
+            for (uint32_t x = 0; x < mTileSize; x++)
+            {
+                keyed.push_back({SpreadBits2D(x) | (SpreadBits2D(y) << 1), {x, y}});
+            }
+        }
+        std::sort(keyed.begin(), keyed.end(), [](const auto &a, const auto &b)
+                  { return a.first < b.first; });
+        for (const auto &[key, offset] : keyed)
+        {
+            mPixelOrder.push_back(offset);
+        }
+
+        Resize(width, height);
+    }
+
+    void TileScheduler::Resize(size_t width, size_t height)
+    {
+        if (width == mWidth && height == mHeight)
+        {
+            return;
+        }
+        mWidth = width;
+        mHeight = height;
+        mTiles.clear();
+        if (width == 0 || height == 0)
+        {
+            return;
+        }
+
+        uint32_t count_x = static_cast<uint32_t>((width + mTileSize - 1) / mTileSize);
+        uint32_t count_y = static_cast<uint32_t>((height + mTileSize - 1) / mTileSize);
+        auto order = mOrder == TileOrder::Hilbert ? GetHilbertOrder(count_x, count_y) : GetSpiralOrder(count_x, count_y);
+        mTiles.reserve(order.size());
+        for (const auto &tile : order)
+        {
+            size_t min_x = tile.x * mTileSize, min_y = tile.y * mTileSize;
+            mTiles.push_back({
+                .__min__ = {min_x, min_y},
+                .__size__ = {std::min(mTileSize, width - min_x), std::min(mTileSize, height - min_y)},
+                // end
+            });
+        }
+    }
+}
\ No newline at end of file
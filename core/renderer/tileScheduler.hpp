@@ -0,0 +1,78 @@
+﻿#pragma once
+#include "thread/threadPool.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace pbrt
+{
+    constexpr size_t RENDER_TILE_SIZE = 16; // 渲染块的边长(像素)
+
+    // 渲染块的发出顺序
+    enum class TileOrder
+    {
+        Hilbert, // 沿Hilbert曲线, 相邻发出的块在画面上也相邻, 同时执行的块共享BVH节点与环境贴图纹素
+        Spiral   // 从画面中心向外螺旋, 预览时主体先收敛
+    };
+
+    struct RenderTile
+    {
+    public:
+        glm::uvec2 __min__;  // 左上角像素
+        glm::uvec2 __size__; // 边缘的块可能小于RENDER_TILE_SIZE
+    };
+
+    /*
+        把胶片划分为固定大小的块, 块按TileOrder排列后由线程池动态领取, 块内像素按Morton顺序遍历
+        与按线程数划分的大矩形相比, 小块的负载更均衡, 同一时刻渲染的像素集中在画面的一小片区域内
+        分辨率不变时可以重复使用, 每块独立完成, 便于逐块输出与保存进度
+    */
+    class TileScheduler
+    {
+    private:
+        size_t mWidth = 0, mHeight = 0;
+        size_t mTileSize;
+        TileOrder mOrder;
+        std::vector<RenderTile> mTiles;      // 按发出顺序排列
+        std::vector<glm::uvec2> mPixelOrder; // 完整块内像素偏移的Morton顺序
+
+    public:
+        TileScheduler(size_t width, size_t height, TileOrder order = TileOrder::Hilbert, size_t tile_size = RENDER_TILE_SIZE);
+        explicit TileScheduler(TileOrder order = TileOrder::Hilbert, size_t tile_size = RENDER_TILE_SIZE) : TileScheduler(0, 0, order, tile_size) {}
+
+        // 胶片分辨率改变时重新划分, 分辨率不变时直接返回
+        void Resize(size_t width, size_t height);
+
+        size_t GetTileCount() const { return mTiles.size(); }
+        const RenderTile &GetTile(size_t index) const { return mTiles[index]; }
+
+        // 按Morton顺序遍历块内的像素, func(x, y)
+        template <typename F>
+        void ForEachPixel(const RenderTile &tile, const F &func) const
+        {
+            for (const auto &offset : mPixelOrder)
+            {
+                if (offset.x < tile.__size__.x && offset.y < tile.__size__.y)
+                {
+                    func(static_cast<size_t>(tile.__min__.x + offset.x), static_cast<size_t>(tile.__min__.y + offset.y));
+                }
+            }
+        }
+
+        // 并行处理所有块, func(tile)返回时该块已完成, 可以在其中输出或记录进度; 所有块完成后返回
+        template <typename F>
+        void ParallelForTiles(const F &func, ThreadPool &pool = MasterThreadPool) const
+        {
+            pool.ParallelFor(mTiles.size(), [&](size_t index)
+                             { func(mTiles[index]); });
+        }
+
+        // 并行渲染所有像素, func(x, y)
+        template <typename F>
+        void ParallelForPixels(const F &func, ThreadPool &pool = MasterThreadPool) const
+        {
+            ParallelForTiles([&](const RenderTile &tile)
+                             { ForEachPixel(tile, func); },
+                             pool);
+        }
+    };
+}
\ No newline at end of file
@@ -10,21 +10,21 @@ namespace pbrt
         {
             sum += v;
         }
-        mProbs.resize(values.size());
-        mItems.resize(values.size());
+        std::vector<float> probs(values.size());
+        std::vector<Item> items(values.size());
         std::vector<size_t> less, greater;
         for (size_t i = 0; i < values.size(); i++)
         {
-            mProbs[i] = values[i] / sum; // 归一化概率
+            probs[i] = values[i] / sum; // 归一化概率
 
             // 初始化别名表项
-            mItems[i].__q__ = 1.0;
-            mItems[i].__p__ = mProbs[i] * values.size();
-            if (mItems[i].__p__ < 1.f)
+            items[i].__q__ = 1.0;
+            items[i].__p__ = probs[i] * values.size();
+            if (items[i].__p__ < 1.f)
             {
                 less.push_back(i);
             }
-            else if (mItems[i].__p__ > 1.f)
+            else if (items[i].__p__ > 1.f)
             {
                 greater.push_back(i);
             }
@@ -33,8 +33,8 @@ namespace pbrt
         // 构建别名表
         while ((!less.empty()) && (!greater.empty()))
         {
-            auto &item_less = mItems[less.back()];
-            auto &item_greater = mItems[greater.back()];
+            auto &item_less = items[less.back()];
+            auto &item_greater = items[greater.back()];
             size_t greater_idx = greater.back();
             less.pop_back();
             greater.pop_back();
@@ -51,6 +51,15 @@ namespace pbrt
                 greater.push_back(greater_idx);
             }
         }
+
+        mProbs.Assign(std::move(probs));
+        mItems.Assign(std::move(items));
+    }
+
+    void AliasTable::Attach(std::span<const float> probs, std::span<const Item> items)
+    {
+        mProbs.Attach(probs);
+        mItems.Attach(items);
     }
 
     AliasTable::SampleResult AliasTable::Sample(float u) const
@@ -1,11 +1,12 @@
 ﻿#pragma once
+#include "utils/mappedFile.hpp"
 #include <vector>
 
 namespace pbrt
 {
     class AliasTable
     {
-    private:
+    public:
         struct Item
         {
             double __q__; // 采样概率(重定位概率为1 - Q)
@@ -16,6 +17,7 @@ namespace pbrt
             };
         };
 
+    private:
         struct SampleResult
         {
             size_t __idx__;
@@ -23,15 +25,17 @@ namespace pbrt
         };
 
     private:
-        std::vector<float> mProbs;
-        std::vector<Item> mItems;
+        MappedArray<float> mProbs;
+        MappedArray<Item> mItems;
 
     public:
         AliasTable() = default;
 
         void Build(const std::vector<float> &values);
+        void Attach(std::span<const float> probs, std::span<const Item> items); // 直接使用外部(如缓存映射)的表数据
         SampleResult Sample(float u) const;
 
-        const std::vector<float> &GetProbs() const { return mProbs; }
+        std::span<const float> GetProbs() const { return mProbs.Span(); }
+        std::span<const Item> GetItems() const { return mItems.Span(); }
     };
 }
\ No newline at end of file
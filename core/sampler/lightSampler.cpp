@@ -13,6 +13,7 @@ namespace pbrt
         }
         mAliasTable.Build(Phis);
         const auto &probs = mAliasTable.GetProbs();
+        mLightProbs.clear();
         for (size_t i = 0; i < mLights.size(); ++i)
         {
             mLightProbs.insert(std::make_pair(mLights[i], probs[i]));
@@ -28,6 +28,12 @@ namespace pbrt
             mLights.push_back(light);
         }
 
+        void RemoveLight(const Light *light)
+        {
+            std::erase(mLights, light);
+        }
+
+        // 可以重复调用, 场景编辑后按新的光源集合与场景半径重新计算概率
         void Build(float scene_radius);
         std::optional<LightSampleInfo> Sample(float u) const;
 
@@ -3,7 +3,7 @@
 
 namespace pbrt
 {
-    std::optional<HitInfo> Circle::Intersect(const Ray &ray, float t_min, float t_max) const
+    bool Circle::IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
     {
         /*
             平面方程: (P - P₀) · N = 0
@@ -20,14 +20,21 @@ namespace pbrt
         glm::vec3 hit_point_to_center = ray.Hit(hit_t) - __point__;
         if ((hit_t > t_min && hit_t < t_max) && (glm::dot(hit_point_to_center, hit_point_to_center) < __radius__ * __radius__))
         {
-            return HitInfo{
-                .__t__ = hit_t,
-                .__hitPoint__ = ray.Hit(hit_t),
-                .__normal__ = __normal__
-                // end
-            };
+            t_max = hit_t;
+            hit = {hit_t, 0.f, 0.f, 0, {}};
+            return true;
         }
-        return std::nullopt;
+        return false;
+    }
+
+    HitInfo Circle::GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const
+    {
+        return HitInfo{
+            .__t__ = hit.__t__,
+            .__hitPoint__ = ray.Hit(hit.__t__),
+            .__normal__ = __normal__
+            // end
+        };
     }
 
     float Circle::GetArea() const
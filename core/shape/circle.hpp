@@ -31,7 +31,8 @@ namespace pbrt
 
         Bounds GetBounds() const override { return __bounds__; }
 
-        std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const override;
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override;
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override;
         float GetArea() const override;
         std::optional<ShapeInfo> SampleShape(const RNG &rng) const override;
     };
@@ -0,0 +1,34 @@
+﻿#include "instanceGroup.hpp"
+#include "utils/logger.hpp"
+
+namespace pbrt
+{
+    bool InstanceGroup::AddShape(const Shape &shape, const Material *material, const glm::vec3 &position, const glm::vec3 &scale, const glm::vec3 &rotate)
+    {
+        if (shape.GetInstanceDepth() + 2 > MAX_INSTANCE_DEPTH)
+        {
+            PBRT_ERROR("InstanceGroup - Instance depth {} of the shape leaves no room for the group and the scene placing it (maximum {}), ignoring it", shape.GetInstanceDepth(), MAX_INSTANCE_DEPTH);
+            return false;
+        }
+        glm::mat4 world_from_object = GetWorldFromObject(position, scale, rotate);
+        mShapeBVHInfos.push_back(ShapeBVHInfo{
+            .__shape__ = &shape,
+            .__material__ = material,
+            .__worldFromObject__ = AffineTransform(world_from_object),
+            .__objectFromWorld__ = AffineTransform(glm::inverse(world_from_object))
+            // end
+        });
+        return true;
+    }
+
+    void InstanceGroup::Build(BVHLayout layout)
+    {
+        if (mShapeBVHInfos.empty())
+        {
+            PBRT_WARN("InstanceGroup - Ignoring the build of an empty group");
+            return;
+        }
+        mSceneBVH.Build(std::move(mShapeBVHInfos), layout);
+        mShapeBVHInfos.clear();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+﻿#pragma once
+#include "accelerate/sceneBVH.hpp"
+#include <vector>
+
+namespace pbrt
+{
+    /*
+        实例组: 一组带变换与材质的物体, 构建为嵌套的SceneBVH后作为一个物体被Scene或其他实例组多次放置
+        顶层BVH的规模与不同的组数而不是总实例数成正比, 如若干棵树组成一片树林, 再多次放置树林
+        命中时变换逐层复合, 组内没有指定材质的实例继承外层实例的材质; 组本身与放置它的场景各占一层, 子物体的嵌套层数超过MAX_INSTANCE_DEPTH - 2时拒绝加入
+        Build之后不能再修改, 否则放置它的场景需要重新Build
+    */
+    class InstanceGroup : public Shape
+    {
+    private:
+        std::vector<ShapeBVHInfo> mShapeBVHInfos;
+        SceneBVH mSceneBVH{};
+
+    public:
+        // 子物体嵌套过深时不加入并返回false
+        bool AddShape(
+            const Shape &shape,
+            const Material *material = nullptr,
+            const glm::vec3 &position = {0.f, 0.f, 0.f},
+            const glm::vec3 &scale = {1.f, 1.f, 1.f},
+            const glm::vec3 &rotate = {0.f, 0.f, 0.f});
+
+        void Build(BVHLayout layout = DEFAULT_BVH_LAYOUT);
+
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override { return mSceneBVH.IntersectPrimitive(ray, t_min, t_max, hit); }
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override { return mSceneBVH.GetHitInfo(ray, hit); }
+        bool Occluded(const Ray &ray, float t_min, float t_max) const override { return mSceneBVH.Occluded(ray, t_min, t_max); }
+        void IntersectBatch(std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const override { mSceneBVH.IntersectBatch(rays, records, t_min); }
+        void OccludedBatch(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const override { mSceneBVH.OccludedBatch(rays, occluded, t_min, t_max); }
+        Bounds GetBounds() const override { return mSceneBVH.GetBounds(); }
+        size_t GetInstanceDepth() const override { return mSceneBVH.GetInstanceDepth(); }
+    };
+}
\ No newline at end of file
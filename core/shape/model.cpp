@@ -1,14 +1,105 @@
 ﻿#include "model.hpp"
+#include "accelerate/bvhCache.hpp"
+#include "accelerate/bvhCalibration.hpp"
 #include "utils/logger.hpp"
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
 #include <rapidobj/rapidobj.hpp>
 
 namespace pbrt
 {
-    Model::Model(const std::filesystem::path &filename, bool byMyself)
+    namespace
     {
+        // OBJ面的一个顶点引用, 索引从0开始, 没有法线时__normal__为-1
+        struct ObjCorner
+        {
+        public:
+            int __position__;
+            int __normal__;
+        };
+
+        /*
+            由OBJ属性数组与面顶点引用构建索引网格, 每3个引用组成一个三角形
+            所有引用的法线索引与位置索引相同(或都没有法线)时直接复用位置数组, 扫描模型通常属于这种情况
+            否则按(位置, 法线)组合合并顶点; 没有法线的引用使用所在三角形的几何法线, 不与其他三角形共享
+        */
+        TriangleMesh BuildTriangleMesh(std::vector<glm::vec3> &&positions, const std::vector<glm::vec3> &normals, const std::vector<ObjCorner> &corners)
+        {
+            bool has_normal = false, is_aligned = normals.size() >= positions.size();
+            for (const auto &corner : corners)
+            {
+                has_normal |= corner.__normal__ >= 0;
+                is_aligned &= corner.__normal__ == corner.__position__;
+            }
+
+            std::vector<uint32_t> indices(corners.size());
+            if (!has_normal || is_aligned)
+            {
+                for (size_t i = 0; i < corners.size(); i++)
+                {
+                    indices[i] = static_cast<uint32_t>(corners[i].__position__);
+                }
+                std::vector<glm::vec3> vertex_normals;
+                if (has_normal)
+                {
+                    vertex_normals.assign(normals.begin(), normals.begin() + positions.size());
+                }
+                return TriangleMesh(std::move(positions), std::move(vertex_normals), std::move(indices));
+            }
+
+            std::vector<glm::vec3> vertex_positions, vertex_normals;
+            std::unordered_map<uint64_t, uint32_t> vertex_map;
+            vertex_map.reserve(positions.size());
+            for (size_t i = 0; i < corners.size(); i += 3)
+            {
+                const auto &p0 = positions[corners[i].__position__];
+                glm::vec3 face_normal = glm::normalize(glm::cross(positions[corners[i + 1].__position__] - p0, positions[corners[i + 2].__position__] - p0));
+                for (size_t j = i; j < i + 3; j++)
+                {
+                    const auto &corner = corners[j];
+                    auto vertex_idx = static_cast<uint32_t>(vertex_positions.size());
+                    if (corner.__normal__ < 0)
+                    {
+                        vertex_positions.push_back(positions[corner.__position__]);
+                        vertex_normals.push_back(face_normal);
+                    }
+                    else
+                    {
+                        uint64_t key = (static_cast<uint64_t>(corner.__position__) << 32) | static_cast<uint32_t>(corner.__normal__);
+                        auto [iter, is_inserted] = vertex_map.try_emplace(key, vertex_idx);
+                        if (is_inserted)
+                        {
+                            vertex_positions.push_back(positions[corner.__position__]);
+                            vertex_normals.push_back(normals[corner.__normal__]);
+                        }
+                        vertex_idx = iter->second;
+                    }
+                    indices[j] = vertex_idx;
+                }
+            }
+            return TriangleMesh(std::move(vertex_positions), std::move(vertex_normals), std::move(indices));
+        }
+
+        // 代价常数参与缓存键, 需在创建BVHCache之前替换
+        BVHBuildSettings GetModelBuildSettings(const BVHBuildSettings &settings)
+        {
+            BVHBuildSettings model_settings = settings;
+            LoadCalibratedBVHCosts(model_settings);
+            return model_settings;
+        }
+    }
+
+    Model::Model(const std::vector<Triangle> &triangles, const BVHBuildSettings &settings)
+    {
+        mBVH.Build(TriangleMesh::FromTriangles(triangles), GetModelBuildSettings(settings));
+    }
+
+    Model::Model(const std::filesystem::path &filename, bool byMyself, const BVHBuildSettings &input_settings)
+    {
+        auto settings = GetModelBuildSettings(input_settings);
         std::ifstream file(filename);
         if (!file.good())
         {
@@ -16,9 +107,16 @@ namespace pbrt
             return;
         }
 
-        std::vector<Triangle> triangles;
+        // 缓存命中时直接映射BVH, 跳过解析与构建
+        BVHCache cache(filename, "byMyself", settings);
+        if (cache.Load(mBVH))
+        {
+            return;
+        }
+
         std::vector<glm::vec3> positions;
         std::vector<glm::vec3> normals;
+        std::vector<ObjCorner> corners;
 
         std::string line;
         char trash;
@@ -46,104 +144,75 @@ namespace pbrt
                 iss >> idx_v.x >> trash >> trash >> idx_vn.x;
                 iss >> idx_v.y >> trash >> trash >> idx_vn.y;
                 iss >> idx_v.z >> trash >> trash >> idx_vn.z;
-                triangles.push_back(Triangle(
-                    positions[idx_v.x - 1], positions[idx_v.y - 1], positions[idx_v.z - 1],
-                    normals[idx_vn.x - 1], normals[idx_vn.y - 1], normals[idx_vn.z - 1]));
+                corners.push_back({idx_v.x - 1, idx_vn.x - 1});
+                corners.push_back({idx_v.y - 1, idx_vn.y - 1});
+                corners.push_back({idx_v.z - 1, idx_vn.z - 1});
             }
         }
 
-        if (triangles.empty())
+        if (corners.empty())
         {
             PBRT_ERROR("Model file {} is empty", std::filesystem::absolute(filename).string());
             return;
         }
-        else
-        {
-            PBRT_INFO("Model file {} loaded with {} triangles", std::filesystem::absolute(filename).string(), triangles.size());
-        }
-        mBVH.Build(std::move(triangles));
+
+        auto mesh = BuildTriangleMesh(std::move(positions), normals, corners);
+        PBRT_INFO("Model file {} loaded with {} triangles, {} vertices", std::filesystem::absolute(filename).string(), mesh.GetTriangleCount(), mesh.GetVertexCount());
+        mBVH.Build(std::move(mesh), settings);
+        cache.Save(mBVH);
     }
 
-    Model::Model(const std::filesystem::path &filename)
+    Model::Model(const std::filesystem::path &filename, const BVHBuildSettings &input_settings)
     {
-        auto result = rapidobj::ParseFile(filename, rapidobj::MaterialLibrary::Ignore());
-        if (result.error)
+        auto settings = GetModelBuildSettings(input_settings);
+        BVHCache cache(filename, "rapidobj", settings);
+        if (cache.Load(mBVH))
         {
-            PBRT_ERROR("Model file not found at {}", std::filesystem::absolute(filename).string());
             return;
         }
-        std::vector<Triangle> triangles;
-        for (const auto &shape : result.shapes)
+
+        // 直接使用rapidobj的属性数组作为共享顶点缓冲, 解析结果在作用域结束时释放, 网格构建期间只保留一份顶点数据
+        std::vector<glm::vec3> positions, normals;
+        std::vector<ObjCorner> corners;
         {
-            size_t idx_offset = 0;
-            for (size_t num_face_vertex : shape.mesh.num_face_vertices)
+            auto result = rapidobj::ParseFile(filename, rapidobj::MaterialLibrary::Ignore());
+            if (result.error)
             {
-                if (num_face_vertex == 3)
+                PBRT_ERROR("Model file not found at {}", std::filesystem::absolute(filename).string());
+                return;
+            }
+
+            positions.resize(result.attributes.positions.size() / 3);
+            normals.resize(result.attributes.normals.size() / 3);
+            std::memcpy(static_cast<void *>(positions.data()), result.attributes.positions.data(), positions.size() * sizeof(glm::vec3));
+            std::memcpy(static_cast<void *>(normals.data()), result.attributes.normals.data(), normals.size() * sizeof(glm::vec3));
+            for (const auto &shape : result.shapes)
+            {
+                size_t idx_offset = 0;
+                for (size_t num_face_vertex : shape.mesh.num_face_vertices)
                 {
-                    auto idx = shape.mesh.indices[idx_offset];
-                    glm::vec3 pos0{
-                        result.attributes.positions[idx.position_index * 3 + 0],
-                        result.attributes.positions[idx.position_index * 3 + 1],
-                        result.attributes.positions[idx.position_index * 3 + 2]};
-
-                    idx = shape.mesh.indices[idx_offset + 1];
-                    glm::vec3 pos1{
-                        result.attributes.positions[idx.position_index * 3 + 0],
-                        result.attributes.positions[idx.position_index * 3 + 1],
-                        result.attributes.positions[idx.position_index * 3 + 2]};
-
-                    idx = shape.mesh.indices[idx_offset + 2];
-                    glm::vec3 pos2{
-                        result.attributes.positions[idx.position_index * 3 + 0],
-                        result.attributes.positions[idx.position_index * 3 + 1],
-                        result.attributes.positions[idx.position_index * 3 + 2]};
-
-                    if (idx.normal_index >= 0)
+                    if (num_face_vertex == 3)
                     {
-                        idx = shape.mesh.indices[idx_offset];
-                        glm::vec3 normal0{
-                            result.attributes.normals[idx.normal_index * 3 + 0],
-                            result.attributes.normals[idx.normal_index * 3 + 1],
-                            result.attributes.normals[idx.normal_index * 3 + 2]};
-
-                        idx = shape.mesh.indices[idx_offset + 1];
-                        glm::vec3 normal1{
-                            result.attributes.normals[idx.normal_index * 3 + 0],
-                            result.attributes.normals[idx.normal_index * 3 + 1],
-                            result.attributes.normals[idx.normal_index * 3 + 2]};
-
-                        idx = shape.mesh.indices[idx_offset + 2];
-                        glm::vec3 normal2{
-                            result.attributes.normals[idx.normal_index * 3 + 0],
-                            result.attributes.normals[idx.normal_index * 3 + 1],
-                            result.attributes.normals[idx.normal_index * 3 + 2]};
-
-                        triangles.push_back(Triangle(pos0, pos1, pos2, normal0, normal1, normal2));
-                    }
-                    else
-                    {
-                        triangles.push_back(Triangle(pos0, pos1, pos2));
+                        for (size_t i = 0; i < 3; i++)
+                        {
+                            const auto &idx = shape.mesh.indices[idx_offset + i];
+                            corners.push_back({idx.position_index, idx.normal_index});
+                        }
                     }
+                    idx_offset += num_face_vertex;
                 }
-                idx_offset += num_face_vertex;
             }
         }
 
-        if (triangles.empty())
+        if (corners.empty())
         {
             PBRT_ERROR("Model file {} is empty", std::filesystem::absolute(filename).string());
             return;
         }
-        else
-        {
-            PBRT_INFO("Model file {} loaded with {} triangles", std::filesystem::absolute(filename).string(), triangles.size());
-        }
 
-        mBVH.Build(std::move(triangles));
-    }
-
-    std::optional<HitInfo> Model::Intersect(const Ray &ray, float t_min, float t_max) const
-    {
-        return mBVH.Intersect(ray, t_min, t_max);
+        auto mesh = BuildTriangleMesh(std::move(positions), normals, corners);
+        PBRT_INFO("Model file {} loaded with {} triangles, {} vertices", std::filesystem::absolute(filename).string(), mesh.GetTriangleCount(), mesh.GetVertexCount());
+        mBVH.Build(std::move(mesh), settings);
+        cache.Save(mBVH);
     }
 }
\ No newline at end of file
@@ -13,15 +13,20 @@ namespace pbrt
         BVH mBVH{};
 
     public:
-        Model(const std::vector<Triangle> &triangles)
-        {
-            auto triangles_copy = triangles;
-            mBVH.Build(std::move(triangles_copy));
-        }
-        Model(const std::filesystem::path &filename, bool byMyself); // 读取obj文件 by myself
-        Model(const std::filesystem::path &filename);                // 读取obj文件 by rapidobj
+        // 构建前按LoadCalibratedBVHCosts读取本机测得的SAH代价(settings.__loadCalibratedCosts__)
+        Model(const std::vector<Triangle> &triangles, const BVHBuildSettings &settings = {});
+        Model(const std::filesystem::path &filename, bool byMyself, const BVHBuildSettings &settings = {}); // 读取obj文件 by myself
+        Model(const std::filesystem::path &filename, const BVHBuildSettings &settings = {});                // 读取obj文件 by rapidobj
 
-        std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const override;
+        // 顶点变形后更新BVH, 顶点顺序与数量需与网格一致; 包围盒可能变化, 所在Scene需要重新Build
+        void Refit(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals = {}) { mBVH.Refit(positions, normals); }
+        const BVH &GetBVH() const { return mBVH; } // 用于统计BVH质量与基准测试
+
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override { return mBVH.IntersectPrimitive(ray, t_min, t_max, hit); }
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override { return mBVH.GetHitInfo(ray, hit); }
+        bool Occluded(const Ray &ray, float t_min, float t_max) const override { return mBVH.Occluded(ray, t_min, t_max); }
+        void IntersectBatch(std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const override { mBVH.IntersectBatch(rays, records, t_min); }
+        void OccludedBatch(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const override { mBVH.OccludedBatch(rays, occluded, t_min, t_max); }
         Bounds GetBounds() const override { return mBVH.GetBounds(); }
         float GetArea() const override { return mBVH.GetArea(); }
         std::optional<ShapeInfo> SampleShape(const RNG &rng) const override { return mBVH.SampleShape(rng); }
@@ -2,7 +2,7 @@
 
 namespace pbrt
 {
-    std::optional<HitInfo> Quad::Intersect(const Ray &ray, float t_min, float t_max) const
+    bool Quad::IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
     {
         /*
             平面方程: (P - P₀) · N = 0
@@ -20,7 +20,7 @@ namespace pbrt
         // 避免除零 - 射线与平面平行
         if (glm::abs(denominator) < 1e-6f)
         {
-            return std::nullopt;
+            return false;
         }
 
         float hit_t = glm::dot(__point__ - ray.__origin__, __normal__) / denominator;
@@ -28,7 +28,7 @@ namespace pbrt
         // 检查t值是否在有效范围内
         if (hit_t <= t_min || hit_t >= t_max)
         {
-            return std::nullopt;
+            return false;
         }
 
         // 计算交点
@@ -42,15 +42,22 @@ namespace pbrt
         // 检查交点是否在四边形范围内 - 现在支持不同的x和z范围
         if (glm::abs(x_local) <= __halfWidthX__ && glm::abs(z_local) <= __halfWidthZ__)
         {
-            return HitInfo{
-                .__t__ = hit_t,
-                .__hitPoint__ = hit_point,
-                .__normal__ = __normal__
-                // end
-            };
+            t_max = hit_t;
+            hit = {hit_t, 0.f, 0.f, 0, {}};
+            return true;
         }
 
-        return std::nullopt;
+        return false;
+    }
+
+    HitInfo Quad::GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const
+    {
+        return HitInfo{
+            .__t__ = hit.__t__,
+            .__hitPoint__ = ray.Hit(hit.__t__),
+            .__normal__ = __normal__
+            // end
+        };
     }
 
     float Quad::GetArea() const
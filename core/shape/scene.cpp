@@ -1,30 +1,410 @@
 ﻿#include "scene.hpp"
-#include <glm/gtc/matrix_transform.hpp>
+#include "model.hpp"
+#include "utils/logger.hpp"
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
 
 namespace pbrt
 {
-    void Scene::AddShape(const Shape &shape, const Material *material, const glm::vec3 &position, const glm::vec3 &scale, const glm::vec3 &rotate)
+    // 划分光线包, 不相干的光线索引写入incoherent(已按卦限排序)
+    template <typename PacketFunc>
+    static void SplitRayPackets(std::span<const Ray> rays, PacketFunc &&packet, ScratchBuffer<uint32_t> &incoherent)
     {
-        // 对象空间到世界空间的变换矩阵
-        // 约定向量都为列向量, 矩阵乘法即变换顺序从右往左
-        glm::mat4 world_from_object =
-            glm::translate(glm::mat4(1.f), position) *
-            glm::rotate(glm::mat4(1.f), glm::radians(rotate.z), {0.f, 0.f, 1.f}) *
-            glm::rotate(glm::mat4(1.f), glm::radians(rotate.y), {0.f, 1.f, 0.f}) *
-            glm::rotate(glm::mat4(1.f), glm::radians(rotate.x), {1.f, 0.f, 0.f}) *
-            glm::scale(glm::mat4(1.f), scale);
+        incoherent.Clear();
+        for (size_t start = 0; start < rays.size(); start += RAY_PACKET_SIZE)
+        {
+            size_t count = std::min(RAY_PACKET_SIZE, rays.size() - start);
+            if (count == RAY_PACKET_SIZE && RayPacket::IsCoherent(rays.subspan(start, count)))
+            {
+                packet(start, count);
+                continue;
+            }
+            for (size_t i = start; i < start + count; i++)
+            {
+                incoherent.PushBack(static_cast<uint32_t>(i));
+            }
+        }
 
+        std::stable_sort(incoherent.begin(), incoherent.end(), [&](uint32_t a, uint32_t b)
+                         { return GetDirectionOctant(rays[a]) < GetDirectionOctant(rays[b]); });
+    }
+
+    // 可以展开到世界空间的三角形几何, 其他物体返回nullptr
+    static const BVH *GetTriangleBVH(const Shape *shape)
+    {
+        if (const auto *model = dynamic_cast<const Model *>(shape))
+        {
+            return &model->GetBVH();
+        }
+        return dynamic_cast<const BVH *>(shape);
+    }
+
+    /*
+        Auto模式的选择: 展开的代价是合并BVH的构建时间与内存(模型自己的几何与BVH仍然驻留, 展开的三角形全部是额外的一份),
+        以及重复放置的模型被复制的三角形; 收益是消除实例变换与顶层包围盒的重叠
+        只有一个三角形实例且为单位变换时没有收益; 展开的三角形数超过FLAT_SCENE_MAX_TRIANGLES时代价过高, 也保留模型的(缓存)BVH
+        重叠程度用实例包围盒表面积之和与场景包围盒表面积之比衡量, 该比值即光线平均需要进入的顶层实例数的估计
+    */
+    static SceneBuildMode ChooseSceneBuildMode(std::vector<ShapeBVHInfo> &shapeBVHInfos)
+    {
+        std::unordered_set<const BVH *> unique_bvhs;
+        size_t unique_triangle_count = 0, flat_triangle_count = 0, triangle_instance_count = 0;
+        bool has_transform = false;
+        float instance_area = 0.f;
+        Bounds scene_bounds{};
+        for (auto &shapeBVHInfo : shapeBVHInfos)
+        {
+            const auto *bvh = GetTriangleBVH(shapeBVHInfo.__shape__);
+            if (bvh)
+            {
+                size_t triangle_count = bvh->GetMesh().GetTriangleCount();
+                flat_triangle_count += triangle_count;
+                triangle_instance_count++;
+                has_transform |= shapeBVHInfo.__worldFromObject__.__type__ != AffineTransformType::Identity;
+                if (unique_bvhs.insert(bvh).second)
+                {
+                    unique_triangle_count += triangle_count;
+                }
+            }
+            if (shapeBVHInfo.__shape__->GetBounds().IsValid())
+            {
+                shapeBVHInfo.UpdateBounds();
+                instance_area += shapeBVHInfo.__bounds__.GetSurfaceArea();
+                scene_bounds.Expand(shapeBVHInfo.__bounds__);
+            }
+        }
+        if (unique_triangle_count == 0 || (triangle_instance_count == 1 && !has_transform))
+        {
+            return SceneBuildMode::TwoLevel;
+        }
+        if (flat_triangle_count > FLAT_SCENE_MAX_TRIANGLES)
+        {
+            PBRT_DEBUG("Scene - Flattened Triangle Count {} exceeds budget {}, Mode: TwoLevel", flat_triangle_count, FLAT_SCENE_MAX_TRIANGLES);
+            return SceneBuildMode::TwoLevel;
+        }
+
+        float duplication = static_cast<float>(flat_triangle_count) / static_cast<float>(unique_triangle_count);
+        float scene_area = scene_bounds.IsValid() ? scene_bounds.GetSurfaceArea() : 0.f;
+        float overlap = scene_area > 0.f ? instance_area / scene_area : 0.f;
+        bool is_flat = duplication <= FLAT_SCENE_MAX_DUPLICATION || (overlap > FLAT_SCENE_MIN_OVERLAP && duplication <= FLAT_SCENE_OVERLAP_MAX_DUPLICATION);
+        PBRT_DEBUG("Scene - Triangle Duplication: {:.2f}, Top-level Overlap: {:.2f}, Mode: {}", duplication, overlap, is_flat ? "Flat" : "TwoLevel");
+        return is_flat ? SceneBuildMode::Flat : SceneBuildMode::TwoLevel;
+    }
+
+    /*
+        把所有三角形几何按实例变换烘焙到世界空间并合并为一个BVH, 每个实例的材质记录为BVH的材质区间
+        镜像变换(行列式为负)交换三角形的两个顶点, 使几何法线方向与两级结构中变换后的法线一致
+        部分网格没有顶点法线时, 这些网格的三角形不共享顶点, 以几何法线作为顶点法线
+        shapeBVHInfos中的三角形实例替换为一个单位变换的实例
+    */
+    static std::unique_ptr<BVH> FlattenTriangleShapes(std::vector<ShapeBVHInfo> &shapeBVHInfos)
+    {
+        bool has_normals = false;
+        const BVH *first_bvh = nullptr;
+        for (const auto &shapeBVHInfo : shapeBVHInfos)
+        {
+            if (const auto *bvh = GetTriangleBVH(shapeBVHInfo.__shape__))
+            {
+                has_normals |= !bvh->GetMesh().GetNormals().empty();
+                first_bvh = first_bvh ? first_bvh : bvh;
+            }
+        }
+        if (!first_bvh)
+        {
+            return nullptr;
+        }
+
+        std::vector<glm::vec3> positions, normals;
+        std::vector<uint32_t> indices;
+        std::vector<BVHMaterialRange> materials;
+        std::vector<ShapeBVHInfo> remaining;
+        for (const auto &shapeBVHInfo : shapeBVHInfos)
+        {
+            const auto *bvh = GetTriangleBVH(shapeBVHInfo.__shape__);
+            if (!bvh)
+            {
+                remaining.push_back(shapeBVHInfo);
+                continue;
+            }
+
+            const auto &mesh = bvh->GetMesh();
+            const auto &world_from_object = shapeBVHInfo.__worldFromObject__;
+            const auto &object_from_world = shapeBVHInfo.__objectFromWorld__;
+            bool is_mirrored = glm::determinant(world_from_object.ToMatrix()) < 0.f;
+            materials.push_back({static_cast<uint32_t>(indices.size() / 3), shapeBVHInfo.__material__});
+
+            auto mesh_positions = mesh.GetPositions();
+            auto mesh_normals = mesh.GetNormals();
+            auto mesh_indices = mesh.GetIndices();
+            if (has_normals && mesh_normals.empty())
+            {
+                for (size_t i = 0; i < mesh.GetTriangleCount(); i++)
+                {
+                    auto base = static_cast<uint32_t>(positions.size());
+                    glm::vec3 p0 = world_from_object.TransformPoint(mesh.GetPosition(i, 0));
+                    glm::vec3 p1 = world_from_object.TransformPoint(mesh.GetPosition(i, is_mirrored ? 2 : 1));
+                    glm::vec3 p2 = world_from_object.TransformPoint(mesh.GetPosition(i, is_mirrored ? 1 : 2));
+                    glm::vec3 normal = glm::normalize(glm::cross(p1 - p0, p2 - p0));
+                    positions.insert(positions.end(), {p0, p1, p2});
+                    normals.insert(normals.end(), {normal, normal, normal});
+                    indices.insert(indices.end(), {base, base + 1, base + 2});
+                }
+                continue;
+            }
+
+            auto base = static_cast<uint32_t>(positions.size());
+            for (const auto &position : mesh_positions)
+            {
+                positions.push_back(world_from_object.TransformPoint(position));
+            }
+            for (const auto &normal : mesh_normals)
+            {
+                normals.push_back(glm::normalize(object_from_world.TransformTransposed(normal)));
+            }
+            for (size_t i = 0; i < mesh_indices.size(); i += 3)
+            {
+                indices.push_back(base + mesh_indices[i]);
+                indices.push_back(base + mesh_indices[i + (is_mirrored ? 2 : 1)]);
+                indices.push_back(base + mesh_indices[i + (is_mirrored ? 1 : 2)]);
+            }
+        }
+
+        auto flat_bvh = std::make_unique<BVH>();
+        flat_bvh->Build(TriangleMesh(std::move(positions), std::move(normals), std::move(indices)), first_bvh->GetSettings());
+        flat_bvh->SetMaterials(std::move(materials));
+        remaining.push_back(ShapeBVHInfo{
+            .__shape__ = flat_bvh.get(),
+            .__material__ = nullptr
+            // end
+        });
+        shapeBVHInfos = std::move(remaining);
+        return flat_bvh;
+    }
+
+    uint32_t Scene::AddShape(const Shape &shape, const Material *material, const glm::vec3 &position, const glm::vec3 &scale, const glm::vec3 &rotate)
+    {
+        if (shape.GetInstanceDepth() + 1 > MAX_INSTANCE_DEPTH)
+        {
+            PBRT_ERROR("Scene - Instance depth {} of the shape exceeds the maximum {}, ignoring it", shape.GetInstanceDepth() + 1, MAX_INSTANCE_DEPTH);
+            return INVALID_SHAPE_ID;
+        }
+        glm::mat4 world_from_object = GetWorldFromObject(position, scale, rotate);
+        auto shape_id = static_cast<uint32_t>(__shapeBVHInfos__.size());
         __shapeBVHInfos__.push_back(ShapeBVHInfo{
             .__shape__ = &shape,
             .__material__ = material,
-            .__worldFromObject__ = world_from_object,
-            .__objectFromWorld__ = glm::inverse(world_from_object)
+            .__worldFromObject__ = AffineTransform(world_from_object),
+            .__objectFromWorld__ = AffineTransform(glm::inverse(world_from_object)),
+            .__id__ = shape_id
             // end
         });
+        __isTopLevelDirty__ = true;
+        return shape_id;
+    }
+
+    void Scene::SetShapeTransform(uint32_t shape_id, const glm::vec3 &position, const glm::vec3 &scale, const glm::vec3 &rotate)
+    {
+        if (shape_id >= __shapeBVHInfos__.size() || !__shapeBVHInfos__[shape_id].__shape__)
+        {
+            PBRT_WARN("Scene - SetShapeTransform: invalid shape id {}", shape_id);
+            return;
+        }
+        auto &shapeBVHInfo = __shapeBVHInfos__[shape_id];
+        if (shapeBVHInfo.__material__ && shapeBVHInfo.__material__->mAreaLight)
+        {
+            PBRT_WARN("Scene - SetShapeTransform: area light {} cannot be moved", shape_id);
+            return;
+        }
+        glm::mat4 world_from_object = GetWorldFromObject(position, scale, rotate);
+        shapeBVHInfo.__worldFromObject__ = AffineTransform(world_from_object);
+        shapeBVHInfo.__objectFromWorld__ = AffineTransform(glm::inverse(world_from_object));
+        __movedShapeIds__.push_back(shape_id);
+    }
+
+    void Scene::RemoveShape(uint32_t shape_id)
+    {
+        if (shape_id >= __shapeBVHInfos__.size() || !__shapeBVHInfos__[shape_id].__shape__)
+        {
+            PBRT_WARN("Scene - RemoveShape: invalid shape id {}", shape_id);
+            return;
+        }
+        auto &shapeBVHInfo = __shapeBVHInfos__[shape_id];
+        if (shapeBVHInfo.__material__ && shapeBVHInfo.__material__->mAreaLight)
+        {
+            __lightSampler__.RemoveLight(shapeBVHInfo.__material__->mAreaLight);
+            __lightSamplerMISC__.RemoveLight(shapeBVHInfo.__material__->mAreaLight);
+            __isLightDirty__ = true;
+        }
+        shapeBVHInfo.__shape__ = nullptr;
+        __isTopLevelDirty__ = true;
+    }
+
+    void Scene::BuildTopLevel(SceneBuildMode mode)
+    {
+        std::vector<ShapeBVHInfo> shapeBVHInfos;
+        shapeBVHInfos.reserve(__shapeBVHInfos__.size());
+        for (const auto &shapeBVHInfo : __shapeBVHInfos__)
+        {
+            if (shapeBVHInfo.__shape__)
+            {
+                shapeBVHInfos.push_back(shapeBVHInfo);
+            }
+        }
+        if (mode == SceneBuildMode::Auto)
+        {
+            mode = ChooseSceneBuildMode(shapeBVHInfos);
+        }
+        std::unique_ptr<BVH> flat_bvh;
+        if (mode == SceneBuildMode::Flat)
+        {
+            flat_bvh = FlattenTriangleShapes(shapeBVHInfos);
+        }
+
+        __sceneBVH__.Build(std::move(shapeBVHInfos));
+        __flatBVH__ = std::move(flat_bvh); // 新的顶层结构不再引用旧的合并BVH后才释放
+        __movedShapeIds__.clear();
+        __isTopLevelDirty__ = false;
+    }
+
+    void Scene::UpdateBoundsAndLights()
+    {
+        auto scene_bounds = __sceneBVH__.GetBounds();
+        if (!scene_bounds.IsValid()) // 场景中没有有限大小的物体
+        {
+            scene_bounds = {glm::vec3(0.f), glm::vec3(0.f)};
+        }
+        float radius = 0.5f * glm::distance(scene_bounds.__bMax__, scene_bounds.__bMin__);
+        __center__ = 0.5f * (scene_bounds.__bMax__ + scene_bounds.__bMin__);
+        if (radius != __radius__ || __isLightDirty__)
+        {
+            __radius__ = radius;
+            __lightSampler__.Build(__radius__);
+            __lightSamplerMISC__.Build(__radius__);
+            __isLightDirty__ = false;
+        }
+    }
+
+    void Scene::Build(SceneBuildMode mode)
+    {
+        BuildTopLevel(mode);
+        __isLightDirty__ = true;
+        UpdateBoundsAndLights();
+    }
+
+    bool Scene::Update()
+    {
+        if (!__isTopLevelDirty__ && __movedShapeIds__.empty() && !__isLightDirty__)
+        {
+            return false;
+        }
+
+        if (__isTopLevelDirty__ || (__flatBVH__ && !__movedShapeIds__.empty()))
+        {
+            BuildTopLevel(SceneBuildMode::TwoLevel);
+        }
+        else if (!__movedShapeIds__.empty())
+        {
+            std::sort(__movedShapeIds__.begin(), __movedShapeIds__.end());
+            __movedShapeIds__.erase(std::unique(__movedShapeIds__.begin(), __movedShapeIds__.end()), __movedShapeIds__.end());
+            std::vector<ShapeBVHInfo> moved_shapeBVHInfos;
+            moved_shapeBVHInfos.reserve(__movedShapeIds__.size());
+            for (auto shape_id : __movedShapeIds__)
+            {
+                moved_shapeBVHInfos.push_back(__shapeBVHInfos__[shape_id]);
+            }
+            if (!__sceneBVH__.Refit(moved_shapeBVHInfos))
+            {
+                PBRT_DEBUG("Scene - Top-level BVH degraded after refit, rebuilding");
+                BuildTopLevel(SceneBuildMode::TwoLevel);
+            }
+            __movedShapeIds__.clear();
+        }
+        UpdateBoundsAndLights();
+        return true;
     }
 
     std::optional<HitInfo> Scene::Intersect(const Ray &ray, float t_min, float t_max) const
     {
         return __sceneBVH__.Intersect(ray, t_min, t_max);
     }
+
+    bool Scene::Occluded(const Ray &ray, float t_min, float t_max) const
+    {
+        return __sceneBVH__.Occluded(ray, t_min, t_max);
+    }
+
+    bool Scene::IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
+    {
+        return __sceneBVH__.IntersectPrimitive(ray, t_min, t_max, hit);
+    }
+
+    HitInfo Scene::GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const
+    {
+        return __sceneBVH__.GetHitInfo(ray, hit);
+    }
+
+    void Scene::Intersect(std::span<const Ray> rays, std::span<HitRecord> records, float t_min, float t_max) const
+    {
+        for (auto &record : records)
+        {
+            record = {t_max};
+        }
+
+        ScratchBuffer<uint32_t> incoherent;
+        SplitRayPackets(
+            rays, [&](size_t start, size_t count)
+            { __sceneBVH__.IntersectBatch(rays.subspan(start, count), records.subspan(start, count), t_min); },
+            incoherent);
+
+        // 非相干光线收集到连续的缓冲中分批遍历, 完成后写回
+        ScratchBuffer<Ray> stream_rays;
+        ScratchBuffer<HitRecord> stream_records;
+        for (size_t start = 0; start < incoherent.Size(); start += RAY_STREAM_SIZE)
+        {
+            size_t count = std::min(RAY_STREAM_SIZE, incoherent.Size() - start);
+            stream_rays.Clear();
+            stream_records.Clear();
+            for (size_t i = start; i < start + count; i++)
+            {
+                stream_rays.PushBack(rays[incoherent[i]]);
+                stream_records.PushBack(records[incoherent[i]]);
+            }
+            __sceneBVH__.IntersectBatch(stream_rays.Span(), stream_records.Span(), t_min);
+            for (size_t i = 0; i < count; i++)
+            {
+                records[incoherent[start + i]] = stream_records[i];
+            }
+        }
+    }
+
+    void Scene::Occluded(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const
+    {
+        std::fill(occluded.begin(), occluded.end(), false);
+
+        ScratchBuffer<uint32_t> incoherent;
+        SplitRayPackets(
+            rays, [&](size_t start, size_t count)
+            { __sceneBVH__.OccludedBatch(rays.subspan(start, count), occluded.subspan(start, count), t_min, t_max); },
+            incoherent);
+
+        ScratchBuffer<Ray> stream_rays;
+        ScratchBuffer<bool> stream_occluded;
+        for (size_t start = 0; start < incoherent.Size(); start += RAY_STREAM_SIZE)
+        {
+            size_t count = std::min(RAY_STREAM_SIZE, incoherent.Size() - start);
+            stream_rays.Clear();
+            for (size_t i = start; i < start + count; i++)
+            {
+                stream_rays.PushBack(rays[incoherent[i]]);
+            }
+            stream_occluded.Clear();
+            stream_occluded.Resize(count, false);
+            __sceneBVH__.OccludedBatch(stream_rays.Span(), stream_occluded.Span(), t_min, t_max);
+            for (size_t i = 0; i < count; i++)
+            {
+                occluded[incoherent[start + i]] = stream_occluded[i];
+            }
+        }
+    }
 }
\ No newline at end of file
@@ -1,36 +1,72 @@
 ﻿#pragma once
+#include "accelerate/bvh.hpp"
 #include "accelerate/sceneBVH.hpp"
 #include "light/areaLight.hpp"
 #include "light/infiniteLight.hpp"
 #include "sampler/lightSampler.hpp"
+#include <cstdint>
+#include <memory>
 
 namespace pbrt
 {
+    constexpr size_t RAY_STREAM_SIZE = 256; // 非相干光线流每批的光线数
+
+    /*
+        场景加速结构的组织方式
+        TwoLevel: 每个物体保留自己的BVH, 顶层SceneBVH按实例变换引用, 同一模型多次放置时只存一份几何
+        Flat: 把所有模型的三角形按实例变换烘焙到世界空间, 合并构建一个BVH, 省去实例间的光线变换, 虚函数调用与顶层包围盒重叠
+              解析图元(球, 圆盘, 四边形等)与无限大物体仍作为顶层实例
+        Auto: 按展开后的三角形数, 复制程度与顶层包围盒的重叠程度自动选择, 大场景与只放置一次且无变换的模型保持TwoLevel
+    */
+    enum class SceneBuildMode
+    {
+        Auto,
+        TwoLevel,
+        Flat
+    };
+
+    constexpr size_t FLAT_SCENE_MAX_TRIANGLES = 1 << 20;      // 展开后的三角形数超过该值时保持TwoLevel: 合并BVH每次启动都要重建, 且与模型自己的几何和BVH同时驻留内存
+    constexpr float FLAT_SCENE_MAX_DUPLICATION = 1.25f;       // 展开后的三角形数不超过去重三角形数的该倍数时选择Flat
+    constexpr float FLAT_SCENE_OVERLAP_MAX_DUPLICATION = 4.f; // 顶层包围盒严重重叠时放宽到该倍数
+    constexpr float FLAT_SCENE_MIN_OVERLAP = 1.f;             // 实例包围盒表面积之和与场景包围盒表面积之比超过该值视为严重重叠
+
+    constexpr uint32_t INVALID_SHAPE_ID = UINT32_MAX;
+
     struct Scene : public Shape
     {
     private:
-        std::vector<ShapeBVHInfo> __shapeBVHInfos__;
+        std::vector<ShapeBVHInfo> __shapeBVHInfos__; // 下标即实例id, 删除的实例__shape__为nullptr
+        std::vector<uint32_t> __movedShapeIds__;     // 上次更新后改变了变换的实例
+        bool __isTopLevelDirty__{false};              // 增删实例后顶层结构需要重建
+        bool __isLightDirty__{false};                 // 光源集合改变后光源采样器需要重建
         SceneBVH __sceneBVH__;
         LightSampler __lightSampler__;
         LightSampler __lightSamplerMISC__;
         std::vector<const Light *> __infiniteLights__;
-        float __radius__;
+        std::unique_ptr<BVH> __flatBVH__; // Flat模式下合并的世界空间三角形BVH
+        float __radius__{};
         glm::vec3 __center__{};
 
+    private:
+        void BuildTopLevel(SceneBuildMode mode);
+        void UpdateBoundsAndLights();
+
     public:
-        void AddShape(
+        // 返回实例id, 用于之后的增量编辑; 物体的嵌套层数使场景超过MAX_INSTANCE_DEPTH时不加入并返回INVALID_SHAPE_ID
+        uint32_t AddShape(
             const Shape &shape,
             const Material *material = nullptr,
             const glm::vec3 &position = {0.f, 0.f, 0.f},
             const glm::vec3 &scale = {1.f, 1.f, 1.f},
             const glm::vec3 &rotate = {0.f, 0.f, 0.f});
 
-        void AddAreaLight(const AreaLight *light, Material *material)
+        uint32_t AddAreaLight(const AreaLight *light, Material *material)
         {
             material->mAreaLight = light;
-            AddShape(light->GetShape(), material);
             __lightSampler__.AddLight(light);
             __lightSamplerMISC__.AddLight(light);
+            __isLightDirty__ = true;
+            return AddShape(light->GetShape(), material);
         }
 
         void AddInfiniteLight(const Light *light)
@@ -41,23 +77,66 @@ namespace pbrt
                 __lightSamplerMISC__.AddLight(light);
             }
             __infiniteLights__.push_back(light);
+            __isLightDirty__ = true;
         }
 
+        /*
+            交互式编辑, 修改在下一次Update时生效, 各物体自身的BVH不会重建
+            面光源的采样直接使用其几何体, 不能通过实例变换移动
+        */
+        void SetShapeTransform(
+            uint32_t shape_id,
+            const glm::vec3 &position,
+            const glm::vec3 &scale = {1.f, 1.f, 1.f},
+            const glm::vec3 &rotate = {0.f, 0.f, 0.f});
+        void RemoveShape(uint32_t shape_id);
+
+        /*
+            应用Build之后的编辑, 返回场景是否发生变化
+            只移动了实例时重新拟合顶层BVH, 拟合后质量退化过多或增删了实例时只重建顶层BVH
+            Flat模式合并的三角形包含实例变换, 编辑后切换为TwoLevel
+            场景包围球或光源集合改变时重建光源采样器(无限大光源的功率依赖场景半径)
+        */
+        bool Update();
+
         std::optional<HitInfo> Intersect(
             const Ray &ray,
             float t_min = 1e-5,
             float t_max = std::numeric_limits<float>::infinity()) const override;
 
-        void Build()
+        bool Occluded(
+            const Ray &ray,
+            float t_min = 1e-5,
+            float t_max = std::numeric_limits<float>::infinity()) const override;
+
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override;
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override;
+        // 批量求交结果的着色数据, 未命中时返回nullopt
+        std::optional<HitInfo> GetHitInfo(const Ray &ray, const HitRecord &record) const
         {
-            __sceneBVH__.Build(std::move(__shapeBVHInfos__));
-            auto scene_bounds = __sceneBVH__.GetBounds();
-            __center__ = 0.5f * (scene_bounds.__bMax__ + scene_bounds.__bMin__);
-            __radius__ = 0.5f * glm::distance(scene_bounds.__bMax__, scene_bounds.__bMin__);
-            __lightSampler__.Build(__radius__);
-            __lightSamplerMISC__.Build(__radius__);
+            return record.__isHit__ ? std::optional<HitInfo>(GetHitInfo(ray, record.__hit__)) : std::nullopt;
         }
 
+        /*
+            批量求交, records[i]为rays[i]的结果
+            连续RAY_PACKET_SIZE条方向卦限相同的光线(如相机同一图块的光线)作为光线包遍历, 共享节点栈, 一个子包围盒用SIMD同时测试多条光线
+            其余光线按方向卦限排序后, 以光线流的方式分批遍历
+            只记录轻量命中, 需要着色数据时对命中的光线调用GetHitInfo
+        */
+        void Intersect(
+            std::span<const Ray> rays,
+            std::span<HitRecord> records,
+            float t_min = 1e-5,
+            float t_max = std::numeric_limits<float>::infinity()) const;
+
+        void Occluded(
+            std::span<const Ray> rays,
+            std::span<bool> occluded,
+            float t_min = 1e-5,
+            float t_max = std::numeric_limits<float>::infinity()) const;
+
+        void Build(SceneBuildMode mode = SceneBuildMode::Auto);
+
         const LightSampler &GetLightSampler(bool MISC) const { return MISC ? __lightSamplerMISC__ : __lightSampler__; }
 
         float GetRadius() const { return __radius__; }
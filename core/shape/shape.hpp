@@ -2,6 +2,7 @@
 #include "light/ray.hpp"
 #include "accelerate/bounds.hpp"
 #include <optional>
+#include <span>
 
 namespace pbrt
 {
@@ -12,11 +13,99 @@ namespace pbrt
         float __pdf__;
     };
 
+    constexpr size_t MAX_INSTANCE_DEPTH = 4; // 实例嵌套的最大层数(场景顶层计为第1层)
+
+    /*
+        轻量命中记录, 遍历中每接受一个更近的候选只更新该记录, 交点, 插值法线与材质等着色数据仅对最终的最近交点由GetHitInfo计算一次
+        __primitiveIdx__由物体解释(如网格三角形索引), __instanceIdx__由各层实例结构解释, [0]为最外层的实例索引
+        内层先写入命中, 外层接受命中时把自己的实例索引压到最前, GetHitInfo时逐层弹出
+    */
+    struct PrimitiveHit
+    {
+    public:
+        float __t__;
+        float __u__, __v__;        // 三角形的重心坐标, 解析图元不使用
+        uint32_t __primitiveIdx__;
+        uint32_t __instanceIdx__[MAX_INSTANCE_DEPTH];
+
+    public:
+        void PushInstance(uint32_t instance_idx)
+        {
+            for (size_t i = MAX_INSTANCE_DEPTH - 1; i > 0; i--)
+            {
+                __instanceIdx__[i] = __instanceIdx__[i - 1];
+            }
+            __instanceIdx__[0] = instance_idx;
+        }
+
+        // 去掉最外层实例索引, 得到内层物体的命中记录
+        PrimitiveHit PopInstance() const
+        {
+            PrimitiveHit hit = *this;
+            for (size_t i = 0; i + 1 < MAX_INSTANCE_DEPTH; i++)
+            {
+                hit.__instanceIdx__[i] = __instanceIdx__[i + 1];
+            }
+            hit.__instanceIdx__[MAX_INSTANCE_DEPTH - 1] = 0;
+            return hit;
+        }
+    };
+
+    // 批量求交的结果, __tMax__既是求交上界, 也随命中收缩为当前最近交点距离; 着色数据由GetHitInfo(rays[i], __hit__)按需计算
+    struct HitRecord
+    {
+        float __tMax__;
+        bool __isHit__{false};
+        PrimitiveHit __hit__{};
+    };
+
     struct Shape
     {
     public:
-        virtual std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const = 0;
+        // 最近交点求交, 交点比t_max更近时收缩t_max并写入hit, 返回是否命中; 不计算着色数据
+        virtual bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const = 0;
+        // 由IntersectPrimitive的命中记录计算着色数据, ray必须与求交时相同
+        virtual HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const = 0;
+
+        virtual std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const
+        {
+            PrimitiveHit hit;
+            if (!IntersectPrimitive(ray, t_min, t_max, hit))
+            {
+                return std::nullopt;
+            }
+            return GetHitInfo(ray, hit);
+        }
+
+        // 遮挡测试, 只判断(t_min, t_max)内是否存在交点, 不计算着色信息
+        virtual bool Occluded(const Ray &ray, float t_min, float t_max) const
+        {
+            PrimitiveHit hit;
+            return IntersectPrimitive(ray, t_min, t_max, hit);
+        }
+
+        // 批量求交, records[i]对应rays[i], 仅当交点比records[i].__tMax__更近时更新
+        virtual void IntersectBatch(std::span<const Ray> rays, std::span<HitRecord> records, float t_min) const
+        {
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                records[i].__isHit__ |= IntersectPrimitive(rays[i], t_min, records[i].__tMax__, records[i].__hit__);
+            }
+        }
+
+        // 批量遮挡测试, 已被遮挡的光线(occluded[i]为true)不再测试
+        virtual void OccludedBatch(std::span<const Ray> rays, std::span<bool> occluded, float t_min, float t_max) const
+        {
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                if (!occluded[i])
+                {
+                    occluded[i] = Occluded(rays[i], t_min, t_max);
+                }
+            }
+        }
         virtual Bounds GetBounds() const { return {}; }
+        virtual size_t GetInstanceDepth() const { return 0; } // 物体内部的实例嵌套层数, 实例结构返回1 + 子物体的最大层数
         virtual float GetArea() const { return -1.f; }
         virtual std::optional<ShapeInfo> SampleShape(const RNG &rng) const { return std::nullopt; }
         virtual float PDF(const glm::vec3 &point, const glm::vec3 &normal) const { return 1.f / GetArea(); }
@@ -3,7 +3,7 @@
 
 namespace pbrt
 {
-    std::optional<HitInfo> Sphere::Intersect(const Ray &ray, float t_min, float t_max) const
+    bool Sphere::IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const
     {
         /*
             球体方程: (x - Cₓ)² + (y - Cᵧ)² + (z - C₂)² = r²
@@ -34,7 +34,7 @@ namespace pbrt
         float discriminant = b * b - 4.f * a * c;
         if (discriminant < 0.f)
         {
-            return std::nullopt;
+            return false;
         }
 
         // 优先选择较小的t值(进入点), 如果进入点在有效范围外, 选择离开点, 确保总是返回最近的合法交点
@@ -46,16 +46,22 @@ namespace pbrt
 
         if (hit_t > t_min && hit_t < t_max)
         {
-            glm::vec3 hit_point = ray.Hit(hit_t);
-            glm::vec3 normal = glm::normalize(hit_point - __center__);
-            return HitInfo{
-                .__t__ = hit_t,
-                .__hitPoint__ = hit_point,
-                .__normal__ = normal
-                // end
-            };
+            t_max = hit_t;
+            hit = {hit_t, 0.f, 0.f, 0, {}};
+            return true;
         }
-        return std::nullopt;
+        return false;
+    }
+
+    HitInfo Sphere::GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const
+    {
+        glm::vec3 hit_point = ray.Hit(hit.__t__);
+        return HitInfo{
+            .__t__ = hit.__t__,
+            .__hitPoint__ = hit_point,
+            .__normal__ = glm::normalize(hit_point - __center__)
+            // end
+        };
     }
 
     float Sphere::GetArea() const
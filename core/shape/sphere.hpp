@@ -11,7 +11,8 @@ namespace pbrt
 
     public:
         Sphere(const glm::vec3 &center, float radius) : __center__(center), __radius__(radius) {}
-        std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const override;
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override;
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override;
         Bounds GetBounds() const override { return {__center__ - __radius__, __center__ + __radius__}; }
         float GetArea() const override;
         std::optional<ShapeInfo> SampleShape(const RNG &rng) const override;
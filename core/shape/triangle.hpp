@@ -3,6 +3,62 @@
 
 namespace pbrt
 {
+    // 三角形的平凡数据(无虚表), 可以直接写入缓存文件, 映射后原样使用
+    struct TriangleData
+    {
+    public:
+        glm::vec3 __p0__, __p1__, __p2__;
+        glm::vec3 __n0__, __n1__, __n2__;
+    };
+
+    namespace internal
+    {
+        /*
+            Möller-Trumbore求交, 交点在(t_min, t_max)内时返回true并写出t与重心坐标u, v
+
+            射线方程P = O + tD
+            O: 射线原点
+            D: 射线方向
+            t: 交点参数, t>0表示在射线正方向上
+
+            P = P₀ + u(P₁ - P₀) + v(P₂ - P₀) = P₀ + ue₁ + ve₂ 其中u, v为重心坐标参数, u ≥ 0, v ≥ 0, u + v ≤ 1
+
+            O + tD = P₀ + ue₁ + ve₂
+            O - P₀ = -tD + ue₁ + ve₂
+            S = O - P₀
+
+            [-D e₁ e₂][t u v]ᵀ = S
+            S₁ = D × e₂
+            S₂ = S × e₁
+
+            [t u v]ᵀ = 1/( S₁ · e₁)[S₂ · e₂, S₁ · S, S₂ · D]ᵀ
+        */
+        inline bool IntersectTriangle(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2, const Ray &ray, float t_min, float t_max, float &t, float &u, float &v)
+        {
+            glm::vec3 e1 = p1 - p0; // 三角形边
+            glm::vec3 e2 = p2 - p0;
+            glm::vec3 s1 = glm::cross(ray.__direction__, e2);
+            float inv_det = 1.f / glm::dot(e1, s1);
+
+            glm::vec3 s = ray.__origin__ - p0;
+            u = glm::dot(s, s1) * inv_det;
+            if (u < 0.f || u > 1.f)
+            {
+                return false;
+            }
+
+            glm::vec3 s2 = glm::cross(s, e1);
+            v = glm::dot(ray.__direction__, s2) * inv_det;
+            if (v < 0.f || u + v > 1.f)
+            {
+                return false;
+            }
+
+            t = glm::dot(e2, s2) * inv_det;
+            return t > t_min && t < t_max;
+        }
+    }
+
     struct Triangle : public Shape
     {
     public:
@@ -14,6 +70,9 @@ namespace pbrt
                  const glm::vec3 &n0, const glm::vec3 &n1, const glm::vec3 &n2)
             : __p0__(p0), __p1__(p1), __p2__(p2), __n0__(n0), __n1__(n1), __n2__(n2) {}
 
+        explicit Triangle(const TriangleData &data)
+            : Triangle(data.__p0__, data.__p1__, data.__p2__, data.__n0__, data.__n1__, data.__n2__) {}
+
         Triangle(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2)
             : __p0__(p0), __p1__(p1), __p2__(p2)
         {
@@ -24,7 +83,11 @@ namespace pbrt
             __n2__ = __n0__;
         }
 
-        std::optional<HitInfo> Intersect(const Ray &ray, float t_min, float t_max) const override;
+        TriangleData GetData() const { return {__p0__, __p1__, __p2__, __n0__, __n1__, __n2__}; }
+
+        bool IntersectPrimitive(const Ray &ray, float t_min, float &t_max, PrimitiveHit &hit) const override;
+        HitInfo GetHitInfo(const Ray &ray, const PrimitiveHit &hit) const override;
+        bool Occluded(const Ray &ray, float t_min, float t_max) const override;
         Bounds GetBounds() const override
         {
             Bounds bounds{};
@@ -0,0 +1,65 @@
+﻿#include "triangleMesh.hpp"
+#include "utils/logger.hpp"
+
+namespace pbrt
+{
+    TriangleMesh::TriangleMesh(std::vector<glm::vec3> &&positions, std::vector<glm::vec3> &&normals, std::vector<uint32_t> &&indices)
+    {
+        mPositions.Assign(std::move(positions));
+        mNormals.Assign(std::move(normals));
+        mIndices.Assign(std::move(indices));
+    }
+
+    TriangleMesh TriangleMesh::FromTriangles(const std::vector<Triangle> &triangles)
+    {
+        std::vector<glm::vec3> positions, normals;
+        std::vector<uint32_t> indices;
+        positions.reserve(triangles.size() * 3);
+        normals.reserve(triangles.size() * 3);
+        indices.reserve(triangles.size() * 3);
+        for (const auto &triangle : triangles)
+        {
+            for (const auto &[position, normal] : {std::pair(triangle.__p0__, triangle.__n0__), std::pair(triangle.__p1__, triangle.__n1__), std::pair(triangle.__p2__, triangle.__n2__)})
+            {
+                indices.push_back(static_cast<uint32_t>(positions.size()));
+                positions.push_back(position);
+                normals.push_back(normal);
+            }
+        }
+        return TriangleMesh(std::move(positions), std::move(normals), std::move(indices));
+    }
+
+    void TriangleMesh::Attach(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals, std::span<const uint32_t> indices)
+    {
+        mPositions.Attach(positions);
+        mNormals.Attach(normals);
+        mIndices.Attach(indices);
+        mNumaPositions.Clear();
+        mNumaNormals.Clear();
+        mNumaIndices.Clear();
+    }
+
+    bool TriangleMesh::SetVertices(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals)
+    {
+        if (positions.size() != mPositions.size() || (!normals.empty() && normals.size() != positions.size()))
+        {
+            PBRT_ERROR("TriangleMesh - vertex count mismatch: {} positions, {} normals, expected {}", positions.size(), normals.size(), mPositions.size());
+            return false;
+        }
+        mPositions.Assign(std::vector<glm::vec3>(positions.begin(), positions.end()));
+        if (!normals.empty())
+        {
+            mNormals.Assign(std::vector<glm::vec3>(normals.begin(), normals.end()));
+        }
+        mNumaPositions.Clear();
+        mNumaNormals.Clear();
+        return true;
+    }
+
+    void TriangleMesh::ReplicatePerNumaNode()
+    {
+        mNumaPositions.Replicate(mPositions.Span());
+        mNumaNormals.Replicate(mNormals.Span());
+        mNumaIndices.Replicate(mIndices.Span());
+    }
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+﻿#pragma once
+#include "triangle.hpp"
+#include "accelerate/bounds.hpp"
+#include "thread/numaReplicated.hpp"
+#include "utils/mappedFile.hpp"
+#include <vector>
+
+namespace pbrt
+{
+    // 网格缓冲的只读视图, 不拥有数据; 用于在遍历或着色前一次性取得本NUMA分区的副本
+    struct TriangleMeshView
+    {
+    public:
+        std::span<const glm::vec3> __positions__;
+        std::span<const glm::vec3> __normals__; // 为空时使用几何法线
+        std::span<const uint32_t> __indices__;
+
+    public:
+        const glm::vec3 &GetPosition(size_t i, size_t vertex) const { return __positions__[__indices__[i * 3 + vertex]]; } // 第i个三角形的第vertex个顶点
+
+        TriangleData GetTriangle(size_t i) const
+        {
+            uint32_t i0 = __indices__[i * 3 + 0], i1 = __indices__[i * 3 + 1], i2 = __indices__[i * 3 + 2];
+            TriangleData triangle{__positions__[i0], __positions__[i1], __positions__[i2]};
+            if (__normals__.empty())
+            {
+                triangle.__n0__ = glm::normalize(glm::cross(triangle.__p1__ - triangle.__p0__, triangle.__p2__ - triangle.__p0__));
+                triangle.__n1__ = triangle.__n0__;
+                triangle.__n2__ = triangle.__n0__;
+            }
+            else
+            {
+                triangle.__n0__ = __normals__[i0];
+                triangle.__n1__ = __normals__[i1];
+                triangle.__n2__ = __normals__[i2];
+            }
+            return triangle;
+        }
+    };
+
+    /*
+        共享顶点的索引三角形网格
+        位置与法线按顶点存储一次, 每个三角形只保存3个32位顶点索引, 相比逐三角形的Triangle对象(约80字节)内存降低3~4倍
+        缓冲可以自有, 也可以直接指向缓存文件的映射内存
+    */
+    class TriangleMesh
+    {
+    private:
+        MappedArray<glm::vec3> mPositions;
+        MappedArray<glm::vec3> mNormals; // 与顶点一一对应, 为空时使用几何法线
+        MappedArray<uint32_t> mIndices;  // 每个三角形3个顶点索引
+        NumaReplicated<glm::vec3> mNumaPositions; // 以上缓冲在各NUMA分区的副本, 顶点修改或重新Attach时丢弃
+        NumaReplicated<glm::vec3> mNumaNormals;
+        NumaReplicated<uint32_t> mNumaIndices;
+
+    public:
+        TriangleMesh() = default;
+        TriangleMesh(std::vector<glm::vec3> &&positions, std::vector<glm::vec3> &&normals, std::vector<uint32_t> &&indices);
+
+        static TriangleMesh FromTriangles(const std::vector<Triangle> &triangles); // 每个三角形独立的3个顶点, 不合并
+        void Attach(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals, std::span<const uint32_t> indices);
+        bool SetVertices(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals); // 顶点数与索引不变, normals为空时保留原法线; 数量不符时返回false
+
+        size_t GetTriangleCount() const { return mIndices.size() / 3; }
+        size_t GetVertexCount() const { return mPositions.size(); }
+        size_t GetMemorySize() const { return (mPositions.size() + mNormals.size()) * sizeof(glm::vec3) + mIndices.size() * sizeof(uint32_t); }
+
+        const glm::vec3 &GetPosition(size_t i, size_t vertex) const { return mPositions[mIndices[i * 3 + vertex]]; } // 第i个三角形的第vertex个顶点
+        TriangleData GetTriangle(size_t i) const { return GetView().GetTriangle(i); }
+
+        // 在线程池的每个NUMA分区复制一份顶点与索引, 只有一个分区时不复制
+        void ReplicatePerNumaNode();
+        TriangleMeshView GetView() const { return {mPositions.Span(), mNormals.Span(), mIndices.Span()}; }
+        TriangleMeshView GetLocalView() const { return {mNumaPositions.Get(mPositions.Span()), mNumaNormals.Get(mNormals.Span()), mNumaIndices.Get(mIndices.Span())}; } // 调用线程所在分区的副本, 没有复制时同GetView
+
+        Bounds GetTriangleBounds(size_t i) const
+        {
+            Bounds bounds{};
+            bounds.Expand(GetPosition(i, 0));
+            bounds.Expand(GetPosition(i, 1));
+            bounds.Expand(GetPosition(i, 2));
+            return bounds;
+        }
+
+        float GetTriangleArea(size_t i) const
+        {
+            const auto &p0 = GetPosition(i, 0);
+            return glm::length(glm::cross(GetPosition(i, 2) - p0, GetPosition(i, 1) - p0)) * 0.5f;
+        }
+
+        std::span<const glm::vec3> GetPositions() const { return mPositions.Span(); }
+        std::span<const glm::vec3> GetNormals() const { return mNormals.Span(); }
+        std::span<const uint32_t> GetIndices() const { return mIndices.Span(); }
+    };
+}
\ No newline at end of file
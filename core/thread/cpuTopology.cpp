@@ -0,0 +1,236 @@
+﻿#include "cpuTopology.hpp"
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace pbrt
+{
+    static std::vector<LogicalCPU> GetFallbackTopology()
+    {
+        std::vector<LogicalCPU> cpus;
+        uint32_t cpu_count = std::max(std::thread::hardware_concurrency(), 1u);
+        for (uint32_t i = 0; i < cpu_count; i++)
+        {
+            cpus.push_back({.__id__ = i, .__coreId__ = i, .__numaNode__ = 0, .__isPrimaryThread__ = true});
+        }
+        return cpus;
+    }
+
+    static bool ParseUInt(std::string_view text, uint32_t &value)
+    {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+        {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\n' || text.back() == '\r'))
+        {
+            text.remove_suffix(1);
+        }
+        auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return !text.empty() && ec == std::errc() && ptr == text.data() + text.size();
+    }
+
+#ifdef __linux__
+    static std::string ReadFirstLine(const std::filesystem::path &path)
+    {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+#endif
+
+    std::vector<uint32_t> ParseCPUList(std::string_view list)
+    {
+        std::vector<uint32_t> cpu_ids;
+        while (!list.empty())
+        {
+            size_t comma = list.find(',');
+            std::string_view token = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+            size_t dash = token.find('-');
+            uint32_t first, last;
+            if (dash == std::string_view::npos)
+            {
+                if (!ParseUInt(token, first))
+                {
+                    return {};
+                }
+                last = first;
+            }
+            else if (!ParseUInt(token.substr(0, dash), first) || !ParseUInt(token.substr(dash + 1), last) || last < first)
+            {
+                return {};
+            }
+            for (uint32_t id = first; id <= last; id++)
+            {
+                cpu_ids.push_back(id);
+            }
+        }
+        std::sort(cpu_ids.begin(), cpu_ids.end());
+        cpu_ids.erase(std::unique(cpu_ids.begin(), cpu_ids.end()), cpu_ids.end());
+        return cpu_ids;
+    }
+
+    std::vector<LogicalCPU> QueryCPUTopology()
+    {
+        std::vector<LogicalCPU> cpus;
+#ifdef _WIN32
+        DWORD length = 0;
+        GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+        std::vector<std::byte> buffer(length);
+        auto *info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data());
+        if (length == 0 || !GetLogicalProcessorInformationEx(RelationAll, info, &length))
+        {
+            return GetFallbackTopology();
+        }
+
+        std::map<uint32_t, uint32_t> cpu_nodes; // 逻辑CPU → 系统的NUMA节点号
+        uint32_t core_count = 0;
+        for (DWORD offset = 0; offset < length;)
+        {
+            auto *entry = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+            if (entry->Relationship == RelationProcessorCore)
+            {
+                bool is_primary = true;
+                for (WORD g = 0; g < entry->Processor.GroupCount; g++)
+                {
+                    const GROUP_AFFINITY &group = entry->Processor.GroupMask[g];
+                    for (uint32_t bit = 0; bit < 64; bit++)
+                    {
+                        if (group.Mask & (KAFFINITY(1) << bit))
+                        {
+                            cpus.push_back({.__id__ = group.Group * 64u + bit, .__coreId__ = core_count, .__numaNode__ = 0, .__isPrimaryThread__ = is_primary});
+                            is_primary = false;
+                        }
+                    }
+                }
+                core_count++;
+            }
+            else if (entry->Relationship == RelationNumaNode)
+            {
+                const GROUP_AFFINITY &group = entry->NumaNode.GroupMask;
+                for (uint32_t bit = 0; bit < 64; bit++)
+                {
+                    if (group.Mask & (KAFFINITY(1) << bit))
+                    {
+                        cpu_nodes[group.Group * 64u + bit] = entry->NumaNode.NodeNumber;
+                    }
+                }
+            }
+            offset += entry->Size;
+        }
+#elif defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        {
+            return GetFallbackTopology();
+        }
+
+        std::map<uint32_t, uint32_t> cpu_nodes;
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator("/sys/devices/system/node", error))
+        {
+            std::string name = entry.path().filename().string();
+            uint32_t node;
+            if (name.rfind("node", 0) != 0 || !ParseUInt(std::string_view(name).substr(4), node))
+            {
+                continue;
+            }
+            for (uint32_t id : ParseCPUList(ReadFirstLine(entry.path() / "cpulist")))
+            {
+                cpu_nodes[id] = node;
+            }
+        }
+
+        std::map<uint64_t, uint32_t> core_ids; // (封装, 核)→ 连续的物理核编号
+        for (uint32_t id = 0; id < CPU_SETSIZE; id++)
+        {
+            if (!CPU_ISSET(id, &allowed))
+            {
+                continue;
+            }
+            std::filesystem::path topology = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology";
+            uint32_t package = 0, core = id;
+            ParseUInt(ReadFirstLine(topology / "physical_package_id"), package);
+            ParseUInt(ReadFirstLine(topology / "core_id"), core);
+            uint64_t key = (static_cast<uint64_t>(package) << 32) | core;
+            // 按编号升序遍历, 物理核中第一个出现的可用CPU作为主线程
+            auto [it, is_primary] = core_ids.try_emplace(key, static_cast<uint32_t>(core_ids.size()));
+            cpus.push_back({.__id__ = id, .__coreId__ = it->second, .__numaNode__ = 0, .__isPrimaryThread__ = is_primary});
+        }
+#else
+        std::map<uint32_t, uint32_t> cpu_nodes;
+#endif
+        if (cpus.empty())
+        {
+            return GetFallbackTopology();
+        }
+
+        // 系统的节点号可能不连续, 重新编号为包含可用CPU的节点的序号
+        std::map<uint32_t, uint32_t> node_ids;
+        for (const auto &cpu : cpus)
+        {
+            auto it = cpu_nodes.find(cpu.__id__);
+            node_ids.try_emplace(it == cpu_nodes.end() ? 0 : it->second, 0);
+        }
+        uint32_t node_count = 0;
+        for (auto &[node, id] : node_ids)
+        {
+            id = node_count++;
+        }
+        for (auto &cpu : cpus)
+        {
+            auto it = cpu_nodes.find(cpu.__id__);
+            cpu.__numaNode__ = node_ids[it == cpu_nodes.end() ? 0 : it->second];
+        }
+        std::sort(cpus.begin(), cpus.end(), [](const LogicalCPU &a, const LogicalCPU &b)
+                  { return a.__id__ < b.__id__; });
+        return cpus;
+    }
+
+    bool SetCurrentThreadAffinity(std::span<const uint32_t> cpu_ids)
+    {
+        if (cpu_ids.empty())
+        {
+            return false;
+        }
+#ifdef _WIN32
+        GROUP_AFFINITY affinity{};
+        affinity.Group = static_cast<WORD>(cpu_ids[0] / 64);
+        for (uint32_t id : cpu_ids)
+        {
+            if (id / 64 == affinity.Group)
+            {
+                affinity.Mask |= KAFFINITY(1) << (id % 64);
+            }
+        }
+        return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (uint32_t id : cpu_ids)
+        {
+            if (id < CPU_SETSIZE)
+            {
+                CPU_SET(id, &set);
+            }
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+﻿#pragma once
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace pbrt
+{
+    struct LogicalCPU
+    {
+    public:
+        uint32_t __id__;             // 操作系统的逻辑CPU编号, Windows下为处理器组 * 64 + 组内编号
+        uint32_t __coreId__;         // 物理核编号, 同一物理核的超线程相同
+        uint32_t __numaNode__;       // 所在NUMA节点, 从0开始连续编号
+        bool __isPrimaryThread__;    // 是否为物理核上编号最小的硬件线程, 关闭SMT时只使用这些CPU
+    };
+
+    /*
+        查询当前进程可以使用的逻辑CPU及其物理核与NUMA节点, 按__id__升序
+        Linux读取sched_getaffinity与/sys/devices/system下的拓扑, 遵循taskset与cgroup的限制; Windows使用GetLogicalProcessorInformationEx
+        查询失败时按hardware_concurrency返回单个节点, 每个CPU视为独立的物理核
+    */
+    std::vector<LogicalCPU> QueryCPUTopology();
+
+    // 将调用线程绑定到一组逻辑CPU, 失败时返回false; Windows下只能绑定到同一处理器组, 使用第一个CPU所在的组
+    bool SetCurrentThreadAffinity(std::span<const uint32_t> cpu_ids);
+
+    // 解析"0-3,8,10-11"格式的CPU列表(与Linux的cpulist相同), 格式错误时返回空
+    std::vector<uint32_t> ParseCPUList(std::string_view list);
+}
\ No newline at end of file
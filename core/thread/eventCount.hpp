@@ -0,0 +1,74 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <immintrin.h>
+#endif
+
+namespace pbrt
+{
+    // 自旋等待中的一次停顿, x86下为pause指令, 降低功耗并让出超线程的执行资源
+    inline void CpuRelax()
+    {
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+        _mm_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    /*
+        事件计数(eventcount): 让等待"某个条件成立"的线程阻塞而不是轮询, 条件本身(如队列非空)由使用者检查
+        等待方: key = PrepareWait() → 再次检查条件 → 成立则CancelWait(), 否则Wait(key)
+        通知方: 使条件成立 → Notify
+        等待方登记后才复查条件, 通知方改变条件后才检查等待者, 两侧各有一个seq_cst栅栏, 因此不会丢失唤醒
+        阻塞使用C++20的std::atomic::wait, 在Linux上为futex, Windows上为WaitOnAddress; 没有等待者时Notify只有一次原子读
+    */
+    class EventCount
+    {
+    private:
+        alignas(64) std::atomic<uint32_t> mEpoch{0}; // 每次通知加一, 等待者阻塞到它变化为止
+        std::atomic<uint32_t> mWaiterCount{0};       // 已登记(PrepareWait)但尚未返回的等待者数
+
+    public:
+        uint32_t PrepareWait()
+        {
+            mWaiterCount.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return mEpoch.load(std::memory_order_acquire);
+        }
+
+        void CancelWait()
+        {
+            mWaiterCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void Wait(uint32_t key)
+        {
+            mEpoch.wait(key, std::memory_order_acquire);
+            mWaiterCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void NotifyOne()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (mWaiterCount.load(std::memory_order_relaxed) != 0)
+            {
+                mEpoch.fetch_add(1, std::memory_order_release);
+                mEpoch.notify_one();
+            }
+        }
+
+        void NotifyAll()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (mWaiterCount.load(std::memory_order_relaxed) != 0)
+            {
+                mEpoch.fetch_add(1, std::memory_order_release);
+                mEpoch.notify_all();
+            }
+        }
+    };
+}
\ No newline at end of file
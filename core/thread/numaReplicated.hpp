@@ -0,0 +1,61 @@
+﻿#pragma once
+#include "threadPool.hpp"
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace pbrt
+{
+    /*
+        只读数组在每个NUMA分区的副本, 工作线程读取本分区的副本, 避免跨节点访问内存
+        每份副本由绑定在对应节点上的临时线程分配并写入, 按操作系统的首次访问策略分配在该节点的内存上
+        线程池只有一个分区时不复制, Get直接返回原数组; 原数组修改后需要重新Replicate
+    */
+    template <typename T>
+    class NumaReplicated
+    {
+    private:
+        std::vector<std::vector<T>> mCopies; // 下标为线程池的NUMA分区
+
+    public:
+        void Replicate(std::span<const T> source, const ThreadPool &pool = MasterThreadPool)
+        {
+            mCopies.clear();
+            size_t node_count = pool.GetNumaNodeCount();
+            if (node_count <= 1 || source.empty())
+            {
+                return;
+            }
+
+            mCopies.resize(node_count);
+            std::vector<std::thread> threads;
+            for (size_t node = 0; node < node_count; node++)
+            {
+                threads.emplace_back([&, node]()
+                                     {
+                                         SetCurrentThreadAffinity(pool.GetNumaNodeCPUs(node));
+                                         mCopies[node].assign(source.begin(), source.end());
+                                         // end
+                                     });
+            }
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        void Clear() { mCopies.clear(); }
+        bool IsReplicated() const { return !mCopies.empty(); }
+
+        // 调用线程所在分区的副本, 没有复制时返回source
+        std::span<const T> Get(std::span<const T> source) const
+        {
+            if (mCopies.empty())
+            {
+                return source;
+            }
+            size_t node = ThreadPool::GetCurrentNumaNode();
+            return node < mCopies.size() ? std::span<const T>(mCopies[node]) : source;
+        }
+    };
+}
\ No newline at end of file
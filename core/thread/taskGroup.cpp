@@ -0,0 +1,14 @@
+﻿#include "taskGroup.hpp"
+
+namespace pbrt
+{
+    void TaskGroup::FinishTask()
+    {
+        // 计数归零后等待者可能立即返回并销毁任务组, 之后只能访问线程池
+        ThreadPool &pool = mPool;
+        if (mPendingTaskCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            pool.mJoinEvent.NotifyAll();
+        }
+    }
+}
\ No newline at end of file
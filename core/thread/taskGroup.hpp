@@ -0,0 +1,56 @@
+﻿#pragma once
+#include "threadPool.hpp"
+#include <type_traits>
+#include <utility>
+
+namespace pbrt
+{
+    /*
+        任务组: 只等待通过它添加的任务, 而不是线程池中的全部任务, 用于嵌套的并行与多个构建同时进行
+        Spawn → 任务放入调用线程的队列 → Wait执行队列中的任务(优先取出自己刚添加的)直到组内任务全部完成
+        等待期间可能顺带执行其他组的任务, 但不会等待它们; 可以在任务内部创建与等待, 析构时自动Wait
+    */
+    class TaskGroup
+    {
+    private:
+        template <typename F>
+        struct GroupTask : public Task
+        {
+        public:
+            F __lambda__;
+            TaskGroup *__group__;
+
+        public:
+            GroupTask(F &&func, TaskGroup *group) : __lambda__(std::move(func)), __group__(group) {}
+            GroupTask(const F &func, TaskGroup *group) : __lambda__(func), __group__(group) {}
+
+            void Run() override
+            {
+                __lambda__();
+                __group__->FinishTask();
+            }
+        };
+
+        ThreadPool &mPool;
+        std::atomic<size_t> mPendingTaskCount{0}; // 组内尚未完成的任务数
+
+    private:
+        void FinishTask();
+
+    public:
+        explicit TaskGroup(ThreadPool &pool = MasterThreadPool) : mPool(pool) {}
+        ~TaskGroup() { Wait(); }
+
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        template <typename F>
+        void Spawn(F &&func)
+        {
+            mPendingTaskCount.fetch_add(1, std::memory_order_relaxed);
+            mPool.AddTask(new GroupTask<std::decay_t<F>>(std::forward<F>(func), this));
+        }
+
+        void Wait() { mPool.Join(mPendingTaskCount); }
+    };
+}
\ No newline at end of file
@@ -1,59 +1,237 @@
 ﻿#include "threadPool.hpp"
+#include "utils/logger.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <optional>
+#include <string_view>
 
 namespace pbrt
 {
-    ThreadPool MasterThreadPool{};
-    void ThreadPool::WorkerThread(ThreadPool *master)
+    ThreadPool MasterThreadPool{ThreadPoolSettings::FromEnvironment()};
+
+    static thread_local const ThreadPool *CurrentPool = nullptr; // 当前线程所属的线程池, 外部线程为nullptr
+    static thread_local size_t CurrentWorkerIndex = 0;
+    static thread_local size_t CurrentNumaNode = 0;
+    static thread_local uint32_t StealRandomState = 0;
+
+    // 读取非负整数环境变量, 未设置或格式错误时返回false
+    static bool GetEnvironmentValue(const char *name, size_t &value)
+    {
+        const char *text = std::getenv(name);
+        if (text == nullptr)
+        {
+            return false;
+        }
+        std::string_view view(text);
+        auto [ptr, ec] = std::from_chars(view.data(), view.data() + view.size(), value);
+        return !view.empty() && ec == std::errc() && ptr == view.data() + view.size();
+    }
+
+    // xorshift随机数, 选择窃取的起始队列, 避免所有空闲线程同时窃取同一个队列
+    static uint32_t NextStealRandom()
+    {
+        if (StealRandomState == 0)
+        {
+            StealRandomState = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1u;
+        }
+        StealRandomState ^= StealRandomState << 13;
+        StealRandomState ^= StealRandomState >> 17;
+        StealRandomState ^= StealRandomState << 5;
+        return StealRandomState;
+    }
+
+    ThreadPoolSettings ThreadPoolSettings::FromEnvironment()
     {
+        // 在静态初始化阶段调用, 日志尚未初始化, 格式错误的值直接忽略
+        ThreadPoolSettings settings{};
+        size_t value;
+        if (GetEnvironmentValue("PBRT_THREADS", value))
+        {
+            settings.__threadCount__ = value;
+        }
+        if (const char *cpus = std::getenv("PBRT_CPUS"))
+        {
+            settings.__cpus__ = ParseCPUList(cpus);
+        }
+        if (GetEnvironmentValue("PBRT_SMT", value))
+        {
+            settings.__useSMT__ = value != 0;
+        }
+        if (GetEnvironmentValue("PBRT_PIN", value))
+        {
+            settings.__pinThreads__ = value != 0;
+        }
+        if (GetEnvironmentValue("PBRT_NUMA", value))
+        {
+            settings.__numaAware__ = value != 0;
+        }
+        return settings;
+    }
+
+    void ThreadPool::WorkerThread(ThreadPool *master, size_t worker_idx)
+    {
+        CurrentPool = master;
+        CurrentWorkerIndex = worker_idx;
+        CurrentNumaNode = master->mWorkerNumaNodes[worker_idx];
+        if (!master->mWorkerAffinities[worker_idx].empty())
+        {
+            SetCurrentThreadAffinity(master->mWorkerAffinities[worker_idx]);
+        }
         while (master->mAlive)
         {
-            if (master->mTasks.empty())
+            Task *task = master->GetTask();
+            for (size_t i = 0; task == nullptr && i < THREAD_POOL_SPIN_COUNT; i++)
             {
-                // 解决工作线程空转问题, 防止与BVH构建线程竞争
-                std::this_thread::sleep_for(std::chrono::milliseconds(2));
-                continue;
+                // 短暂自旋: 连续的ParallelFor之间间隔很短, 避免刚阻塞就被唤醒的系统调用开销
+                CpuRelax();
+                task = master->GetTask();
             }
-            Task *task = master->GetTask();
             if (task != nullptr)
             {
-                task->Run();
-                delete task;
-                master->mPendingTaskCount--;
+                master->RunTask(task);
+                continue;
             }
-            else
+
+            // 阻塞直到有新任务或线程池析构, 不与BVH构建线程竞争CPU
+            uint32_t key = master->mWorkEvent.PrepareWait();
+            if (!master->mAlive || master->HasTask())
             {
-                std::this_thread::yield(); // 让出操作权给os, 让os选择就绪线程执行
+                master->mWorkEvent.CancelWait();
+                continue;
             }
+            master->mWorkEvent.Wait(key);
         }
     }
 
-    ThreadPool::ThreadPool(size_t thread_count)
+    ThreadPool::ThreadPool(size_t thread_count) : ThreadPool(ThreadPoolSettings{.__threadCount__ = thread_count})
+    {
+    }
+
+    ThreadPool::ThreadPool(const ThreadPoolSettings &settings)
     {
-        mAlive = 1;
         mPendingTaskCount = 0;
-        if (thread_count == 0)
+        Start(settings);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        Stop();
+    }
+
+    void ThreadPool::Configure(const ThreadPoolSettings &settings)
+    {
+        Stop();
+        Start(settings);
+        PBRT_INFO("ThreadPool - Threads: {}, NUMA Partitions: {}, SMT: {}, Pinned: {}", mThreads.size(), mNumaNodeCPUs.size(), settings.__useSMT__, settings.__pinThreads__);
+    }
+
+    void ThreadPool::Start(const ThreadPoolSettings &settings)
+    {
+        // 按配置筛选CPU; 筛选后为空(如指定的CPU都不可用)时退回全部CPU
+        auto topology = QueryCPUTopology();
+        std::vector<uint32_t> allowed_ids = settings.__cpus__; // 调用者传入的列表不要求有序
+        std::sort(allowed_ids.begin(), allowed_ids.end());
+        allowed_ids.erase(std::unique(allowed_ids.begin(), allowed_ids.end()), allowed_ids.end());
+        std::vector<LogicalCPU> cpus;
+        for (const auto &cpu : topology)
+        {
+            bool is_allowed = allowed_ids.empty() || std::binary_search(allowed_ids.begin(), allowed_ids.end(), cpu.__id__);
+            if (is_allowed && (settings.__useSMT__ || cpu.__isPrimaryThread__))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        bool is_restricted = !cpus.empty() && cpus.size() != topology.size();
+        if (cpus.empty())
+        {
+            cpus = topology;
+        }
+        // 同一分区内先使用各物理核的第一个硬件线程, 线程数少于CPU数时不会两个线程挤在同一物理核上
+        std::stable_sort(cpus.begin(), cpus.end(), [&](const LogicalCPU &a, const LogicalCPU &b)
+                         {
+                             uint32_t node_a = settings.__numaAware__ ? a.__numaNode__ : 0;
+                             uint32_t node_b = settings.__numaAware__ ? b.__numaNode__ : 0;
+                             if (node_a != node_b)
+                             {
+                                 return node_a < node_b;
+                             }
+                             return a.__isPrimaryThread__ && !b.__isPrimaryThread__;
+                             // end
+                         });
+
+        mNumaNodeCPUs.clear();
+        for (const auto &cpu : cpus)
         {
-            // 赋值线程数为CPU线程数
-            thread_count = std::thread::hardware_concurrency();
+            size_t node = settings.__numaAware__ ? cpu.__numaNode__ : 0;
+            if (node >= mNumaNodeCPUs.size())
+            {
+                mNumaNodeCPUs.resize(node + 1);
+            }
+            mNumaNodeCPUs[node].push_back(cpu.__id__);
         }
+        std::erase_if(mNumaNodeCPUs, [](const std::vector<uint32_t> &node_cpus)
+                      { return node_cpus.empty(); });
 
+        size_t thread_count = settings.__threadCount__ != 0 ? settings.__threadCount__ : cpus.size();
+        mWorkerAffinities.assign(thread_count, {});
+        mWorkerNumaNodes.assign(thread_count, 0);
+        mNumaNodeWorkers.assign(mNumaNodeCPUs.size(), {});
+        for (size_t i = 0; i < thread_count; i++)
+        {
+            // 按CPU数比例分配: 选择已分配线程数与CPU数之比最小的分区
+            size_t node = 0;
+            for (size_t k = 1; k < mNumaNodeCPUs.size(); k++)
+            {
+                if (mNumaNodeWorkers[k].size() * mNumaNodeCPUs[node].size() < mNumaNodeWorkers[node].size() * mNumaNodeCPUs[k].size())
+                {
+                    node = k;
+                }
+            }
+            const auto &node_cpus = mNumaNodeCPUs[node];
+            if (settings.__pinThreads__)
+            {
+                mWorkerAffinities[i] = {node_cpus[mNumaNodeWorkers[node].size() % node_cpus.size()]};
+            }
+            else if (settings.__numaAware__ || is_restricted)
+            {
+                mWorkerAffinities[i] = node_cpus;
+            }
+            mWorkerNumaNodes[i] = static_cast<uint32_t>(node);
+            mNumaNodeWorkers[node].push_back(i);
+        }
+
+        // 队列在线程启动前全部创建, 之后只读
+        mAlive = 1;
+        mExternalQueueIdx = thread_count;
+        for (size_t i = 0; i <= thread_count; i++)
+        {
+            mQueues.push_back(std::make_unique<WorkStealingDeque<Task *>>());
+        }
         for (size_t i = 0; i < thread_count; i++)
         {
             // 添加工作线程
-            mThreads.push_back(std::thread(ThreadPool::WorkerThread, this));
+            mThreads.push_back(std::thread(ThreadPool::WorkerThread, this, i));
         }
     }
 
-    ThreadPool::~ThreadPool()
+    void ThreadPool::Stop()
     {
         Wait();
         mAlive = 0;
+        mWorkEvent.NotifyAll();
         // 等待所有线程执行完毕后清空线程池
         for (auto &thread : mThreads)
         {
             thread.join();
         }
         mThreads.clear();
+        mQueues.clear();
+    }
+
+    size_t ThreadPool::GetCurrentNumaNode()
+    {
+        return CurrentNumaNode;
     }
 
     struct ParallelTask : public Task // 任务块
@@ -113,7 +291,12 @@ namespace pbrt
     */
     void ThreadPool::ParallelFor(size_t width, size_t height, const std::function<void(size_t, size_t)> &lambda, bool is_complex)
     {
-        Guard guard(mLock);
+        size_t queue_idx = GetQueueIndex();
+        std::optional<Guard> guard;
+        if (queue_idx == mExternalQueueIdx)
+        {
+            guard.emplace(mExternalLock);
+        }
 
         // 将大量任务分块, 减少new Task的次数
         float chunk_width_float = static_cast<float>(width) / std::sqrt(mThreads.size());
@@ -127,7 +310,8 @@ namespace pbrt
         size_t chunk_width = std::ceil(chunk_width_float);
         size_t chunk_height = std::ceil(chunk_height_float);
 
-        // 添加所有任务块, 列优先遍历提高cache命中率
+        // 添加所有任务块, 列优先遍历提高cache命中率; 窃取从队列顶部按添加顺序进行
+        size_t task_count = 0;
         for (size_t x = 0; x < width; x += chunk_width)
         {
             size_t W = ((x + chunk_width) > width) ? (width - x) : chunk_width;
@@ -135,35 +319,237 @@ namespace pbrt
             {
                 mPendingTaskCount++;
                 size_t H = ((y + chunk_height) > height) ? (height - y) : chunk_height;
-                mTasks.push(new ParallelTask(x, y, W, H, lambda));
+                mQueues[queue_idx]->Push(new ParallelTask(x, y, W, H, lambda));
+                task_count++;
             }
         }
+
+        // 唤醒阻塞的工作线程, 只有一个任务块时唤醒一个即可
+        if (task_count == 1)
+        {
+            mWorkEvent.NotifyOne();
+        }
+        else if (task_count > 1)
+        {
+            mWorkEvent.NotifyAll();
+        }
     }
 
-    void ThreadPool::Wait() const
+    void ThreadPool::Wait()
     {
-        while (mPendingTaskCount > 0)
+        // 调用线程参与执行任务, 而不是空等工作线程
+        size_t spin_count = 0;
+        while (true)
         {
-            std::this_thread::yield();
+            int pending_task_count = mPendingTaskCount.load();
+            if (pending_task_count <= 0)
+            {
+                return;
+            }
+
+            Task *task = GetTask();
+            if (task != nullptr)
+            {
+                RunTask(task);
+                spin_count = 0;
+            }
+            else if (spin_count < THREAD_POOL_SPIN_COUNT)
+            {
+                CpuRelax();
+                spin_count++;
+            }
+            else
+            {
+                // 剩余任务都在其他线程上执行, 阻塞到计数变化(最后一个任务完成时通知)
+                mPendingTaskCount.wait(pending_task_count);
+            }
         }
     }
 
     void ThreadPool::AddTask(Task *task)
     {
-        Guard guard(mLock);
+        size_t queue_idx = GetQueueIndex();
         mPendingTaskCount++;
-        mTasks.push(task);
+        if (queue_idx == mExternalQueueIdx)
+        {
+            Guard guard(mExternalLock);
+            mQueues[queue_idx]->Push(task);
+        }
+        else
+        {
+            mQueues[queue_idx]->Push(task);
+        }
+        mWorkEvent.NotifyOne();
     }
 
     Task *ThreadPool::GetTask()
     {
-        Guard guard(mLock);
-        if (mTasks.empty())
+        size_t queue_idx = GetQueueIndex();
+        Task *task = nullptr;
+        if (queue_idx == mExternalQueueIdx)
+        {
+            Guard guard(mExternalLock);
+            task = mQueues[queue_idx]->Pop();
+        }
+        else
         {
-            return nullptr;
+            task = mQueues[queue_idx]->Pop();
+        }
+        return task != nullptr ? task : StealTask(queue_idx);
+    }
+
+    size_t ThreadPool::GetQueueIndex() const
+    {
+        return CurrentPool == this ? CurrentWorkerIndex : mExternalQueueIdx;
+    }
+
+    Task *ThreadPool::StealTask(size_t queue_idx)
+    {
+        // 多个NUMA分区时先在本分区内窃取, 任务数据更可能在本节点的内存与缓存中
+        if (mNumaNodeWorkers.size() > 1 && queue_idx != mExternalQueueIdx)
+        {
+            const auto &node_workers = mNumaNodeWorkers[mWorkerNumaNodes[queue_idx]];
+            size_t node_start = NextStealRandom() % node_workers.size();
+            for (size_t i = 0; i < node_workers.size(); i++)
+            {
+                size_t victim_idx = node_workers[(node_start + i) % node_workers.size()];
+                if (victim_idx == queue_idx)
+                {
+                    continue;
+                }
+                if (Task *task = mQueues[victim_idx]->Steal())
+                {
+                    return task;
+                }
+            }
+        }
+
+        size_t queue_count = mQueues.size();
+        size_t start = NextStealRandom() % queue_count;
+        for (size_t i = 0; i < queue_count; i++)
+        {
+            size_t victim_idx = (start + i) % queue_count;
+            if (victim_idx == queue_idx)
+            {
+                continue;
+            }
+            if (Task *task = mQueues[victim_idx]->Steal())
+            {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    bool ThreadPool::HasTask() const
+    {
+        for (const auto &queue : mQueues)
+        {
+            if (!queue->Empty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::RunTask(Task *task)
+    {
+        bool is_owned_by_pool = task->IsOwnedByPool(); // Run返回后task可能已被提交者销毁
+        task->Run();
+        if (is_owned_by_pool)
+        {
+            delete task;
+        }
+        if (mPendingTaskCount.fetch_sub(1) == 1)
+        {
+            mPendingTaskCount.notify_all(); // 唤醒阻塞在Wait中的线程
+        }
+    }
+
+    void ParallelForTask::RunChunks()
+    {
+        size_t chunk_idx;
+        while ((chunk_idx = __nextChunk__.fetch_add(1, std::memory_order_relaxed)) < __chunkCount__)
+        {
+            __runChunk__(__body__, chunk_idx);
+        }
+    }
+
+    void ParallelForTask::Run()
+    {
+        RunChunks();
+        // 计数归零后调用者可能立即返回并销毁task, 之后只能访问线程池的事件
+        EventCount *done_event = __doneEvent__;
+        if (__referenceCount__.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            done_event->NotifyAll();
+        }
+    }
+
+    void ThreadPool::RunParallelFor(ParallelForTask &task)
+    {
+        // 调用线程自己也执行, 副本数不超过剩余块数
+        size_t copy_count = std::min(task.__chunkCount__ - 1, mThreads.size());
+        task.__referenceCount__.store(copy_count, std::memory_order_relaxed);
+        task.__doneEvent__ = &mJoinEvent;
+        if (copy_count > 0)
+        {
+            size_t queue_idx = GetQueueIndex();
+            mPendingTaskCount += static_cast<int>(copy_count);
+            {
+                std::optional<Guard> guard;
+                if (queue_idx == mExternalQueueIdx)
+                {
+                    guard.emplace(mExternalLock);
+                }
+                for (size_t i = 0; i < copy_count; i++)
+                {
+                    mQueues[queue_idx]->Push(&task);
+                }
+            }
+            if (copy_count == 1)
+            {
+                mWorkEvent.NotifyOne();
+            }
+            else
+            {
+                mWorkEvent.NotifyAll();
+            }
+        }
+
+        task.RunChunks();
+
+        // 块已全部领取, 等待其他线程上的副本返回; 留在队列中的副本优先被自己取出, 它们会立即返回
+        Join(task.__referenceCount__);
+    }
+
+    void ThreadPool::Join(const std::atomic<size_t> &pending_count)
+    {
+        size_t spin_count = 0;
+        while (pending_count.load(std::memory_order_acquire) > 0)
+        {
+            Task *task = GetTask();
+            if (task != nullptr)
+            {
+                RunTask(task);
+                spin_count = 0;
+            }
+            else if (spin_count < THREAD_POOL_SPIN_COUNT)
+            {
+                CpuRelax();
+                spin_count++;
+            }
+            else
+            {
+                uint32_t key = mJoinEvent.PrepareWait();
+                if (pending_count.load(std::memory_order_acquire) == 0)
+                {
+                    mJoinEvent.CancelWait();
+                    break;
+                }
+                mJoinEvent.Wait(key);
+            }
         }
-        Task *task = mTasks.front();
-        mTasks.pop();
-        return task;
     }
 }
\ No newline at end of file
@@ -1,9 +1,15 @@
 ﻿#pragma once
 #include "spinLock.hpp"
+#include "eventCount.hpp"
+#include "cpuTopology.hpp"
+#include "workStealingDeque.hpp"
 #include <vector>
 #include <thread>
-#include <queue>
+#include <memory>
+#include <span>
 #include <functional>
+#include <algorithm>
+#include <cmath>
 
 namespace pbrt
 {
@@ -12,31 +18,179 @@ namespace pbrt
     public:
         virtual ~Task() = default; // 虚析构函数, 确保派生类正确析构
         virtual void Run() = 0;
+        virtual bool IsOwnedByPool() const { return true; } // 为true时线程池执行后delete; 否则由提交者管理生命周期, Run返回后线程池不再访问它
     };
 
     /*
-        主线程 → 添加任务 → 工作线程获取 → 执行任务 → 完成通知
+        线程池配置, MasterThreadPool在启动时从环境变量读取, 之后可用ThreadPool::Configure修改
+        PBRT_THREADS=16           线程数, 0或未设置时等于可用的逻辑CPU数
+        PBRT_CPUS=0-15,32-47      允许使用的逻辑CPU
+        PBRT_SMT=0                每个物理核只使用一个硬件线程
+        PBRT_PIN=1                每个工作线程绑定到一个逻辑CPU
+        PBRT_NUMA=1               每个NUMA节点一个分区: 工作线程按CPU数比例分到各节点并绑定在节点内, 窃取优先在节点内进行
+    */
+    struct ThreadPoolSettings
+    {
+    public:
+        size_t __threadCount__ = 0;
+        std::vector<uint32_t> __cpus__{}; // 为空时使用进程可用的全部CPU, 顺序任意
+        bool __useSMT__ = true;
+        bool __pinThreads__ = false;
+        bool __numaAware__ = false;
+
+    public:
+        static ThreadPoolSettings FromEnvironment();
+    };
+
+    constexpr size_t THREAD_POOL_SPIN_COUNT = 64;          // 没有任务时阻塞前的自旋次数, 每次自旋尝试取出或窃取一次任务
+    constexpr size_t THREAD_POOL_CHUNK_COUNT_PER_THREAD = 8; // 模板ParallelFor每个线程平均分到的块数, 块由原子计数器动态领取
+
+    /*
+        模板ParallelFor的共享任务, 分配在调用者的栈上, 同一个指针被多次放入队列
+        每个副本执行时从原子计数器领取块直到领完, 最后一个副本返回时通知调用者
+    */
+    struct ParallelForTask : public Task
+    {
+    public:
+        void (*__runChunk__)(const void *body, size_t chunk_idx);
+        const void *__body__;
+        size_t __chunkCount__;
+        std::atomic<size_t> __nextChunk__{0};
+        std::atomic<size_t> __referenceCount__{0}; // 仍在队列中或正在执行的副本数
+        EventCount *__doneEvent__ = nullptr;
+
+    public:
+        template <typename C>
+        ParallelForTask(const C &run_chunk, size_t chunk_count)
+            : __runChunk__([](const void *body, size_t chunk_idx)
+                           { (*static_cast<const C *>(body))(chunk_idx); }),
+              __body__(&run_chunk), __chunkCount__(chunk_count) {}
+
+        void RunChunks();
+        void Run() override;
+        bool IsOwnedByPool() const override { return false; }
+    };
+
+    /*
+        工作窃取线程池: 每个工作线程拥有一个Chase-Lev双端队列, 外部线程(如主线程)共用最后一个队列
+        添加任务 → 放入调用线程的队列底部 → 所有者从底部取出, 空闲线程从随机的其他队列顶部窃取 → 执行任务 → 完成通知
+        外部线程在Wait中同样取出与窃取任务, 参与执行而不是空等; Wait等待所有任务完成, 不能在任务内部调用
+        空闲的工作线程短暂自旋后阻塞在事件计数上, 添加任务时立即唤醒; Wait在没有可窃取的任务时同样阻塞到最后一个任务完成
     */
     class ThreadPool
     {
     private:
-        std::vector<std::thread> mThreads;  // 线程池, 存储所有工作线程
-        std::queue<Task *> mTasks;          // 任务队列
-        SpinLock mLock{};                   // 线程同步
-        std::atomic<int> mAlive;            // 线程池存活标志
-        std::atomic<int> mPendingTaskCount; // 待处理任务计数
+        std::vector<std::thread> mThreads;                               // 线程池, 存储所有工作线程
+        std::vector<std::unique_ptr<WorkStealingDeque<Task *>>> mQueues; // [0, 线程数)为工作线程的队列, 最后一个由外部线程共用
+        size_t mExternalQueueIdx;                                        // 外部线程共用的队列, 在启动工作线程前确定
+        SpinLock mExternalLock{};                                        // 外部线程可能有多个, 串行化它们在共用队列底部的操作
+        std::atomic<int> mAlive;                                         // 线程池存活标志
+        std::atomic<int> mPendingTaskCount;                              // 待处理任务计数, 归零时通知Wait
+        EventCount mWorkEvent{};                                         // 空闲工作线程在此阻塞, 添加任务或析构时通知
+        EventCount mJoinEvent{};                                         // 等待一组任务(模板ParallelFor的副本, TaskGroup)的线程在此阻塞
+        std::vector<std::vector<uint32_t>> mWorkerAffinities;            // 每个工作线程绑定的逻辑CPU, 为空时不绑定
+        std::vector<uint32_t> mWorkerNumaNodes;                          // 每个工作线程所在的NUMA分区
+        std::vector<std::vector<size_t>> mNumaNodeWorkers;               // 每个NUMA分区内工作线程的队列下标
+        std::vector<std::vector<uint32_t>> mNumaNodeCPUs;                // 每个NUMA分区使用的逻辑CPU, 未开启NUMA分区时只有一个
+
+    private:
+        void Start(const ThreadPoolSettings &settings);
+        void Stop();
+        size_t GetQueueIndex() const; // 调用线程的队列
+        Task *StealTask(size_t queue_idx);
+        bool HasTask() const; // 任一队列非空, 工作线程阻塞前复查
+        void RunTask(Task *task);
+        void RunParallelFor(ParallelForTask &task); // 放入副本并参与执行, 所有块完成且副本全部返回后才返回
+        void Join(const std::atomic<size_t> &pending_count); // 执行队列中的任务直到计数归零, 没有任务可执行时阻塞在mJoinEvent上
+
+        friend class TaskGroup;
 
     public:
-        static void WorkerThread(ThreadPool *master);
+        static void WorkerThread(ThreadPool *master, size_t worker_idx);
 
         ThreadPool(size_t thread_count = 0);
+        explicit ThreadPool(const ThreadPoolSettings &settings);
         ~ThreadPool();
 
+        /*
+            按新配置重启工作线程, 应在程序启动后、提交任何任务之前调用
+            调用时不能有未完成的任务(包括异步ParallelFor之后尚未Wait的任务), 也不能有其他线程在使用线程池, 否则排队的任务会随旧线程一起丢失
+            之前按旧分区复制的NumaReplicated副本不会随之更新, 需要重新复制
+        */
+        void Configure(const ThreadPoolSettings &settings);
+        size_t GetNumaNodeCount() const { return mNumaNodeCPUs.size(); }
+        std::span<const uint32_t> GetNumaNodeCPUs(size_t node) const { return mNumaNodeCPUs[node]; }
+        static size_t GetCurrentNumaNode(); // 调用线程所在的NUMA分区, 外部线程为0
+
+        // 异步版本: 每块复制一次lambda并new一个任务, 需要之后调用Wait; 适合在任务内部递归拆分(如SceneBVH的构建)
         void ParallelFor(size_t width, size_t height, const std::function<void(size_t, size_t)> &lambda, bool is_complex = true);
-        void Wait() const;
+        void Wait();
+
+        /*
+            同步版本: 按引用持有func, 不复制也不分配内存, 返回时所有func(i)都已执行完毕, 不需要Wait
+            块内的循环在模板中展开, func可被内联; 调用线程同时参与执行, 可以在任务内部嵌套调用
+        */
+        template <typename F>
+        void ParallelFor(size_t count, const F &func)
+        {
+            if (count == 0)
+            {
+                return;
+            }
+            size_t chunk_count = std::min(count, (GetThreadCount() + 1) * THREAD_POOL_CHUNK_COUNT_PER_THREAD);
+            size_t chunk_size = (count + chunk_count - 1) / chunk_count;
+            chunk_count = (count + chunk_size - 1) / chunk_size;
+
+            auto run_chunk = [&](size_t chunk_idx)
+            {
+                size_t begin = chunk_idx * chunk_size;
+                size_t end = std::min(begin + chunk_size, count);
+                for (size_t i = begin; i < end; i++)
+                {
+                    func(i);
+                }
+                // end
+            };
+            ParallelForTask task(run_chunk, chunk_count);
+            RunParallelFor(task);
+        }
+
+        // 同步二维版本, 按接近正方形的块划分, 块内逐行调用func(x, y)
+        template <typename F>
+        void ParallelFor2D(size_t width, size_t height, const F &func)
+        {
+            if (width == 0 || height == 0)
+            {
+                return;
+            }
+            float chunk_count_sqrt = std::sqrt(static_cast<float>((GetThreadCount() + 1) * THREAD_POOL_CHUNK_COUNT_PER_THREAD));
+            size_t chunk_width = static_cast<size_t>(std::ceil(static_cast<float>(width) / chunk_count_sqrt));
+            size_t chunk_height = static_cast<size_t>(std::ceil(static_cast<float>(height) / chunk_count_sqrt));
+            size_t chunk_count_x = (width + chunk_width - 1) / chunk_width;
+            size_t chunk_count_y = (height + chunk_height - 1) / chunk_height;
+
+            auto run_chunk = [&](size_t chunk_idx)
+            {
+                size_t x_begin = (chunk_idx % chunk_count_x) * chunk_width;
+                size_t y_begin = (chunk_idx / chunk_count_x) * chunk_height;
+                size_t x_end = std::min(x_begin + chunk_width, width);
+                size_t y_end = std::min(y_begin + chunk_height, height);
+                for (size_t y = y_begin; y < y_end; y++)
+                {
+                    for (size_t x = x_begin; x < x_end; x++)
+                    {
+                        func(x, y);
+                    }
+                }
+                // end
+            };
+            ParallelForTask task(run_chunk, chunk_count_x * chunk_count_y);
+            RunParallelFor(task);
+        }
+        size_t GetThreadCount() const { return mThreads.size(); }
 
         void AddTask(Task *task);
-        Task *GetTask();
+        Task *GetTask(); // 先取调用线程自己的队列, 再从其他队列窃取, 没有任务时返回nullptr
     };
 
     extern ThreadPool MasterThreadPool;
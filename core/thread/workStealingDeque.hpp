@@ -0,0 +1,128 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace pbrt
+{
+    /*
+        Chase-Lev工作窃取双端队列(按Lê等人2013年的C11内存序版本实现)
+        所有者线程在底部Push/Pop(后进先出, 刚拆分出的任务数据仍在缓存中), 其他线程在顶部Steal(先进先出, 窃取较早较大的任务)
+        三个操作都无锁, 只有队列中剩最后一个元素时Pop与Steal通过CAS竞争
+        Push/Pop必须由同一线程(或在同一把锁下)调用; 队列满时容量翻倍, 旧数组可能仍被窃取者读取, 保留到析构时释放
+    */
+    template <typename T>
+    class WorkStealingDeque
+    {
+    private:
+        struct Array
+        {
+        public:
+            int64_t __capacity__;
+            std::unique_ptr<std::atomic<T>[]> __items__;
+
+        public:
+            explicit Array(int64_t capacity) : __capacity__(capacity), __items__(new std::atomic<T>[capacity]) {}
+
+            // 元素本身用acquire/release发布, 在x86上与relaxed等价, 也让ThreadSanitizer能识别Task的同步关系
+            T Get(int64_t i) const { return __items__[i & (__capacity__ - 1)].load(std::memory_order_acquire); }
+            void Put(int64_t i, T item) { __items__[i & (__capacity__ - 1)].store(item, std::memory_order_release); }
+        };
+
+        alignas(64) std::atomic<int64_t> mTop{0};    // 窃取端, 多个线程竞争
+        alignas(64) std::atomic<int64_t> mBottom{0}; // 所有者端
+        std::atomic<Array *> mArray;
+        std::vector<std::unique_ptr<Array>> mArrays; // 当前数组与扩容前的旧数组, 只由所有者修改
+
+    public:
+        explicit WorkStealingDeque(int64_t capacity = 1024)
+        {
+            mArrays.push_back(std::make_unique<Array>(capacity)); // capacity必须为2的幂
+            mArray.store(mArrays.back().get(), std::memory_order_relaxed);
+        }
+
+        WorkStealingDeque(const WorkStealingDeque &) = delete;
+        WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+        void Push(T item)
+        {
+            int64_t bottom = mBottom.load(std::memory_order_relaxed);
+            int64_t top = mTop.load(std::memory_order_acquire);
+            Array *array = mArray.load(std::memory_order_relaxed);
+            if (bottom - top > array->__capacity__ - 1)
+            {
+                array = Grow(array, bottom, top);
+            }
+            array->Put(bottom, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        // 队列为空或最后一个元素被窃取时返回T{}
+        T Pop()
+        {
+            int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+            Array *array = mArray.load(std::memory_order_relaxed);
+            mBottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = mTop.load(std::memory_order_relaxed);
+            if (top > bottom)
+            {
+                mBottom.store(bottom + 1, std::memory_order_relaxed);
+                return T{};
+            }
+
+            T item = array->Get(bottom);
+            if (top == bottom)
+            {
+                // 最后一个元素, 与窃取者竞争
+                if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    item = T{};
+                }
+                mBottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // 队列为空或与其他线程竞争失败时返回T{}
+        T Steal()
+        {
+            int64_t top = mTop.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = mBottom.load(std::memory_order_acquire);
+            if (top >= bottom)
+            {
+                return T{};
+            }
+
+            Array *array = mArray.load(std::memory_order_acquire);
+            T item = array->Get(top);
+            if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return T{};
+            }
+            return item;
+        }
+
+        bool Empty() const
+        {
+            return mBottom.load(std::memory_order_relaxed) <= mTop.load(std::memory_order_relaxed);
+        }
+
+    private:
+        Array *Grow(Array *array, int64_t bottom, int64_t top)
+        {
+            auto grown = std::make_unique<Array>(array->__capacity__ * 2);
+            for (int64_t i = top; i < bottom; i++)
+            {
+                grown->Put(i, array->Get(i));
+            }
+            Array *result = grown.get();
+            mArrays.push_back(std::move(grown));
+            mArray.store(result, std::memory_order_release);
+            return result;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+namespace pbrt
+{
+    /*
+        64位非加密内容哈希(xxHash64算法), 用于缓存键, 每次处理32字节, 大文件哈希耗时远小于解析
+        结果只依赖输入字节与种子, 不同进程与不同次运行之间稳定
+    */
+    class Hash64
+    {
+    private:
+        static constexpr uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+        static constexpr uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+        static constexpr uint64_t PRIME3 = 0x165667b19e3779f9ull;
+        static constexpr uint64_t PRIME4 = 0x85ebca77c2b2ae63ull;
+        static constexpr uint64_t PRIME5 = 0x27d4eb2f165667c5ull;
+
+    private:
+        static inline uint64_t RotateLeft(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+        static inline uint64_t Read64(const uint8_t *p)
+        {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static inline uint32_t Read32(const uint8_t *p)
+        {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static inline uint64_t Round(uint64_t acc, uint64_t input)
+        {
+            acc += input * PRIME2;
+            return RotateLeft(acc, 31) * PRIME1;
+        }
+
+        static inline uint64_t MergeRound(uint64_t acc, uint64_t v)
+        {
+            acc ^= Round(0, v);
+            return acc * PRIME1 + PRIME4;
+        }
+
+    public:
+        static uint64_t Compute(const void *data, size_t size, uint64_t seed = 0)
+        {
+            const uint8_t *p = static_cast<const uint8_t *>(data);
+            const uint8_t *end = p + size;
+            uint64_t h;
+            if (size >= 32)
+            {
+                // 4条独立的累加链, 流水线可以并行执行
+                uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+                const uint8_t *limit = end - 32;
+                do
+                {
+                    v1 = Round(v1, Read64(p));
+                    v2 = Round(v2, Read64(p + 8));
+                    v3 = Round(v3, Read64(p + 16));
+                    v4 = Round(v4, Read64(p + 24));
+                    p += 32;
+                } while (p <= limit);
+                h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+                h = MergeRound(h, v1);
+                h = MergeRound(h, v2);
+                h = MergeRound(h, v3);
+                h = MergeRound(h, v4);
+            }
+            else
+            {
+                h = seed + PRIME5;
+            }
+            h += static_cast<uint64_t>(size);
+
+            // 不足32字节的尾部
+            for (; p + 8 <= end; p += 8)
+            {
+                h ^= Round(0, Read64(p));
+                h = RotateLeft(h, 27) * PRIME1 + PRIME4;
+            }
+            if (p + 4 <= end)
+            {
+                h ^= static_cast<uint64_t>(Read32(p)) * PRIME1;
+                h = RotateLeft(h, 23) * PRIME2 + PRIME3;
+                p += 4;
+            }
+            for (; p < end; p++)
+            {
+                h ^= (*p) * PRIME5;
+                h = RotateLeft(h, 11) * PRIME1;
+            }
+
+            // 雪崩混合
+            h ^= h >> 33;
+            h *= PRIME2;
+            h ^= h >> 29;
+            h *= PRIME3;
+            h ^= h >> 32;
+            return h;
+        }
+
+        // 对平凡类型的值求哈希并与已有哈希组合
+        template <typename T>
+        static uint64_t Combine(uint64_t hash, const T &value)
+        {
+            return Compute(&value, sizeof(T), hash);
+        }
+    };
+}
\ No newline at end of file
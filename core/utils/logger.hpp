@@ -21,4 +21,7 @@ namespace pbrt
 #define PBRT_INFO(...) ::pbrt::Logger::GetCoreLogger()->info(__VA_ARGS__)
 #define PBRT_WARN(...) ::pbrt::Logger::GetCoreLogger()->warn(__VA_ARGS__)
 #define PBRT_ERROR(...) ::pbrt::Logger::GetCoreLogger()->error(__VA_ARGS__)
-#define PBRT_CRITICAL(...) ::pbrt::Logger::GetCoreLogger()->critical(__VA_ARGS__)
\ No newline at end of file
+#define PBRT_CRITICAL(...) ::pbrt::Logger::GetCoreLogger()->critical(__VA_ARGS__)
+
+// 只为调试日志做的额外计算(统计, 探测)需要先检查调试级别, 日志宏的参数总会被求值
+#define PBRT_DEBUG_ENABLED() (::pbrt::Logger::GetCoreLogger()->should_log(spdlog::level::debug))
\ No newline at end of file
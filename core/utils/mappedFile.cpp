@@ -0,0 +1,87 @@
+﻿#include "mappedFile.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pbrt
+{
+    std::shared_ptr<MappedFile> MappedFile::Open(const std::filesystem::path &path)
+    {
+        auto file = std::make_shared<MappedFile>();
+#ifdef _WIN32
+        HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+        file->mFile = handle;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+        {
+            return nullptr;
+        }
+        file->mMapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (file->mMapping == nullptr)
+        {
+            return nullptr;
+        }
+        void *data = MapViewOfFile(file->mMapping, FILE_MAP_READ, 0, 0, 0);
+        if (data == nullptr)
+        {
+            return nullptr;
+        }
+        file->mData = static_cast<const std::byte *>(data);
+        file->mSize = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+        // 映射建立后即可关闭文件描述符, 映射本身保持文件引用
+        void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        file->mData = static_cast<const std::byte *>(data);
+        file->mSize = static_cast<size_t>(st.st_size);
+#endif
+        return file;
+    }
+
+    MappedFile::~MappedFile()
+    {
+#ifdef _WIN32
+        if (mData != nullptr)
+        {
+            UnmapViewOfFile(mData);
+        }
+        if (mMapping != nullptr)
+        {
+            CloseHandle(mMapping);
+        }
+        if (mFile != nullptr)
+        {
+            CloseHandle(mFile);
+        }
+#else
+        if (mData != nullptr)
+        {
+            munmap(const_cast<std::byte *>(mData), mSize);
+        }
+#endif
+    }
+}
\ No newline at end of file
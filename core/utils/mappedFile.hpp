@@ -0,0 +1,97 @@
+﻿#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace pbrt
+{
+    /*
+        只读内存映射文件
+        以共享方式映射, 同一主机上映射同一文件的多个进程共用相同的物理页
+    */
+    class MappedFile
+    {
+    private:
+        const std::byte *mData = nullptr;
+        size_t mSize = 0;
+#ifdef _WIN32
+        void *mFile = nullptr;    // 文件句柄
+        void *mMapping = nullptr; // 映射对象句柄
+#endif
+
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile();
+
+        static std::shared_ptr<MappedFile> Open(const std::filesystem::path &path); // 失败返回nullptr
+
+        const std::byte *GetData() const { return mData; }
+        size_t GetSize() const { return mSize; }
+    };
+
+    /*
+        自有或映射的只读数组
+        构建时持有std::vector, 从缓存加载时直接指向映射内存, 不拷贝; 映射内存的生命周期由使用者保证
+    */
+    template <typename T>
+    class MappedArray
+    {
+    private:
+        std::vector<T> mOwned;
+        std::span<const T> mView;
+
+    public:
+        MappedArray() = default;
+        MappedArray(const MappedArray &other) { *this = other; }
+        MappedArray(MappedArray &&other) noexcept = default; // vector移动后缓冲区地址不变, 视图仍然有效
+
+        MappedArray &operator=(const MappedArray &other)
+        {
+            if (this != &other)
+            {
+                mOwned = other.mOwned;
+                mView = other.IsOwned() ? std::span<const T>(mOwned) : other.mView;
+            }
+            return *this;
+        }
+        MappedArray &operator=(MappedArray &&other) noexcept = default;
+
+        void Assign(std::vector<T> &&values)
+        {
+            mOwned = std::move(values);
+            mView = mOwned;
+        }
+
+        void Attach(std::span<const T> view)
+        {
+            mOwned.clear();
+            mOwned.shrink_to_fit();
+            mView = view;
+        }
+
+        bool IsOwned() const { return mView.data() == mOwned.data(); }
+
+        // 返回可原地修改的自有数组, 当前为映射视图时先拷贝(写时复制); 修改长度后需重新Assign
+        std::vector<T> &Own()
+        {
+            if (!IsOwned())
+            {
+                mOwned.assign(mView.begin(), mView.end());
+                mView = mOwned;
+            }
+            return mOwned;
+        }
+
+        const T &operator[](size_t i) const { return mView[i]; }
+        const T *data() const { return mView.data(); }
+        size_t size() const { return mView.size(); }
+        bool empty() const { return mView.empty(); }
+        auto begin() const { return mView.begin(); }
+        auto end() const { return mView.end(); }
+        std::span<const T> Span() const { return mView; }
+    };
+}
\ No newline at end of file
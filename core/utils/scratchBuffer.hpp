@@ -0,0 +1,126 @@
+﻿#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <span>
+#include <type_traits>
+
+namespace pbrt
+{
+    /*
+        线程私有的临时数组, 用于批量求交等热路径中每次调用都需要的缓冲, 容量在线程内跨调用保留, 稳定后不再分配内存
+        每个线程按嵌套深度持有一组存储: 实例结构的批量求交会递归进入子物体的批量求交, 内层获取的是更深一层的存储, 不会覆盖外层的数据
+        必须作为局部变量使用, 按后进先出的顺序释放; 元素需可平凡拷贝, Resize新增的元素值未定义
+    */
+    template <typename T>
+    class ScratchBuffer
+    {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>);
+
+    private:
+        struct Storage
+        {
+        public:
+            std::unique_ptr<T[]> __data__;
+            size_t __capacity__ = 0;
+        };
+
+        struct Pool
+        {
+        public:
+            std::deque<Storage> __storages__; // deque在末尾追加时不移动已有元素, 外层持有的指针保持有效
+            size_t __depth__ = 0;
+        };
+
+        static Pool &GetPool()
+        {
+            thread_local Pool pool;
+            return pool;
+        }
+
+    private:
+        Storage *mStorage;
+        size_t mDepth;
+        size_t mSize = 0;
+
+    public:
+        explicit ScratchBuffer(size_t size = 0)
+        {
+            auto &pool = GetPool();
+            if (pool.__depth__ == pool.__storages__.size())
+            {
+                pool.__storages__.emplace_back();
+            }
+            mDepth = pool.__depth__++;
+            mStorage = &pool.__storages__[mDepth];
+            Resize(size);
+        }
+
+        ~ScratchBuffer()
+        {
+            auto &pool = GetPool();
+            assert(pool.__depth__ == mDepth + 1);
+            pool.__depth__ = mDepth;
+        }
+
+        ScratchBuffer(const ScratchBuffer &) = delete;
+        ScratchBuffer &operator=(const ScratchBuffer &) = delete;
+
+        size_t Size() const { return mSize; }
+        bool Empty() const { return mSize == 0; }
+        T *Data() { return mStorage->__data__.get(); }
+        const T *Data() const { return mStorage->__data__.get(); }
+        T &operator[](size_t i) { return mStorage->__data__[i]; }
+        const T &operator[](size_t i) const { return mStorage->__data__[i]; }
+        T *begin() { return Data(); }
+        T *end() { return Data() + mSize; }
+        const T *begin() const { return Data(); }
+        const T *end() const { return Data() + mSize; }
+        std::span<T> Span() { return {Data(), mSize}; }
+        std::span<const T> Span() const { return {Data(), mSize}; }
+
+        void Clear() { mSize = 0; }
+
+        // 扩容时按倍数增长并保留已有元素
+        void Reserve(size_t capacity)
+        {
+            if (capacity <= mStorage->__capacity__)
+            {
+                return;
+            }
+            capacity = std::max(capacity, mStorage->__capacity__ * 2);
+            std::unique_ptr<T[]> data(new T[capacity]);
+            std::copy(Data(), Data() + mSize, data.get());
+            mStorage->__data__ = std::move(data);
+            mStorage->__capacity__ = capacity;
+        }
+
+        void Resize(size_t size)
+        {
+            Reserve(size);
+            mSize = size;
+        }
+
+        // 新增的元素赋值为value
+        void Resize(size_t size, const T &value)
+        {
+            Reserve(size);
+            if (size > mSize)
+            {
+                std::fill(Data() + mSize, Data() + size, value);
+            }
+            mSize = size;
+        }
+
+        void PushBack(const T &value)
+        {
+            if (mSize == mStorage->__capacity__)
+            {
+                Reserve(std::max<size_t>(mSize + 1, 16));
+            }
+            mStorage->__data__[mSize++] = value;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,325 @@
+﻿#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+/*
+    SIMD封装: VFloat<N>为N路单精度浮点, VMask<N>为对应的比较掩码
+    x64下SSE2始终可用, 4路使用SSE; 开启AVX(/arch:AVX2 或 -mavx2)后8路使用AVX, 否则由两组SSE拼接
+    非x86平台退化为标量循环, 由编译器自动向量化
+*/
+#if defined(__AVX__)
+#define PBRT_SIMD_AVX
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PBRT_SIMD_SSE
+#include <immintrin.h>
+#endif
+
+namespace pbrt
+{
+    // 当前指令集下最自然的SIMD宽度
+#ifdef PBRT_SIMD_AVX
+    constexpr size_t SIMD_WIDTH = 8;
+#else
+    constexpr size_t SIMD_WIDTH = 4;
+#endif
+
+    template <size_t N>
+    struct VMask
+    {
+    public:
+        bool __m__[N];
+
+    public:
+        uint32_t Bits() const
+        {
+            uint32_t bits = 0;
+            for (size_t i = 0; i < N; i++)
+            {
+                bits |= static_cast<uint32_t>(__m__[i]) << i;
+            }
+            return bits;
+        }
+    };
+
+    template <size_t N>
+    struct VFloat
+    {
+    public:
+        float __v__[N];
+
+    public:
+        static VFloat Load(const float *ptr)
+        {
+            VFloat r;
+            for (size_t i = 0; i < N; i++)
+                r.__v__[i] = ptr[i];
+            return r;
+        }
+        static VFloat Broadcast(float value)
+        {
+            VFloat r;
+            for (size_t i = 0; i < N; i++)
+                r.__v__[i] = value;
+            return r;
+        }
+        static VFloat LoadU8(const uint8_t *ptr) // 读取N个8位无符号整数并转换为浮点
+        {
+            VFloat r;
+            for (size_t i = 0; i < N; i++)
+                r.__v__[i] = static_cast<float>(ptr[i]);
+            return r;
+        }
+        void Store(float *ptr) const
+        {
+            for (size_t i = 0; i < N; i++)
+                ptr[i] = __v__[i];
+        }
+    };
+
+#define PBRT_VFLOAT_GENERIC_OP(op)                                     \
+    template <size_t N>                                                \
+    inline VFloat<N> operator op(const VFloat<N> &a, const VFloat<N> &b) \
+    {                                                                  \
+        VFloat<N> r;                                                   \
+        for (size_t i = 0; i < N; i++)                                 \
+            r.__v__[i] = a.__v__[i] op b.__v__[i];                     \
+        return r;                                                      \
+    }
+#define PBRT_VFLOAT_GENERIC_CMP(op)                                    \
+    template <size_t N>                                                \
+    inline VMask<N> operator op(const VFloat<N> &a, const VFloat<N> &b) \
+    {                                                                  \
+        VMask<N> r;                                                    \
+        for (size_t i = 0; i < N; i++)                                 \
+            r.__m__[i] = a.__v__[i] op b.__v__[i];                     \
+        return r;                                                      \
+    }
+
+    PBRT_VFLOAT_GENERIC_OP(+)
+    PBRT_VFLOAT_GENERIC_OP(-)
+    PBRT_VFLOAT_GENERIC_OP(*)
+    PBRT_VFLOAT_GENERIC_OP(/)
+    PBRT_VFLOAT_GENERIC_CMP(<)
+    PBRT_VFLOAT_GENERIC_CMP(<=)
+    PBRT_VFLOAT_GENERIC_CMP(>)
+    PBRT_VFLOAT_GENERIC_CMP(>=)
+#undef PBRT_VFLOAT_GENERIC_OP
+#undef PBRT_VFLOAT_GENERIC_CMP
+
+    // 与SSE语义一致: 任一操作数为NaN时返回b
+    template <size_t N>
+    inline VFloat<N> Min(const VFloat<N> &a, const VFloat<N> &b)
+    {
+        VFloat<N> r;
+        for (size_t i = 0; i < N; i++)
+            r.__v__[i] = a.__v__[i] < b.__v__[i] ? a.__v__[i] : b.__v__[i];
+        return r;
+    }
+
+    template <size_t N>
+    inline VFloat<N> Max(const VFloat<N> &a, const VFloat<N> &b)
+    {
+        VFloat<N> r;
+        for (size_t i = 0; i < N; i++)
+            r.__v__[i] = a.__v__[i] > b.__v__[i] ? a.__v__[i] : b.__v__[i];
+        return r;
+    }
+
+    template <size_t N>
+    inline VFloat<N> Select(const VMask<N> &mask, const VFloat<N> &a, const VFloat<N> &b)
+    {
+        VFloat<N> r;
+        for (size_t i = 0; i < N; i++)
+            r.__v__[i] = mask.__m__[i] ? a.__v__[i] : b.__v__[i];
+        return r;
+    }
+
+    template <size_t N>
+    inline VMask<N> operator&(const VMask<N> &a, const VMask<N> &b)
+    {
+        VMask<N> r;
+        for (size_t i = 0; i < N; i++)
+            r.__m__[i] = a.__m__[i] && b.__m__[i];
+        return r;
+    }
+
+    template <size_t N>
+    inline VMask<N> operator|(const VMask<N> &a, const VMask<N> &b)
+    {
+        VMask<N> r;
+        for (size_t i = 0; i < N; i++)
+            r.__m__[i] = a.__m__[i] || b.__m__[i];
+        return r;
+    }
+
+#ifdef PBRT_SIMD_SSE
+    // ---------------------------------------------------------------- SSE 4路
+    template <>
+    struct VMask<4>
+    {
+    public:
+        __m128 __m__;
+
+    public:
+        uint32_t Bits() const { return static_cast<uint32_t>(_mm_movemask_ps(__m__)); }
+    };
+
+    template <>
+    struct VFloat<4>
+    {
+    public:
+        __m128 __v__;
+
+    public:
+        static VFloat Load(const float *ptr) { return {_mm_loadu_ps(ptr)}; }
+        static VFloat Broadcast(float value) { return {_mm_set1_ps(value)}; }
+        static VFloat LoadU8(const uint8_t *ptr)
+        {
+            // 仅用SSE2: 8位零扩展为16位再到32位
+            int32_t packed;
+            std::memcpy(&packed, ptr, sizeof(packed));
+            __m128i zero = _mm_setzero_si128();
+            __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+            return {_mm_cvtepi32_ps(v)};
+        }
+        void Store(float *ptr) const { _mm_storeu_ps(ptr, __v__); }
+    };
+
+    inline VFloat<4> operator+(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_add_ps(a.__v__, b.__v__)}; }
+    inline VFloat<4> operator-(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_sub_ps(a.__v__, b.__v__)}; }
+    inline VFloat<4> operator*(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_mul_ps(a.__v__, b.__v__)}; }
+    inline VFloat<4> operator/(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_div_ps(a.__v__, b.__v__)}; }
+    inline VMask<4> operator<(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_cmplt_ps(a.__v__, b.__v__)}; }
+    inline VMask<4> operator<=(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_cmple_ps(a.__v__, b.__v__)}; }
+    inline VMask<4> operator>(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_cmpgt_ps(a.__v__, b.__v__)}; }
+    inline VMask<4> operator>=(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_cmpge_ps(a.__v__, b.__v__)}; }
+    inline VFloat<4> Min(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_min_ps(a.__v__, b.__v__)}; }
+    inline VFloat<4> Max(const VFloat<4> &a, const VFloat<4> &b) { return {_mm_max_ps(a.__v__, b.__v__)}; }
+    inline VFloat<4> Select(const VMask<4> &mask, const VFloat<4> &a, const VFloat<4> &b)
+    {
+        return {_mm_or_ps(_mm_and_ps(mask.__m__, a.__v__), _mm_andnot_ps(mask.__m__, b.__v__))};
+    }
+    inline VMask<4> operator&(const VMask<4> &a, const VMask<4> &b) { return {_mm_and_ps(a.__m__, b.__m__)}; }
+    inline VMask<4> operator|(const VMask<4> &a, const VMask<4> &b) { return {_mm_or_ps(a.__m__, b.__m__)}; }
+
+#ifdef PBRT_SIMD_AVX
+    // ---------------------------------------------------------------- AVX 8路
+    template <>
+    struct VMask<8>
+    {
+    public:
+        __m256 __m__;
+
+    public:
+        uint32_t Bits() const { return static_cast<uint32_t>(_mm256_movemask_ps(__m__)); }
+    };
+
+    template <>
+    struct VFloat<8>
+    {
+    public:
+        __m256 __v__;
+
+    public:
+        static VFloat Load(const float *ptr) { return {_mm256_loadu_ps(ptr)}; }
+        static VFloat Broadcast(float value) { return {_mm256_set1_ps(value)}; }
+        static VFloat LoadU8(const uint8_t *ptr)
+        {
+            __m128i zero = _mm_setzero_si128();
+            __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(ptr)), zero);
+            __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+            __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+            return {_mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1)};
+        }
+        void Store(float *ptr) const { _mm256_storeu_ps(ptr, __v__); }
+    };
+
+    inline VFloat<8> operator+(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_add_ps(a.__v__, b.__v__)}; }
+    inline VFloat<8> operator-(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_sub_ps(a.__v__, b.__v__)}; }
+    inline VFloat<8> operator*(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_mul_ps(a.__v__, b.__v__)}; }
+    inline VFloat<8> operator/(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_div_ps(a.__v__, b.__v__)}; }
+    inline VMask<8> operator<(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_cmp_ps(a.__v__, b.__v__, _CMP_LT_OQ)}; }
+    inline VMask<8> operator<=(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_cmp_ps(a.__v__, b.__v__, _CMP_LE_OQ)}; }
+    inline VMask<8> operator>(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_cmp_ps(a.__v__, b.__v__, _CMP_GT_OQ)}; }
+    inline VMask<8> operator>=(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_cmp_ps(a.__v__, b.__v__, _CMP_GE_OQ)}; }
+    inline VFloat<8> Min(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_min_ps(a.__v__, b.__v__)}; }
+    inline VFloat<8> Max(const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_max_ps(a.__v__, b.__v__)}; }
+    inline VFloat<8> Select(const VMask<8> &mask, const VFloat<8> &a, const VFloat<8> &b) { return {_mm256_blendv_ps(b.__v__, a.__v__, mask.__m__)}; }
+    inline VMask<8> operator&(const VMask<8> &a, const VMask<8> &b) { return {_mm256_and_ps(a.__m__, b.__m__)}; }
+    inline VMask<8> operator|(const VMask<8> &a, const VMask<8> &b) { return {_mm256_or_ps(a.__m__, b.__m__)}; }
+#else
+    // ---------------------------------------------------------------- 无AVX时8路由两组SSE拼接
+    template <>
+    struct VMask<8>
+    {
+    public:
+        __m128 __lo__, __hi__;
+
+    public:
+        uint32_t Bits() const { return static_cast<uint32_t>(_mm_movemask_ps(__lo__) | (_mm_movemask_ps(__hi__) << 4)); }
+    };
+
+    template <>
+    struct VFloat<8>
+    {
+    public:
+        __m128 __lo__, __hi__;
+
+    public:
+        static VFloat Load(const float *ptr) { return {_mm_loadu_ps(ptr), _mm_loadu_ps(ptr + 4)}; }
+        static VFloat Broadcast(float value) { return {_mm_set1_ps(value), _mm_set1_ps(value)}; }
+        static VFloat LoadU8(const uint8_t *ptr)
+        {
+            __m128i zero = _mm_setzero_si128();
+            __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(ptr)), zero);
+            return {_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero))};
+        }
+        void Store(float *ptr) const
+        {
+            _mm_storeu_ps(ptr, __lo__);
+            _mm_storeu_ps(ptr + 4, __hi__);
+        }
+    };
+
+#define PBRT_VFLOAT8_SSE_OP(op, intrinsic) \
+    inline VFloat<8> op(const VFloat<8> &a, const VFloat<8> &b) { return {intrinsic(a.__lo__, b.__lo__), intrinsic(a.__hi__, b.__hi__)}; }
+#define PBRT_VMASK8_SSE_OP(op, intrinsic) \
+    inline VMask<8> op(const VFloat<8> &a, const VFloat<8> &b) { return {intrinsic(a.__lo__, b.__lo__), intrinsic(a.__hi__, b.__hi__)}; }
+
+    PBRT_VFLOAT8_SSE_OP(operator+, _mm_add_ps)
+    PBRT_VFLOAT8_SSE_OP(operator-, _mm_sub_ps)
+    PBRT_VFLOAT8_SSE_OP(operator*, _mm_mul_ps)
+    PBRT_VFLOAT8_SSE_OP(operator/, _mm_div_ps)
+    PBRT_VFLOAT8_SSE_OP(Min, _mm_min_ps)
+    PBRT_VFLOAT8_SSE_OP(Max, _mm_max_ps)
+    PBRT_VMASK8_SSE_OP(operator<, _mm_cmplt_ps)
+    PBRT_VMASK8_SSE_OP(operator<=, _mm_cmple_ps)
+    PBRT_VMASK8_SSE_OP(operator>, _mm_cmpgt_ps)
+    PBRT_VMASK8_SSE_OP(operator>=, _mm_cmpge_ps)
+#undef PBRT_VFLOAT8_SSE_OP
+#undef PBRT_VMASK8_SSE_OP
+
+    inline VFloat<8> Select(const VMask<8> &mask, const VFloat<8> &a, const VFloat<8> &b)
+    {
+        return {_mm_or_ps(_mm_and_ps(mask.__lo__, a.__lo__), _mm_andnot_ps(mask.__lo__, b.__lo__)),
+                _mm_or_ps(_mm_and_ps(mask.__hi__, a.__hi__), _mm_andnot_ps(mask.__hi__, b.__hi__))};
+    }
+    inline VMask<8> operator&(const VMask<8> &a, const VMask<8> &b) { return {_mm_and_ps(a.__lo__, b.__lo__), _mm_and_ps(a.__hi__, b.__hi__)}; }
+    inline VMask<8> operator|(const VMask<8> &a, const VMask<8> &b) { return {_mm_or_ps(a.__lo__, b.__lo__), _mm_or_ps(a.__hi__, b.__hi__)}; }
+#endif
+#endif
+
+    // 取出最低位的置位索引并清除该位
+    inline uint32_t PopLowestBit(uint32_t &bits)
+    {
+        uint32_t idx = static_cast<uint32_t>(std::countr_zero(bits));
+        bits &= bits - 1;
+        return idx;
+    }
+}
\ No newline at end of file
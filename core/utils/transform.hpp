@@ -0,0 +1,109 @@
+﻿#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstdint>
+
+namespace pbrt
+{
+    // 仿射变换的类别, 单位变换与纯平移可以跳过线性部分的矩阵乘法
+    enum class AffineTransformType : uint8_t
+    {
+        Identity,    // 单位变换
+        Translation, // 线性部分为单位矩阵, 只有平移
+        General      // 一般仿射变换
+    };
+
+    // 对象空间到世界空间的变换矩阵, 依次缩放, 绕x, y, z轴旋转(角度), 平移
+    // 约定向量都为列向量, 矩阵乘法即变换顺序从右往左
+    inline glm::mat4 GetWorldFromObject(const glm::vec3 &position, const glm::vec3 &scale, const glm::vec3 &rotate)
+    {
+        return glm::translate(glm::mat4(1.f), position) *
+               glm::rotate(glm::mat4(1.f), glm::radians(rotate.z), {0.f, 0.f, 1.f}) *
+               glm::rotate(glm::mat4(1.f), glm::radians(rotate.y), {0.f, 1.f, 0.f}) *
+               glm::rotate(glm::mat4(1.f), glm::radians(rotate.x), {1.f, 0.f, 0.f}) *
+               glm::scale(glm::mat4(1.f), scale);
+    }
+
+    /*
+        3x4仿射变换矩阵[A | t], 按行存储, 省略恒为(0, 0, 0, 1)的最后一行
+        比glm::mat4少16字节, 构造时识别单位变换与纯平移, 变换点与向量时走对应的快速路径
+    */
+    struct AffineTransform
+    {
+    public:
+        glm::vec4 __rows__[3];       // 第i行为(A[i][0], A[i][1], A[i][2], t[i])
+        AffineTransformType __type__;
+
+    public:
+        AffineTransform() : AffineTransform(glm::mat4(1.f)) {}
+
+        explicit AffineTransform(const glm::mat4 &matrix)
+        {
+            // glm按列存储, matrix[col][row]
+            bool is_linear_identity = true, is_translation_zero = true;
+            for (int row = 0; row < 3; row++)
+            {
+                __rows__[row] = {matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]};
+                for (int col = 0; col < 3; col++)
+                {
+                    is_linear_identity = is_linear_identity && matrix[col][row] == (row == col ? 1.f : 0.f);
+                }
+                is_translation_zero = is_translation_zero && matrix[3][row] == 0.f;
+            }
+            __type__ = !is_linear_identity ? AffineTransformType::General : (is_translation_zero ? AffineTransformType::Identity : AffineTransformType::Translation);
+        }
+
+        glm::mat4 ToMatrix() const
+        {
+            glm::mat4 matrix(1.f);
+            for (int row = 0; row < 3; row++)
+            {
+                for (int col = 0; col < 4; col++)
+                {
+                    matrix[col][row] = __rows__[row][col];
+                }
+            }
+            return matrix;
+        }
+
+        AffineTransform Inverse() const { return AffineTransform(glm::inverse(ToMatrix())); }
+
+        bool IsIdentity() const { return __type__ == AffineTransformType::Identity; }
+
+        glm::vec3 GetTranslation() const { return {__rows__[0].w, __rows__[1].w, __rows__[2].w}; }
+
+        glm::vec3 TransformPoint(const glm::vec3 &point) const
+        {
+            switch (__type__)
+            {
+            case AffineTransformType::Identity:
+                return point;
+            case AffineTransformType::Translation:
+                return point + GetTranslation();
+            default:
+                return TransformLinear(point) + GetTranslation();
+            }
+        }
+
+        glm::vec3 TransformVector(const glm::vec3 &vector) const
+        {
+            return __type__ == AffineTransformType::General ? TransformLinear(vector) : vector;
+        }
+
+        // 计算Aᵀv, 以逆变换的转置变换法线时使用, 结果未归一化
+        glm::vec3 TransformTransposed(const glm::vec3 &vector) const
+        {
+            if (__type__ != AffineTransformType::General)
+            {
+                return vector;
+            }
+            return glm::vec3(__rows__[0]) * vector.x + glm::vec3(__rows__[1]) * vector.y + glm::vec3(__rows__[2]) * vector.z;
+        }
+
+    private:
+        glm::vec3 TransformLinear(const glm::vec3 &vector) const
+        {
+            return {glm::dot(glm::vec3(__rows__[0]), vector), glm::dot(glm::vec3(__rows__[1]), vector), glm::dot(glm::vec3(__rows__[2]), vector)};
+        }
+    };
+}
\ No newline at end of file
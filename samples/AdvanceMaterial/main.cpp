@@ -53,6 +53,7 @@ int main()
 
     // light
     pbrt::Image env_map("../../../assets/hdris/puresky04.exr");
+    env_map.ReplicatePerNumaNode(); // 线程池开启NUMA分区(PBRT_NUMA)时每个分区读取本地副本
     scene.AddInfiniteLight(new pbrt::EnvLight{&env_map});
     scene.Build();
 
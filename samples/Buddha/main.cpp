@@ -40,6 +40,7 @@ int main()
     scene.AddShape(ground, new pbrt::GroundMaterial{pbrt::RGB(155, 191, 255)});
 
     pbrt::Image env_map("../../../assets/hdris/puresky04.exr");
+    env_map.ReplicatePerNumaNode(); // 线程池开启NUMA分区(PBRT_NUMA)时每个分区读取本地副本
     scene.AddInfiniteLight(new pbrt::EnvLight{&env_map});
 
     scene.Build();
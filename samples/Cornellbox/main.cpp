@@ -63,6 +63,7 @@ int main()
 
     // light
     pbrt::Image env_map("../../../assets/hdris/puresky02.exr");
+    env_map.ReplicatePerNumaNode(); // 线程池开启NUMA分区(PBRT_NUMA)时每个分区读取本地副本
     scene.AddInfiniteLight(new pbrt::EnvLight{&env_map, 90.f});
 
     auto *light = new pbrt::AreaLight{quad, pbrt::RGB(255, 220, 150), false};
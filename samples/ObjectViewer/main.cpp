@@ -31,18 +31,31 @@ int main()
     pbrt::Circle ground{{0.f, 0.f, 0.f}, {0.f, 1.f, 0.f}, 100.f};
     pbrt::Scene scene{};
 
-    scene.AddShape(teapot, new pbrt::DielectricMaterial{pbrt::RGB(255, 255, 255), 1.2f, 0.1f, 0.1f}, {-5.f, 0.4f, 4.5f}, {1.f, 1.f, 1.f}, {0.f, -10.f, 0.f});
+    float glass_teapot_angle = -10.f;
+    uint32_t glass_teapot = scene.AddShape(teapot, new pbrt::DielectricMaterial{pbrt::RGB(255, 255, 255), 1.2f, 0.1f, 0.1f}, {-5.f, 0.4f, 4.5f}, {1.f, 1.f, 1.f}, {0.f, glass_teapot_angle, 0.f});
     scene.AddShape(teapot, new pbrt::ConductorMaterial{{0.1f, 1.2f, 1.8f}, {5.f, 2.5f, 2.f}, 0.2f, 0.2f}, {-5.f, 0.4f, -4.5f}, {1.f, 1.f, 1.f});
     // scene.AddShape(ajax, new pbrt::IridescentMaterial{0.8f, 2.f, 3.f, 0.2f, 0.3f, 0.3f}, {-5.f, 0.4f, -4.5f}, {7.f, 7.f, 7.f}, {0.f, 90.f, 0.f});
     scene.AddShape(ground, new pbrt::GroundMaterial{pbrt::RGB(225, 225, 225)});
 
     // light
     pbrt::Image env_map("../../../assets/hdris/puresky04.exr");
+    env_map.ReplicatePerNumaNode(); // 线程池开启NUMA分区(PBRT_NUMA)时每个分区读取本地副本
     scene.AddInfiniteLight(new pbrt::EnvLight{&env_map});
     scene.Build();
 
     pbrt::MISRenderer mis{camera, scene};
     pbrt::Previewer previewer(mis, 1);
+    previewer.SetSceneEditor(scene, [&](pbrt::Scene &scene, float dt)
+                             {
+                                 // keyboard: Q/E 旋转玻璃茶壶
+                                 float turn = (sf::Keyboard::isKeyPressed(sf::Keyboard::Key::E) ? 1.f : 0.f) - (sf::Keyboard::isKeyPressed(sf::Keyboard::Key::Q) ? 1.f : 0.f);
+                                 if (turn != 0.f)
+                                 {
+                                     glass_teapot_angle += 90.f * turn * dt;
+                                     scene.SetShapeTransform(glass_teapot, {-5.f, 0.4f, 4.5f}, {1.f, 1.f, 1.f}, {0.f, glass_teapot_angle, 0.f});
+                                 }
+                                 // end
+                             });
     if (previewer.Preview())
     {
         mis.Render("../../../teapot.exr", 64);